@@ -0,0 +1,77 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Tiny benchmark harness for the native environment. Each case is run repeatedly until it has
+// taken at least BENCH_MIN_TIME_MS, then reports ns/op, pixels/sec and panel traffic per op
+// (bus transactions, draw commands and pixels sent).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include "canvas.h"
+
+#define BENCH_MIN_TIME_MS 250
+
+struct BenchResult
+{
+  const char *name;
+  uint64_t iterations;
+  double nsPerOp;
+  double pixelsPerSec;
+  double transactionsPerOp;
+  double windowsPerOp;
+  double panelPixelsPerOp;
+};
+
+/**
+ * Time a kernel.
+ * @param name Printed label for the case.
+ * @param pixelsPerOp Canvas pixels touched by one call, used for the pixels/sec figure.
+ * @param op Callable run once per iteration. Receives the iteration number.
+ */
+template <typename Op>
+BenchResult benchRun(const char *name, uint64_t pixelsPerOp, Op op)
+{
+  using clock = std::chrono::steady_clock;
+  BenchResult r = {name, 0, 0, 0, 0, 0, 0};
+
+  // Warm up caches and any lazily built tables.
+  op(0);
+  tft.resetStats();
+
+  clock::time_point start = clock::now();
+  clock::time_point now = start;
+  uint64_t batch = 1;
+  while (std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count() < BENCH_MIN_TIME_MS)
+  {
+    for (uint64_t i = 0; i < batch; i++)
+      op(r.iterations + i);
+    r.iterations += batch;
+    batch *= 2;
+    now = clock::now();
+  }
+
+  double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+  r.nsPerOp = ns / r.iterations;
+  r.pixelsPerSec = pixelsPerOp ? (double)pixelsPerOp * r.iterations / (ns / 1e9) : 0;
+  r.transactionsPerOp = (double)tft.transactions / r.iterations;
+  r.windowsPerOp = (double)tft.windows / r.iterations;
+  r.panelPixelsPerOp = (double)tft.pixels / r.iterations;
+
+  printf("%-36s %12.0f ns/op %10.2f Mpix/s %8.1f txn/op %8.1f cmd/op %9.0f px/op\n",
+         r.name, r.nsPerOp, r.pixelsPerSec / 1e6, r.transactionsPerOp, r.windowsPerOp, r.panelPixelsPerOp);
+  return r;
+}
+
+void benchPaintSketch();
+void benchCanvas();
+void benchFill();
+void benchJournal();
+void benchFbox();
+void benchIndex();
+void benchFriends();
+void benchUpload();
+void benchNet();
+void benchOutbox();
+void benchBoot();
+void benchTouch();
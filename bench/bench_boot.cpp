@@ -0,0 +1,143 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Boot orchestrator on the device's stage graph, each stage a sleep of roughly what it takes on
+// the box. Boots once with every stage on one lane, as the old sequential start-up did, then with
+// two lanes as on the two cores, and checks that no stage started before what it waits for.
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "bench.h"
+#include "boot_seq.h"
+
+#define BENCH_BOOT_UI_LANE 1
+#define BENCH_BOOT_WORKER_LANE 0
+
+/** Sleep for a stage, ms. Indexed like bootStages. */
+static const uint32_t stageMs[] = {120, 2, 5, 150, 0, 40, 60, 62, 30, 10, 20, 5};
+
+template <int i>
+static bool stage()
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(stageMs[i]));
+  return true;
+}
+
+// Same graph as bootStages in main.cpp.
+#define DISPLAY 0
+#define FRAMEBUFFER 1
+#define SETTINGS 2
+#define SD 3
+#define SD_READY 4
+#define SKETCH 6
+#define SHOW 7
+#define FRIENDS 8
+#define OUTBOX 9
+
+static BootStage stages[] = {
+    {"display", stage<0>, 0, BENCH_BOOT_UI_LANE},
+    {"framebuffer", stage<1>, 0, BOOT_ANY_LANE},
+    {"settings", stage<2>, 0, BOOT_ANY_LANE},
+    {"sd", stage<3>, BOOT_AFTER(DISPLAY), BOOT_ANY_LANE},
+    {"sd ready", stage<4>, BOOT_AFTER(DISPLAY) | BOOT_AFTER(SD), BENCH_BOOT_UI_LANE},
+    {"wifi", stage<5>, BOOT_AFTER(SETTINGS), BENCH_BOOT_WORKER_LANE},
+    {"sketch", stage<6>, BOOT_AFTER(FRAMEBUFFER) | BOOT_AFTER(SETTINGS) | BOOT_AFTER(SD_READY), BOOT_ANY_LANE},
+    {"show sketch", stage<7>, BOOT_AFTER(DISPLAY) | BOOT_AFTER(SKETCH), BENCH_BOOT_UI_LANE},
+    {"friends", stage<8>, BOOT_AFTER(SETTINGS) | BOOT_AFTER(SD_READY), BOOT_ANY_LANE},
+    {"outbox", stage<9>, BOOT_AFTER(SD_READY), BOOT_ANY_LANE},
+    {"touch", stage<10>, BOOT_AFTER(SD_READY) | BOOT_AFTER(SHOW) | BOOT_AFTER(FRIENDS) | BOOT_AFTER(OUTBOX), BENCH_BOOT_UI_LANE},
+    {"network task", stage<11>, BOOT_AFTER(FRIENDS) | BOOT_AFTER(OUTBOX), BOOT_ANY_LANE},
+};
+#define STAGE_COUNT (sizeof(stages) / sizeof(stages[0]))
+static_assert(STAGE_COUNT == sizeof(stageMs) / sizeof(stageMs[0]), "One duration per stage");
+
+static BootSequence boot;
+static std::chrono::steady_clock::time_point epoch;
+
+static uint32_t benchClock()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static void benchIdle()
+{
+  std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+/** Every stage started after all it waits for had ended, and pinned stages ran on their lane. */
+static bool orderRespected()
+{
+  for (uint8_t i = 0; i < STAGE_COUNT; i++)
+  {
+    if (stages[i].lane != BOOT_ANY_LANE && stages[i].ranOn != stages[i].lane)
+      return false;
+    for (uint8_t d = 0; d < i; d++)
+    {
+      if ((stages[i].after & BOOT_AFTER(d)) && (int32_t)(stages[i].startUs - stages[d].endUs) < 0)
+        return false;
+    }
+  }
+  return true;
+}
+
+/** Boot the table once, on one lane or two. @return ms from start to the last stage done, negative if the table is invalid. */
+static double runBoot(bool twoLanes)
+{
+  epoch = std::chrono::steady_clock::now();
+  if (!bootInit(&boot, stages, STAGE_COUNT, benchClock, benchIdle))
+    return -1;
+  if (!twoLanes)
+  {
+    bootLane(&boot, BENCH_BOOT_UI_LANE);
+    return (bootEndUs(&boot) - boot.startUs) / 1000.0;
+  }
+  std::thread worker(bootLane, &boot, (uint8_t)BENCH_BOOT_WORKER_LANE);
+  bootLane(&boot, BENCH_BOOT_UI_LANE);
+  worker.join();
+  return (bootEndUs(&boot) - boot.startUs) / 1000.0;
+}
+
+void benchBoot()
+{
+  printf("\n-- boot sequence (simulated stage times) --\n");
+  // One lane: stages the other lane would have taken run here too.
+  int8_t lanes[STAGE_COUNT];
+  for (uint8_t i = 0; i < STAGE_COUNT; i++)
+  {
+    lanes[i] = stages[i].lane;
+    stages[i].lane = BOOT_ANY_LANE;
+  }
+  double sequentialMs = runBoot(false);
+  if (sequentialMs < 0)
+  {
+    printf("boot table INVALID, a stage waits for one below it\n");
+    return;
+  }
+  double sequentialShowMs = (stages[SHOW].endUs - boot.startUs) / 1000.0;
+  for (uint8_t i = 0; i < STAGE_COUNT; i++)
+    stages[i].lane = lanes[i];
+
+  double parallelMs = runBoot(true);
+  double parallelShowMs = (stages[SHOW].endUs - boot.startUs) / 1000.0;
+  static char trace[1024];
+  bootFormatTrace(&boot, trace, sizeof(trace));
+  fputs(trace, stdout);
+  printf("one lane   sketch on screen %6.1f ms, done %6.1f ms\n", sequentialShowMs, sequentialMs);
+  printf("two lanes  sketch on screen %6.1f ms, done %6.1f ms  (%.0f%% sooner), order %s\n", parallelShowMs, parallelMs,
+         100.0 * (1.0 - parallelShowMs / sequentialShowMs), orderRespected() ? "respected" : "VIOLATED");
+
+  benchRun("  schedule an empty 12-stage boot", 0, [](uint64_t)
+           {
+             static BootStage empty[STAGE_COUNT];
+             static BootSequence quick;
+             for (uint8_t i = 0; i < STAGE_COUNT; i++)
+             {
+               empty[i].name = stages[i].name;
+               empty[i].run = []()
+               { return true; };
+               empty[i].after = stages[i].after;
+               empty[i].lane = BOOT_ANY_LANE;
+             }
+             bootInit(&quick, empty, STAGE_COUNT, benchClock, nullptr);
+             bootLane(&quick, 0); });
+}
@@ -0,0 +1,90 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Framebuffer kernel benchmarks.
+
+#include <stdio.h>
+#include "bench.h"
+
+/** Number of pixels inside a disc of the given radius, as tested by the brush kernels. */
+static uint64_t discArea(int radius)
+{
+  uint64_t area = 0;
+  for (int dy = -radius; dy <= radius; dy++)
+    for (int dx = -radius; dx <= radius; dx++)
+      if (dx * dx + dy * dy <= radius * radius)
+        area++;
+  return area;
+}
+
+void benchCanvas()
+{
+  printf("-- canvas kernels --\n");
+
+  benchRun("drawPixelToFB", 1, [](uint64_t i)
+           { drawPixelToFB((int)((i * 7919) % TFT_HOR_RES), (int)((i * 104729) % TFT_VER_RES), (uint8_t)(i & 0x0F)); });
+
+  const int radii[] = {1, 5, 25, 100};
+  for (int r : radii)
+  {
+    char name[40];
+    snprintf(name, sizeof(name), "drawBrushToFB r=%d", r);
+    benchRun(name, discArea(r), [r](uint64_t i)
+             { drawBrushToFB(240, 160, r, (uint8_t)(i & 0x0F)); });
+  }
+
+  benchRun("drawDitherToFB r=25", discArea(25) / 4, [](uint64_t i)
+           { drawDitherToFB(240, 160, 25, (uint8_t)(i & 0x0F)); });
+  canvasSetDitherLevel(CANVAS_DITHER_LEVELS / 2);
+  benchRun("drawDitherToFB r=25 level 32", discArea(25) / 2, [](uint64_t i)
+           { drawDitherToFB(240, 160, 25, (uint8_t)(i & 0x0F)); });
+  canvasSetDitherLevel(CANVAS_DITHER_DEFAULT_LEVEL);
+  benchRun("ditherSpanToFB 479px", TFT_HOR_RES / 4, [](uint64_t i)
+           { ditherSpanToFB(1, TFT_HOR_RES - 1, (int)(i % TFT_VER_RES), (uint8_t)(i & 0x0F)); });
+
+  // A 300px horizontal stroke sampled every 3px. Per-sample discs redraw each pixel many times,
+  // capsule segments only write what the previous segment did not cover.
+  benchRun("stroke 100 samples r=10 (discs)", 0, [](uint64_t i)
+           {
+             for (int s = 0; s <= 100; s++)
+               drawBrushToFB(90 + s * 3, 160, 10, (uint8_t)(i & 0x0F));
+           });
+  benchRun("stroke 100 samples r=10 (capsules)", 0, [](uint64_t i)
+           {
+             drawBrushToFB(90, 160, 10, (uint8_t)(i & 0x0F));
+             for (int s = 1; s <= 100; s++)
+               drawStrokeToFB(90 + (s - 1) * 3, 160, 90 + s * 3, 160, 10, (uint8_t)(i & 0x0F));
+           });
+  canvasSetBatchedFlush(true);
+  benchRun("stroke 100 samples r=10 (batched)", 0, [](uint64_t i)
+           {
+             drawBrushToFB(90, 160, 10, (uint8_t)(i & 0x0F));
+             for (int s = 1; s <= 100; s++)
+               drawStrokeToFB(90 + (s - 1) * 3, 160, 90 + s * 3, 160, 10, (uint8_t)(i & 0x0F));
+             canvasFlushDirty(0, true);
+           });
+  canvasSetBatchedFlush(false);
+
+  benchRun("drawDitherStrokeToFB 300px r=10", 0, [](uint64_t i)
+           { drawDitherStrokeToFB(90, 10, 390, 310, 10, (uint8_t)(i & 0x0F)); });
+
+  benchRun("drawClearScreen", TFT_HOR_RES * TFT_VER_RES, [](uint64_t i)
+           { drawClearScreen((uint8_t)(i & 0x0F)); });
+
+  drawTest4();
+  canvasResetFlushStats();
+  benchRun("drawFramebuffer full", TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           { drawFramebuffer(); });
+  // On the host the panel is free, so this is how far ahead of the SPI clock the conversion runs.
+  printf("%-36s %12.1fx the %d MHz bus\n", "  conversion headroom", canvasFlushBusUtilization(), CANVAS_SPI_WRITE_HZ / 1000000);
+  benchRun("drawFramebuffer 110x50 odd x", 110 * 50, [](uint64_t)
+           { drawFramebuffer(31, 5, 110, 50); });
+
+  // Box-filtered previews of the striped test pattern, every box straddles two stripes at 3x and 2.5x.
+  benchRun("canvasPreviewFramebuffer 1/2", TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           { canvasPreviewFramebuffer(0, 0, 240, 160); });
+  benchRun("canvasPreviewFramebuffer 1/3", TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           { canvasPreviewFramebuffer(0, 0, 160, 107); });
+  benchRun("canvasPreviewFramebuffer 1/2.5", TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           { canvasPreviewFramebuffer(0, 0, 192, 128); });
+
+  printf("\n");
+}
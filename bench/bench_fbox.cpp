@@ -0,0 +1,126 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// .fbox v2 encode/decode throughput and compression on a few representative canvases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "fbox.h"
+
+static uint8_t *fboxBuffer;
+static size_t fboxBufferSize;
+static size_t fboxLength;
+
+static size_t nullWrite(void *, const uint8_t *, size_t len)
+{
+  return len;
+}
+
+static void nullRow(void *, int, const uint8_t *)
+{
+}
+
+/** Decoded rows land here, ctx is the buffer. */
+static void scratchRow(void *ctx, int y, const uint8_t *row)
+{
+  memcpy((uint8_t *)ctx + y * (TFT_HOR_RES / 2), row, TFT_HOR_RES / 2);
+}
+
+/** Decode a file and check it gives back the canvas byte for byte. */
+static bool decodesToCanvas(const uint8_t *file, size_t length)
+{
+  static uint8_t decoded[CANVAS_FRAMEBUFFER_SIZE];
+  memset(decoded, 0, sizeof(decoded));
+  FboxMemoryReader r = {file, length, 0};
+  return fboxRead(fboxMemoryRead, &r, length, scratchRow, decoded) == FBOX_OK &&
+         memcmp(decoded, canvas_framebuffer, CANVAS_FRAMEBUFFER_SIZE) == 0;
+}
+
+/** A few brush strokes and a filled shape on a plain background, roughly what people actually draw. */
+void benchPaintSketch()
+{
+  drawClearScreen(2);
+  drawFillToFB(0, 0, 2);
+  for (int i = 0; i < 12; i++)
+  {
+    int x = 40 + i * 33;
+    drawBrushToFB(x, 80, 4, (uint8_t)(3 + i % 8));
+    drawStrokeToFB(x, 80, x + 20, 240, 4, (uint8_t)(3 + i % 8));
+  }
+  drawBrushToFB(240, 160, 50, 13);
+  drawFillToFB(240, 160, 8);
+}
+
+static void paintNoise()
+{
+  uint32_t seed = 12345;
+  for (int i = 0; i < CANVAS_FRAMEBUFFER_SIZE; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    canvas_framebuffer[i] = seed >> 16;
+  }
+}
+
+static void benchCanvasFile(const char *label)
+{
+  FboxMemoryWriter w = {fboxBuffer, fboxBufferSize, 0};
+  fboxWrite(canvas_framebuffer, fboxMemoryWrite, &w);
+  fboxLength = w.length;
+  printf("%-36s %8zu bytes  %5.1fx smaller than raw, %s%s\n", label, fboxLength, (double)CANVAS_FRAMEBUFFER_SIZE / fboxLength,
+         decodesToCanvas(fboxBuffer, fboxLength) ? "verified" : "MISMATCH",
+         fboxFileSize(fboxBuffer, FBOX_HEADER_SIZE) == fboxLength ? "" : "  HEADER SIZE WRONG");
+
+  char name[64];
+  snprintf(name, sizeof(name), "  fboxWrite %s", label);
+  benchRun(name, TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           { fboxWrite(canvas_framebuffer, nullWrite, nullptr); });
+  snprintf(name, sizeof(name), "  fboxRead %s", label);
+  benchRun(name, TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           {
+             FboxMemoryReader r = {fboxBuffer, fboxLength, 0};
+             fboxRead(fboxMemoryRead, &r, fboxLength, nullRow, nullptr); });
+}
+
+static uint8_t thumb[FBOX_THUMB_BYTES];
+
+/** Preview cost: the embedded thumbnail versus building one from the whole sketch. */
+static void benchThumbnail()
+{
+  FboxMemoryWriter w = {fboxBuffer, fboxBufferSize, 0};
+  fboxWrite(canvas_framebuffer, fboxMemoryWrite, &w);
+  fboxLength = w.length;
+  benchRun("  fboxReadThumbnail (embedded)", FBOX_THUMB_WIDTH * FBOX_THUMB_HEIGHT, [](uint64_t)
+           {
+             FboxMemoryReader r = {fboxBuffer, fboxLength, 0};
+             fboxReadThumbnail(fboxMemoryRead, &r, fboxLength, thumb); });
+  benchRun("  fboxDecodeThumbnail (full decode)", FBOX_THUMB_WIDTH * FBOX_THUMB_HEIGHT, [](uint64_t)
+           {
+             FboxMemoryReader r = {fboxBuffer, fboxLength, 0};
+             fboxDecodeThumbnail(fboxMemoryRead, &r, fboxLength, thumb); });
+}
+
+void benchFbox()
+{
+  printf("\n-- .fbox v2 (raw is %d bytes) --\n", CANVAS_FRAMEBUFFER_SIZE);
+  fboxBufferSize = CANVAS_PACKBITS_MAX_SIZE(CANVAS_FRAMEBUFFER_SIZE) + FBOX_HEADER_SIZE + 2 + CANVAS_PACKBITS_MAX_SIZE(FBOX_THUMB_BYTES);
+  fboxBuffer = (uint8_t *)malloc(fboxBufferSize);
+
+  memset(canvas_framebuffer, 0, CANVAS_FRAMEBUFFER_SIZE);
+  benchCanvasFile("blank");
+  benchPaintSketch();
+  benchCanvasFile("sketch");
+  benchThumbnail();
+  paintNoise();
+  benchCanvasFile("noise");
+
+  // A pre-v2 dump is the framebuffer itself.
+  printf("%-36s %8d bytes  %s\n", "legacy raw", CANVAS_FRAMEBUFFER_SIZE,
+         decodesToCanvas(canvas_framebuffer, CANVAS_FRAMEBUFFER_SIZE) ? "verified" : "MISMATCH");
+  benchRun("  legacy raw read", TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           {
+             FboxMemoryReader r = {canvas_framebuffer, CANVAS_FRAMEBUFFER_SIZE, 0};
+             fboxRead(fboxMemoryRead, &r, CANVAS_FRAMEBUFFER_SIZE, nullRow, nullptr); });
+
+  free(fboxBuffer);
+  memset(canvas_framebuffer, 0, CANVAS_FRAMEBUFFER_SIZE);
+}
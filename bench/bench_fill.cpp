@@ -0,0 +1,74 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Bucket fill benchmarks on shapes that stress the scanline fill.
+
+#include <stdio.h>
+#include "bench.h"
+
+#define FILL_WALL 2
+
+/** Reset the canvas to color 0 and draw walls for a pattern. */
+static void paintPattern(bool (*isWall)(int x, int y))
+{
+  for (int y = 0; y < TFT_VER_RES; y++)
+    for (int x = 0; x < TFT_HOR_RES; x++)
+      drawPixelToFB(x, y, isWall(x, y) ? FILL_WALL : 0);
+}
+
+static bool noWalls(int, int)
+{
+  return false;
+}
+
+/** Concentric 1px rings 4px apart, each with one door, alternating sides: one long corridor. */
+static bool spiralWalls(int x, int y)
+{
+  int ring = x < y ? x : y;
+  if (TFT_HOR_RES - 1 - x < ring)
+    ring = TFT_HOR_RES - 1 - x;
+  if (TFT_VER_RES - 1 - y < ring)
+    ring = TFT_VER_RES - 1 - y;
+  if (ring % 4 != 0)
+    return false;
+  int door = (ring / 4) & 1 ? TFT_HOR_RES / 2 - 1 : TFT_HOR_RES / 2 + 1;
+  return !(y == ring && (x == door || x == door + 1));
+}
+
+/** Open even rows, odd rows are a 1px checkerboard: ~38k single-pixel runs hanging off every row. */
+static bool latticeWalls(int x, int y)
+{
+  return (y & 1) && ((x + (y >> 1)) & 1);
+}
+
+/** 240 one-pixel teeth joined along the bottom row. */
+static bool combWalls(int x, int y)
+{
+  return (x & 1) && y < TFT_VER_RES - 1;
+}
+
+static void benchShape(const char *name, bool (*isWall)(int x, int y))
+{
+  paintPattern(isWall);
+  uint64_t area = 0;
+  for (int y = 0; y < TFT_VER_RES; y++)
+    for (int x = 0; x < TFT_HOR_RES; x++)
+      area += !isWall(x, y);
+
+  // Alternate between two colors so every iteration refills the whole region.
+  static uint8_t nextColor;
+  nextColor = 1;
+  benchRun(name, area, [](uint64_t)
+           {
+             drawFillToFB(0, 0, nextColor);
+             nextColor ^= 1;
+           });
+}
+
+void benchFill()
+{
+  printf("-- bucket fill (stack %d seeds) --\n", CANVAS_FILL_STACK_SIZE);
+  benchShape("drawFillToFB empty canvas", noWalls);
+  benchShape("drawFillToFB spiral", spiralWalls);
+  benchShape("drawFillToFB comb", combWalls);
+  benchShape("drawFillToFB lattice (stack overflow)", latticeWalls);
+  printf("\n");
+}
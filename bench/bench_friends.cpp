@@ -0,0 +1,93 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Friend list parsing and cache persistence. Parsing is fed a 10k friend JSON payload in
+// TCP-segment-sized chunks, the way HTTPClient::writeToStream delivers it on the device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "bench.h"
+#include "fbox.h"
+#include "friend_cache.h"
+
+#define BENCH_FRIEND_COUNT 10000
+/** What writeToStream hands over per write, one TCP segment. */
+#define BENCH_FRIEND_CHUNK 1460
+
+static std::string payload;
+static FriendCache friends;
+static FriendCache loaded;
+static FriendTable parsed;
+static uint8_t *cacheStorage;
+static size_t cacheCapacity;
+static size_t cacheLength;
+
+static void parsePayload(FriendTable *table)
+{
+  FriendTableParser parser;
+  friendTableFree(table);
+  friendTableParseBegin(&parser, table);
+  for (size_t i = 0; i < payload.size(); i += BENCH_FRIEND_CHUNK)
+  {
+    size_t n = payload.size() - i < BENCH_FRIEND_CHUNK ? payload.size() - i : BENCH_FRIEND_CHUNK;
+    friendTableParse(&parser, (const uint8_t *)payload.data() + i, n);
+  }
+}
+
+void benchFriends()
+{
+  printf("\n-- friend list (%d friends) --\n", BENCH_FRIEND_COUNT);
+  payload = "[";
+  for (int i = 0; i < BENCH_FRIEND_COUNT; i++)
+  {
+    char name[48];
+    // A few escapes, so the slow path is part of the mix.
+    snprintf(name, sizeof(name), i % 16 ? "%s\"Friend Number %d\"" : "%s\"Friend \\\"No.\\\" \\u00e9%d\"", i ? ", " : "", i);
+    payload += name;
+  }
+  payload += "]";
+  friendTableInit(&parsed);
+
+  benchRun("parse 10k payload (default ceiling)", 0, [](uint64_t)
+           { parsePayload(&parsed); });
+  printf("  payload %zu bytes -> %u friends kept in %u bytes (ceiling %u), parser state %zu bytes%s\n",
+         payload.size(), parsed.count, parsed.capacity, parsed.maxBytes, sizeof(FriendTableParser),
+         parsed.truncated ? ", truncated" : "");
+
+  FriendTable whole;
+  friendTableInit(&whole, UINT16_MAX);
+  parsePayload(&whole);
+  printf("  with a 64 KB ceiling: %u friends in %u bytes%s\n", whole.count, whole.capacity,
+         whole.truncated ? ", truncated" : "");
+  friendTableFree(&whole);
+
+  friendCacheInit(&friends);
+  friendCacheInit(&loaded);
+  friendCacheStore(&friends, &parsed, "\"5f2c-9a1b77e0\"", 0);
+  cacheCapacity = 64 * 1024;
+  cacheStorage = (uint8_t *)malloc(cacheCapacity);
+
+  benchRun("save cache", 0, [](uint64_t)
+           {
+             FboxMemoryWriter w = {cacheStorage, cacheCapacity, 0};
+             friendCacheSave(&friends, fboxMemoryWrite, &w);
+             cacheLength = w.length; });
+  printf("  cache file: %zu bytes\n", cacheLength);
+  benchRun("load cache", 0, [](uint64_t)
+           {
+             FboxMemoryReader r = {cacheStorage, cacheLength, 0};
+             friendCacheLoad(&loaded, fboxMemoryRead, &r); });
+  benchRun("page from cache (TTL check + 5 names)", 0, [](uint64_t i)
+           {
+             volatile size_t chars = 0;
+             uint32_t first = (i * 5) % (friends.friends.count - 5);
+             if (!friendCacheNeedsRefresh(&friends, (uint32_t)i))
+               for (uint32_t f = first; f < first + 5; f++)
+                 chars += strlen(friendTableName(&friends.friends, f)); });
+
+  free(cacheStorage);
+  friendTableFree(&parsed);
+  friendTableFree(&friends.friends);
+  friendTableFree(&loaded.friends);
+  payload.clear();
+}
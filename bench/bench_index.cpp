@@ -0,0 +1,112 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Sketch index operations on a 500 entry index held in memory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "fbox.h"
+#include "sketch_index.h"
+
+#define BENCH_INDEX_ENTRIES 500
+
+/** A file held in memory, ctx for the storage callbacks. */
+struct MemoryFile
+{
+  uint8_t *data;
+  size_t capacity;
+};
+
+static MemoryFile indexFile;
+static MemoryFile orderFile;
+static SketchIndex sketches;
+static SketchIndexOrder orders;
+static SketchPager pager;
+
+static size_t memoryIndexRead(void *ctx, uint32_t offset, uint8_t *data, size_t len)
+{
+  MemoryFile *f = (MemoryFile *)ctx;
+  if (offset > f->capacity || len > f->capacity - offset)
+    return 0;
+  memcpy(data, f->data + offset, len);
+  return len;
+}
+
+static size_t memoryIndexWrite(void *ctx, uint32_t offset, const uint8_t *data, size_t len)
+{
+  MemoryFile *f = (MemoryFile *)ctx;
+  if (offset > f->capacity || len > f->capacity - offset)
+    return 0;
+  memcpy(f->data + offset, data, len);
+  return len;
+}
+
+static void makeEntry(SketchIndexEntry *entry, uint32_t i)
+{
+  char name[SKETCH_INDEX_NAME_MAX];
+  uint8_t header[FBOX_HEADER_SIZE] = {'F', 'B', 'O', 'X', FBOX_VERSION, FBOX_FLAG_THUMBNAIL};
+  // Scramble the order a little so sorting has work to do.
+  snprintf(name, sizeof(name), "sketch_%04u.fbox", (unsigned)((i * 7919) % 10000));
+  sketchIndexMakeEntry(entry, name, 4000 + (i * 37) % 1000, 1700000000 + (i * 131) % 5000, header, sizeof(header));
+}
+
+void benchIndex()
+{
+  printf("\n-- sketch index (%d entries) --\n", BENCH_INDEX_ENTRIES);
+  indexFile.capacity = SKETCH_INDEX_HEADER_SIZE + (BENCH_INDEX_ENTRIES + 1) * SKETCH_INDEX_RECORD_SIZE;
+  indexFile.data = (uint8_t *)calloc(indexFile.capacity, 1);
+  orderFile.capacity = SKETCH_INDEX_ORDER_HEADER_SIZE + SKETCH_SORT_COUNT * (BENCH_INDEX_ENTRIES + 1) * 2;
+  orderFile.data = (uint8_t *)calloc(orderFile.capacity, 1);
+  sketches = {memoryIndexRead, memoryIndexWrite, &indexFile, 0, 0, 0};
+  orders = {memoryIndexRead, memoryIndexWrite, &orderFile, 0, 0};
+
+  benchRun("rebuild", 0, [](uint64_t)
+           {
+             sketchIndexReset(&sketches);
+             SketchIndexEntry entry;
+             for (uint32_t i = 0; i < BENCH_INDEX_ENTRIES; i++)
+             {
+               makeEntry(&entry, i);
+               sketchIndexAppend(&sketches, &entry);
+             }
+             sketchIndexCommit(&sketches, 1); });
+  benchRun("open (valid)", 0, [](uint64_t)
+           { sketchIndexOpen(&sketches, 1); });
+  benchRun("list all names", 0, [](uint64_t)
+           {
+             SketchIndexEntry entry;
+             for (uint32_t i = 0; i < sketches.count; i++)
+               sketchIndexGet(&sketches, i, &entry); });
+  benchRun("upsert existing (last entry)", 0, [](uint64_t)
+           {
+             SketchIndexEntry entry;
+             makeEntry(&entry, BENCH_INDEX_ENTRIES - 1);
+             sketchIndexUpsert(&sketches, &entry);
+             sketchIndexCommit(&sketches, 1); });
+  benchRun("append + remove", 0, [](uint64_t)
+           {
+             SketchIndexEntry entry;
+             makeEntry(&entry, BENCH_INDEX_ENTRIES);
+             sketchIndexUpsert(&sketches, &entry);
+             sketchIndexRemove(&sketches, entry.name);
+             sketchIndexCommit(&sketches, 1); });
+  benchRun("build sort orders", 0, [](uint64_t)
+           { sketchIndexOrderBuild(&orders, &sketches); });
+  sketchPagerInit(&pager, &sketches, &orders, 5);
+  benchRun("page of 5 by date (cold)", 0, [](uint64_t i)
+           {
+             SketchIndexEntry entry;
+             sketchPagerSetSort(&pager, SKETCH_SORT_DATE);
+             uint32_t first = (i * 5) % BENCH_INDEX_ENTRIES;
+             for (uint32_t p = first; p < first + 5; p++)
+               sketchPagerGet(&pager, p, &entry); });
+  benchRun("page through all by size", 0, [](uint64_t)
+           {
+             SketchIndexEntry entry;
+             sketchPagerSetSort(&pager, SKETCH_SORT_SIZE);
+             for (uint32_t p = 0; p < sketchPagerCount(&pager); p++)
+               sketchPagerGet(&pager, p, &entry); });
+
+  free(indexFile.data);
+  free(orderFile.data);
+}
@@ -0,0 +1,51 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Undo journal benchmarks: the cost a stroke pays for being recorded, and undo/redo latency.
+
+#include <stdio.h>
+#include "bench.h"
+
+/** A 20 sample stroke wandering around the middle of the canvas. */
+static void journalStroke(uint64_t i, int radius)
+{
+  int x = 140 + (int)(i % 200);
+  int y = 160;
+  drawBrushToFB(x, y, radius, (uint8_t)(i & 0x0F));
+  for (int s = 1; s < 20; s++)
+  {
+    int nx = x + ((s * 7) % 11) - 5;
+    int ny = y + ((s * 5) % 9) - 4;
+    drawStrokeToFB(x, y, nx, ny, radius, (uint8_t)(i & 0x0F));
+    x = nx;
+    y = ny;
+  }
+}
+
+void benchJournal()
+{
+  printf("\n-- undo journal --\n");
+  canvasJournalInit();
+
+  benchRun("stroke r=10 unrecorded", 0, [](uint64_t i)
+           { journalStroke(i, 10); });
+  benchRun("stroke r=10 recorded", 0, [](uint64_t i)
+           {
+             canvasJournalBeginStroke();
+             journalStroke(i, 10);
+             canvasJournalEndStroke(); });
+  benchRun("stroke r=60 recorded", 0, [](uint64_t i)
+           {
+             canvasJournalBeginStroke();
+             journalStroke(i, 60);
+             canvasJournalEndStroke(); });
+  benchRun("undo + redo r=60 stroke", 0, [](uint64_t)
+           {
+             canvasUndo();
+             canvasRedo(); });
+  benchRun("clear screen recorded", TFT_HOR_RES * TFT_VER_RES, [](uint64_t i)
+           {
+             canvasJournalBeginStroke();
+             drawClearScreen((uint8_t)(i & 0x0F));
+             canvasJournalEndStroke(); });
+
+  canvasJournalReset();
+}
@@ -0,0 +1,33 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Native benchmark entry point. Build and run with:
+//   pio run -e native -t exec
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+HeadlessPanel tft;
+
+int main()
+{
+  canvas_framebuffer = (uint8_t *)malloc(CANVAS_FRAMEBUFFER_SIZE);
+  memset(canvas_framebuffer, 0, CANVAS_FRAMEBUFFER_SIZE);
+  tft.keepShadow = false;
+
+  printf("FriendBox native benchmarks (min %d ms per case)\n\n", BENCH_MIN_TIME_MS);
+  benchCanvas();
+  benchFill();
+  benchJournal();
+  benchFbox();
+  benchIndex();
+  benchFriends();
+  benchUpload();
+  benchNet();
+  benchOutbox();
+  benchBoot();
+  benchTouch();
+
+  free(canvas_framebuffer);
+  return 0;
+}
@@ -0,0 +1,154 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Network work queue with a fake transport. Measures the queue round trip, then what the user
+// feels: the longest the UI loop goes without drawing while uploads run, sent inline (the old
+// blocking Send) versus handed to a worker thread standing in for the network task. The fake
+// transport spends each segment's airtime on a 1 Mbit/s link asleep, like a socket write would.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "bench.h"
+#include "http_stream.h"
+#include "net_queue.h"
+
+#define BENCH_NET_UPLOADS 4
+/** About the size of a compressed sketch. */
+#define BENCH_NET_BODY 6000
+#define BENCH_NET_LINK_BPS 1000000.0
+
+static NetWorker worker;
+static std::atomic<bool> workerRunning;
+static bool bodiesIntact;
+
+/** Checks the body came through and reports progress a segment at a time. */
+static int fakeTransport(void *ctx, const NetRequest *request, NetProgress *progress)
+{
+  bool sleepOnWire = ctx != nullptr;
+  for (uint32_t i = 0; i < request->bodyLength; i++)
+  {
+    if (request->body[i] != (uint8_t)(request->id + i))
+      bodiesIntact = false;
+  }
+  for (uint32_t done = 0; done < request->bodyLength;)
+  {
+    uint32_t n = request->bodyLength - done < HTTP_CHUNK_SIZE ? request->bodyLength - done : HTTP_CHUNK_SIZE;
+    if (sleepOnWire)
+      std::this_thread::sleep_for(std::chrono::microseconds((long)(n * 8 / BENCH_NET_LINK_BPS * 1e6)));
+    done += n;
+    netReportProgress(progress, done, request->bodyLength);
+  }
+  return 200;
+}
+
+static void workerIdle()
+{
+  std::this_thread::yield();
+}
+
+static void workerLoop()
+{
+  while (workerRunning.load())
+  {
+    if (!netWorkerStep(&worker))
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+/** A request with a body whose bytes depend on the id it will be given. */
+static bool submitUpload()
+{
+  NetRequest request = {NET_REQUEST_SEND_OUTBOX};
+  request.body = (uint8_t *)malloc(BENCH_NET_BODY);
+  request.bodyLength = BENCH_NET_BODY;
+  for (uint32_t i = 0; i < BENCH_NET_BODY; i++)
+    request.body[i] = (uint8_t)(worker.nextId + i);
+  if (netSubmit(&worker, &request))
+    return true;
+  free(request.body);
+  return false;
+}
+
+/** One frame of drawing, the work the UI loop has to keep doing. */
+static void drawFrame(uint64_t i)
+{
+  int x = (int)(i * 37 % (TFT_HOR_RES - 40)) + 20;
+  drawStrokeToFB(x, 40, x + 10, TFT_VER_RES - 40, 4, (uint8_t)(i & 15));
+}
+
+/**
+ * Run the uploads and keep drawing. @param threaded Hand the uploads to a worker thread rather
+ * than running each to completion on the UI loop.
+ * @return The longest gap between frames, in ms.
+ */
+static double runUploads(bool threaded, uint32_t *completed, bool *inOrder)
+{
+  using clock = std::chrono::steady_clock;
+  netWorkerInit(&worker, fakeTransport, (void *)1, workerIdle);
+  std::thread thread;
+  if (threaded)
+  {
+    workerRunning = true;
+    thread = std::thread(workerLoop);
+  }
+  for (int i = 0; i < BENCH_NET_UPLOADS; i++)
+    submitUpload();
+
+  *completed = 0;
+  *inOrder = true;
+  double longestGap = 0;
+  clock::time_point last = clock::now();
+  for (uint64_t frame = 0; *completed < BENCH_NET_UPLOADS; frame++)
+  {
+    if (!threaded)
+      netWorkerStep(&worker);
+    NetEvent event;
+    while (netPollEvent(&worker, &event))
+    {
+      if (event.kind == NET_EVENT_DONE)
+      {
+        *inOrder = *inOrder && event.requestId == *completed + 1 && event.status == 200;
+        (*completed)++;
+      }
+    }
+    drawFrame(frame);
+    clock::time_point now = clock::now();
+    double gap = std::chrono::duration_cast<std::chrono::microseconds>(now - last).count() / 1000.0;
+    if (gap > longestGap)
+      longestGap = gap;
+    last = now;
+  }
+  if (threaded)
+  {
+    workerRunning = false;
+    thread.join();
+  }
+  return longestGap;
+}
+
+void benchNet()
+{
+  printf("\n-- network queue (fake transport) --\n");
+  bodiesIntact = true;
+  netWorkerInit(&worker, fakeTransport, nullptr);
+  benchRun("submit, run, drain events", 0, [](uint64_t)
+           {
+             submitUpload();
+             netWorkerStep(&worker);
+             NetEvent event;
+             while (netPollEvent(&worker, &event))
+               ; });
+  printf("  %u progress events dropped\n", worker.droppedEvents.load());
+
+  uint32_t completed;
+  bool inOrder;
+  double inlineGap = runUploads(false, &completed, &inOrder);
+  printf("%d uploads, blocking on the UI loop:   longest frame gap %7.2f ms, %u done%s\n", BENCH_NET_UPLOADS, inlineGap,
+         completed, inOrder ? "" : ", OUT OF ORDER");
+  double threadedGap = runUploads(true, &completed, &inOrder);
+  printf("%d uploads, queued to a worker thread: longest frame gap %7.2f ms, %u done%s\n", BENCH_NET_UPLOADS, threadedGap,
+         completed, inOrder ? "" : ", OUT OF ORDER");
+  printf("  bodies %s\n", bodiesIntact ? "verified" : "CORRUPT");
+}
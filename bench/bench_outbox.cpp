@@ -0,0 +1,167 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Durable outbox against an in-memory log. Measures what queueing a sketch costs in storage
+// writes, then sends a burst queued while the server is down: how many requests it takes once
+// batched per recipient, how the retries back off, and that a reboot with a torn last write comes
+// back with the same queue.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "bench.h"
+#include "outbox.h"
+
+#define BENCH_OUTBOX_SKETCHES 24
+#define BENCH_OUTBOX_RECIPIENTS 3
+/** How long the server stays unreachable in the simulated outage. */
+#define BENCH_OUTBOX_OUTAGE_MS (3 * 60 * 1000UL)
+
+static const char *recipients[BENCH_OUTBOX_RECIPIENTS] = {"Alice", "Bob", "Friend Number 3"};
+
+struct BenchLog
+{
+  std::vector<uint8_t> bytes;
+  uint32_t appends;
+  size_t position;
+};
+
+static BenchLog storage;
+static Outbox outbox;
+
+static size_t logAppend(void *ctx, const uint8_t *data, size_t len)
+{
+  BenchLog *l = (BenchLog *)ctx;
+  l->bytes.insert(l->bytes.end(), data, data + len);
+  l->appends++;
+  return len;
+}
+
+static size_t logRead(void *ctx, uint8_t *data, size_t len)
+{
+  BenchLog *l = (BenchLog *)ctx;
+  size_t n = l->bytes.size() - l->position < len ? l->bytes.size() - l->position : len;
+  memcpy(data, l->bytes.data() + l->position, n);
+  l->position += n;
+  return n;
+}
+
+/** Drain the queue completely, as if every send went through. */
+static void deliverAll(Outbox *o)
+{
+  OutboxEntry batch[OUTBOX_BATCH_MAX];
+  uint32_t n;
+  while ((n = outboxNextBatch(o, 0, batch)) > 0)
+    outboxDone(o, batch, n);
+}
+
+/** Same sequences, in the same order, for the same recipients. */
+static bool sameQueue(const Outbox *a, const Outbox *b)
+{
+  if (a->count != b->count || a->nextSequence != b->nextSequence)
+    return false;
+  for (uint32_t i = 0; i < a->count; i++)
+  {
+    if (a->pending[i].sequence != b->pending[i].sequence || strcmp(a->pending[i].recipient, b->pending[i].recipient) != 0)
+      return false;
+  }
+  return true;
+}
+
+/** Reload the queue from the log, as at boot. */
+static bool reboot(Outbox *into)
+{
+  static BenchLog copy;
+  copy = storage;
+  copy.position = 0;
+  outboxInit(into, logAppend, &copy);
+  return outboxLoad(into, logRead, &copy);
+}
+
+void benchOutbox()
+{
+  printf("\n-- outbox (in-memory log) --\n");
+  storage = BenchLog();
+  outboxInit(&outbox, logAppend, &storage);
+  benchRun("queue a sketch", 0, [](uint64_t i)
+           {
+             if (outbox.count == OUTBOX_MAX_PENDING)
+               deliverAll(&outbox);
+             outboxAdd(&outbox, recipients[i % BENCH_OUTBOX_RECIPIENTS], 0);
+             if (storage.bytes.size() > (1 << 20))
+             {
+               storage.bytes.clear();
+               outboxCompact(&outbox, logAppend, &storage);
+             } });
+  storage = BenchLog();
+  outboxInit(&outbox, logAppend, &storage);
+  outboxAdd(&outbox, recipients[0], 0);
+  printf("  %u append of %zu bytes per queued sketch, queue held in %zu bytes of RAM\n", storage.appends, storage.bytes.size(), sizeof(Outbox));
+
+  // A burst queued while the server is down, then sent once it is back.
+  storage = BenchLog();
+  outboxInit(&outbox, logAppend, &storage);
+  for (int i = 0; i < BENCH_OUTBOX_SKETCHES; i++)
+    outboxAdd(&outbox, recipients[i % BENCH_OUTBOX_RECIPIENTS], 0);
+  uint32_t nowMs = 0;
+  uint32_t requests = 0, failures = 0, sent = 0;
+  bool inOrder = true;
+  uint32_t lastSequence[BENCH_OUTBOX_RECIPIENTS] = {0};
+  srand(1);
+  printf("  retries at (s):");
+  for (uint32_t waitMs; (waitMs = outboxWaitMs(&outbox, nowMs)) != UINT32_MAX;)
+  {
+    nowMs += waitMs;
+    OutboxEntry batch[OUTBOX_BATCH_MAX];
+    uint32_t n = outboxNextBatch(&outbox, nowMs, batch);
+    requests++;
+    if (nowMs < BENCH_OUTBOX_OUTAGE_MS)
+    {
+      failures++;
+      outboxFailed(&outbox, nowMs, rand());
+      printf(" %.0f", (outbox.retryAtMs) / 1000.0);
+      continue;
+    }
+    for (uint32_t i = 0; i < n; i++)
+    {
+      int r = 0;
+      while (strcmp(recipients[r], batch[i].recipient) != 0)
+        r++;
+      inOrder = inOrder && batch[i].sequence > lastSequence[r];
+      lastSequence[r] = batch[i].sequence;
+    }
+    sent += n;
+    outboxDone(&outbox, batch, n);
+    // Sketches are shown as sent the moment the server is back, not on the next retry after.
+    nowMs += 1;
+  }
+  printf("\n%d sketches for %d friends, %.0f s outage  %u requests (%u failed) instead of %d, %u sent%s\n", BENCH_OUTBOX_SKETCHES,
+         BENCH_OUTBOX_RECIPIENTS, BENCH_OUTBOX_OUTAGE_MS / 1000.0, requests, failures, BENCH_OUTBOX_SKETCHES, sent,
+         inOrder ? ", in order per friend" : ", OUT OF ORDER");
+
+  // Power lost partway through: half sent, then a record cut off in the middle of its write.
+  storage = BenchLog();
+  outboxInit(&outbox, logAppend, &storage);
+  for (int i = 0; i < BENCH_OUTBOX_SKETCHES; i++)
+    outboxAdd(&outbox, recipients[i % BENCH_OUTBOX_RECIPIENTS], 0);
+  OutboxEntry batch[OUTBOX_BATCH_MAX];
+  uint32_t n = outboxNextBatch(&outbox, 0, batch);
+  outboxDone(&outbox, batch, n);
+  uint8_t torn[OUTBOX_RECORD_SIZE / 2];
+  memset(torn, 'Q', sizeof(torn));
+  storage.bytes.insert(storage.bytes.end(), torn, torn + sizeof(torn));
+  Outbox rebooted;
+  bool clean = reboot(&rebooted);
+  bool same = sameQueue(&outbox, &rebooted);
+  BenchLog compacted = BenchLog();
+  outboxCompact(&rebooted, logAppend, &compacted);
+  storage = compacted;
+  Outbox again;
+  bool cleanAgain = reboot(&again);
+  printf("reboot with a torn last write         %u of %u queued back, log %s; compacted to %zu bytes, %s\n", rebooted.count,
+         outbox.count, clean ? "clean" : "damaged", compacted.bytes.size(), same && cleanAgain && sameQueue(&outbox, &again) ? "verified" : "MISMATCH");
+
+  benchRun("  replay the compacted log at boot", 0, [](uint64_t)
+           {
+             Outbox o;
+             reboot(&o); });
+}
@@ -0,0 +1,368 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Touch sample stream. A thread stands in for the sampling task, reading a synthetic pen trace at
+// TOUCH_SAMPLE_HZ, while the main thread runs a loop() whose frames now and then stall the way a
+// full redraw or an SD write does. Compares the samples the canvas gets against the old one read
+// per loop(), and checks that a tap inside a stalled frame still reads as a press and a release.
+// Then runs a simulated XPT2046 trace, strokes at several speeds with pressure ramps, jitter that
+// grows as the pressure drops and the odd wild reading, through the old drop-and-delay touch queue
+// and through touchFilter: how long before the first ink, how far behind the pen the ink runs, and
+// how much of it lands off the pen's path.
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "bench.h"
+#include "touch_stream.h"
+
+#define BENCH_TOUCH_RUN_MS 2000
+#define BENCH_TOUCH_FRAME_MS 5
+/** Every BENCH_TOUCH_STALL_EVERY frames one takes this long instead. */
+#define BENCH_TOUCH_STALL_MS 60
+#define BENCH_TOUCH_STALL_EVERY 10
+/** TOUCH_INPUT_BUFFER, as the old touch queue had it. */
+#define BENCH_TOUCH_OLD_BUFFER 10
+
+static TouchStream stream;
+static std::atomic<bool> sampling;
+static std::chrono::steady_clock::time_point epoch;
+
+static uint32_t nowUs()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+/** The pen: circles for 900 ms, lifted for 100 ms, and so on. */
+static bool penAt(uint32_t us, uint16_t *x, uint16_t *y)
+{
+  uint32_t ms = us / 1000;
+  if (ms % 1000 >= 900)
+    return false;
+  double a = ms * 0.01;
+  *x = (uint16_t)(240 + 100 * cos(a));
+  *y = (uint16_t)(160 + 100 * sin(a));
+  return true;
+}
+
+static void samplerThread()
+{
+  std::chrono::steady_clock::time_point wake = std::chrono::steady_clock::now();
+  while (sampling.load(std::memory_order_relaxed))
+  {
+    uint32_t us = nowUs();
+    uint16_t x = 0, y = 0;
+    bool touching = penAt(us, &x, &y);
+    touchStreamSample(&stream, us, touching, x, y, 800);
+    wake += std::chrono::microseconds(1000000 / TOUCH_SAMPLE_HZ);
+    std::this_thread::sleep_until(wake);
+  }
+}
+
+/**
+ * The touch queue as loop() kept it before the stream, one reading per call. Returns true with the
+ * point to draw, or false with *down cleared on a lift.
+ */
+static bool oldTouchQueue(bool touching, uint16_t x, uint16_t y, uint16_t *outX, uint16_t *outY, bool *down)
+{
+  static uint16_t count = 0;
+  static uint16_t qx[BENCH_TOUCH_OLD_BUFFER] = {0}, qy[BENCH_TOUCH_OLD_BUFFER] = {0};
+  static uint8_t last = 0;
+  if (!touching)
+  {
+    count = 0;
+    memset(qx, 0, sizeof(qx));
+    memset(qy, 0, sizeof(qy));
+    *down = false;
+    return false;
+  }
+  if (++count <= BENCH_TOUCH_OLD_BUFFER)
+    return false;
+  qx[last] = x;
+  qy[last] = y;
+  last = (last + 1) % BENCH_TOUCH_OLD_BUFFER;
+  uint8_t read = (last + 1) % BENCH_TOUCH_OLD_BUFFER;
+  if (qx[read] + qy[read] == 0)
+    return false;
+  *outX = qx[read];
+  *outY = qy[read];
+  *down = true;
+  return true;
+}
+
+#define BENCH_TOUCH_STROKE_MS 400
+#define BENCH_TOUCH_GAP_MS 40
+#define BENCH_TOUCH_RAMP_MS 12
+#define BENCH_TOUCH_FULL_Z 1500
+/** Readings below this pressure the controller reports as no touch. */
+#define BENCH_TOUCH_THRESHOLD_Z 150
+/** Ink further than this from the pen's path counts as smear, px. */
+#define BENCH_TOUCH_SMEAR_PX 4.0
+
+struct TraceSample
+{
+  TouchSample raw;
+  /** Where the pen really was. */
+  float x;
+  float y;
+  int stroke;
+};
+
+/** Pen speeds, px/s, one stroke each, straight lines and arcs in turn. */
+static const float strokeSpeeds[] = {60, 150, 300, 600, 1200, 60, 300, 1200};
+#define BENCH_TOUCH_STROKES (int)(sizeof(strokeSpeeds) / sizeof(strokeSpeeds[0]))
+#define BENCH_TOUCH_TRACE_MAX (BENCH_TOUCH_STROKES * (BENCH_TOUCH_STROKE_MS + BENCH_TOUCH_GAP_MS) * TOUCH_SAMPLE_HZ / 1000)
+static TraceSample trace[BENCH_TOUCH_TRACE_MAX];
+static int traceLength;
+
+static uint32_t traceRandom = 1;
+/** Uniform in [-1, 1). */
+static float noise()
+{
+  traceRandom = traceRandom * 1103515245 + 12345;
+  return ((traceRandom >> 8) & 0xFFFF) / 32768.0f - 1.0f;
+}
+
+static void buildTrace()
+{
+  traceLength = 0;
+  traceRandom = 1;
+  const uint32_t stepUs = 1000000 / TOUCH_SAMPLE_HZ;
+  uint32_t us = 0;
+  for (int s = 0; s < BENCH_TOUCH_STROKES; s++)
+  {
+    for (uint32_t t = 0; t < (BENCH_TOUCH_STROKE_MS + BENCH_TOUCH_GAP_MS) * 1000UL; t += stepUs, us += stepUs)
+    {
+      TraceSample *sample = &trace[traceLength++];
+      float ms = t / 1000.0f;
+      float along = strokeSpeeds[s] * t / 1e6f;
+      if (s % 2 == 0)
+      {
+        sample->x = 60 + along;
+        sample->y = 60 + 30 * s;
+      }
+      else
+      {
+        sample->x = 240 + 100 * cosf(along / 100);
+        sample->y = 160 + 100 * sinf(along / 100);
+      }
+      sample->stroke = s;
+      float z = 0;
+      if (ms < BENCH_TOUCH_STROKE_MS)
+      {
+        float ramp = ms < BENCH_TOUCH_RAMP_MS ? ms / BENCH_TOUCH_RAMP_MS : (BENCH_TOUCH_STROKE_MS - ms < BENCH_TOUCH_RAMP_MS ? (BENCH_TOUCH_STROKE_MS - ms) / BENCH_TOUCH_RAMP_MS : 1);
+        z = BENCH_TOUCH_FULL_Z * ramp * (1 + 0.05f * noise());
+      }
+      sample->raw = {us, 0, 0, 0};
+      if (z < BENCH_TOUCH_THRESHOLD_Z)
+        continue;
+      // Light contact reads as if the pen were pulled towards the middle of the panel, and noisier.
+      float light = 1 - z / BENCH_TOUCH_FULL_Z;
+      float jitter = 0.8f * BENCH_TOUCH_FULL_Z / z;
+      float rx = sample->x + light * (240 - sample->x) * 0.15f + jitter * noise();
+      float ry = sample->y + light * (160 - sample->y) * 0.15f + jitter * noise();
+      if (noise() > 0.97f)
+      {
+        rx += 35 * noise();
+        ry += 35 * noise();
+      }
+      sample->raw.x = (uint16_t)lroundf(rx < 0 ? 0 : rx);
+      sample->raw.y = (uint16_t)lroundf(ry < 0 ? 0 : ry);
+      sample->raw.z = (uint16_t)z;
+    }
+  }
+}
+
+struct TouchScore
+{
+  uint32_t inked;
+  uint32_t smeared;
+  double firstInkMs;
+  double lagMs;
+  double offPathPx;
+};
+
+/**
+ * Score one drawn point from the trace at index i: how far it is from where the pen went during
+ * its stroke, and how long ago the pen was closest to it.
+ */
+static void scorePoint(TouchScore *score, int i, uint16_t x, uint16_t y)
+{
+  double best = 1e9;
+  int bestAt = i;
+  for (int j = i; j >= 0 && trace[j].stroke == trace[i].stroke; j--)
+  {
+    if (trace[j].raw.us + 100000 < trace[i].raw.us)
+      break;
+    double dx = trace[j].x - x, dy = trace[j].y - y;
+    double d = dx * dx + dy * dy;
+    if (d < best)
+    {
+      best = d;
+      bestAt = j;
+    }
+  }
+  // Smear is measured against the whole stroke, ahead of the pen too.
+  double nearest = best;
+  for (int j = i; j < traceLength && trace[j].stroke == trace[i].stroke; j++)
+  {
+    double dx = trace[j].x - x, dy = trace[j].y - y;
+    if (dx * dx + dy * dy < nearest)
+      nearest = dx * dx + dy * dy;
+  }
+  score->inked++;
+  score->offPathPx += sqrt(nearest);
+  if (sqrt(nearest) > BENCH_TOUCH_SMEAR_PX)
+    score->smeared++;
+  else
+    score->lagMs += (trace[i].raw.us - trace[bestAt].raw.us) / 1000.0;
+}
+
+/** Run the trace through the old touch queue or touchFilter and score what would have been drawn. */
+static TouchScore runTrace(bool filtered)
+{
+  TouchScore score = {0, 0, 0, 0, 0};
+  TouchFilter filter;
+  touchFilterInit(&filter);
+  int strokeStart = -1;
+  bool inked = false;
+  double firstInkTotal = 0;
+  int firstInks = 0;
+  for (int i = 0; i < traceLength; i++)
+  {
+    const TouchSample *raw = &trace[i].raw;
+    if (raw->z && strokeStart < 0)
+    {
+      strokeStart = i;
+      inked = false;
+    }
+    if (!raw->z)
+      strokeStart = -1;
+    bool draws;
+    uint16_t x = 0, y = 0;
+    if (filtered)
+    {
+      TouchSample out;
+      draws = touchFilter(&filter, raw, &out) && out.z;
+      x = out.x;
+      y = out.y;
+    }
+    else
+    {
+      bool down;
+      draws = oldTouchQueue(raw->z != 0, raw->x, raw->y, &x, &y, &down);
+    }
+    if (!draws)
+      continue;
+    if (!inked)
+    {
+      firstInkTotal += (raw->us - trace[strokeStart].raw.us) / 1000.0;
+      firstInks++;
+      inked = true;
+    }
+    scorePoint(&score, i, x, y);
+  }
+  score.firstInkMs = firstInks ? firstInkTotal / firstInks : 0;
+  uint32_t onPath = score.inked - score.smeared;
+  score.lagMs = onPath ? score.lagMs / onPath : 0;
+  score.offPathPx = score.inked ? score.offPathPx / score.inked : 0;
+  return score;
+}
+
+static void benchTouchFilter()
+{
+  buildTrace();
+  printf("simulated XPT2046 trace: %d strokes at 60-1200 px/s, %d ms pressure ramps, %d samples\n", BENCH_TOUCH_STROKES,
+         BENCH_TOUCH_RAMP_MS, traceLength);
+  const char *names[2] = {"old drop-10 queue", "touchFilter"};
+  for (int f = 0; f < 2; f++)
+  {
+    TouchScore score = runTrace(f == 1);
+    printf("%-18s first ink %5.1f ms, %4.1f ms behind the pen, %4.2f px off path on average, %u of %u points smeared\n",
+           names[f], score.firstInkMs, score.lagMs, score.offPathPx, score.smeared, score.inked);
+  }
+}
+
+/** A tap that starts and ends between two drains still shows up as a press, then a release. */
+static bool tapSurvivesStall()
+{
+  touchStreamInit(&stream);
+  for (int i = 0; i < 15; i++)
+    touchStreamSample(&stream, i, true, 100, 100, 800);
+  touchStreamSample(&stream, 15, false, 0, 0, 0);
+  TouchSample samples[TOUCH_RING_SIZE];
+  uint32_t first = touchStreamDrain(&stream, samples, TOUCH_RING_SIZE);
+  bool pressed = first == 15 && samples[first - 1].z != 0;
+  uint32_t second = touchStreamDrain(&stream, samples, TOUCH_RING_SIZE);
+  return pressed && second == 1 && samples[0].z == 0;
+}
+
+void benchTouch()
+{
+  printf("\n-- touch stream (%d Hz sampler thread, %d ms frames, %d ms stall every %d) --\n", TOUCH_SAMPLE_HZ, BENCH_TOUCH_FRAME_MS,
+         BENCH_TOUCH_STALL_MS, BENCH_TOUCH_STALL_EVERY);
+  touchStreamInit(&stream);
+  epoch = std::chrono::steady_clock::now();
+  sampling = true;
+  std::thread sampler(samplerThread);
+
+  static TouchSample samples[TOUCH_RING_SIZE];
+  uint32_t frames = 0, polled = 0, drained = 0, peak = 0;
+  uint32_t polledGapUs = 0, drainedGapUs = 0, lastPolledUs = 0, lastDrainedUs = 0;
+  bool inOrder = true;
+  while (nowUs() < BENCH_TOUCH_RUN_MS * 1000UL)
+  {
+    // What loop() used to see: one reading, taken now.
+    uint32_t us = nowUs();
+    uint16_t x, y;
+    if (penAt(us, &x, &y))
+    {
+      if (lastPolledUs && us - lastPolledUs > polledGapUs)
+        polledGapUs = us - lastPolledUs;
+      lastPolledUs = us;
+      polled++;
+    }
+    else
+    {
+      lastPolledUs = 0;
+    }
+
+    uint32_t backlog = stream.ring.size();
+    if (backlog > peak)
+      peak = backlog;
+    uint32_t n = touchStreamDrain(&stream, samples, TOUCH_RING_SIZE);
+    for (uint32_t i = 0; i < n; i++)
+    {
+      if (samples[i].z == 0)
+      {
+        lastDrainedUs = 0;
+        continue;
+      }
+      if (lastDrainedUs && samples[i].us - lastDrainedUs > drainedGapUs)
+        drainedGapUs = samples[i].us - lastDrainedUs;
+      inOrder = inOrder && samples[i].us >= lastDrainedUs;
+      lastDrainedUs = samples[i].us;
+      drained++;
+    }
+    frames++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(frames % BENCH_TOUCH_STALL_EVERY ? BENCH_TOUCH_FRAME_MS : BENCH_TOUCH_STALL_MS));
+  }
+  sampling = false;
+  sampler.join();
+
+  printf("read in loop()     %5u contacts over %u frames, longest gap between points %6.1f ms\n", polled, frames, polledGapUs / 1000.0);
+  printf("drained from ring  %5u contacts, %u lost, peak backlog %u of %d, longest gap %6.1f ms%s\n", drained,
+         stream.dropped.load(), peak, TOUCH_RING_SIZE, drainedGapUs / 1000.0, inOrder ? ", in order" : ", OUT OF ORDER");
+  printf("tap inside one stalled frame: %s\n", tapSurvivesStall() ? "press then release" : "LOST");
+  benchTouchFilter();
+
+  touchStreamInit(&stream);
+  benchRun("  filter + sample + drain", 0, [](uint64_t i)
+           {
+             static TouchFilter filter;
+             TouchSample raw = {(uint32_t)i * 2000, (uint16_t)(i & 255), (uint16_t)(i & 127), (uint16_t)((i & 63) != 63 ? 800 : 0)}, out;
+             if (touchFilter(&filter, &raw, &out))
+               touchStreamSample(&stream, out.us, out.z != 0, out.x, out.y, out.z);
+             touchStreamDrain(&stream, samples, TOUCH_RING_SIZE); });
+}
@@ -0,0 +1,522 @@
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Canvas upload against a stand-in server on the loopback interface. Compares the old raw POST
+// with the compressed chunked upload from RAM and the saved-file upload from SD (an in-memory
+// .fbox here). Loopback hides link speed, so the bytes on the wire are also converted to airtime
+// on a weak 1 Mbit/s Wi-Fi link, which is what the user actually waits for. Then sends several
+// uploads in a row to count handshakes, with the connection kept alive or not, and against a
+// server that drops idle connections without saying so, and against one too slow to answer, which
+// must not get the upload twice. Last, the inbox download: the sketch is decoded as it streams in,
+// and a download cut off part way resumes with a Range request.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "bench.h"
+#include "fbox.h"
+#include "http_stream.h"
+
+#define BENCH_UPLOAD_LINK_BPS 1000000.0
+/** Sends in a row, like a sketch going to several friends. */
+#define BENCH_UPLOAD_BURST 5
+/** The client's read timeout, shorter than the device's so the stalled server case runs quickly. */
+#define BENCH_UPLOAD_READ_TIMEOUT_MS 200
+
+static int listenFd = -1;
+static uint16_t serverPort;
+static std::thread server;
+/** Body of the last request the server received, chunked framing removed. */
+static std::vector<uint8_t> receivedBody;
+static uint8_t *savedFbox;
+static size_t savedFboxLength;
+/** Requests the server answers on one connection before hanging up, 0 for no limit. */
+static int serverRequestLimit;
+/** Hang up without a Connection: close, the way an idle timeout does. */
+static bool serverSilentClose;
+/** Wait this long before answering an upload, 0 to answer at once. */
+static int serverStallMs;
+/** Uploads the server has read, answered or not. */
+static std::atomic<int> serverUploads;
+static int clientFd = -1;
+static HttpConnection conn;
+/** Method and Range start of the last request the server read, -1 for no range. */
+static bool requestIsGet;
+static long requestRangeStart;
+/** Hang up after sending this many body bytes of the next download, 0 to send it all. */
+static size_t serverCutAfter;
+
+static size_t socketWrite(void *ctx, const uint8_t *data, size_t len)
+{
+  int fd = *(int *)ctx;
+  size_t sent = 0;
+  while (sent < len)
+  {
+    ssize_t n = send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+      return sent;
+    sent += n;
+  }
+  return sent;
+}
+
+static size_t socketRead(void *ctx, uint8_t *data, size_t len)
+{
+  ssize_t n = recv(*(int *)ctx, data, len, 0);
+  return n > 0 ? n : 0;
+}
+
+static bool readExactly(int fd, uint8_t *data, size_t len)
+{
+  return len == 0 || recv(fd, data, len, MSG_WAITALL) == (ssize_t)len;
+}
+
+/** Read one line off the socket, CRLF stripped. */
+static bool serverLine(int fd, char *line, size_t max)
+{
+  size_t len = 0;
+  uint8_t c;
+  while (socketRead(&fd, &c, 1) == 1)
+  {
+    if (c == '\n')
+    {
+      if (len > 0 && line[len - 1] == '\r')
+        len--;
+      line[len] = 0;
+      return true;
+    }
+    if (len < max - 1)
+      line[len++] = c;
+  }
+  return false;
+}
+
+/** Read one request off fd into receivedBody. @return False once the client has gone. */
+static bool serveRequest(int fd)
+{
+  char line[HTTP_LINE_MAX];
+  long contentLength = -1;
+  bool chunked = false;
+  if (!serverLine(fd, line, sizeof(line)))
+    return false;
+  requestIsGet = strncmp(line, "GET ", 4) == 0;
+  requestRangeStart = -1;
+  bool ok = true;
+  while (ok && (ok = serverLine(fd, line, sizeof(line))) && line[0])
+  {
+    if (strncasecmp(line, "Range: bytes=", 13) == 0)
+      requestRangeStart = atol(line + 13);
+    else if (strncasecmp(line, "Content-Length:", 15) == 0)
+      contentLength = atol(line + 15);
+    else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked"))
+      chunked = true;
+  }
+  receivedBody.clear();
+  if (chunked)
+  {
+    for (;;)
+    {
+      ok = ok && serverLine(fd, line, sizeof(line));
+      size_t size = ok ? strtoul(line, nullptr, 16) : 0;
+      size_t at = receivedBody.size();
+      receivedBody.resize(at + size);
+      // Each chunk's data is followed by CRLF, the zero-length last chunk by the empty trailer line.
+      ok = ok && readExactly(fd, receivedBody.data() + at, size) && serverLine(fd, line, sizeof(line));
+      if (!ok || size == 0)
+        break;
+    }
+  }
+  else if (contentLength > 0)
+  {
+    receivedBody.resize(contentLength);
+    ok = readExactly(fd, receivedBody.data(), contentLength);
+  }
+  return ok;
+}
+
+/** Answer a GET with the saved sketch, or the part of it asked for. @return False if the connection was cut. */
+static bool serveDownload(int fd)
+{
+  char head[160];
+  size_t start = requestRangeStart > 0 ? requestRangeStart : 0;
+  if (start >= savedFboxLength)
+    snprintf(head, sizeof(head), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n");
+  else if (start > 0)
+    snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %zu-%zu/%zu\r\nContent-Length: %zu\r\n\r\n",
+             start, savedFboxLength - 1, savedFboxLength, savedFboxLength - start);
+  else
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", savedFboxLength);
+  socketWrite(&fd, (const uint8_t *)head, strlen(head));
+  if (start >= savedFboxLength)
+    return true;
+  size_t len = savedFboxLength - start;
+  if (serverCutAfter && serverCutAfter < len)
+  {
+    socketWrite(&fd, savedFbox + start, serverCutAfter);
+    serverCutAfter = 0;
+    return false;
+  }
+  socketWrite(&fd, savedFbox + start, len);
+  return true;
+}
+
+/** Answer each connection's requests with 200 until the client leaves or the request limit is hit. */
+static void serveUploads()
+{
+  for (;;)
+  {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+      return;
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    for (int served = 1; serveRequest(fd); served++)
+    {
+      if (requestIsGet)
+      {
+        if (!serveDownload(fd))
+          break;
+        continue;
+      }
+      serverUploads++;
+      if (serverStallMs)
+        usleep(serverStallMs * 1000);
+      bool last = serverRequestLimit && served == serverRequestLimit;
+      const char *reply = last && !serverSilentClose ? "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nOK"
+                                                     : "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK";
+      socketWrite(&fd, (const uint8_t *)reply, strlen(reply));
+      if (last)
+        break;
+    }
+    close(fd);
+  }
+}
+
+static bool startServer()
+{
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t addrLen = sizeof(addr);
+  if (listenFd < 0 || bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0 ||
+      getsockname(listenFd, (sockaddr *)&addr, &addrLen) != 0)
+    return false;
+  serverPort = ntohs(addr.sin_port);
+  server = std::thread(serveUploads);
+  return true;
+}
+
+static void stopServer()
+{
+  shutdown(listenFd, SHUT_RDWR);
+  close(listenFd);
+  server.join();
+}
+
+static bool socketConnect(void *ctx, const char *, uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    close(fd);
+    return false;
+  }
+  // As on the device: heads and bodies are separate writes, Nagle would hold the body back for an ACK.
+  int noDelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  // Reads give up like WiFiClient's do, rather than waiting on a stalled server forever.
+  timeval timeout = {0, BENCH_UPLOAD_READ_TIMEOUT_MS * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  *(int *)ctx = fd;
+  return true;
+}
+
+static void socketClose(void *ctx)
+{
+  close(*(int *)ctx);
+  *(int *)ctx = -1;
+}
+
+/** Peek without waiting: end of stream or a reset means the server is gone, nothing yet means it is slow. */
+static bool socketClosed(void *ctx)
+{
+  uint8_t c;
+  ssize_t n = recv(*(int *)ctx, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+static bool writeFramebufferBody(void *, http_write_fn_t write, void *writeCtx)
+{
+  for (size_t i = 0; i < CANVAS_FRAMEBUFFER_SIZE; i += HTTP_CHUNK_SIZE)
+  {
+    size_t n = CANVAS_FRAMEBUFFER_SIZE - i < HTTP_CHUNK_SIZE ? CANVAS_FRAMEBUFFER_SIZE - i : HTTP_CHUNK_SIZE;
+    if (write(writeCtx, canvas_framebuffer + i, n) != n)
+      return false;
+  }
+  return true;
+}
+
+static bool writeCanvasBody(void *, http_write_fn_t write, void *writeCtx)
+{
+  return fboxWrite(canvas_framebuffer, write, writeCtx) == FBOX_OK;
+}
+
+static bool writeSavedFileBody(void *, http_write_fn_t write, void *writeCtx)
+{
+  FboxMemoryReader file = {savedFbox, savedFboxLength, 0};
+  uint8_t buffer[HTTP_CHUNK_SIZE];
+  size_t n;
+  while ((n = fboxMemoryRead(&file, buffer, sizeof(buffer))) > 0)
+  {
+    if (write(writeCtx, buffer, n) != n)
+      return false;
+  }
+  return true;
+}
+
+/** Send one upload on conn and read the reply. @return Bytes on the wire, 0 on failure. */
+static size_t upload(const char *contentType, int32_t contentLength, http_body_fn_t body)
+{
+  HttpResponse response;
+  int status = httpRequest(&conn, "POST", "/sketches/upload", contentType, contentLength, nullptr, body, nullptr, &response);
+  bool ok = status >= 0 && httpFinishRequest(&conn, &response);
+  return ok && status == 200 ? conn.bytesOnWire : 0;
+}
+
+/** The old path: the raw framebuffer with a Content-Length. */
+static size_t uploadRaw()
+{
+  return upload("application/octet-stream", CANVAS_FRAMEBUFFER_SIZE, writeFramebufferBody);
+}
+
+/** The chunked writer on its own: .fbox compressed straight into a body of unknown length. */
+static size_t uploadCanvasChunked()
+{
+  return upload("application/x-fbox", -1, writeCanvasBody);
+}
+
+/** What writeFileBody does for each outbox sketch: an already compressed file, read and sent a segment at a time. */
+static size_t uploadSavedFile()
+{
+  return upload("application/x-fbox", savedFboxLength, writeSavedFileBody);
+}
+
+/** Check the server got the canvas back intact. */
+static bool receivedCanvas(bool compressed)
+{
+  if (!compressed)
+    return receivedBody.size() == CANVAS_FRAMEBUFFER_SIZE && memcmp(receivedBody.data(), canvas_framebuffer, CANVAS_FRAMEBUFFER_SIZE) == 0;
+  std::vector<uint8_t> original(canvas_framebuffer, canvas_framebuffer + CANVAS_FRAMEBUFFER_SIZE);
+  FboxMemoryReader r = {receivedBody.data(), receivedBody.size(), 0};
+  bool ok = fboxReadToFramebuffer(fboxMemoryRead, &r, receivedBody.size()) == FBOX_OK &&
+            memcmp(original.data(), canvas_framebuffer, CANVAS_FRAMEBUFFER_SIZE) == 0;
+  memcpy(canvas_framebuffer, original.data(), CANVAS_FRAMEBUFFER_SIZE);
+  return ok;
+}
+
+static void benchUploadCase(const char *name, size_t (*upload)(), bool compressed)
+{
+  static size_t (*current)();
+  current = upload;
+  size_t wire = upload();
+  bool intact = wire && receivedCanvas(compressed);
+  BenchResult r = benchRun(name, 0, [](uint64_t)
+                           { current(); });
+  printf("  %zu bytes on the wire, %s, %.2f ms loopback, %.0f ms at 1 Mbit/s\n", wire, intact ? "verified" : "CORRUPT",
+         r.nsPerOp / 1e6, wire * 8 / BENCH_UPLOAD_LINK_BPS * 1000);
+}
+
+/**
+ * Send BENCH_UPLOAD_BURST uploads back to back and count the handshakes they took.
+ * @param keepAlive Keep the connection between uploads, otherwise close it after each like the old code.
+ */
+static void benchUploadBurst(const char *name, bool keepAlive, int requestLimit, bool silentClose)
+{
+  static bool closeEach;
+  closeEach = !keepAlive;
+  serverRequestLimit = requestLimit;
+  serverSilentClose = silentClose;
+  httpConnectionInit(&conn, "127.0.0.1", serverPort, socketWrite, socketRead, socketConnect, socketClose, &clientFd, socketClosed);
+  int ok = 0;
+  for (int i = 0; i < BENCH_UPLOAD_BURST; i++)
+  {
+    ok += uploadSavedFile() != 0;
+    if (closeEach)
+      httpConnectionClose(&conn);
+  }
+  printf("%-36s %d/%d sent, %u connections for %u requests, %u resent\n", name, ok, BENCH_UPLOAD_BURST, conn.connects,
+         conn.requests, conn.retries);
+  benchRun("  per upload", 0, [](uint64_t)
+           {
+             uploadSavedFile();
+             if (closeEach)
+               httpConnectionClose(&conn); });
+  httpConnectionClose(&conn);
+  serverRequestLimit = 0;
+}
+
+/**
+ * An upload on a kept-alive connection that the server takes but answers too late. Nothing comes
+ * back before the read times out, just as when the server has dropped the connection, but the
+ * upload has arrived and must not be sent again.
+ */
+static void benchUploadStall(const char *name)
+{
+  httpConnectionInit(&conn, "127.0.0.1", serverPort, socketWrite, socketRead, socketConnect, socketClose, &clientFd, socketClosed);
+  bool first = uploadSavedFile() != 0;
+  serverUploads = 0;
+  serverStallMs = 2 * BENCH_UPLOAD_READ_TIMEOUT_MS;
+  bool stalled = uploadSavedFile() == 0;
+  int arrived = serverUploads;
+  // Let the server finish with it before anything else connects.
+  usleep(serverStallMs * 1000);
+  serverStallMs = 0;
+  httpConnectionClose(&conn);
+  printf("%-36s %s, upload arrived %d time(s), %u resent, %s\n", name, first && stalled ? "timed out" : "NOT STALLED", arrived,
+         conn.retries, arrived == 1 && conn.retries == 0 ? "verified" : "DUPLICATED");
+}
+
+/** The inbox part file, SD on the device. */
+static std::vector<uint8_t> partFile;
+static int rowsShown;
+
+/** What inboxRead does: replay the part file, then pull the body and append it. */
+struct DownloadReader
+{
+  size_t fromFile;
+  size_t position;
+  HttpBodyReader body;
+};
+
+static size_t downloadRead(void *ctx, uint8_t *data, size_t len)
+{
+  DownloadReader *r = (DownloadReader *)ctx;
+  if (r->fromFile > 0)
+  {
+    size_t n = len < r->fromFile ? len : r->fromFile;
+    memcpy(data, partFile.data() + r->position, n);
+    r->position += n;
+    r->fromFile -= n;
+    return n;
+  }
+  size_t n = httpBodyRead(&r->body, data, len);
+  partFile.insert(partFile.end(), data, data + n);
+  return n;
+}
+
+static void downloadRow(void *, int, const uint8_t *)
+{
+  rowsShown++;
+}
+
+/**
+ * What networkDownloadSketch does, against the stand-in server.
+ * @return Attempts it took, 0 if it failed.
+ */
+static int downloadSketch(fbox_result_id_t *result)
+{
+  partFile.clear();
+  for (int attempt = 1; attempt <= 3; attempt++)
+  {
+    char range[40] = "";
+    if (!partFile.empty())
+      snprintf(range, sizeof(range), "Range: bytes=%zu-\r\n", partFile.size());
+    HttpResponse response;
+    int status = httpRequest(&conn, "GET", "/sketches/inbox/1", nullptr, 0, range, nullptr, nullptr, &response);
+    DownloadReader reader = {0, 0};
+    uint32_t total;
+    if (status == 206 && response.rangeStart == (int32_t)partFile.size())
+    {
+      reader.fromFile = partFile.size();
+      total = response.rangeTotal;
+    }
+    else if (status == 200)
+    {
+      partFile.clear();
+      total = response.contentLength;
+    }
+    else
+      return 0;
+    httpBodyBegin(&reader.body, socketRead, &clientFd, &response);
+    rowsShown = 0;
+    *result = fboxRead(downloadRead, &reader, total, downloadRow, nullptr);
+    if (*result == FBOX_OK)
+    {
+      httpDrainBody(&conn, &reader.body);
+      return attempt;
+    }
+    httpConnectionClose(&conn);
+    if (!reader.body.failed && reader.body.done)
+      return 0;
+  }
+  return 0;
+}
+
+static void benchInboxCase(const char *name, size_t cutAfter)
+{
+  static size_t cut;
+  cut = cutAfter;
+  fbox_result_id_t result;
+  serverCutAfter = cut;
+  conn.bytesOnWire = 0;
+  int attempts = downloadSketch(&result);
+  bool intact = attempts && result == FBOX_OK && partFile.size() == savedFboxLength &&
+                memcmp(partFile.data(), savedFbox, savedFboxLength) == 0 && rowsShown == TFT_VER_RES;
+  printf("%-36s %d attempt(s), %d rows shown on the last, %zu bytes on SD, %s\n", name, attempts, rowsShown, partFile.size(),
+         intact ? "verified" : "CORRUPT");
+  benchRun("  per download", TFT_HOR_RES * TFT_VER_RES, [](uint64_t)
+           {
+             fbox_result_id_t r;
+             serverCutAfter = cut;
+             downloadSketch(&r); });
+}
+
+void benchUpload()
+{
+  printf("\n-- canvas upload (loopback stand-in server) --\n");
+  if (!startServer())
+  {
+    printf("  could not start the stand-in server, skipped\n");
+    return;
+  }
+  benchPaintSketch();
+  savedFboxLength = fboxEncodedSize(canvas_framebuffer);
+  savedFbox = (uint8_t *)malloc(savedFboxLength);
+  FboxMemoryWriter w = {savedFbox, savedFboxLength, 0};
+  fboxWrite(canvas_framebuffer, fboxMemoryWrite, &w);
+
+  httpConnectionInit(&conn, "127.0.0.1", serverPort, socketWrite, socketRead, socketConnect, socketClose, &clientFd, socketClosed);
+  benchUploadCase("raw framebuffer (old path)", uploadRaw, false);
+  benchUploadCase("fbox chunked from RAM", uploadCanvasChunked, true);
+  benchUploadCase("fbox from saved file", uploadSavedFile, true);
+  httpConnectionClose(&conn);
+
+  benchUploadBurst("connection per upload (old)", false, 0, false);
+  benchUploadBurst("kept-alive connection", true, 0, false);
+  benchUploadBurst("server closes every 2nd, says so", true, 2, false);
+  benchUploadBurst("server drops every 2nd silently", true, 2, true);
+  benchUploadStall("server stalls past the read timeout");
+
+  printf("\n-- inbox download (loopback stand-in server) --\n");
+  httpConnectionInit(&conn, "127.0.0.1", serverPort, socketWrite, socketRead, socketConnect, socketClose, &clientFd, socketClosed);
+  benchInboxCase("whole sketch", 0);
+  benchInboxCase("cut off halfway, resumed", savedFboxLength / 2);
+  httpConnectionClose(&conn);
+
+  free(savedFbox);
+  stopServer();
+}
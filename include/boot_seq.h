@@ -0,0 +1,66 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Boot orchestrator. Start-up is a table of stages, each naming the stages it has to wait for and,
+// if it touches something only one core may use (the display), the lane it must run on. Every
+// lane, one per core, calls bootLane: it keeps taking the first stage whose dependencies are done
+// until none are left, so independent stages overlap and nothing waits longer than it has to.
+// Each stage's start and end are recorded for the boot trace. The clock and the wait between
+// polls are callbacks, which keeps this free of RTOS dependencies.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define BOOT_MAX_STAGES 32
+#define BOOT_LANES 2
+/** BootStage::lane for a stage either lane may run. */
+#define BOOT_ANY_LANE -1
+/** Dependency mask bit for the stage at index i. */
+#define BOOT_AFTER(i) (1UL << (i))
+
+typedef enum
+{
+  BOOT_STAGE_WAITING,
+  BOOT_STAGE_RUNNING,
+  BOOT_STAGE_DONE
+} boot_stage_state_id_t;
+
+struct BootStage
+{
+  const char *name;
+  /** @return False on failure. Stages after it still run, and can check ok. */
+  bool (*run)();
+  /** BOOT_AFTER bits of the stages to wait for, all declared earlier in the table. */
+  uint32_t after;
+  /** Lane the stage must run on, BOOT_ANY_LANE for whichever gets to it first. */
+  int8_t lane;
+
+  // Filled in as it runs.
+  std::atomic<uint8_t> state{BOOT_STAGE_WAITING};
+  uint8_t ranOn;
+  bool ok;
+  /** Clock readings, in the clock's own µs. */
+  uint32_t startUs;
+  uint32_t endUs;
+};
+
+/** Clock for the trace, µs. */
+typedef uint32_t (*boot_clock_fn_t)();
+
+struct BootSequence
+{
+  BootStage *stages;
+  uint8_t count;
+  boot_clock_fn_t clock;
+  /** Called by a lane with nothing it can run yet. */
+  void (*idle)();
+  uint32_t startUs;
+  /** Bit i set once stage i is done. */
+  std::atomic<uint32_t> finished{0};
+};
+
+bool bootInit(BootSequence *boot, BootStage *stages, uint8_t count, boot_clock_fn_t clock, void (*idle)());
+void bootLane(BootSequence *boot, uint8_t lane);
+uint32_t bootEndUs(const BootSequence *boot);
+size_t bootFormatTrace(const BootSequence *boot, char *out, size_t size);
@@ -0,0 +1,136 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Canvas framebuffer kernels. Kept free of Arduino dependencies so they can be built
+// for the native environment against HeadlessPanel and measured off-device.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <LGFX_ESP32_ST7796S_XPT2046.hpp>
+typedef LGFX CanvasPanel;
+#else
+#include "headless_panel.h"
+typedef HeadlessPanel CanvasPanel;
+#endif
+
+#define TFT_HOR_RES 480
+#define TFT_VER_RES 320
+
+/** Size of the packed 4bpp canvas in bytes, two pixels per byte. */
+#define CANVAS_FRAMEBUFFER_SIZE ((TFT_HOR_RES * TFT_VER_RES) / 2)
+
+/** The display, defined by whoever owns the hardware (main.cpp on device, the bench on native). */
+extern CanvasPanel tft;
+
+/* Stores our image drawing buffer. About ~76.8kb! */
+extern uint8_t *canvas_framebuffer;
+
+/** Largest brush radius the rasterizer accepts, matches the limit in changeBrushSize. */
+#define CANVAS_MAX_BRUSH_RADIUS 100
+
+/** Pending dirty rectangles before they collapse into a single bounding box. */
+#define CANVAS_DIRTY_RECT_MAX 8
+/** Minimum time between batched panel flushes, ~60 Hz. */
+#define CANVAS_FLUSH_INTERVAL_MS 16
+
+/** Pending seed segments the bucket fill may hold, 8 bytes each and only allocated while filling. */
+#define CANVAS_FILL_STACK_SIZE 1024
+
+/** Side of the square tiles the undo journal records, in pixels. Must divide both screen dimensions. */
+#define CANVAS_UNDO_TILE_SIZE 16
+/** Bytes in one packed tile. */
+#define CANVAS_UNDO_TILE_BYTES (CANVAS_UNDO_TILE_SIZE * CANVAS_UNDO_TILE_SIZE / 2)
+/** RAM ring holding compressed undo records. Older records spill to SD once it fills. */
+#define CANVAS_UNDO_ARENA_SIZE 16384
+/** Tiles one undo record can stage before it is committed. A stroke covering more becomes several joined records. */
+#define CANVAS_UNDO_STAGE_TILES 64
+/** Records the RAM ring can index, regardless of their size. */
+#define CANVAS_UNDO_MAX_RECORDS 128
+/** Spill file for undo records evicted from RAM. */
+#define CANVAS_UNDO_SPILL_PATH "/friendbox/undo.jnl"
+/** Spilled history past this size is discarded rather than filling the card. */
+#define CANVAS_UNDO_SPILL_MAX_BYTES (1024UL * 1024UL)
+
+/** Worst case PackBits output for n input bytes. */
+#define CANVAS_PACKBITS_MAX_SIZE(n) ((n) + ((n) + 127) / 128)
+
+/** Number of ordered dither densities above zero; level N paints N of every 64 pixels of the 8x8 Bayer tile. */
+#define CANVAS_DITHER_LEVELS 64
+/** Starting dither density. 16 paints even pixels on even rows, the brush's original look. */
+#define CANVAS_DITHER_DEFAULT_LEVEL 16
+
+/** Rows converted per DMA transfer in drawFramebuffer. Each ring buffer is CANVAS_DMA_ROWS * 480 * 2 bytes. */
+#define CANVAS_DMA_ROWS 4
+/** Depth of the drawFramebuffer output ring. 2 lets the CPU convert one chunk while the previous one is sent. */
+#define CANVAS_DMA_BUFFER_COUNT 2
+/** Panel SPI write clock, keep in sync with freq_write in LGFX_ESP32_ST7796S_XPT2046.hpp. */
+#define CANVAS_SPI_WRITE_HZ 80000000
+
+/** Running totals for drawFramebuffer, used to compare achieved throughput against the bus clock. */
+struct CanvasFlushStats
+{
+  uint32_t calls;
+  uint64_t pixels;
+  uint32_t micros;
+};
+
+struct CanvasRect
+{
+  int16_t x, y, w, h;
+};
+
+/** Takes or gives a bus the canvas shares with someone else. */
+typedef void (*canvas_bus_fn_t)();
+/** Receives each finished row of a downscale, one palette index per pixel. */
+typedef void (*canvas_scaled_row_fn_t)(void *ctx, int y, const uint8_t *indices);
+struct CanvasScaler;
+struct CanvasPreview;
+
+/** RGB565 colors for each of the 16 framebuffer indices. */
+extern uint16_t draw_color_palette[16];
+
+uint32_t canvasColorDistance(uint16_t a, uint16_t b);
+
+void drawPixelToFB(int x, int y, uint8_t colorIndex);
+void fillSpanToFB(int x0, int x1, int y, uint8_t colorIndex);
+void ditherSpanToFB(int x0, int x1, int y, uint8_t colorIndex);
+void canvasSetDitherLevel(int level);
+int canvasGetDitherLevel();
+void drawBrushToFB(int x, int y, int radius, uint8_t colorIndex);
+void drawDitherToFB(int x, int y, int radius, uint8_t colorIndex);
+void drawStrokeToFB(int x0, int y0, int x1, int y1, int radius, uint8_t colorIndex);
+void drawDitherStrokeToFB(int x0, int y0, int x1, int y1, int radius, uint8_t colorIndex);
+void canvasRebuildPaletteLUT();
+void canvasSetBatchedFlush(bool enabled);
+bool canvasIsBatchedFlush();
+void canvasMarkDirty(int x, int y, int w, int h);
+bool canvasFlushDirty(uint32_t nowMs, bool force = false);
+bool drawFillToFB(int x, int y, uint8_t colorIndex);
+void drawClearScreen(uint8_t colorIndex);
+void drawTest4();
+void drawFramebuffer(int x = 0, int y = 0, int w = TFT_HOR_RES, int h = TFT_VER_RES);
+void drawPackedRows(const uint8_t *rows, int y, int h);
+size_t canvasPackBitsEncode(const uint8_t *src, size_t len, uint8_t *dst);
+size_t canvasPackBitsDecode(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstLen);
+CanvasScaler *canvasScalerCreate(int w, int h, canvas_scaled_row_fn_t rowFn, void *ctx);
+void canvasScalerRow(void *scaler, int srcY, const uint8_t *row);
+void canvasScalerFree(CanvasScaler *scaler);
+CanvasPreview *canvasPreviewBegin(int x, int y, int w, int h);
+void canvasPreviewRow(void *preview, int srcY, const uint8_t *row);
+void canvasPreviewEnd(CanvasPreview *preview);
+bool canvasPreviewFramebuffer(int x, int y, int w, int h);
+bool canvasJournalInit();
+void canvasJournalSetBusLock(canvas_bus_fn_t lock, canvas_bus_fn_t unlock);
+void canvasJournalReset();
+void canvasJournalBeginStroke();
+void canvasJournalEndStroke();
+void canvasJournalCaptureSpan(int x0, int x1, int y);
+bool canvasUndo();
+bool canvasRedo();
+bool canvasCanUndo();
+bool canvasCanRedo();
+CanvasFlushStats canvasGetFlushStats();
+void canvasResetFlushStats();
+float canvasFlushBusUtilization();
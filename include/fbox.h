@@ -0,0 +1,90 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// FriendBox sketch container (.fbox). Version 2 puts a header with the dimensions, palette and a
+// CRC in front of PackBits compressed pixels, optionally row delta filtered. Files from before v2
+// are headerless 76,800 byte framebuffer dumps and still load. Both directions stream through
+// small stack buffers, so nothing beyond the framebuffer itself is ever held in RAM.
+//
+// v2 header, little endian:
+//   0  "FBOX"            4  version (2)       5  flags
+//   6  width:2           8  height:2          10 bits per pixel (4)   11 reserved
+//   12 palette 16 x RGB565                    44 payload offset:4
+//   48 payload size:4    52 CRC32 of the decoded pixels:4
+// Readers skip anything between the header and the payload offset. With FBOX_FLAG_THUMBNAIL a
+// 120x80 4bpp thumbnail sits there as [length:2][PackBits], so previews read at most 4.8 KB
+// instead of decoding the whole sketch.
+//
+// Sketches without a thumbnail get a sidecar "<file>.thm" built the first time they are previewed:
+//   0  "FBTH"            4  size of the sketch it was made from:4      8  thumbnail pixels
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FBOX_VERSION 2
+#define FBOX_HEADER_SIZE 56
+/** Payload is PackBits. Without it the payload is the raw packed framebuffer. */
+#define FBOX_FLAG_PACKBITS 0x01
+/** Each row is stored XORed with the row above, so anything that repeats vertically packs to zero runs. */
+#define FBOX_FLAG_ROW_DELTA 0x02
+/** A PackBits thumbnail in the file's palette, preceded by its length, starts right after the header. */
+#define FBOX_FLAG_THUMBNAIL 0x04
+/** Framebuffer rows compressed per chunk. Each chunk is one write to the sink. */
+#define FBOX_ENCODE_ROWS 4
+/** Bytes pulled from the source per read while decoding. */
+#define FBOX_READ_CHUNK 512
+
+/** Thumbnails are the canvas shrunk by this factor in both directions, packed 4bpp like the framebuffer. */
+#define FBOX_THUMB_SCALE 4
+#define FBOX_THUMB_WIDTH 120
+#define FBOX_THUMB_HEIGHT 80
+#define FBOX_THUMB_BYTES (FBOX_THUMB_WIDTH * FBOX_THUMB_HEIGHT / 2)
+#define FBOX_THUMB_FILE_HEADER_SIZE 8
+#define FBOX_THUMB_FILE_SUFFIX ".thm"
+
+typedef enum
+{
+  FBOX_OK,
+  FBOX_ERR_IO,
+  FBOX_ERR_FORMAT,
+  FBOX_ERR_CRC,
+  /** Valid sketch, it just carries no thumbnail. Use fboxDecodeThumbnail instead. */
+  FBOX_ERR_NO_THUMBNAIL
+} fbox_result_id_t;
+
+/** Byte sink. @return Number of bytes accepted, anything short is treated as an I/O error. */
+typedef size_t (*fbox_write_fn_t)(void *ctx, const uint8_t *data, size_t len);
+/** Byte source. @return Number of bytes read, 0 at the end of input. */
+typedef size_t (*fbox_read_fn_t)(void *ctx, uint8_t *data, size_t len);
+/** Receives each decoded row of packed 4bpp pixels, top to bottom. */
+typedef void (*fbox_row_fn_t)(void *ctx, int y, const uint8_t *row);
+
+/** Sink that appends into a caller owned buffer. */
+struct FboxMemoryWriter
+{
+  uint8_t *data;
+  size_t capacity;
+  size_t length;
+};
+
+/** Source that reads from a caller owned buffer. */
+struct FboxMemoryReader
+{
+  const uint8_t *data;
+  size_t length;
+  size_t position;
+};
+
+uint32_t fboxCrc32(uint32_t crc, const uint8_t *data, size_t len);
+size_t fboxEncodedSize(const uint8_t *framebuffer, uint32_t *pixelCrc = nullptr);
+fbox_result_id_t fboxWrite(const uint8_t *framebuffer, fbox_write_fn_t write, void *ctx);
+uint32_t fboxFileSize(const uint8_t *header, size_t got);
+fbox_result_id_t fboxRead(fbox_read_fn_t read, void *ctx, uint32_t fileSize, fbox_row_fn_t row, void *rowCtx);
+fbox_result_id_t fboxReadToFramebuffer(fbox_read_fn_t read, void *ctx, uint32_t fileSize);
+void fboxMakeThumbnail(const uint8_t *framebuffer, uint8_t *thumb);
+fbox_result_id_t fboxReadThumbnail(fbox_read_fn_t read, void *ctx, uint32_t fileSize, uint8_t *thumb);
+fbox_result_id_t fboxDecodeThumbnail(fbox_read_fn_t read, void *ctx, uint32_t fileSize, uint8_t *thumb);
+fbox_result_id_t fboxWriteThumbnailFile(const uint8_t *thumb, uint32_t sketchSize, fbox_write_fn_t write, void *ctx);
+fbox_result_id_t fboxReadThumbnailFile(fbox_read_fn_t read, void *ctx, uint32_t sketchSize, uint8_t *thumb);
+size_t fboxMemoryWrite(void *ctx, const uint8_t *data, size_t len);
+size_t fboxMemoryRead(void *ctx, uint8_t *data, size_t len);
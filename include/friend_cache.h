@@ -0,0 +1,112 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Friend list cache. The send screen pages through this instead of asking the server, which is
+// only contacted when the list is older than its TTL or the user presses Refresh. Fetches are
+// conditional on the server's ETag, so an unchanged list costs a 304 and no parsing. The list is
+// persisted so the address book shows up straight after boot, before Wi-Fi is even connected.
+// Storage is reached through streaming callbacks, which keeps this free of SD dependencies.
+//
+// Cache file, little endian:
+//   0  "FBFC"   4  version (1)   5  ETag length   6  friend count:2   8  ETag
+//   then per friend: name length, name (no terminator)
+//
+// Names live in a FriendTable: one heap block holding the NUL terminated names from the front and
+// a uint16 offset per name from the back, capped at a fixed size. The server's JSON array is
+// scanned into it a chunk at a time, so neither the response body nor a parsed document is ever
+// held in memory, however long the list is.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRIEND_CACHE_PATH "/friendbox/friends.cache"
+#define FRIEND_CACHE_VERSION 1
+#define FRIEND_CACHE_HEADER_SIZE 8
+/** Default time a fetched list is trusted before a background refresh, see FriendCache::ttlMs. */
+#define FRIEND_CACHE_TTL_MS (10 * 60 * 1000UL)
+/** Longest ETag kept, including the terminator. Longer ones are dropped, so fetches go unconditional. */
+#define FRIEND_CACHE_ETAG_MAX 64
+/** Longest friend name stored. */
+#define FRIEND_CACHE_NAME_MAX 255
+#define FRIEND_CACHE_MAX_FRIENDS 65535
+/** Default ceiling for a FriendTable's block. Friends past it are dropped and the table marked truncated. */
+#define FRIEND_TABLE_MAX_BYTES (24 * 1024)
+/** First allocation of a table, doubled as it fills. */
+#define FRIEND_TABLE_INITIAL_BYTES 512
+
+/** Byte sink. @return Number of bytes accepted, anything short is an error. */
+typedef size_t (*friend_cache_write_fn_t)(void *ctx, const uint8_t *data, size_t len);
+/** Byte source. @return Number of bytes read, 0 at the end of input. */
+typedef size_t (*friend_cache_read_fn_t)(void *ctx, uint8_t *data, size_t len);
+
+/** Compact list of friend names. Offsets are 16 bit, so a table never exceeds 64 KB. */
+struct FriendTable
+{
+  /** Names from the front, their offsets from the back. Null until the first name is added. */
+  uint8_t *block;
+  uint32_t capacity;
+  /** Bytes of names at the front of block. */
+  uint32_t used;
+  uint32_t count;
+  uint32_t maxBytes;
+  /** Set when a name did not fit under maxBytes. */
+  bool truncated;
+};
+
+typedef enum
+{
+  FRIEND_PARSE_MORE,
+  FRIEND_PARSE_DONE,
+  /** The body is not a JSON array. */
+  FRIEND_PARSE_ERROR
+} friend_parse_result_id_t;
+
+/**
+ * Incremental scanner for a JSON array of strings. It keeps only the name being read, so memory
+ * does not depend on the size of the payload. Anything in the array that is not a string (numbers,
+ * nested objects) is skipped. It tolerates malformed input rather than validating it.
+ */
+struct FriendTableParser
+{
+  FriendTable *table;
+  friend_parse_result_id_t result;
+  uint8_t state;
+  /** Array and object nesting, 1 inside the top-level array. */
+  uint16_t depth;
+  /** Strings at depth 1 are names, anything deeper is skipped. */
+  bool capture;
+  uint8_t hexDigits;
+  uint16_t codepoint;
+  uint16_t nameLength;
+  char name[FRIEND_CACHE_NAME_MAX];
+};
+
+struct FriendCache
+{
+  FriendTable friends;
+  /** ETag of the response friends came from, empty if unknown. */
+  char etag[FRIEND_CACHE_ETAG_MAX];
+  /** millis() of the last fetch that confirmed friends, valid only if fresh is set. */
+  uint32_t fetchedMs;
+  /** Set once the server confirmed the list this boot. A list loaded from storage is not fresh. */
+  bool fresh;
+  uint32_t ttlMs;
+  /** Bumped whenever friends change, so views can tell whether to redraw. */
+  uint32_t version;
+};
+
+void friendTableInit(FriendTable *table, uint32_t maxBytes = FRIEND_TABLE_MAX_BYTES);
+void friendTableFree(FriendTable *table);
+bool friendTableAdd(FriendTable *table, const char *name, size_t len);
+const char *friendTableName(const FriendTable *table, uint32_t i);
+bool friendTableEqual(const FriendTable *a, const FriendTable *b);
+void friendTableSwap(FriendTable *a, FriendTable *b);
+void friendTableParseBegin(FriendTableParser *parser, FriendTable *table);
+friend_parse_result_id_t friendTableParse(FriendTableParser *parser, const uint8_t *data, size_t len);
+
+void friendCacheInit(FriendCache *cache, uint32_t ttlMs = FRIEND_CACHE_TTL_MS);
+bool friendCacheNeedsRefresh(const FriendCache *cache, uint32_t nowMs);
+void friendCacheStore(FriendCache *cache, FriendTable *friends, const char *etag, uint32_t nowMs);
+void friendCacheConfirm(FriendCache *cache, uint32_t nowMs);
+bool friendCacheSave(const FriendCache *cache, friend_cache_write_fn_t write, void *ctx);
+bool friendCacheLoad(FriendCache *cache, friend_cache_read_fn_t read, void *ctx);
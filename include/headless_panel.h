@@ -0,0 +1,159 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Stand-in for the LGFX panel used by the native environment. Implements the subset of the
+// LovyanGFX drawing API the canvas kernels rely on, keeps an RGB565 shadow of the screen so
+// results can be checked, and counts bus transactions and pixels so benchmarks can report
+// how much SPI traffic a kernel would have generated on the real ST7796.
+
+#include <stdint.h>
+#include <string.h>
+
+class HeadlessPanel
+{
+public:
+  static const int WIDTH = 480;
+  static const int HEIGHT = 320;
+
+  /** Number of chip-select cycles (one per outermost startWrite or standalone primitive). */
+  uint32_t transactions = 0;
+  /** Number of address windows set, i.e. separate draw commands sent to the panel. */
+  uint32_t windows = 0;
+  /** Number of pixels pushed over the bus. */
+  uint64_t pixels = 0;
+  /** Set false to skip updating the shadow, so benchmarks time the kernel rather than the stand-in. */
+  bool keepShadow = true;
+  /** Screen contents in native-endian RGB565. */
+  uint16_t shadow[WIDTH * HEIGHT];
+
+  HeadlessPanel() { resetStats(); memset(shadow, 0, sizeof(shadow)); }
+
+  void resetStats()
+  {
+    transactions = 0;
+    windows = 0;
+    pixels = 0;
+  }
+
+  int32_t width() const { return WIDTH; }
+  int32_t height() const { return HEIGHT; }
+
+  void startWrite()
+  {
+    if (_writeDepth++ == 0)
+      transactions++;
+  }
+
+  void endWrite()
+  {
+    if (_writeDepth > 0)
+      _writeDepth--;
+  }
+
+  void setAddrWindow(int32_t x, int32_t y, int32_t w, int32_t h)
+  {
+    windows++;
+    _winX = x;
+    _winY = y;
+    _winW = w;
+    _winH = h;
+    _curX = 0;
+    _curY = 0;
+  }
+
+  /** @param swap True when data is native-endian and must be byte swapped for the panel. */
+  void writePixelsDMA(const uint16_t *data, uint32_t len, bool swap = true)
+  {
+    pixels += len;
+    if (!keepShadow)
+      return;
+    for (uint32_t i = 0; i < len; i++)
+    {
+      uint16_t c = swap ? data[i] : (uint16_t)((data[i] << 8) | (data[i] >> 8));
+      windowPut(c);
+    }
+  }
+
+  /** Transfers complete synchronously here, so there is never anything to wait for. */
+  void waitDMA() {}
+  bool dmaBusy() const { return false; }
+
+  void writePixels(const uint16_t *data, uint32_t len, bool swap = true) { writePixelsDMA(data, len, swap); }
+
+  void drawPixel(int32_t x, int32_t y, uint16_t color)
+  {
+    startWrite();
+    windows++;
+    put(x, y, color);
+    pixels++;
+    endWrite();
+  }
+
+  void writeFastHLine(int32_t x, int32_t y, int32_t w, uint16_t color)
+  {
+    fillRect(x, y, w, 1, color);
+  }
+
+  void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color)
+  {
+    startWrite();
+    windows++;
+    for (int32_t py = y; keepShadow && py < y + h; py++)
+      for (int32_t px = x; px < x + w; px++)
+        put(px, py, color);
+    if (w > 0 && h > 0)
+      pixels += (uint64_t)w * h;
+    endWrite();
+  }
+
+  void fillScreen(uint16_t color) { fillRect(0, 0, WIDTH, HEIGHT, color); }
+
+  void drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color)
+  {
+    startWrite();
+    fillRect(x, y, w, 1, color);
+    fillRect(x, y + h - 1, w, 1, color);
+    fillRect(x, y, 1, h, color);
+    fillRect(x + w - 1, y, 1, h, color);
+    endWrite();
+  }
+
+  /** @param data Native-endian RGB565 block of w*h pixels. */
+  void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data)
+  {
+    startWrite();
+    windows++;
+    for (int32_t py = 0; keepShadow && py < h; py++)
+      for (int32_t px = 0; px < w; px++)
+        put(x + px, y + py, data[py * w + px]);
+    pixels += (uint64_t)w * h;
+    endWrite();
+  }
+
+  uint16_t readShadow(int32_t x, int32_t y) const { return shadow[y * WIDTH + x]; }
+
+private:
+  int _writeDepth = 0;
+  int32_t _winX = 0, _winY = 0, _winW = 0, _winH = 0;
+  int32_t _curX = 0, _curY = 0;
+
+  void put(int32_t x, int32_t y, uint16_t color)
+  {
+    if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT)
+      return;
+    shadow[y * WIDTH + x] = color;
+  }
+
+  void windowPut(uint16_t color)
+  {
+    if (_winW <= 0 || _winH <= 0)
+      return;
+    put(_winX + _curX, _winY + _curY, color);
+    if (++_curX == _winW)
+    {
+      _curX = 0;
+      if (++_curY == _winH)
+        _curY = 0;
+    }
+  }
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Minimal HTTP/1.1 client for talking to the FriendBox server. Bodies of unknown size go out with
+// chunked transfer encoding, coalesced into chunks that fill a TCP segment, so a sketch can be
+// compressed straight onto the socket without ever holding the encoded copy. Requests share one
+// kept-alive connection, reopened whenever the server has closed it. The socket is reached through
+// callbacks, which keeps this free of network dependencies and lets the native build run it
+// against a local server.
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Body bytes per chunk. With its size line and CRLF a full chunk still fits one 1460 byte segment. */
+#define HTTP_CHUNK_SIZE 1448
+/** Room in front of each chunk for its hex size line. */
+#define HTTP_CHUNK_PREFIX 6
+/** Longest request or response head line handled. */
+#define HTTP_LINE_MAX 256
+/** Longest ETag kept from a response, terminator included. Longer ones are ignored. */
+#define HTTP_ETAG_MAX 64
+
+/** Byte sink. @return Number of bytes accepted, anything short is an error. */
+typedef size_t (*http_write_fn_t)(void *ctx, const uint8_t *data, size_t len);
+/** Byte source. @return Number of bytes read, 0 on end of stream or timeout. */
+typedef size_t (*http_read_fn_t)(void *ctx, uint8_t *data, size_t len);
+/** Open a fresh connection to host. */
+typedef bool (*http_connect_fn_t)(void *ctx, const char *host, uint16_t port);
+typedef void (*http_close_fn_t)(void *ctx);
+/** True if the server has closed its end, as opposed to being slow to answer. */
+typedef bool (*http_closed_fn_t)(void *ctx);
+/**
+ * Writes a request body through write and writeCtx. Runs again from the start if the request has
+ * to be resent, so it must not consume its source.
+ */
+typedef bool (*http_body_fn_t)(void *bodyCtx, http_write_fn_t write, void *writeCtx);
+
+/** Chunked body in progress. Pass it as ctx to httpChunkedWrite, which matches fbox_write_fn_t. */
+struct HttpChunkedWriter
+{
+  http_write_fn_t write;
+  void *ctx;
+  size_t used;
+  /** Everything handed to write so far, framing included. */
+  size_t bytesOnWire;
+  bool ok;
+  uint8_t buffer[HTTP_CHUNK_PREFIX + HTTP_CHUNK_SIZE + 2];
+};
+
+struct HttpResponse
+{
+  int status;
+  /** -1 if the response did not give one. */
+  int32_t contentLength;
+  /** From Content-Range on a 206: where the body starts in the whole resource, -1 otherwise. */
+  int32_t rangeStart;
+  /** From Content-Range: size of the whole resource, -1 if not given. */
+  int32_t rangeTotal;
+  bool chunked;
+  /** False once the server has said it will close the connection after this response. */
+  bool keepAlive;
+  /** Empty if the response had none. */
+  char etag[HTTP_ETAG_MAX];
+};
+
+/** Pulls a response body after its head, chunked encoding undone. Pass it as ctx to httpBodyRead. */
+struct HttpBodyReader
+{
+  http_read_fn_t read;
+  void *ctx;
+  HttpResponse *response;
+  /** Bytes left in the body, or in the current chunk when chunked. */
+  uint32_t left;
+  bool started;
+  /** The whole body has been read. */
+  bool done;
+  /** The body was cut off or its framing was bad. */
+  bool failed;
+};
+
+/** A kept-alive connection to one server. Opened on first use, reopened when the server has closed it. */
+struct HttpConnection
+{
+  const char *host;
+  uint16_t port;
+  http_write_fn_t write;
+  http_read_fn_t read;
+  http_connect_fn_t connect;
+  http_close_fn_t close;
+  /** May be null, in which case nothing is ever resent. */
+  http_closed_fn_t closed;
+  void *ctx;
+  bool open;
+  /** Connections opened, each one a TCP handshake. */
+  uint32_t connects;
+  /** Requests that got a response. */
+  uint32_t requests;
+  /** Requests sent again because a kept-alive connection had gone away under them. */
+  uint32_t retries;
+  /** Head and body bytes of the last request, framing included. */
+  size_t bytesOnWire;
+};
+
+size_t httpWriteRequestHead(http_write_fn_t write, void *ctx, const char *method, const char *host, uint16_t port, const char *path, const char *contentType, int32_t contentLength, const char *extraHeaders = nullptr);
+void httpChunkedBegin(HttpChunkedWriter *writer, http_write_fn_t write, void *ctx);
+size_t httpChunkedWrite(void *writer, const uint8_t *data, size_t len);
+bool httpChunkedEnd(HttpChunkedWriter *writer);
+int httpReadResponseHead(http_read_fn_t read, void *ctx, HttpResponse *response);
+void httpBodyBegin(HttpBodyReader *body, http_read_fn_t read, void *ctx, HttpResponse *response);
+size_t httpBodyRead(void *body, uint8_t *data, size_t len);
+bool httpReadBody(http_read_fn_t read, void *ctx, HttpResponse *response, http_write_fn_t sink, void *sinkCtx);
+void httpConnectionInit(HttpConnection *conn, const char *host, uint16_t port, http_write_fn_t write, http_read_fn_t read, http_connect_fn_t connect, http_close_fn_t close, void *ctx, http_closed_fn_t closed = nullptr);
+void httpConnectionClose(HttpConnection *conn);
+int httpRequest(HttpConnection *conn, const char *method, const char *path, const char *contentType, int32_t contentLength, const char *extraHeaders, http_body_fn_t body, void *bodyCtx, HttpResponse *response);
+bool httpFinishRequest(HttpConnection *conn, HttpResponse *response, http_write_fn_t sink = nullptr, void *sinkCtx = nullptr);
+bool httpDrainBody(HttpConnection *conn, HttpBodyReader *body);
+bool httpPercentEncode(const char *in, char *out, size_t size);
@@ -0,0 +1,90 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Network work queue. The UI submits requests and keeps running; a worker on the other core takes
+// them one at a time, hands each to a transport and posts progress and completion back through a
+// lock-free mailbox that the UI drains once per loop(). The transport is a single callback, so the
+// native build can drive the whole queue with a fake one.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "spsc_ring.h"
+
+/** Requests waiting for the worker. */
+#define NET_QUEUE_DEPTH 8
+/** Events waiting for the UI. Progress is dropped when this is full, completion never is. */
+#define NET_MAILBOX_DEPTH 16
+/** Progress is reported each time this fraction (1/n) of the total has gone by. */
+#define NET_PROGRESS_STEPS 32
+
+typedef enum
+{
+  NET_REQUEST_GET_FRIENDS,
+  /** Download the next sketch waiting in the inbox, if any. */
+  NET_REQUEST_RECEIVE_INBOX,
+  /** Send the next batch from the SD outbox. Started by the worker itself when one is due. */
+  NET_REQUEST_SEND_OUTBOX
+} net_request_id_t;
+
+typedef enum
+{
+  NET_EVENT_STARTED,
+  NET_EVENT_PROGRESS,
+  NET_EVENT_DONE
+} net_event_id_t;
+
+struct NetRequest
+{
+  net_request_id_t type;
+  /** Assigned by netSubmit, never 0. Requests the worker runs on its own have 0. */
+  uint32_t id;
+  /** malloc'd payload owned by the queue once submitted, freed after the request runs. */
+  uint8_t *body;
+  uint32_t bodyLength;
+};
+
+struct NetEvent
+{
+  net_event_id_t kind;
+  net_request_id_t type;
+  uint32_t requestId;
+  /** Transport result on NET_EVENT_DONE, an HTTP status or negative on failure. */
+  int32_t status;
+  uint32_t done;
+  /** 0 if the size is not known in advance. */
+  uint32_t total;
+};
+
+struct NetWorker;
+
+/** Passed to the transport for reporting progress on the request it is running. */
+struct NetProgress
+{
+  NetWorker *worker;
+  const NetRequest *request;
+  uint32_t lastReported;
+};
+
+/** Runs one request on the worker. @return HTTP status, or negative on failure. */
+typedef int (*net_handler_fn_t)(void *ctx, const NetRequest *request, NetProgress *progress);
+
+struct NetWorker
+{
+  SpscRing<NetRequest, NET_QUEUE_DEPTH> requests;
+  SpscRing<NetEvent, NET_MAILBOX_DEPTH> events;
+  net_handler_fn_t handler;
+  void *ctx;
+  /** Called by the worker while waiting for the UI to make room for a completion event. */
+  void (*idle)();
+  uint32_t nextId;
+  /** Progress events dropped because the mailbox was full. */
+  std::atomic<uint32_t> droppedEvents{0};
+};
+
+void netWorkerInit(NetWorker *worker, net_handler_fn_t handler, void *ctx, void (*idle)() = nullptr);
+uint32_t netSubmit(NetWorker *worker, NetRequest *request);
+bool netWorkerStep(NetWorker *worker);
+int netWorkerRun(NetWorker *worker, NetRequest *request);
+void netReportProgress(NetProgress *progress, uint32_t done, uint32_t total);
+bool netPollEvent(NetWorker *worker, NetEvent *event);
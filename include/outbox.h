@@ -0,0 +1,80 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Durable outbox. A sketch being sent is written to its own file first, then queued with one small
+// append to a log, so nothing is lost if the server is unreachable or the power goes. The network
+// worker drains the queue a batch at a time, each batch being the oldest sketches for one
+// recipient, and backs off exponentially while sends keep failing. The pending queue is rebuilt
+// from the log at boot. Storage is reached through streaming callbacks, which keeps this free of
+// SD dependencies.
+//
+// Log file, append only, records of OUTBOX_RECORD_SIZE bytes:
+//   0  type ('Q' queued, 'D' delivered)   1  checksum of bytes 2..63   2  sequence count (D)
+//   3  reserved   4  queued: sequence:4, then recipient (NUL terminated)
+//                    delivered: up to OUTBOX_DONE_MAX sequences:4
+// Replay stops at the first short or damaged record, which can only be a write cut off by a power
+// loss. The log is rewritten with just the pending records whenever it has grown well past them.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define OUTBOX_LOG_PATH "/friendbox/outbox.log"
+/** Written during compaction, then renamed over the log. */
+#define OUTBOX_LOG_TEMP_PATH "/friendbox/outbox.tmp"
+/** Sketches waiting to go out, one file per sequence number. */
+#define OUTBOX_DIR "/friendbox/outbox"
+#define OUTBOX_RECORD_SIZE 64
+/** Longest recipient name queued, including the terminator. */
+#define OUTBOX_RECIPIENT_MAX (OUTBOX_RECORD_SIZE - 8)
+/** Sequences one delivered record can carry, and so the most sketches in a batch. */
+#define OUTBOX_DONE_MAX ((OUTBOX_RECORD_SIZE - 4) / 4)
+#define OUTBOX_BATCH_MAX 8
+#define OUTBOX_MAX_PENDING 32
+/** Records in the log beyond the pending ones before it is compacted. */
+#define OUTBOX_COMPACT_SLACK 64
+/** Wait after the first failed batch, doubled on each failure after that. */
+#define OUTBOX_RETRY_MIN_MS 5000UL
+#define OUTBOX_RETRY_MAX_MS (10 * 60 * 1000UL)
+
+/** Byte sink. @return Number of bytes accepted, anything short is an error. */
+typedef size_t (*outbox_write_fn_t)(void *ctx, const uint8_t *data, size_t len);
+/** Byte source. @return Number of bytes read, 0 at the end of input. */
+typedef size_t (*outbox_read_fn_t)(void *ctx, uint8_t *data, size_t len);
+
+struct OutboxEntry
+{
+  /** Names the sketch's file in OUTBOX_DIR. Never 0. */
+  uint32_t sequence;
+  char recipient[OUTBOX_RECIPIENT_MAX];
+};
+
+struct Outbox
+{
+  /** Oldest first. */
+  OutboxEntry pending[OUTBOX_MAX_PENDING];
+  uint32_t count;
+  /** Sequence the next queued sketch gets. Write its file before calling outboxAdd. */
+  uint32_t nextSequence;
+  /** Records in the log, pending or not. */
+  uint32_t records;
+  /** Set when replay found a damaged tail, which later appends must not follow. */
+  bool damaged;
+  /** Failed batches in a row. */
+  uint8_t failures;
+  /** millis() before which no batch is handed out, valid while failures is non-zero. */
+  uint32_t retryAtMs;
+  /** Appends to the log. */
+  outbox_write_fn_t append;
+  void *ctx;
+};
+
+void outboxInit(Outbox *outbox, outbox_write_fn_t append, void *ctx);
+bool outboxLoad(Outbox *outbox, outbox_read_fn_t read, void *ctx);
+bool outboxAdd(Outbox *outbox, const char *recipient, uint32_t nowMs);
+uint32_t outboxNextBatch(Outbox *outbox, uint32_t nowMs, OutboxEntry *batch);
+bool outboxDone(Outbox *outbox, const OutboxEntry *batch, uint32_t n);
+void outboxFailed(Outbox *outbox, uint32_t nowMs, uint32_t random);
+void outboxRetryNow(Outbox *outbox, uint32_t nowMs);
+uint32_t outboxWaitMs(const Outbox *outbox, uint32_t nowMs);
+bool outboxNeedsCompact(const Outbox *outbox);
+bool outboxCompact(Outbox *outbox, outbox_write_fn_t write, void *ctx);
@@ -0,0 +1,125 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Persistent index of the sketches in /sketches/saved, so the file browser never has to walk the
+// directory. Records are fixed size, so any entry can be read with one seek. Storage is reached
+// through positional read/write callbacks, which keeps this free of SD dependencies.
+//
+// Index file, little endian:
+//   0  "FBIX"   4  version (2)   5  reserved:3   8  entry count:4   12 directory modified time:4
+//   16 generation:4, bumped on every commit
+//   20 records of SKETCH_INDEX_RECORD_SIZE bytes:
+//      0 name (NUL terminated)   40 size:4   44 modified:4   48 name key:4   52 thumbnail offset:4
+//      56 flags   57 reserved:7
+//
+// Sort order file, rebuilt whenever its generation falls behind the index's:
+//   0  "FBIO"   4  version (1)   5  reserved:3   8  generation:4   12 entry count:4
+//   16 one uint16 record position per entry for each sketch_sort_id_t, in enum order
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SKETCH_INDEX_PATH "/friendbox/sketches.idx"
+#define SKETCH_INDEX_DIR "/sketches/saved"
+#define SKETCH_INDEX_ORDER_PATH "/friendbox/sketches.ord"
+#define SKETCH_INDEX_VERSION 2
+#define SKETCH_INDEX_HEADER_SIZE 20
+#define SKETCH_INDEX_ORDER_VERSION 1
+#define SKETCH_INDEX_ORDER_HEADER_SIZE 16
+/** Positions in the order file are 16 bit. */
+#define SKETCH_INDEX_MAX_ENTRIES 65535
+#define SKETCH_INDEX_RECORD_SIZE 64
+/** Longest file name the index can hold, including the terminator. Longer names are left out. */
+#define SKETCH_INDEX_NAME_MAX 40
+/** Records read per storage call while scanning. */
+#define SKETCH_INDEX_SCAN_RECORDS 8
+/** Largest page a SketchPager serves. It caches two pages: the visible one and the next. */
+#define SKETCH_PAGER_MAX_PAGE 8
+
+/** Entry is a v2 .fbox. Without it the file is a legacy raw framebuffer (or unreadable). */
+#define SKETCH_INDEX_FLAG_V2 0x01
+
+typedef enum
+{
+  /** A to Z, ignoring case. */
+  SKETCH_SORT_NAME,
+  /** Newest first. */
+  SKETCH_SORT_DATE,
+  /** Largest first. */
+  SKETCH_SORT_SIZE,
+  SKETCH_SORT_COUNT
+} sketch_sort_id_t;
+
+/** One sketch as the index records it. */
+struct SketchIndexEntry
+{
+  char name[SKETCH_INDEX_NAME_MAX];
+  uint32_t size;
+  /** Last write time as the filesystem reports it, seconds since the epoch. */
+  uint32_t modified;
+  /** First four characters folded to upper case, big endian, so comparing keys orders by name. */
+  uint32_t nameKey;
+  /** Offset of the embedded thumbnail in the file, 0 if it has none. */
+  uint32_t thumbOffset;
+  uint8_t flags;
+};
+
+/** Positional storage access. @return Bytes transferred, anything short is an error. */
+typedef size_t (*sketch_index_read_fn_t)(void *ctx, uint32_t offset, uint8_t *data, size_t len);
+typedef size_t (*sketch_index_write_fn_t)(void *ctx, uint32_t offset, const uint8_t *data, size_t len);
+
+/** An open index. count and dirModified mirror the header on storage once committed. */
+struct SketchIndex
+{
+  sketch_index_read_fn_t read;
+  sketch_index_write_fn_t write;
+  void *ctx;
+  uint32_t count;
+  uint32_t dirModified;
+  uint32_t generation;
+};
+
+/** Precomputed sort orders for an index, stored in their own file. */
+struct SketchIndexOrder
+{
+  sketch_index_read_fn_t read;
+  sketch_index_write_fn_t write;
+  void *ctx;
+  /** Index generation the orders were built from, 0 if there are none. */
+  uint32_t generation;
+  uint32_t count;
+};
+
+/**
+ * Serves index entries by position in a sort order, one page at a time. Only the page asked for
+ * and the one after it are held in RAM, so paging costs the same however many sketches there are.
+ */
+struct SketchPager
+{
+  SketchIndex *index;
+  SketchIndexOrder *order;
+  sketch_sort_id_t sort;
+  uint32_t pageSize;
+  uint32_t cacheFirst;
+  uint32_t cacheCount;
+  SketchIndexEntry cache[2 * SKETCH_PAGER_MAX_PAGE];
+};
+
+uint32_t sketchIndexNameKey(const char *name);
+bool sketchIndexMakeEntry(SketchIndexEntry *entry, const char *name, uint32_t size, uint32_t modified, const uint8_t *fboxHeader, size_t headerLen);
+bool sketchIndexOpen(SketchIndex *index, uint32_t dirModified);
+bool sketchIndexReset(SketchIndex *index);
+bool sketchIndexCommit(SketchIndex *index, uint32_t dirModified);
+bool sketchIndexGet(SketchIndex *index, uint32_t i, SketchIndexEntry *entry);
+int32_t sketchIndexFind(SketchIndex *index, const char *name);
+bool sketchIndexAppend(SketchIndex *index, const SketchIndexEntry *entry);
+bool sketchIndexUpsert(SketchIndex *index, const SketchIndexEntry *entry);
+bool sketchIndexRemove(SketchIndex *index, const char *name);
+bool sketchIndexOrderOpen(SketchIndexOrder *order, const SketchIndex *index);
+bool sketchIndexOrderBuild(SketchIndexOrder *order, SketchIndex *index);
+bool sketchIndexOrderRead(SketchIndexOrder *order, sketch_sort_id_t sort, uint32_t first, uint32_t n, uint16_t *positions);
+void sketchPagerInit(SketchPager *pager, SketchIndex *index, SketchIndexOrder *order, uint32_t pageSize);
+void sketchPagerSetSort(SketchPager *pager, sketch_sort_id_t sort);
+void sketchPagerInvalidate(SketchPager *pager);
+uint32_t sketchPagerCount(const SketchPager *pager);
+bool sketchPagerGet(SketchPager *pager, uint32_t position, SketchIndexEntry *entry);
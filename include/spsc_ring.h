@@ -0,0 +1,48 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Fixed size single-producer single-consumer ring. One task pushes, another pops, no locks: each
+// side only ever writes its own index, and the acquire/release pair on it publishes the item.
+
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, uint32_t N>
+struct SpscRing
+{
+  static_assert(N && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+  T items[N];
+  /** Next slot to fill, written only by the producer. */
+  std::atomic<uint32_t> head{0};
+  /** Next slot to empty, written only by the consumer. */
+  std::atomic<uint32_t> tail{0};
+
+  /** Producer side. @return False if the ring is full. */
+  bool push(const T &item)
+  {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N)
+      return false;
+    items[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Consumer side. @return False if the ring is empty. */
+  bool pop(T *item)
+  {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+      return false;
+    *item = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Items waiting. Exact only from the consumer or producer's own point of view. */
+  uint32_t size() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+};
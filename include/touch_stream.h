@@ -0,0 +1,90 @@
+#pragma once
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Touch sample stream. A task reads the touch controller at a fixed rate, runs each reading through
+// touchFilter and pushes the contacts that come out, timestamped, into a lock-free ring; a lift is
+// pushed once, when the pen leaves the screen. The UI drains everything that arrived since its
+// last loop(), so a slow frame delays samples instead of losing them. Nothing here touches the
+// controller, which keeps it free of display dependencies.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "spsc_ring.h"
+
+#define TOUCH_SAMPLE_HZ 500
+/** Samples the ring holds, a little over a quarter of a second at TOUCH_SAMPLE_HZ. */
+#define TOUCH_RING_SIZE 128
+/** Most contacts waited at pen-down for the pressure to stop rising. */
+#define TOUCH_SETTLE_MAX 4
+/** The pressure has levelled off once it rises by less than this between samples, %. */
+#define TOUCH_SETTLE_RISE_PCT 12
+/** The pen is leaving once the pressure falls below this share of the touch's peak, %. */
+#define TOUCH_LIFT_PCT 60
+/** After that, a stroke only starts again before the lift if the pressure comes back above this share, %. */
+#define TOUCH_RELAND_PCT 85
+/** One-Euro low-pass: cutoff at rest, how fast it opens up with speed, and the speed estimate's cutoff. */
+#define TOUCH_FILTER_MIN_CUTOFF_HZ 2.0f
+#define TOUCH_FILTER_BETA 0.05f
+#define TOUCH_FILTER_SPEED_CUTOFF_HZ 10.0f
+
+struct TouchSample
+{
+  /** When it was read, µs. */
+  uint32_t us;
+  uint16_t x;
+  uint16_t y;
+  /** Pressure reported by the controller, 0 for a lift. */
+  uint16_t z;
+};
+
+struct TouchStream
+{
+  SpscRing<TouchSample, TOUCH_RING_SIZE> ring;
+  /** Samples lost to a full ring. Written by the producer only. */
+  std::atomic<uint32_t> dropped{0};
+  /** Producer side: the pen was down at the last sample. */
+  bool down;
+  /** Consumer side: a lift kept back for the next drain, see touchStreamDrain. */
+  TouchSample held;
+  bool holding;
+};
+
+/** One axis of the adaptive low-pass. */
+struct TouchAxis
+{
+  float value;
+  /** Smoothed speed, px/s. */
+  float speed;
+};
+
+/**
+ * Turns raw contacts into points worth drawing. Waits for the pressure to level off at pen-down,
+ * ends the touch as soon as it falls away at pen-up, drops lone outliers with a median of three,
+ * then smooths what is left with a One-Euro low-pass: heavy when the pen is slow, so it holds
+ * still, light when it moves fast, so it keeps up.
+ */
+struct TouchFilter
+{
+  /** Passing contacts on. Cleared by a lift, or by the pressure falling away. */
+  bool down;
+  /** The pressure fell away and an early lift went out; the real one has not come yet. */
+  bool lifted;
+  /** Contacts waited so far for the pressure to level off. */
+  uint8_t settling;
+  uint16_t lastZ;
+  uint16_t peakZ;
+  /** Last three positions, for the median. */
+  uint16_t recentX[3];
+  uint16_t recentY[3];
+  uint8_t recent;
+  uint32_t lastUs;
+  TouchAxis x;
+  TouchAxis y;
+};
+
+void touchStreamInit(TouchStream *stream);
+bool touchStreamSample(TouchStream *stream, uint32_t us, bool touching, uint16_t x, uint16_t y, uint16_t z);
+uint32_t touchStreamDrain(TouchStream *stream, TouchSample *out, uint32_t max);
+void touchFilterInit(TouchFilter *filter);
+bool touchFilter(TouchFilter *filter, const TouchSample *in, TouchSample *out);
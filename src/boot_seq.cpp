@@ -0,0 +1,109 @@
+#include "boot_seq.h"
+#include <stdio.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Boot orchestrator, see boot_seq.h.
+
+/**
+ * Check the table and reset its trace. Dependencies may only point at earlier stages, which rules
+ * out cycles, and so a boot that can never finish.
+ * @return False if the table breaks that rule, names a lane that does not exist or is too long.
+ */
+bool bootInit(BootSequence *boot, BootStage *stages, uint8_t count, boot_clock_fn_t clock, void (*idle)())
+{
+  if (count > BOOT_MAX_STAGES)
+    return false;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if ((stages[i].after >> i) != 0 || stages[i].lane >= BOOT_LANES || stages[i].lane < BOOT_ANY_LANE)
+      return false;
+    stages[i].state.store(BOOT_STAGE_WAITING, std::memory_order_relaxed);
+    stages[i].ranOn = 0;
+    stages[i].ok = false;
+    stages[i].startUs = 0;
+    stages[i].endUs = 0;
+  }
+  boot->stages = stages;
+  boot->count = count;
+  boot->clock = clock;
+  boot->idle = idle;
+  boot->startUs = clock();
+  boot->finished.store(0, std::memory_order_release);
+  return true;
+}
+
+/**
+ * Run stages on this lane until every stage in the table is done. Call once from each lane; the
+ * stages a lane may run are taken in table order as their dependencies complete.
+ */
+void bootLane(BootSequence *boot, uint8_t lane)
+{
+  uint32_t all = boot->count == 32 ? 0xFFFFFFFFUL : BOOT_AFTER(boot->count) - 1;
+  for (;;)
+  {
+    uint32_t finished = boot->finished.load(std::memory_order_acquire);
+    if (finished == all)
+      return;
+    int next = -1;
+    for (uint8_t i = 0; i < boot->count && next < 0; i++)
+    {
+      BootStage *stage = &boot->stages[i];
+      if ((stage->lane != BOOT_ANY_LANE && stage->lane != lane) || (stage->after & ~finished) != 0)
+        continue;
+      uint8_t expected = BOOT_STAGE_WAITING;
+      if (stage->state.compare_exchange_strong(expected, BOOT_STAGE_RUNNING, std::memory_order_acq_rel))
+        next = i;
+    }
+    if (next < 0)
+    {
+      if (boot->idle)
+        boot->idle();
+      continue;
+    }
+    BootStage *stage = &boot->stages[next];
+    stage->ranOn = lane;
+    stage->startUs = boot->clock();
+    stage->ok = stage->run();
+    stage->endUs = boot->clock();
+    stage->state.store(BOOT_STAGE_DONE, std::memory_order_release);
+    boot->finished.fetch_or(BOOT_AFTER(next), std::memory_order_acq_rel);
+  }
+}
+
+/** When the last stage finished. */
+uint32_t bootEndUs(const BootSequence *boot)
+{
+  uint32_t end = boot->startUs;
+  for (uint8_t i = 0; i < boot->count; i++)
+  {
+    if ((int32_t)(boot->stages[i].endUs - end) > 0)
+      end = boot->stages[i].endUs;
+  }
+  return end;
+}
+
+/**
+ * The trace as text, one line per stage in table order, times in ms on the boot clock.
+ * @return Length written, excluding the terminator. Lines that do not fit are left out.
+ */
+size_t bootFormatTrace(const BootSequence *boot, char *out, size_t size)
+{
+  size_t used = 0;
+  int n = snprintf(out, size, "%-14s lane  start_ms  end_ms  took_ms\n", "stage");
+  if (n < 0 || (size_t)n >= size)
+    return 0;
+  used = n;
+  for (uint8_t i = 0; i < boot->count; i++)
+  {
+    const BootStage *stage = &boot->stages[i];
+    n = snprintf(out + used, size - used, "%-14s %4u %9.1f %7.1f %8.1f%s\n", stage->name, stage->ranOn, stage->startUs / 1000.0,
+                 stage->endUs / 1000.0, (uint32_t)(stage->endUs - stage->startUs) / 1000.0, stage->ok ? "" : "  FAILED");
+    if (n < 0 || (size_t)n >= size - used)
+    {
+      out[used] = 0;
+      break;
+    }
+    used += n;
+  }
+  return used;
+}
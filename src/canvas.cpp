@@ -0,0 +1,704 @@
+#include "canvas.h"
+#include <string.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+#include <limits.h>
+#include <math.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+
+uint8_t *canvas_framebuffer;
+
+static inline uint32_t canvasMicros()
+{
+#ifdef ARDUINO
+  return micros();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/** Defines color palette for our 4-bit color frame buffer.
+ *
+ * @param 0 Black
+ * @param 1 Gray
+ * @param 2 White
+ * @param 3 Red
+ * @param 4 Meat
+ * @param 5 Dark Brown
+ * @param 6 Brown
+ * @param 7 Orange
+ * @param 8 Yellow
+ * @param 9 Dark Green
+ * @param 10 Green
+ * @param 11 Slime Green
+ * @param 12 Night Blue
+ * @param 13 Sea Blue
+ * @param 14 Sky Blue
+ * @param 15 Cloud Blue
+ *
+ * Color palette is from https://androidarts.com/palette/16pal.htm
+ */
+uint16_t draw_color_palette[16] = {
+    0x0000, // Black (0)
+    0x9CF3, // Gray (1)
+    0xFFFF, // White (2)
+    0xb926, // Red (3)
+    0xdb71, // Meat (4)
+    0x49e5, // Dark Brown (5)
+    0xa324, // Brown (6)
+    0xec46, // Orange (7)
+    0xf70d, // Yellow (8)
+    0x3249, // Dark Green (9)
+    0x4443, // Green (10)
+    0xa665, // Slime Green (11)
+    0x1926, // Night Blue (12)
+    0x02b0, // Sea Blue (13)
+    0x351d, // Sky Blue (14)
+    0xb6dd  // Cloud Blue (15)
+};
+
+/**
+ * How far apart two RGB565 colors look, squared. Red and blue are scaled up to green's 6 bits, so
+ * each channel counts the same. Palette remapping and preview downscaling both pick colors by it.
+ */
+uint32_t canvasColorDistance(uint16_t a, uint16_t b)
+{
+  int dr = ((a >> 11) & 0x1F) - ((b >> 11) & 0x1F);
+  int dg = ((a >> 5) & 0x3F) - ((b >> 5) & 0x3F);
+  int db = (a & 0x1F) - (b & 0x1F);
+  return 4 * dr * dr + dg * dg + 4 * db * db;
+}
+
+void drawPixelToFB(int x, int y, uint8_t colorIndex)
+{
+  if (x < 0 || x >= tft.width() || y < 0 || y >= tft.height())
+    return;
+  canvasJournalCaptureSpan(x, x, y);
+
+  int index = y * tft.width() + x;
+  int byteIndex = index >> 1;
+
+  if (index & 1)
+    canvas_framebuffer[byteIndex] = (canvas_framebuffer[byteIndex] & 0xF0) | (colorIndex & 0x0F);
+  else
+    canvas_framebuffer[byteIndex] = (canvas_framebuffer[byteIndex] & 0x0F) | ((colorIndex & 0x0F) << 4);
+}
+
+/**
+ * Fill the horizontal run x0..x1 (inclusive) on row y of the framebuffer. Whole bytes are
+ * written in bulk; only an odd nibble at either edge needs a read-modify-write.
+ */
+void fillSpanToFB(int x0, int x1, int y, uint8_t colorIndex)
+{
+  if (y < 0 || y >= TFT_VER_RES)
+    return;
+  if (x0 < 0)
+    x0 = 0;
+  if (x1 >= TFT_HOR_RES)
+    x1 = TFT_HOR_RES - 1;
+  if (x0 > x1)
+    return;
+  canvasJournalCaptureSpan(x0, x1, y);
+
+  colorIndex &= 0x0F;
+  uint8_t *row = canvas_framebuffer + (y * TFT_HOR_RES >> 1);
+
+  // Leading odd pixel lives in the low nibble of its byte.
+  if (x0 & 1)
+  {
+    row[x0 >> 1] = (row[x0 >> 1] & 0xF0) | colorIndex;
+    x0++;
+  }
+  // Trailing even pixel lives in the high nibble of its byte.
+  if (x0 <= x1 && !(x1 & 1))
+  {
+    row[x1 >> 1] = (row[x1 >> 1] & 0x0F) | (colorIndex << 4);
+    x1--;
+  }
+  if (x0 < x1)
+    memset(row + (x0 >> 1), (colorIndex << 4) | colorIndex, (x1 - x0 + 1) >> 1);
+}
+
+/** Classic 8x8 Bayer threshold matrix. A pixel is part of the pattern when its threshold is below the dither level. */
+static const uint8_t bayerMatrix[8][8] = {
+    {0, 32, 8, 40, 2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44, 4, 36, 14, 46, 6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    {3, 35, 11, 43, 1, 33, 9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47, 7, 39, 13, 45, 5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+/** Current dither density, 0 (nothing) to CANVAS_DITHER_LEVELS (solid). */
+static int ditherLevel = CANVAS_DITHER_DEFAULT_LEVEL;
+/** Nibble masks for each Bayer row at ditherLevel. The pattern repeats every 8 pixels, which is 4 framebuffer bytes. */
+static uint8_t ditherRowMasks[8][4];
+static bool ditherMasksValid = false;
+
+static void rebuildDitherMasks()
+{
+  for (int r = 0; r < 8; r++)
+    for (int b = 0; b < 4; b++)
+      ditherRowMasks[r][b] = (bayerMatrix[r][b * 2] < ditherLevel ? 0xF0 : 0x00) |
+                             (bayerMatrix[r][b * 2 + 1] < ditherLevel ? 0x0F : 0x00);
+  ditherMasksValid = true;
+}
+
+/** Set the ordered dither density used by the dither brush. Out of range values are clamped. */
+void canvasSetDitherLevel(int level)
+{
+  if (level < 0)
+    level = 0;
+  if (level > CANVAS_DITHER_LEVELS)
+    level = CANVAS_DITHER_LEVELS;
+  if (level != ditherLevel)
+    ditherMasksValid = false;
+  ditherLevel = level;
+}
+
+int canvasGetDitherLevel()
+{
+  return ditherLevel;
+}
+
+/**
+ * Write colorIndex into the pixels of x0..x1 on row y that are part of the current Bayer pattern.
+ * Each byte is a masked write using the precomputed row masks; only the edge bytes get their mask trimmed.
+ */
+void ditherSpanToFB(int x0, int x1, int y, uint8_t colorIndex)
+{
+  if (y < 0 || y >= TFT_VER_RES)
+    return;
+  if (x0 < 0)
+    x0 = 0;
+  if (x1 >= TFT_HOR_RES)
+    x1 = TFT_HOR_RES - 1;
+  if (x0 > x1)
+    return;
+  canvasJournalCaptureSpan(x0, x1, y);
+  if (!ditherMasksValid)
+    rebuildDitherMasks();
+
+  const uint8_t *masks = ditherRowMasks[y & 7];
+  uint8_t *row = canvas_framebuffer + (y * TFT_HOR_RES >> 1);
+  colorIndex &= 0x0F;
+  uint8_t fill = (colorIndex << 4) | colorIndex;
+  int b0 = x0 >> 1;
+  int b1 = x1 >> 1;
+
+  // First byte loses its high nibble if the span starts on an odd pixel.
+  uint8_t m = masks[b0 & 3];
+  if (x0 & 1)
+    m &= 0x0F;
+  if (b0 == b1)
+  {
+    if (!(x1 & 1))
+      m &= 0xF0;
+    row[b0] = (row[b0] & ~m) | (fill & m);
+    return;
+  }
+  row[b0] = (row[b0] & ~m) | (fill & m);
+
+  for (int b = b0 + 1; b < b1; b++)
+  {
+    m = masks[b & 3];
+    row[b] = (row[b] & ~m) | (fill & m);
+  }
+
+  // Last byte loses its low nibble if the span ends on an even pixel.
+  m = masks[b1 & 3];
+  if (!(x1 & 1))
+    m &= 0xF0;
+  row[b1] = (row[b1] & ~m) | (fill & m);
+}
+
+/** Signature for per-row writers used by the capsule rasterizer. x0..x1 is inclusive and already clipped. */
+typedef void (*canvas_span_fn_t)(int x0, int x1, int y, uint8_t colorIndex);
+
+/** When true, strokes only touch the framebuffer and the panel is updated by canvasFlushDirty. */
+static bool batchedFlush = false;
+
+/** Pending dirty rectangles, waiting for the next frame flush. */
+static CanvasRect dirtyRects[CANVAS_DIRTY_RECT_MAX];
+static int dirtyRectCount = 0;
+static uint32_t lastFlushMs = 0;
+
+/** Inclusive bounds of everything the current rasterizer call has written. */
+static int strokeBoundsX0, strokeBoundsY0, strokeBoundsX1, strokeBoundsY1;
+
+/** Brush span: solid fill in the framebuffer, then one line command to the panel. */
+static void brushSpan(int x0, int x1, int y, uint8_t colorIndex)
+{
+  fillSpanToFB(x0, x1, y, colorIndex);
+  if (!batchedFlush)
+    tft.writeFastHLine(x0, y, x1 - x0 + 1, draw_color_palette[colorIndex & 0x0F]);
+}
+
+/** Send x0..x1 on row y from the framebuffer to the panel. Must be called inside startWrite. */
+static void flushSpanToPanel(int x0, int x1, int y)
+{
+  static uint16_t spanBuffer[TFT_HOR_RES];
+  const uint8_t *row = canvas_framebuffer + (y * TFT_HOR_RES >> 1);
+  for (int px = x0; px <= x1; px++)
+  {
+    uint8_t byte = row[px >> 1];
+    spanBuffer[px - x0] = draw_color_palette[(px & 1) ? (byte & 0x0F) : (byte >> 4)];
+  }
+  tft.setAddrWindow(x0, y, x1 - x0 + 1, 1);
+  tft.writePixels(spanBuffer, x1 - x0 + 1, true);
+}
+
+/** Dither span: Bayer pattern pixels only, then push the span as it now looks in the framebuffer. */
+static void ditherSpan(int x0, int x1, int y, uint8_t colorIndex)
+{
+  if (ditherLevel == 0)
+    return;
+  ditherSpanToFB(x0, x1, y, colorIndex);
+  if (!batchedFlush)
+    flushSpanToPanel(x0, x1, y);
+}
+
+/**
+ * Intersect row y with the region where lo <= a*x + b <= hi, narrowing [xl, xr].
+ * @return false if the intersection is empty.
+ */
+static bool clipLinear(float a, float b, float lo, float hi, float &xl, float &xr)
+{
+  if (a == 0)
+    return b >= lo && b <= hi;
+  float t0 = (lo - b) / a;
+  float t1 = (hi - b) / a;
+  if (t0 > t1)
+  {
+    float t = t0;
+    t0 = t1;
+    t1 = t;
+  }
+  if (t0 > xl)
+    xl = t0;
+  if (t1 < xr)
+    xr = t1;
+  return xl <= xr;
+}
+
+/** Clip x0..x1 to the canvas and pass it on if anything is left. */
+static inline void emitSpan(int x0, int x1, int y, uint8_t colorIndex, canvas_span_fn_t spanFn)
+{
+  if (x0 < 0)
+    x0 = 0;
+  if (x1 >= TFT_HOR_RES)
+    x1 = TFT_HOR_RES - 1;
+  if (x0 > x1)
+    return;
+  spanFn(x0, x1, y, colorIndex);
+
+  if (x0 < strokeBoundsX0)
+    strokeBoundsX0 = x0;
+  if (x1 > strokeBoundsX1)
+    strokeBoundsX1 = x1;
+  if (y < strokeBoundsY0)
+    strokeBoundsY0 = y;
+  if (y > strokeBoundsY1)
+    strokeBoundsY1 = y;
+}
+
+/**
+ * Rasterize the capsule swept by a disc of the given radius moving from (x0,y0) to (x1,y1).
+ * The capsule is convex, so each row is a single span: the union of both end caps and the body.
+ * When continuing a stroke the start cap was already drawn by the previous segment, so it is cut out
+ * of each row, leaving at most two spans. Spans are handed to spanFn clipped to the canvas.
+ */
+static void rasterizeCapsule(int x0, int y0, int x1, int y1, int radius, uint8_t colorIndex, bool includeStartCap, canvas_span_fn_t spanFn)
+{
+  if (radius < 0)
+    return;
+  if (radius > CANVAS_MAX_BRUSH_RADIUS)
+    radius = CANVAS_MAX_BRUSH_RADIUS;
+
+  // Half-width of the disc for every row offset, shared by both caps.
+  static int16_t capHalfWidth[CANVAS_MAX_BRUSH_RADIUS + 1];
+  static int capRadius = -1;
+  if (capRadius != radius)
+  {
+    int r2 = radius * radius;
+    int halfWidth = radius;
+    for (int dy = 0; dy <= radius; dy++)
+    {
+      while (halfWidth * halfWidth + dy * dy > r2)
+        halfWidth--;
+      capHalfWidth[dy] = halfWidth;
+    }
+    capRadius = radius;
+  }
+
+  int dx = x1 - x0;
+  int dy = y1 - y0;
+  float length2 = (float)dx * dx + (float)dy * dy;
+  float reach = radius * sqrtf(length2);
+
+  int top = (y0 < y1 ? y0 : y1) - radius;
+  int bottom = (y0 > y1 ? y0 : y1) + radius;
+  if (top < 0)
+    top = 0;
+  if (bottom >= TFT_VER_RES)
+    bottom = TFT_VER_RES - 1;
+
+  strokeBoundsX0 = strokeBoundsY0 = INT_MAX;
+  strokeBoundsX1 = strokeBoundsY1 = INT_MIN;
+
+  if (!batchedFlush)
+    tft.startWrite();
+  for (int py = top; py <= bottom; py++)
+  {
+    int xl = INT_MAX;
+    int xr = INT_MIN;
+
+    int startCapL = INT_MAX;
+    int startCapR = INT_MIN;
+    int capDy = py - y0 < 0 ? y0 - py : py - y0;
+    if (capDy <= radius)
+    {
+      startCapL = xl = x0 - capHalfWidth[capDy];
+      startCapR = xr = x0 + capHalfWidth[capDy];
+    }
+    capDy = py - y1 < 0 ? y1 - py : py - y1;
+    if (capDy <= radius)
+    {
+      if (x1 - capHalfWidth[capDy] < xl)
+        xl = x1 - capHalfWidth[capDy];
+      if (x1 + capHalfWidth[capDy] > xr)
+        xr = x1 + capHalfWidth[capDy];
+    }
+
+    // Body: points whose projection lands on the segment and whose distance from it is within radius.
+    if (length2 > 0)
+    {
+      float bl = -1e9f, br = 1e9f;
+      float ry = (float)(py - y0);
+      if (clipLinear((float)dx, ry * dy - (float)x0 * dx, 0, length2, bl, br) &&
+          clipLinear((float)dy, -ry * dx - (float)x0 * dy, -reach, reach, bl, br))
+      {
+        int bx0 = (int)ceilf(bl);
+        int bx1 = (int)floorf(br);
+        if (bx0 <= bx1)
+        {
+          if (bx0 < xl)
+            xl = bx0;
+          if (bx1 > xr)
+            xr = bx1;
+        }
+      }
+    }
+
+    if (includeStartCap || startCapL > startCapR)
+    {
+      emitSpan(xl, xr, py, colorIndex, spanFn);
+    }
+    else
+    {
+      // The start cap sits inside the row span, so what remains is whatever lies on either side of it.
+      emitSpan(xl, startCapL - 1, py, colorIndex, spanFn);
+      emitSpan(startCapR + 1, xr, py, colorIndex, spanFn);
+    }
+  }
+  if (!batchedFlush)
+    tft.endWrite();
+  else if (strokeBoundsX0 <= strokeBoundsX1)
+    canvasMarkDirty(strokeBoundsX0, strokeBoundsY0, strokeBoundsX1 - strokeBoundsX0 + 1, strokeBoundsY1 - strokeBoundsY0 + 1);
+}
+
+/** Draw a circle brush at x,y with given radius and color - Updates BOTH framebuffer and screen in real-time!
+ * Rasterized one horizontal span per row, and pushed to the panel inside a single write transaction.
+ */
+void drawBrushToFB(int x, int y, int radius, uint8_t colorIndex)
+{
+  rasterizeCapsule(x, y, x, y, radius, colorIndex, true, brushSpan);
+}
+
+/** Circle brush that only paints the pixels of the current ordered dither pattern, see canvasSetDitherLevel. */
+void drawDitherToFB(int x, int y, int radius, uint8_t colorIndex)
+{
+  rasterizeCapsule(x, y, x, y, radius, colorIndex, true, ditherSpan);
+}
+
+/** Continue a brush stroke from (x0,y0), already drawn, to (x1,y1). Only pixels the previous
+ * segment did not cover are written, so the cost follows stroke area rather than sample count.
+ * Start a stroke with drawBrushToFB.
+ */
+void drawStrokeToFB(int x0, int y0, int x1, int y1, int radius, uint8_t colorIndex)
+{
+  rasterizeCapsule(x0, y0, x1, y1, radius, colorIndex, false, brushSpan);
+}
+
+/** Dithered counterpart of drawStrokeToFB. */
+void drawDitherStrokeToFB(int x0, int y0, int x1, int y1, int radius, uint8_t colorIndex)
+{
+  rasterizeCapsule(x0, y0, x1, y1, radius, colorIndex, false, ditherSpan);
+}
+
+/** Ring of multi-row output buffers. Word aligned so byte pairs can be stored as uint32_t. */
+static uint32_t dmaRing[CANVAS_DMA_BUFFER_COUNT][CANVAS_DMA_ROWS * TFT_HOR_RES / 2];
+static int dmaRingIndex = 0;
+static CanvasFlushStats flushStats = {0, 0, 0};
+
+/** Palette colors with their bytes swapped into the order the panel expects. */
+static uint16_t paletteSwapped[16];
+/** Maps one packed framebuffer byte to its two pixels, pre-swapped. The high nibble (left pixel)
+ * goes in the low half so a little-endian uint32_t store lays them out left to right. */
+static uint32_t paletteByteLUT[256];
+static bool paletteLUTValid = false;
+
+static inline uint16_t swap565(uint16_t color)
+{
+  return (uint16_t)((color << 8) | (color >> 8));
+}
+
+/** Rebuild the byte-to-pixel-pair table from draw_color_palette. Call after changing the palette. */
+void canvasRebuildPaletteLUT()
+{
+  for (int c = 0; c < 16; c++)
+    paletteSwapped[c] = swap565(draw_color_palette[c]);
+  for (int b = 0; b < 256; b++)
+    paletteByteLUT[b] = (uint32_t)paletteSwapped[b >> 4] | ((uint32_t)paletteSwapped[b & 0x0F] << 16);
+  paletteLUTValid = true;
+}
+
+void canvasSetBatchedFlush(bool enabled)
+{
+  batchedFlush = enabled;
+}
+
+bool canvasIsBatchedFlush()
+{
+  return batchedFlush;
+}
+
+/** True if the rectangles overlap or share an edge, so merging them costs no extra pixels along the seam. */
+static bool rectsTouch(const CanvasRect &a, const CanvasRect &b)
+{
+  return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+}
+
+static CanvasRect rectUnion(const CanvasRect &a, const CanvasRect &b)
+{
+  int x0 = a.x < b.x ? a.x : b.x;
+  int y0 = a.y < b.y ? a.y : b.y;
+  int x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+  int y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+  return {(int16_t)x0, (int16_t)y0, (int16_t)(x1 - x0), (int16_t)(y1 - y0)};
+}
+
+/**
+ * Queue a region of the canvas for the next frame flush. Touching rectangles are merged; once
+ * CANVAS_DIRTY_RECT_MAX are pending, everything collapses into one bounding box.
+ */
+void canvasMarkDirty(int x, int y, int w, int h)
+{
+  int x1 = x + w < TFT_HOR_RES ? x + w : TFT_HOR_RES;
+  int y1 = y + h < TFT_VER_RES ? y + h : TFT_VER_RES;
+  if (x < 0)
+    x = 0;
+  if (y < 0)
+    y = 0;
+  if (x >= x1 || y >= y1)
+    return;
+
+  CanvasRect rect = {(int16_t)x, (int16_t)y, (int16_t)(x1 - x), (int16_t)(y1 - y)};
+
+  // Absorb every pending rectangle the new one touches. A merge can make it reach others, so rescan.
+  bool merged = true;
+  while (merged)
+  {
+    merged = false;
+    for (int i = 0; i < dirtyRectCount; i++)
+    {
+      if (rectsTouch(dirtyRects[i], rect))
+      {
+        rect = rectUnion(dirtyRects[i], rect);
+        dirtyRects[i] = dirtyRects[--dirtyRectCount];
+        merged = true;
+        break;
+      }
+    }
+  }
+
+  if (dirtyRectCount == CANVAS_DIRTY_RECT_MAX)
+  {
+    for (int i = 0; i < dirtyRectCount; i++)
+      rect = rectUnion(dirtyRects[i], rect);
+    dirtyRectCount = 0;
+  }
+  dirtyRects[dirtyRectCount++] = rect;
+}
+
+/**
+ * Push pending dirty rectangles to the panel, at most once per CANVAS_FLUSH_INTERVAL_MS.
+ * @param nowMs Current time in milliseconds (millis() on device).
+ * @param force Flush regardless of the frame interval, e.g. before the UI draws over the canvas.
+ * @return True if anything was sent to the panel.
+ */
+bool canvasFlushDirty(uint32_t nowMs, bool force)
+{
+  if (dirtyRectCount == 0)
+    return false;
+  if (!force && nowMs - lastFlushMs < CANVAS_FLUSH_INTERVAL_MS)
+    return false;
+
+  tft.startWrite();
+  for (int i = 0; i < dirtyRectCount; i++)
+    drawFramebuffer(dirtyRects[i].x, dirtyRects[i].y, dirtyRects[i].w, dirtyRects[i].h);
+  tft.endWrite();
+
+  dirtyRectCount = 0;
+  lastFlushMs = nowMs;
+  return true;
+}
+
+void drawTest4()
+{
+  for (int y = 0; y < TFT_VER_RES; y++)
+  {
+    for (int x = 0; x < TFT_HOR_RES; x += 32)
+      fillSpanToFB(x, x + 31, y, (x >> 5) & 0x0F); // 16 vertical stripes
+  }
+}
+
+void drawClearScreen(uint8_t colorIndex)
+{
+  for (int y = 0; y < TFT_VER_RES; y++)
+    fillSpanToFB(0, TFT_HOR_RES - 1, y, colorIndex);
+  // updateDisplayWithFB();
+  drawFramebuffer();
+}
+
+/**
+ * Send a window of packed 4bpp pixels to the panel.
+ * @param pixels Full-width packed rows, the first of which is shown at panel row originY.
+ */
+static void drawPackedWindow(const uint8_t *pixels, int originY, int x, int y, int w, int h)
+{
+  int x1 = x > 0 ? x : 0;
+  int y1 = y > 0 ? y : 0;
+  int x2 = x + w < (int)tft.width() ? x + w : (int)tft.width();
+  int y2 = y + h < (int)tft.height() ? y + h : (int)tft.height();
+
+  int width = x2 - x1;
+  int height = y2 - y1;
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  if (!paletteLUTValid)
+    canvasRebuildPaletteLUT();
+
+  uint32_t startMicros = canvasMicros();
+
+  tft.startWrite();
+  tft.setAddrWindow(x1, y1, width, height);
+
+  // Rows per chunk, so one DMA transfer carries as many whole rows as fit in a ring buffer.
+  int chunkRows = (CANVAS_DMA_ROWS * TFT_HOR_RES) / width;
+  int py = y1;
+  while (py < y2)
+  {
+    int rows = y2 - py < chunkRows ? y2 - py : chunkRows;
+
+    // With a single buffer there is nothing to overlap with, wait for its last transfer.
+    // Otherwise every writePixelsDMA waits for the one before it, so by the time we come back
+    // around the ring the buffer we are about to fill has been sent.
+    if (CANVAS_DMA_BUFFER_COUNT == 1)
+      tft.waitDMA();
+    uint32_t *chunk32 = dmaRing[dmaRingIndex];
+    dmaRingIndex = (dmaRingIndex + 1) % CANVAS_DMA_BUFFER_COUNT;
+    uint16_t *chunk = (uint16_t *)chunk32;
+
+    for (int r = 0; r < rows; r++, py++)
+    {
+      const uint8_t *row = pixels + ((py - originY) * TFT_HOR_RES >> 1);
+      uint16_t *lineBuffer = chunk + r * width;
+      int px = x1;
+      int i = 0;
+
+      // Odd left edge: the first pixel is the low nibble of its byte.
+      if (px & 1)
+      {
+        lineBuffer[i++] = paletteSwapped[row[px >> 1] & 0x0F];
+        px++;
+      }
+
+      const uint8_t *bytes = row + (px >> 1);
+      int pairs = (x2 - px) >> 1;
+      if (!((r * width + i) & 1))
+      {
+        // Word aligned, expand a whole byte (two pixels) per store.
+        uint32_t *out = chunk32 + ((r * width + i) >> 1);
+        for (int b = 0; b < pairs; b++)
+          out[b] = paletteByteLUT[bytes[b]];
+      }
+      else
+      {
+        for (int b = 0; b < pairs; b++)
+        {
+          uint32_t pair = paletteByteLUT[bytes[b]];
+          lineBuffer[i + 2 * b] = (uint16_t)pair;
+          lineBuffer[i + 2 * b + 1] = (uint16_t)(pair >> 16);
+        }
+      }
+      i += pairs * 2;
+      px += pairs * 2;
+
+      // Odd right edge: the last pixel is the high nibble of its byte.
+      if (px < x2)
+        lineBuffer[i++] = paletteSwapped[row[px >> 1] >> 4];
+    }
+
+    // Pixels are already in panel byte order. Returns once queued, so the next chunk converts while this one sends.
+    tft.writePixelsDMA(chunk, width * rows, false);
+  }
+
+  tft.endWrite();
+
+  flushStats.calls++;
+  flushStats.pixels += (uint64_t)width * height;
+  flushStats.micros += canvasMicros() - startMicros;
+}
+
+// Replace specified areas with corresponding contents of the framebuffer. Passing no parameters, this will be the entire screen.
+void drawFramebuffer(int x, int y, int w, int h)
+{
+  // A full redraw supersedes anything waiting for the next frame.
+  if (x <= 0 && y <= 0 && x + w >= TFT_HOR_RES && y + h >= TFT_VER_RES)
+    dirtyRectCount = 0;
+  drawPackedWindow(canvas_framebuffer, 0, x, y, w, h);
+}
+
+/** Show h full-width rows of packed pixels from outside the framebuffer at panel row y, such as a sketch being received. */
+void drawPackedRows(const uint8_t *rows, int y, int h)
+{
+  drawPackedWindow(rows, y, 0, y, TFT_HOR_RES, h);
+}
+
+CanvasFlushStats canvasGetFlushStats()
+{
+  return flushStats;
+}
+
+void canvasResetFlushStats()
+{
+  flushStats = {0, 0, 0};
+}
+
+/** Achieved drawFramebuffer throughput as a fraction of the raw SPI write clock (16 bits per pixel). */
+float canvasFlushBusUtilization()
+{
+  if (flushStats.micros == 0)
+    return 0;
+  float bitsPerSecond = (float)flushStats.pixels * 16.0f * 1e6f / (float)flushStats.micros;
+  return bitsPerSecond / (float)CANVAS_SPI_WRITE_HZ;
+}
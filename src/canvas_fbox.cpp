@@ -0,0 +1,650 @@
+#include "canvas.h"
+#include "fbox.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef ARDUINO
+#include <esp_rom_crc.h>
+#endif
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Streaming encoder and decoder for .fbox sketches, see fbox.h for the layout.
+
+#define FBOX_ROW_BYTES (TFT_HOR_RES / 2)
+#define FBOX_CHUNK_BYTES (FBOX_ROW_BYTES * FBOX_ENCODE_ROWS)
+
+#define FBOX_THUMB_ROW_BYTES (FBOX_THUMB_WIDTH / 2)
+
+static_assert(TFT_VER_RES % FBOX_ENCODE_ROWS == 0, "Encode chunks must tile the canvas");
+static_assert(FBOX_THUMB_WIDTH * FBOX_THUMB_SCALE == TFT_HOR_RES && FBOX_THUMB_HEIGHT * FBOX_THUMB_SCALE == TFT_VER_RES,
+              "Thumbnail must be the canvas scaled down evenly");
+static_assert(FBOX_THUMB_BYTES % FBOX_CHUNK_BYTES == 0, "Thumbnails are packed in chunk sized pieces");
+
+static const uint8_t fboxMagic[4] = {'F', 'B', 'O', 'X'};
+static const uint8_t thumbMagic[4] = {'F', 'B', 'T', 'H'};
+
+/** CRC-32 (zlib polynomial). Pass 0 to start, or a previous result to continue. */
+uint32_t fboxCrc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+#ifdef ARDUINO
+  return esp_rom_crc32_le(crc, data, len);
+#else
+  static uint32_t table[256];
+  if (!table[1])
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+#endif
+}
+
+static inline void putU16(uint8_t *p, uint16_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static inline void putU32(uint8_t *p, uint32_t v)
+{
+  putU16(p, v & 0xFFFF);
+  putU16(p + 2, v >> 16);
+}
+
+static inline uint16_t getU16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t getU32(const uint8_t *p)
+{
+  return getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+/** Shrink one full resolution row into a thumbnail row by taking the first pixel of each block. */
+static void sampleThumbnailRow(const uint8_t *row, uint8_t *out)
+{
+  memset(out, 0, FBOX_THUMB_ROW_BYTES);
+  for (int tx = 0; tx < FBOX_THUMB_WIDTH; tx++)
+  {
+    int x = tx * FBOX_THUMB_SCALE;
+    uint8_t index = (x & 1) ? (row[x >> 1] & 0x0F) : (row[x >> 1] >> 4);
+    out[tx >> 1] |= (tx & 1) ? index : (index << 4);
+  }
+}
+
+/** Point sampling fallback for when there is no memory for a scaler, ctx is the thumbnail. */
+static void sampledThumbnailRow(void *ctx, int y, const uint8_t *row)
+{
+  if (y % FBOX_THUMB_SCALE == 0)
+    sampleThumbnailRow(row, (uint8_t *)ctx + (y / FBOX_THUMB_SCALE) * FBOX_THUMB_ROW_BYTES);
+}
+
+/** Scaler output, packed into the thumbnail passed as ctx. */
+static void packThumbnailRow(void *ctx, int ty, const uint8_t *indices)
+{
+  uint8_t *out = (uint8_t *)ctx + ty * FBOX_THUMB_ROW_BYTES;
+  for (int tx = 0; tx < FBOX_THUMB_WIDTH; tx += 2)
+    out[tx >> 1] = (indices[tx] << 4) | indices[tx + 1];
+}
+
+/** Build the FBOX_THUMB_BYTES thumbnail of framebuffer into thumb. Box filtered, so thin lines survive. */
+void fboxMakeThumbnail(const uint8_t *framebuffer, uint8_t *thumb)
+{
+  CanvasScaler *scaler = canvasScalerCreate(FBOX_THUMB_WIDTH, FBOX_THUMB_HEIGHT, packThumbnailRow, thumb);
+  for (int y = 0; y < TFT_VER_RES; y++)
+  {
+    const uint8_t *row = framebuffer + y * FBOX_ROW_BYTES;
+    if (scaler)
+      canvasScalerRow(scaler, y, row);
+    else
+      sampledThumbnailRow(thumb, y, row);
+  }
+  canvasScalerFree(scaler);
+}
+
+/** Thumbnail for fboxWrite to embed, or null to write the file without one. Free with free(). */
+static uint8_t *buildThumbnail(const uint8_t *framebuffer)
+{
+  uint8_t *thumb = (uint8_t *)malloc(FBOX_THUMB_BYTES);
+  if (thumb)
+    fboxMakeThumbnail(framebuffer, thumb);
+  return thumb;
+}
+
+static size_t packedThumbnailSize(const uint8_t *thumb)
+{
+  uint8_t packed[CANVAS_PACKBITS_MAX_SIZE(FBOX_CHUNK_BYTES)];
+  size_t size = 0;
+  for (int i = 0; i < FBOX_THUMB_BYTES; i += FBOX_CHUNK_BYTES)
+    size += canvasPackBitsEncode(thumb + i, FBOX_CHUNK_BYTES, packed);
+  return size;
+}
+
+/** Rows y..y+FBOX_ENCODE_ROWS-1 ready for packing. With rowDelta each is XORed with the row above, so pixels that repeat vertically become zero runs. */
+static void prepareChunk(const uint8_t *framebuffer, int y, bool rowDelta, uint8_t *chunk)
+{
+  for (int r = 0; r < FBOX_ENCODE_ROWS; r++)
+  {
+    const uint8_t *row = framebuffer + (y + r) * FBOX_ROW_BYTES;
+    uint8_t *out = chunk + r * FBOX_ROW_BYTES;
+    if (!rowDelta || y + r == 0)
+    {
+      memcpy(out, row, FBOX_ROW_BYTES);
+      continue;
+    }
+    const uint8_t *above = row - FBOX_ROW_BYTES;
+    for (int i = 0; i < FBOX_ROW_BYTES; i++)
+      out[i] = row[i] ^ above[i];
+  }
+}
+
+static size_t packedSize(const uint8_t *framebuffer, bool rowDelta)
+{
+  uint8_t chunk[FBOX_CHUNK_BYTES];
+  uint8_t packed[CANVAS_PACKBITS_MAX_SIZE(FBOX_CHUNK_BYTES)];
+  size_t size = 0;
+  for (int y = 0; y < TFT_VER_RES; y += FBOX_ENCODE_ROWS)
+  {
+    prepareChunk(framebuffer, y, rowDelta, chunk);
+    size += canvasPackBitsEncode(chunk, FBOX_CHUNK_BYTES, packed);
+  }
+  return size;
+}
+
+/** Measure the payload both with and without row deltas. Line art favours deltas, scattered noise does not. */
+static size_t choosePayload(const uint8_t *framebuffer, bool *rowDelta)
+{
+  size_t withDelta = packedSize(framebuffer, true);
+  size_t without = packedSize(framebuffer, false);
+  *rowDelta = withDelta <= without;
+  return *rowDelta ? withDelta : without;
+}
+
+/**
+ * Size of the file fboxWrite would produce, found by compressing without writing anything.
+ * @param pixelCrc Optional, receives the CRC of the framebuffer.
+ */
+size_t fboxEncodedSize(const uint8_t *framebuffer, uint32_t *pixelCrc)
+{
+  bool rowDelta;
+  size_t size = FBOX_HEADER_SIZE + choosePayload(framebuffer, &rowDelta);
+  uint8_t *thumb = buildThumbnail(framebuffer);
+  if (thumb)
+    size += 2 + packedThumbnailSize(thumb);
+  free(thumb);
+  if (pixelCrc)
+    *pixelCrc = fboxCrc32(0, framebuffer, CANVAS_FRAMEBUFFER_SIZE);
+  return size;
+}
+
+/**
+ * Write framebuffer as a v2 .fbox. The header needs the payload size and CRC up front, so the
+ * image is compressed to measure it before the real pass. That costs a few ms of CPU and lets
+ * the sink be a plain forward-only stream such as an HTTP body. A thumbnail goes in front of the
+ * pixels so previews never have to touch them.
+ */
+fbox_result_id_t fboxWrite(const uint8_t *framebuffer, fbox_write_fn_t write, void *ctx)
+{
+  bool rowDelta;
+  size_t payload = choosePayload(framebuffer, &rowDelta);
+  uint8_t *thumb = buildThumbnail(framebuffer);
+  size_t thumbSize = thumb ? packedThumbnailSize(thumb) : 0;
+  uint32_t crc = fboxCrc32(0, framebuffer, CANVAS_FRAMEBUFFER_SIZE);
+
+  uint8_t header[FBOX_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, fboxMagic, 4);
+  header[4] = FBOX_VERSION;
+  header[5] = FBOX_FLAG_PACKBITS | (thumb ? FBOX_FLAG_THUMBNAIL : 0) | (rowDelta ? FBOX_FLAG_ROW_DELTA : 0);
+  putU16(header + 6, TFT_HOR_RES);
+  putU16(header + 8, TFT_VER_RES);
+  header[10] = 4;
+  for (int i = 0; i < 16; i++)
+    putU16(header + 12 + i * 2, draw_color_palette[i]);
+  putU32(header + 44, FBOX_HEADER_SIZE + (thumb ? 2 + thumbSize : 0));
+  putU32(header + 48, payload);
+  putU32(header + 52, crc);
+  bool ok = write(ctx, header, sizeof(header)) == sizeof(header);
+
+  uint8_t chunk[FBOX_CHUNK_BYTES];
+  uint8_t packed[CANVAS_PACKBITS_MAX_SIZE(FBOX_CHUNK_BYTES)];
+  if (thumb)
+  {
+    uint8_t thumbLength[2];
+    putU16(thumbLength, thumbSize);
+    ok = ok && write(ctx, thumbLength, 2) == 2;
+    for (int i = 0; ok && i < FBOX_THUMB_BYTES; i += FBOX_CHUNK_BYTES)
+    {
+      size_t len = canvasPackBitsEncode(thumb + i, FBOX_CHUNK_BYTES, packed);
+      ok = write(ctx, packed, len) == len;
+    }
+    free(thumb);
+  }
+  if (!ok)
+    return FBOX_ERR_IO;
+
+  for (int y = 0; y < TFT_VER_RES; y += FBOX_ENCODE_ROWS)
+  {
+    prepareChunk(framebuffer, y, rowDelta, chunk);
+    size_t len = canvasPackBitsEncode(chunk, FBOX_CHUNK_BYTES, packed);
+    if (write(ctx, packed, len) != len)
+      return FBOX_ERR_IO;
+  }
+  return FBOX_OK;
+}
+
+/** Rows being assembled by fboxRead, whichever way the pixels arrive. */
+struct FboxRowAssembler
+{
+  uint8_t row[FBOX_ROW_BYTES];
+  /** Previous decoded row, kept when rows are stored as deltas. */
+  uint8_t above[FBOX_ROW_BYTES];
+  bool rowDelta;
+  int fill;
+  int y;
+  uint32_t crc;
+  /** Index remap for files whose palette differs from ours, null when they match. */
+  const uint8_t *remap;
+  fbox_row_fn_t rowFn;
+  void *rowCtx;
+};
+
+/** Hand a finished row to the caller. */
+static void completeRow(FboxRowAssembler &a)
+{
+  if (a.rowDelta)
+  {
+    for (int i = 0; i < FBOX_ROW_BYTES; i++)
+      a.row[i] ^= a.above[i];
+    memcpy(a.above, a.row, FBOX_ROW_BYTES);
+  }
+  a.crc = fboxCrc32(a.crc, a.row, FBOX_ROW_BYTES);
+  if (a.remap)
+    for (int i = 0; i < FBOX_ROW_BYTES; i++)
+      a.row[i] = a.remap[a.row[i]];
+  a.rowFn(a.rowCtx, a.y++, a.row);
+  a.fill = 0;
+}
+
+static void assembleBytes(FboxRowAssembler &a, const uint8_t *data, size_t len)
+{
+  while (len > 0 && a.y < TFT_VER_RES)
+  {
+    size_t n = FBOX_ROW_BYTES - a.fill;
+    if (n > len)
+      n = len;
+    memcpy(a.row + a.fill, data, n);
+    a.fill += n;
+    data += n;
+    len -= n;
+    if (a.fill == FBOX_ROW_BYTES)
+      completeRow(a);
+  }
+}
+
+static void assembleRun(FboxRowAssembler &a, uint8_t value, size_t len)
+{
+  while (len > 0 && a.y < TFT_VER_RES)
+  {
+    size_t n = FBOX_ROW_BYTES - a.fill;
+    if (n > len)
+      n = len;
+    memset(a.row + a.fill, value, n);
+    a.fill += n;
+    len -= n;
+    if (a.fill == FBOX_ROW_BYTES)
+      completeRow(a);
+  }
+}
+
+/** PackBits decoder state carried across read chunks. */
+struct PackBitsStream
+{
+  size_t literalLeft;
+  size_t runLength;
+};
+
+/** Feed n bytes of PackBits through the stream, passing literals to bytes(data, len) and runs to run(value, len). */
+template <typename BytesFn, typename RunFn>
+static void unpackBits(PackBitsStream &s, const uint8_t *in, size_t n, BytesFn bytes, RunFn run)
+{
+  size_t pos = 0;
+  while (pos < n)
+  {
+    if (s.literalLeft > 0)
+    {
+      size_t take = n - pos < s.literalLeft ? n - pos : s.literalLeft;
+      bytes(in + pos, take);
+      pos += take;
+      s.literalLeft -= take;
+    }
+    else if (s.runLength > 0)
+    {
+      run(in[pos++], s.runLength);
+      s.runLength = 0;
+    }
+    else
+    {
+      uint8_t packet = in[pos++];
+      if (packet < 128)
+        s.literalLeft = packet + 1;
+      else if (packet > 128)
+        s.runLength = 257 - packet;
+    }
+  }
+}
+
+/** Keep reading until len bytes arrive or the source runs dry. Sources such as sockets return short reads. */
+static size_t readFully(fbox_read_fn_t read, void *ctx, uint8_t *data, size_t len)
+{
+  size_t total = 0;
+  while (total < len)
+  {
+    size_t n = read(ctx, data + total, len - total);
+    if (n == 0)
+      break;
+    total += n;
+  }
+  return total;
+}
+
+/** Fields of a v2 header that the readers act on. */
+struct FboxHeader
+{
+  uint8_t flags;
+  uint32_t payloadOffset;
+  uint32_t payloadSize;
+  uint32_t crc;
+};
+
+static bool isV2Header(const uint8_t *header, size_t got)
+{
+  return got == FBOX_HEADER_SIZE && memcmp(header, fboxMagic, 4) == 0 && header[4] == FBOX_VERSION;
+}
+
+static fbox_result_id_t parseHeader(const uint8_t *header, FboxHeader &out)
+{
+  if (getU16(header + 6) != TFT_HOR_RES || getU16(header + 8) != TFT_VER_RES || header[10] != 4)
+    return FBOX_ERR_FORMAT;
+  out.flags = header[5];
+  out.payloadOffset = getU32(header + 44);
+  out.payloadSize = getU32(header + 48);
+  out.crc = getU32(header + 52);
+  if (out.payloadOffset < FBOX_HEADER_SIZE)
+    return FBOX_ERR_FORMAT;
+  if ((out.flags & FBOX_FLAG_THUMBNAIL) && out.payloadOffset < FBOX_HEADER_SIZE + 2)
+    return FBOX_ERR_FORMAT;
+  return FBOX_OK;
+}
+
+/**
+ * Map the header's palette onto ours, as a table over whole bytes (two pixels). Sketches from this
+ * firmware always match exactly.
+ * @return False if no remapping is needed, in which case remap is left untouched.
+ */
+static bool buildRemap(const uint8_t *header, uint8_t *remap)
+{
+  bool remapNeeded = false;
+  uint8_t indexMap[16];
+  for (int i = 0; i < 16; i++)
+  {
+    uint16_t c = getU16(header + 12 + i * 2);
+    indexMap[i] = i;
+    if (c == draw_color_palette[i])
+      continue;
+    remapNeeded = true;
+    int best = 0;
+    uint32_t bestDistance = UINT32_MAX;
+    for (int j = 0; j < 16; j++)
+    {
+      uint32_t distance = canvasColorDistance(c, draw_color_palette[j]);
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        best = j;
+      }
+    }
+    indexMap[i] = best;
+  }
+  if (remapNeeded)
+    for (int b = 0; b < 256; b++)
+      remap[b] = (indexMap[b >> 4] << 4) | indexMap[b & 0x0F];
+  return remapNeeded;
+}
+
+/**
+ * Size of the file a header came from, for sources that cannot say, like a chunked HTTP body. v2
+ * files end with their payload; anything else can only be a legacy framebuffer dump.
+ * @param got Bytes read into header, up to FBOX_HEADER_SIZE.
+ */
+uint32_t fboxFileSize(const uint8_t *header, size_t got)
+{
+  if (!isV2Header(header, got))
+    return CANVAS_FRAMEBUFFER_SIZE;
+  return getU32(header + 44) + getU32(header + 48);
+}
+
+/**
+ * Read an .fbox from a byte source, handing each row of packed pixels to row as soon as it is
+ * complete. Legacy headerless files are recognised by their exact size of CANVAS_FRAMEBUFFER_SIZE.
+ * Rows already delivered stay delivered on error; a CRC failure is only known after the last row.
+ * @param fileSize Total size of the source, used to recognise legacy files.
+ */
+fbox_result_id_t fboxRead(fbox_read_fn_t read, void *ctx, uint32_t fileSize, fbox_row_fn_t row, void *rowCtx)
+{
+  FboxRowAssembler a;
+  a.fill = 0;
+  a.y = 0;
+  a.crc = 0;
+  a.remap = nullptr;
+  a.rowDelta = false;
+  memset(a.above, 0, sizeof(a.above));
+  a.rowFn = row;
+  a.rowCtx = rowCtx;
+
+  uint8_t header[FBOX_HEADER_SIZE];
+  size_t got = readFully(read, ctx, header, sizeof(header));
+  if (got < 4)
+    return FBOX_ERR_IO;
+
+  if (!isV2Header(header, got))
+  {
+    if (fileSize != CANVAS_FRAMEBUFFER_SIZE)
+      return FBOX_ERR_FORMAT;
+    // Legacy: the header bytes we just read are already pixels.
+    uint8_t in[FBOX_READ_CHUNK];
+    assembleBytes(a, header, got);
+    size_t n;
+    while (a.y < TFT_VER_RES && (n = read(ctx, in, sizeof(in))) > 0)
+      assembleBytes(a, in, n);
+    return a.y == TFT_VER_RES ? FBOX_OK : FBOX_ERR_IO;
+  }
+
+  FboxHeader h;
+  fbox_result_id_t result = parseHeader(header, h);
+  if (result != FBOX_OK)
+    return result;
+  uint8_t flags = h.flags;
+  a.rowDelta = flags & FBOX_FLAG_ROW_DELTA;
+  uint8_t remap[256];
+  if (buildRemap(header, remap))
+    a.remap = remap;
+
+  // Skip the thumbnail and any other extension data between the header and the payload.
+  uint8_t in[FBOX_READ_CHUNK];
+  uint32_t skip = h.payloadOffset - FBOX_HEADER_SIZE;
+  while (skip > 0)
+  {
+    size_t n = read(ctx, in, skip < sizeof(in) ? skip : sizeof(in));
+    if (n == 0)
+      return FBOX_ERR_IO;
+    skip -= n;
+  }
+
+  PackBitsStream stream = {0, 0};
+  uint32_t remaining = h.payloadSize;
+  while (remaining > 0 && a.y < TFT_VER_RES)
+  {
+    size_t n = read(ctx, in, remaining < sizeof(in) ? remaining : sizeof(in));
+    if (n == 0)
+      return FBOX_ERR_IO;
+    remaining -= n;
+    if (!(flags & FBOX_FLAG_PACKBITS))
+    {
+      assembleBytes(a, in, n);
+      continue;
+    }
+    unpackBits(
+        stream, in, n,
+        [&](const uint8_t *data, size_t len)
+        { assembleBytes(a, data, len); },
+        [&](uint8_t value, size_t len)
+        { assembleRun(a, value, len); });
+  }
+
+  if (a.y != TFT_VER_RES)
+    return FBOX_ERR_FORMAT;
+  return a.crc == h.crc ? FBOX_OK : FBOX_ERR_CRC;
+}
+
+static void fboxRowToFramebuffer(void *, int y, const uint8_t *row)
+{
+  memcpy(canvas_framebuffer + y * FBOX_ROW_BYTES, row, FBOX_ROW_BYTES);
+}
+
+/** fboxRead straight into canvas_framebuffer. */
+fbox_result_id_t fboxReadToFramebuffer(fbox_read_fn_t read, void *ctx, uint32_t fileSize)
+{
+  return fboxRead(read, ctx, fileSize, fboxRowToFramebuffer, nullptr);
+}
+
+/**
+ * Read just the embedded thumbnail, remapped to our palette. Stops at the end of the thumbnail,
+ * which is usually well under FBOX_THUMB_BYTES; the pixels are neither read nor CRC checked.
+ * @return FBOX_ERR_NO_THUMBNAIL for legacy files and v2 files written without one.
+ */
+fbox_result_id_t fboxReadThumbnail(fbox_read_fn_t read, void *ctx, uint32_t fileSize, uint8_t *thumb)
+{
+  uint8_t header[FBOX_HEADER_SIZE];
+  size_t got = readFully(read, ctx, header, sizeof(header));
+  if (!isV2Header(header, got))
+  {
+    if (fileSize == CANVAS_FRAMEBUFFER_SIZE)
+      return FBOX_ERR_NO_THUMBNAIL;
+    return got < 4 ? FBOX_ERR_IO : FBOX_ERR_FORMAT;
+  }
+  FboxHeader h;
+  fbox_result_id_t result = parseHeader(header, h);
+  if (result != FBOX_OK)
+    return result;
+  if (!(h.flags & FBOX_FLAG_THUMBNAIL))
+    return FBOX_ERR_NO_THUMBNAIL;
+
+  uint8_t thumbLength[2];
+  if (readFully(read, ctx, thumbLength, 2) != 2)
+    return FBOX_ERR_IO;
+  uint32_t remaining = getU16(thumbLength);
+  if (FBOX_HEADER_SIZE + 2 + remaining > h.payloadOffset)
+    return FBOX_ERR_FORMAT;
+
+  PackBitsStream stream = {0, 0};
+  size_t fill = 0;
+  uint8_t in[FBOX_READ_CHUNK];
+  while (remaining > 0)
+  {
+    size_t n = read(ctx, in, remaining < sizeof(in) ? remaining : sizeof(in));
+    if (n == 0)
+      return FBOX_ERR_IO;
+    remaining -= n;
+    // Bounded by FBOX_THUMB_BYTES, so a damaged thumbnail cannot overrun the caller's buffer.
+    unpackBits(
+        stream, in, n,
+        [&](const uint8_t *data, size_t len)
+        {
+          if (len > FBOX_THUMB_BYTES - fill)
+            len = FBOX_THUMB_BYTES - fill;
+          memcpy(thumb + fill, data, len);
+          fill += len;
+        },
+        [&](uint8_t value, size_t len)
+        {
+          if (len > FBOX_THUMB_BYTES - fill)
+            len = FBOX_THUMB_BYTES - fill;
+          memset(thumb + fill, value, len);
+          fill += len;
+        });
+  }
+  if (fill != FBOX_THUMB_BYTES)
+    return FBOX_ERR_FORMAT;
+
+  uint8_t remap[256];
+  if (buildRemap(header, remap))
+    for (int i = 0; i < FBOX_THUMB_BYTES; i++)
+      thumb[i] = remap[thumb[i]];
+  return FBOX_OK;
+}
+
+/** Build a thumbnail by decoding the whole sketch, for files that do not carry one. */
+fbox_result_id_t fboxDecodeThumbnail(fbox_read_fn_t read, void *ctx, uint32_t fileSize, uint8_t *thumb)
+{
+  CanvasScaler *scaler = canvasScalerCreate(FBOX_THUMB_WIDTH, FBOX_THUMB_HEIGHT, packThumbnailRow, thumb);
+  fbox_result_id_t result = scaler ? fboxRead(read, ctx, fileSize, canvasScalerRow, scaler)
+                                   : fboxRead(read, ctx, fileSize, sampledThumbnailRow, thumb);
+  canvasScalerFree(scaler);
+  return result;
+}
+
+/** Write a sidecar thumbnail for a sketch of sketchSize bytes. */
+fbox_result_id_t fboxWriteThumbnailFile(const uint8_t *thumb, uint32_t sketchSize, fbox_write_fn_t write, void *ctx)
+{
+  uint8_t header[FBOX_THUMB_FILE_HEADER_SIZE];
+  memcpy(header, thumbMagic, 4);
+  putU32(header + 4, sketchSize);
+  if (write(ctx, header, sizeof(header)) != sizeof(header) || write(ctx, thumb, FBOX_THUMB_BYTES) != FBOX_THUMB_BYTES)
+    return FBOX_ERR_IO;
+  return FBOX_OK;
+}
+
+/**
+ * Read a sidecar thumbnail. A sidecar made from a sketch of a different size is stale.
+ * @return FBOX_ERR_FORMAT if the sidecar is damaged or stale and should be rebuilt.
+ */
+fbox_result_id_t fboxReadThumbnailFile(fbox_read_fn_t read, void *ctx, uint32_t sketchSize, uint8_t *thumb)
+{
+  uint8_t header[FBOX_THUMB_FILE_HEADER_SIZE];
+  if (readFully(read, ctx, header, sizeof(header)) != sizeof(header))
+    return FBOX_ERR_FORMAT;
+  if (memcmp(header, thumbMagic, 4) != 0 || getU32(header + 4) != sketchSize)
+    return FBOX_ERR_FORMAT;
+  if (readFully(read, ctx, thumb, FBOX_THUMB_BYTES) != FBOX_THUMB_BYTES)
+    return FBOX_ERR_FORMAT;
+  return FBOX_OK;
+}
+
+size_t fboxMemoryWrite(void *ctx, const uint8_t *data, size_t len)
+{
+  FboxMemoryWriter *w = (FboxMemoryWriter *)ctx;
+  if (len > w->capacity - w->length)
+    len = w->capacity - w->length;
+  memcpy(w->data + w->length, data, len);
+  w->length += len;
+  return len;
+}
+
+size_t fboxMemoryRead(void *ctx, uint8_t *data, size_t len)
+{
+  FboxMemoryReader *r = (FboxMemoryReader *)ctx;
+  if (len > r->length - r->position)
+    len = r->length - r->position;
+  memcpy(data, r->data + r->position, len);
+  r->position += len;
+  return len;
+}
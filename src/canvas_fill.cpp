@@ -0,0 +1,250 @@
+#include "canvas.h"
+#include <stdlib.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Bucket fill working directly on the packed 4bpp framebuffer.
+
+/** One pending seed: row y - dy between xl and xr was filled, row y still needs exploring. */
+struct FillSegment
+{
+  int16_t y, xl, xr;
+  int8_t dy;
+};
+
+/** Working state for one drawFillToFB call. */
+struct FillState
+{
+  uint8_t target;
+  uint8_t colorIndex;
+  FillSegment *stack;
+  int sp;
+  bool overflowed;
+  /** One bit per canvas pixel, set for every pixel this fill has written. */
+  uint8_t *mask;
+  int boundsX0, boundsY0, boundsX1, boundsY1;
+};
+
+#define FILL_MASK_ROW_BYTES (TFT_HOR_RES / 8)
+
+static inline uint8_t readPixelFB(int x, int y)
+{
+  uint8_t byte = canvas_framebuffer[(y * TFT_HOR_RES + x) >> 1];
+  return (x & 1) ? (byte & 0x0F) : (byte >> 4);
+}
+
+/** True if any mask bit in x0..x1 on row y is set. */
+static bool maskAny(const FillState &fill, int x0, int x1, int y)
+{
+  if (y < 0 || y >= TFT_VER_RES)
+    return false;
+  const uint8_t *row = fill.mask + y * FILL_MASK_ROW_BYTES;
+  for (int x = x0; x <= x1;)
+  {
+    // Whole bytes at a time once aligned.
+    if (!(x & 7) && x + 7 <= x1)
+    {
+      if (row[x >> 3])
+        return true;
+      x += 8;
+    }
+    else
+    {
+      if (row[x >> 3] & (0x80 >> (x & 7)))
+        return true;
+      x++;
+    }
+  }
+  return false;
+}
+
+/** Write the run x0..x1 on row y, record it in the mask and grow the bounding box. */
+static void fillRun(FillState &fill, int x0, int x1, int y)
+{
+  fillSpanToFB(x0, x1, y, fill.colorIndex);
+
+  uint8_t *row = fill.mask + y * FILL_MASK_ROW_BYTES;
+  for (int x = x0; x <= x1;)
+  {
+    if (!(x & 7) && x + 7 <= x1)
+    {
+      row[x >> 3] = 0xFF;
+      x += 8;
+    }
+    else
+    {
+      row[x >> 3] |= 0x80 >> (x & 7);
+      x++;
+    }
+  }
+
+  if (x0 < fill.boundsX0)
+    fill.boundsX0 = x0;
+  if (x1 > fill.boundsX1)
+    fill.boundsX1 = x1;
+  if (y < fill.boundsY0)
+    fill.boundsY0 = y;
+  if (y > fill.boundsY1)
+    fill.boundsY1 = y;
+}
+
+/** Queue row y + dy between x0 and x1 for exploration. Seeds past the stack budget are dropped and left to the repair pass. */
+static void pushSegment(FillState &fill, int y, int x0, int x1, int dy)
+{
+  if (y + dy < 0 || y + dy >= TFT_VER_RES)
+    return;
+  if (fill.sp == CANVAS_FILL_STACK_SIZE)
+  {
+    fill.overflowed = true;
+    return;
+  }
+  fill.stack[fill.sp++] = {(int16_t)(y + dy), (int16_t)x0, (int16_t)x1, (int8_t)dy};
+}
+
+/** Scanline fill (Heckbert, Graphics Gems I). Each run is found by reading nibbles, then written in one go. */
+static void scanlineFill(FillState &fill)
+{
+  while (fill.sp > 0)
+  {
+    FillSegment seg = fill.stack[--fill.sp];
+    int py = seg.y;
+    int x1 = seg.xl;
+    int x2 = seg.xr;
+    int dy = seg.dy;
+    int px = x1;
+    int left;
+
+    // Extend left from x1. If x1 is fillable the run may leak past the parent's left edge.
+    while (px >= 0 && readPixelFB(px, py) == fill.target)
+      px--;
+    if (px < x1)
+    {
+      left = px + 1;
+      if (left < x1)
+        pushSegment(fill, py, left, x1 - 1, -dy);
+      px = x1 + 1;
+    }
+    else
+    {
+      // x1 is a blocker, skip to the first fillable pixel under the parent.
+      for (px = x1 + 1; px <= x2 && readPixelFB(px, py) != fill.target; px++)
+        ;
+      if (px > x2)
+        continue;
+      left = px;
+    }
+
+    for (;;)
+    {
+      // Extend right, then write the whole run at once.
+      while (px < TFT_HOR_RES && readPixelFB(px, py) == fill.target)
+        px++;
+      fillRun(fill, left, px - 1, py);
+      pushSegment(fill, py, left, px - 1, dy);
+      // Run leaked past the parent's right edge, so explore back the way we came too.
+      if (px > x2 + 1)
+        pushSegment(fill, py, x2 + 1, px - 1, -dy);
+
+      // Skip blockers under the parent to the next fillable pixel.
+      for (px++; px <= x2 && readPixelFB(px, py) != fill.target; px++)
+        ;
+      if (px > x2)
+        break;
+      left = px;
+    }
+  }
+}
+
+/**
+ * Finish a fill whose stack overflowed. Sweeps the rows around the filled area, alternating
+ * down and up, and restarts the scanline fill from every target run that touches a pixel this
+ * fill already wrote. Repeats until a sweep changes nothing. Needs no memory beyond the mask.
+ */
+static void repairFill(FillState &fill)
+{
+  bool changed = true;
+  bool down = true;
+  while (changed)
+  {
+    changed = false;
+    int first = fill.boundsY0 > 0 ? fill.boundsY0 - 1 : 0;
+    int last = fill.boundsY1 < TFT_VER_RES - 1 ? fill.boundsY1 + 1 : TFT_VER_RES - 1;
+    for (int i = 0; i <= last - first; i++)
+    {
+      int py = down ? first + i : last - i;
+      int px = 0;
+      while (px < TFT_HOR_RES)
+      {
+        if (readPixelFB(px, py) != fill.target)
+        {
+          px++;
+          continue;
+        }
+        int runStart = px;
+        while (px < TFT_HOR_RES && readPixelFB(px, py) == fill.target)
+          px++;
+        if (maskAny(fill, runStart, px - 1, py - 1) || maskAny(fill, runStart, px - 1, py + 1))
+        {
+          // Reseed the stack from this run; it is empty here, so it can take the region a long way.
+          fillRun(fill, runStart, px - 1, py);
+          pushSegment(fill, py, runStart, px - 1, 1);
+          pushSegment(fill, py, runStart, px - 1, -1);
+          scanlineFill(fill);
+          changed = true;
+        }
+      }
+    }
+    down = !down;
+  }
+}
+
+/**
+ * Bucket fill the 4-connected region under (x,y) with colorIndex. Memory is bounded: a stack of
+ * CANVAS_FILL_STACK_SIZE seeds plus a 1-bit coverage mask (19.2 KB), both freed before returning.
+ * If the stack runs out, repairFill completes the region, so the result is always exact. Only the
+ * bounding box of the filled region is sent to the panel.
+ * @return False if the working memory could not be allocated.
+ */
+bool drawFillToFB(int x, int y, uint8_t colorIndex)
+{
+  if (x < 0 || x >= TFT_HOR_RES || y < 0 || y >= TFT_VER_RES)
+    return true;
+
+  FillState fill;
+  fill.colorIndex = colorIndex & 0x0F;
+  fill.target = readPixelFB(x, y);
+  if (fill.target == fill.colorIndex)
+    return true;
+
+  fill.stack = (FillSegment *)malloc(CANVAS_FILL_STACK_SIZE * sizeof(FillSegment));
+  fill.mask = (uint8_t *)calloc(FILL_MASK_ROW_BYTES * TFT_VER_RES, 1);
+  if (!fill.stack || !fill.mask)
+  {
+    free(fill.stack);
+    free(fill.mask);
+    return false;
+  }
+
+  fill.sp = 0;
+  fill.overflowed = false;
+  fill.boundsX0 = fill.boundsX1 = x;
+  fill.boundsY0 = fill.boundsY1 = y;
+
+  // Seed is row y itself, explored in both directions.
+  fill.stack[fill.sp++] = {(int16_t)y, (int16_t)x, (int16_t)x, 1};
+  pushSegment(fill, y, x, x, -1);
+
+  scanlineFill(fill);
+  if (fill.overflowed)
+    repairFill(fill);
+
+  free(fill.stack);
+  free(fill.mask);
+
+  int w = fill.boundsX1 - fill.boundsX0 + 1;
+  int h = fill.boundsY1 - fill.boundsY0 + 1;
+  if (canvasIsBatchedFlush())
+    canvasMarkDirty(fill.boundsX0, fill.boundsY0, w, h);
+  else
+    drawFramebuffer(fill.boundsX0, fill.boundsY0, w, h);
+  return true;
+}
@@ -0,0 +1,611 @@
+#include "canvas.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef ARDUINO
+#include <SD.h>
+#else
+#include <stdio.h>
+#endif
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Tile granular undo/redo. While a stroke is open, the first write to each tile copies its old
+// contents into a staging area. When the stroke ends every staged tile is XORed with what it holds
+// now and PackBits encoded. A XOR delta is its own inverse, so undo and redo apply the same bytes
+// and a record never changes once written.
+//
+// Record: [flags:1][tileCount:2] then per tile [tileIndex:2][encodedLength:2][PackBits delta].
+// Records spilled to SD are framed as [length:4][record][length:4] so the file can be walked both ways.
+
+#define JOURNAL_TILES_X (TFT_HOR_RES / CANVAS_UNDO_TILE_SIZE)
+#define JOURNAL_TILES_Y (TFT_VER_RES / CANVAS_UNDO_TILE_SIZE)
+#define JOURNAL_TILE_COUNT (JOURNAL_TILES_X * JOURNAL_TILES_Y)
+#define JOURNAL_TILE_ROW_BYTES (CANVAS_UNDO_TILE_SIZE / 2)
+#define JOURNAL_RECORD_HEADER 3
+#define JOURNAL_TILE_HEADER 4
+#define JOURNAL_STAGE_EMPTY 0xFF
+/** Record flag: undo and redo this record together with the one before it. */
+#define JOURNAL_FLAG_JOINED 0x01
+
+static_assert(TFT_HOR_RES % CANVAS_UNDO_TILE_SIZE == 0 && TFT_VER_RES % CANVAS_UNDO_TILE_SIZE == 0, "Undo tiles must divide the screen");
+static_assert(CANVAS_UNDO_STAGE_TILES < JOURNAL_STAGE_EMPTY, "Stage slots are stored in a byte");
+static_assert(CANVAS_UNDO_STAGE_TILES >= TFT_HOR_RES / CANVAS_UNDO_TILE_SIZE, "A full row of tiles must fit the staging area");
+static_assert(CANVAS_UNDO_ARENA_SIZE >= JOURNAL_RECORD_HEADER + CANVAS_UNDO_STAGE_TILES * (JOURNAL_TILE_HEADER + CANVAS_PACKBITS_MAX_SIZE(CANVAS_UNDO_TILE_BYTES)),
+              "Undo arena must hold a full staging area");
+
+/** Where one record sits in the arena. */
+struct JournalEntry
+{
+  uint32_t offset;
+  uint32_t length;
+};
+
+/** Compressed records, oldest first starting at entryFirst. Null until canvasJournalInit succeeds. */
+static uint8_t *arena = nullptr;
+static JournalEntry entries[CANVAS_UNDO_MAX_RECORDS];
+static int entryFirst = 0;
+static int entryCount = 0;
+
+/** Old contents of the tiles written since the last commit. */
+static uint8_t *stageData = nullptr;
+static uint16_t stageTile[CANVAS_UNDO_STAGE_TILES];
+static uint8_t stageSlot[JOURNAL_TILE_COUNT];
+static int stageCount = 0;
+static bool strokeOpen = false;
+/** Records committed since the stroke began, every one after the first is joined to its predecessor. */
+static int strokeRecords = 0;
+
+/** Records on SD are the oldest history. spillCursor is the end of the last applied one. */
+static uint32_t spilledCount = 0;
+static uint32_t spillEnd = 0;
+static uint32_t spillCursor = 0;
+/** Number of records currently applied, counting spilled and RAM records. Anything above it can be redone. */
+static uint32_t cursor = 0;
+
+/** Tiles changed by the current undo or redo, repainted once it finishes. */
+static uint8_t repaintTiles[(JOURNAL_TILE_COUNT + 7) / 8];
+
+/** Held around every access to the spill file, whose card may share its bus. Either may be null. */
+static canvas_bus_fn_t busLock = nullptr;
+static canvas_bus_fn_t busUnlock = nullptr;
+
+/** Holds the bus for as long as it is in scope. */
+struct SpillBusHold
+{
+  SpillBusHold()
+  {
+    if (busLock)
+      busLock();
+  }
+  ~SpillBusHold()
+  {
+    if (busUnlock)
+      busUnlock();
+  }
+};
+
+#ifdef ARDUINO
+static File spillFile;
+
+static bool spillWrite(uint32_t offset, const uint8_t *data, size_t len)
+{
+  SpillBusHold bus;
+  if (!spillFile)
+    spillFile = SD.open(CANVAS_UNDO_SPILL_PATH, "w+");
+  return spillFile && spillFile.seek(offset) && spillFile.write(data, len) == len;
+}
+
+static bool spillRead(uint32_t offset, uint8_t *data, size_t len)
+{
+  SpillBusHold bus;
+  return spillFile && spillFile.seek(offset) && spillFile.read(data, len) == len;
+}
+
+static void spillClose()
+{
+  SpillBusHold bus;
+  if (spillFile)
+    spillFile.close();
+}
+#else
+static FILE *spillFile = nullptr;
+
+static bool spillWrite(uint32_t offset, const uint8_t *data, size_t len)
+{
+  if (!spillFile)
+    spillFile = tmpfile();
+  return spillFile && fseek(spillFile, offset, SEEK_SET) == 0 && fwrite(data, 1, len, spillFile) == len;
+}
+
+static bool spillRead(uint32_t offset, uint8_t *data, size_t len)
+{
+  return spillFile && fseek(spillFile, offset, SEEK_SET) == 0 && fread(data, 1, len, spillFile) == len;
+}
+
+static void spillClose()
+{
+  if (spillFile)
+    fclose(spillFile);
+  spillFile = nullptr;
+}
+#endif
+
+static inline uint8_t *tilePointer(int tile)
+{
+  int tx = tile % JOURNAL_TILES_X;
+  int ty = tile / JOURNAL_TILES_X;
+  return canvas_framebuffer + ((ty * CANVAS_UNDO_TILE_SIZE) * TFT_HOR_RES + tx * CANVAS_UNDO_TILE_SIZE) / 2;
+}
+
+static bool isZero(const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    if (data[i])
+      return false;
+  return true;
+}
+
+static inline uint16_t readU16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline void writeU16(uint8_t *p, uint16_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+/** History older than the RAM ring is gone, e.g. the card is missing or the spill file hit its cap. */
+static void dropSpilled()
+{
+  cursor -= spilledCount;
+  spilledCount = 0;
+  spillEnd = 0;
+  spillCursor = 0;
+}
+
+/** Forget the oldest RAM record without spilling it. */
+static void discardOldest()
+{
+  entryFirst = (entryFirst + 1) % CANVAS_UNDO_MAX_RECORDS;
+  entryCount--;
+  cursor--;
+}
+
+/** With nothing older left, a joined record at the bottom of the history belongs to a stroke whose start is gone. */
+static void dropOrphans()
+{
+  while (spilledCount == 0 && entryCount > 0 && (arena[entries[entryFirst].offset] & JOURNAL_FLAG_JOINED))
+    discardOldest();
+}
+
+/**
+ * Move the oldest RAM record to the end of the spill file. Only applied records are ever evicted.
+ * If older history has been lost, continuation records of the lost stroke are dropped as well, so
+ * a stroke is never left half undoable.
+ */
+static void evictOldest()
+{
+  JournalEntry &e = entries[entryFirst];
+  if (spillEnd + e.length + 8 > CANVAS_UNDO_SPILL_MAX_BYTES)
+    dropSpilled();
+
+  uint32_t frame = e.length;
+  bool orphan = spilledCount == 0 && (arena[e.offset] & JOURNAL_FLAG_JOINED);
+  if (!orphan &&
+      spillWrite(spillEnd, (const uint8_t *)&frame, 4) &&
+      spillWrite(spillEnd + 4, arena + e.offset, e.length) &&
+      spillWrite(spillEnd + 4 + e.length, (const uint8_t *)&frame, 4))
+  {
+    spillEnd += e.length + 8;
+    spillCursor = spillEnd;
+    spilledCount++;
+    entryFirst = (entryFirst + 1) % CANVAS_UNDO_MAX_RECORDS;
+    entryCount--;
+    return;
+  }
+
+  // No card, a write error or an orphan: this record and everything older are lost.
+  dropSpilled();
+  discardOldest();
+  dropOrphans();
+}
+
+/** Find room for a need byte record at the head of the ring, evicting the oldest records as required. */
+static uint32_t reserveRecord(uint32_t need)
+{
+  while (entryCount == CANVAS_UNDO_MAX_RECORDS)
+    evictOldest();
+
+  uint32_t start = 0;
+  if (entryCount > 0)
+  {
+    JournalEntry &newest = entries[(entryFirst + entryCount - 1) % CANVAS_UNDO_MAX_RECORDS];
+    start = newest.offset + newest.length;
+  }
+  if (start + need > CANVAS_UNDO_ARENA_SIZE)
+  {
+    // Wrap to the front. Records still sitting past the newest one are the oldest, and go first.
+    while (entryCount > 0 && entries[entryFirst].offset >= start)
+      evictOldest();
+    start = 0;
+  }
+  while (entryCount > 0 && entries[entryFirst].offset < start + need && start < entries[entryFirst].offset + entries[entryFirst].length)
+    evictOldest();
+  return start;
+}
+
+/** A new edit makes everything past the cursor unreachable. */
+static void truncateRedo()
+{
+  if (cursor == spilledCount + entryCount)
+    return;
+  if (cursor >= spilledCount)
+  {
+    entryCount = cursor - spilledCount;
+  }
+  else
+  {
+    entryCount = 0;
+    spilledCount = cursor;
+    spillEnd = spillCursor;
+  }
+}
+
+/** Turn the staged tiles into a record. Tiles the stroke did not actually change are left out. */
+static void commitStage()
+{
+  if (stageCount == 0)
+    return;
+
+  // Staged copies become XOR deltas in place, and the record size is measured before reserving room.
+  uint8_t scratch[CANVAS_PACKBITS_MAX_SIZE(CANVAS_UNDO_TILE_BYTES)];
+  uint32_t size = JOURNAL_RECORD_HEADER;
+  int tileCount = 0;
+  for (int i = 0; i < stageCount; i++)
+  {
+    uint8_t *delta = stageData + i * CANVAS_UNDO_TILE_BYTES;
+    const uint8_t *src = tilePointer(stageTile[i]);
+    for (int r = 0; r < CANVAS_UNDO_TILE_SIZE; r++)
+      for (int b = 0; b < JOURNAL_TILE_ROW_BYTES; b++)
+        delta[r * JOURNAL_TILE_ROW_BYTES + b] ^= src[r * (TFT_HOR_RES / 2) + b];
+    if (isZero(delta, CANVAS_UNDO_TILE_BYTES))
+      continue;
+    size += JOURNAL_TILE_HEADER + canvasPackBitsEncode(delta, CANVAS_UNDO_TILE_BYTES, scratch);
+    tileCount++;
+  }
+
+  if (tileCount > 0)
+  {
+    truncateRedo();
+    uint32_t offset = reserveRecord(size);
+    uint8_t *out = arena + offset;
+    out[0] = strokeRecords > 0 ? JOURNAL_FLAG_JOINED : 0;
+    writeU16(out + 1, tileCount);
+    uint32_t pos = JOURNAL_RECORD_HEADER;
+    // Walk tiles in screen order so repaints can join neighbours into one rectangle.
+    for (int tile = 0; tile < JOURNAL_TILE_COUNT; tile++)
+    {
+      if (stageSlot[tile] == JOURNAL_STAGE_EMPTY)
+        continue;
+      const uint8_t *delta = stageData + stageSlot[tile] * CANVAS_UNDO_TILE_BYTES;
+      if (isZero(delta, CANVAS_UNDO_TILE_BYTES))
+        continue;
+      size_t encoded = canvasPackBitsEncode(delta, CANVAS_UNDO_TILE_BYTES, out + pos + JOURNAL_TILE_HEADER);
+      writeU16(out + pos, tile);
+      writeU16(out + pos + 2, encoded);
+      pos += JOURNAL_TILE_HEADER + encoded;
+    }
+
+    JournalEntry &e = entries[(entryFirst + entryCount) % CANVAS_UNDO_MAX_RECORDS];
+    e.offset = offset;
+    e.length = pos;
+    entryCount++;
+    cursor++;
+    strokeRecords++;
+    dropOrphans();
+  }
+
+  for (int i = 0; i < stageCount; i++)
+    stageSlot[stageTile[i]] = JOURNAL_STAGE_EMPTY;
+  stageCount = 0;
+}
+
+static void applyTileDelta(int tile, const uint8_t *encoded, size_t length)
+{
+  uint8_t delta[CANVAS_UNDO_TILE_BYTES];
+  if (tile >= JOURNAL_TILE_COUNT || canvasPackBitsDecode(encoded, length, delta, CANVAS_UNDO_TILE_BYTES) != CANVAS_UNDO_TILE_BYTES)
+    return;
+  uint8_t *dst = tilePointer(tile);
+  for (int r = 0; r < CANVAS_UNDO_TILE_SIZE; r++)
+    for (int b = 0; b < JOURNAL_TILE_ROW_BYTES; b++)
+      dst[r * (TFT_HOR_RES / 2) + b] ^= delta[r * JOURNAL_TILE_ROW_BYTES + b];
+  repaintTiles[tile >> 3] |= 0x80 >> (tile & 7);
+}
+
+/** @return The record's flags. */
+static uint8_t applyRecord(const uint8_t *record)
+{
+  int tileCount = readU16(record + 1);
+  uint32_t pos = JOURNAL_RECORD_HEADER;
+  for (int i = 0; i < tileCount; i++)
+  {
+    uint16_t tile = readU16(record + pos);
+    uint16_t length = readU16(record + pos + 2);
+    applyTileDelta(tile, record + pos + JOURNAL_TILE_HEADER, length);
+    pos += JOURNAL_TILE_HEADER + length;
+  }
+  return record[0];
+}
+
+/** Stream a spilled record from offset (its first byte, past the frame) one tile at a time. @return Its flags, or -1 on a read error. */
+static int applySpilledRecord(uint32_t offset)
+{
+  uint8_t header[JOURNAL_RECORD_HEADER];
+  if (!spillRead(offset, header, sizeof(header)))
+    return -1;
+  int tileCount = readU16(header + 1);
+  uint32_t pos = offset + JOURNAL_RECORD_HEADER;
+  for (int i = 0; i < tileCount; i++)
+  {
+    uint8_t tileHeader[JOURNAL_TILE_HEADER];
+    uint8_t encoded[CANVAS_PACKBITS_MAX_SIZE(CANVAS_UNDO_TILE_BYTES)];
+    if (!spillRead(pos, tileHeader, sizeof(tileHeader)))
+      return -1;
+    uint16_t length = readU16(tileHeader + 2);
+    if (length > sizeof(encoded) || !spillRead(pos + JOURNAL_TILE_HEADER, encoded, length))
+      return -1;
+    applyTileDelta(readU16(tileHeader), encoded, length);
+    pos += JOURNAL_TILE_HEADER + length;
+  }
+  return header[0];
+}
+
+/** Revert the newest applied record. @return Its flags, or -1 if there was nothing to undo. */
+static int undoOne()
+{
+  if (cursor == 0)
+    return -1;
+  if (cursor > spilledCount)
+  {
+    JournalEntry &e = entries[(entryFirst + cursor - spilledCount - 1) % CANVAS_UNDO_MAX_RECORDS];
+    cursor--;
+    return applyRecord(arena + e.offset);
+  }
+
+  uint32_t length;
+  int flags = -1;
+  if (spillRead(spillCursor - 4, (uint8_t *)&length, 4))
+    flags = applySpilledRecord(spillCursor - 4 - length);
+  if (flags < 0)
+  {
+    // The card let us down. Records on either side of it no longer line up with the canvas.
+    canvasJournalReset();
+    return -1;
+  }
+  uint32_t start = spillCursor - 8 - length;
+  spillCursor = start;
+  cursor--;
+  return flags;
+}
+
+/** Reapply the oldest undone record. @return Its flags, or -1 if there was nothing to redo. */
+static int redoOne()
+{
+  if (cursor == spilledCount + entryCount)
+    return -1;
+  if (cursor >= spilledCount)
+  {
+    JournalEntry &e = entries[(entryFirst + cursor - spilledCount) % CANVAS_UNDO_MAX_RECORDS];
+    cursor++;
+    return applyRecord(arena + e.offset);
+  }
+
+  uint32_t length;
+  int flags = -1;
+  if (spillRead(spillCursor, (uint8_t *)&length, 4))
+    flags = applySpilledRecord(spillCursor + 4);
+  if (flags < 0)
+  {
+    canvasJournalReset();
+    return -1;
+  }
+  spillCursor += length + 8;
+  cursor++;
+  return flags;
+}
+
+/** Flags of the record redo would apply next, or -1 if there is none. */
+static int peekRedoFlags()
+{
+  if (cursor == spilledCount + entryCount)
+    return -1;
+  if (cursor >= spilledCount)
+    return arena[entries[(entryFirst + cursor - spilledCount) % CANVAS_UNDO_MAX_RECORDS].offset];
+  uint8_t flags;
+  if (!spillRead(spillCursor + 4, &flags, 1))
+    return -1;
+  return flags;
+}
+
+/** Send the tiles touched by the last undo or redo to the panel, joining horizontal neighbours. */
+static void repaintChangedTiles()
+{
+  bool batched = canvasIsBatchedFlush();
+  if (!batched)
+    tft.startWrite();
+  for (int ty = 0; ty < JOURNAL_TILES_Y; ty++)
+  {
+    int tx = 0;
+    while (tx < JOURNAL_TILES_X)
+    {
+      int tile = ty * JOURNAL_TILES_X + tx;
+      if (!(repaintTiles[tile >> 3] & (0x80 >> (tile & 7))))
+      {
+        tx++;
+        continue;
+      }
+      int runStart = tx;
+      while (tx < JOURNAL_TILES_X && (repaintTiles[(tile + tx - runStart) >> 3] & (0x80 >> ((tile + tx - runStart) & 7))))
+        tx++;
+      int x = runStart * CANVAS_UNDO_TILE_SIZE;
+      int y = ty * CANVAS_UNDO_TILE_SIZE;
+      int w = (tx - runStart) * CANVAS_UNDO_TILE_SIZE;
+      if (batched)
+        canvasMarkDirty(x, y, w, CANVAS_UNDO_TILE_SIZE);
+      else
+        drawFramebuffer(x, y, w, CANVAS_UNDO_TILE_SIZE);
+    }
+  }
+  if (!batched)
+    tft.endWrite();
+}
+
+/**
+ * Allocate the undo arena and staging area, about 24 KB together. Undo stays disabled if this fails.
+ * @return True if undo is available.
+ */
+bool canvasJournalInit()
+{
+  if (arena)
+    return true;
+  arena = (uint8_t *)malloc(CANVAS_UNDO_ARENA_SIZE);
+  stageData = (uint8_t *)malloc(CANVAS_UNDO_STAGE_TILES * CANVAS_UNDO_TILE_BYTES);
+  if (!arena || !stageData)
+  {
+    free(arena);
+    free(stageData);
+    arena = nullptr;
+    stageData = nullptr;
+    return false;
+  }
+  memset(stageSlot, JOURNAL_STAGE_EMPTY, sizeof(stageSlot));
+  canvasJournalReset();
+  return true;
+}
+
+/**
+ * Have the journal hold a bus lock around each access to the spill file. A stroke can spill from
+ * any draw call, so the caller cannot take the lock itself.
+ */
+void canvasJournalSetBusLock(canvas_bus_fn_t lock, canvas_bus_fn_t unlock)
+{
+  busLock = lock;
+  busUnlock = unlock;
+}
+
+/** Forget all history, e.g. after a different sketch is loaded into the framebuffer. */
+void canvasJournalReset()
+{
+  for (int i = 0; i < stageCount; i++)
+    stageSlot[stageTile[i]] = JOURNAL_STAGE_EMPTY;
+  stageCount = 0;
+  strokeOpen = false;
+  entryFirst = 0;
+  entryCount = 0;
+  spilledCount = 0;
+  spillEnd = 0;
+  spillCursor = 0;
+  cursor = 0;
+  spillClose();
+}
+
+/** Start recording. Everything written to the framebuffer until canvasJournalEndStroke undoes as one step. */
+void canvasJournalBeginStroke()
+{
+  if (!arena)
+    return;
+  canvasJournalEndStroke();
+  strokeOpen = true;
+  strokeRecords = 0;
+}
+
+void canvasJournalEndStroke()
+{
+  if (!strokeOpen)
+    return;
+  commitStage();
+  strokeOpen = false;
+}
+
+/** Called by the framebuffer writers before they touch x0..x1 on row y, already clipped to the screen. */
+void canvasJournalCaptureSpan(int x0, int x1, int y)
+{
+  if (!strokeOpen)
+    return;
+  int rowTile = (y / CANVAS_UNDO_TILE_SIZE) * JOURNAL_TILES_X;
+  int tx0 = x0 / CANVAS_UNDO_TILE_SIZE;
+  int tx1 = x1 / CANVAS_UNDO_TILE_SIZE;
+
+  // The whole span must land in one record, so commit first if its new tiles would not fit.
+  int fresh = 0;
+  for (int tx = tx0; tx <= tx1; tx++)
+    if (stageSlot[rowTile + tx] == JOURNAL_STAGE_EMPTY)
+      fresh++;
+  if (fresh == 0)
+    return;
+  if (stageCount + fresh > CANVAS_UNDO_STAGE_TILES)
+    commitStage();
+
+  for (int tx = tx0; tx <= tx1; tx++)
+  {
+    int tile = rowTile + tx;
+    if (stageSlot[tile] != JOURNAL_STAGE_EMPTY)
+      continue;
+    uint8_t *dst = stageData + stageCount * CANVAS_UNDO_TILE_BYTES;
+    const uint8_t *src = tilePointer(tile);
+    for (int r = 0; r < CANVAS_UNDO_TILE_SIZE; r++)
+      memcpy(dst + r * JOURNAL_TILE_ROW_BYTES, src + r * (TFT_HOR_RES / 2), JOURNAL_TILE_ROW_BYTES);
+    stageSlot[tile] = stageCount;
+    stageTile[stageCount++] = tile;
+  }
+}
+
+/** Undo the last stroke and repaint the tiles it changed. @return False if there was nothing to undo. */
+bool canvasUndo()
+{
+  if (!arena)
+    return false;
+  canvasJournalEndStroke();
+  memset(repaintTiles, 0, sizeof(repaintTiles));
+  int flags = undoOne();
+  if (flags < 0)
+    return false;
+  while (flags & JOURNAL_FLAG_JOINED)
+  {
+    flags = undoOne();
+    if (flags < 0)
+      break;
+  }
+  repaintChangedTiles();
+  return true;
+}
+
+/** Redo the last undone stroke and repaint the tiles it changed. @return False if there was nothing to redo. */
+bool canvasRedo()
+{
+  if (!arena)
+    return false;
+  canvasJournalEndStroke();
+  memset(repaintTiles, 0, sizeof(repaintTiles));
+  if (redoOne() < 0)
+    return false;
+  int next;
+  while ((next = peekRedoFlags()) >= 0 && (next & JOURNAL_FLAG_JOINED))
+  {
+    if (redoOne() < 0)
+      break;
+  }
+  repaintChangedTiles();
+  return true;
+}
+
+bool canvasCanUndo()
+{
+  return arena && cursor > 0;
+}
+
+bool canvasCanRedo()
+{
+  return arena && cursor < spilledCount + entryCount;
+}
@@ -0,0 +1,226 @@
+#include "canvas.h"
+#include <stdlib.h>
+#include <string.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Box-filtered downscaling of packed 4bpp rows, for sketch previews and thumbnails.
+
+/**
+ * Working state for one downscale. Each output pixel owns a box of whole source pixels, so any
+ * output size works, including fractional scale factors. Boxes keep a count per palette index
+ * rather than summed colors, so resolving a box is a handful of lookups in the palette-distance
+ * table and a box of one color always comes back as exactly that color.
+ */
+struct CanvasScaler
+{
+  int w, h;
+  canvas_scaled_row_fn_t rowFn;
+  void *rowCtx;
+  /** Output row being accumulated, and the first source row that belongs to the next one. */
+  int outY;
+  int nextRowStart;
+  /** Output column for every source column. */
+  uint16_t destColumn[TFT_HOR_RES];
+  /** Squared distance between every pair of palette colors, weighted like the eye (green counts most). */
+  uint32_t distance[16][16];
+  /** w * 16 counts, then w bitmasks of which indices appear in each box, then w resolved indices. */
+  uint16_t *counts;
+  uint16_t *present;
+  uint8_t *indices;
+};
+
+/** Panel output for canvasPreviewBegin, rows go straight out as DMA writes. */
+struct CanvasPreview
+{
+  CanvasScaler *scaler;
+  uint16_t paletteSwapped[16];
+  /** Two output rows, so one converts while the other is sent. */
+  uint16_t *lines[2];
+  int lineIndex;
+};
+
+/** First source row (or column) of output row (or column) i when src is shrunk to dst. */
+static inline int boxStart(int i, int src, int dst)
+{
+  return (int)((int64_t)i * src / dst);
+}
+
+static void buildDistanceTable(uint32_t distance[16][16])
+{
+  for (int i = 0; i < 16; i++)
+  {
+    for (int j = 0; j < 16; j++)
+      distance[i][j] = canvasColorDistance(draw_color_palette[i], draw_color_palette[j]);
+  }
+}
+
+/**
+ * Start shrinking a TFT_HOR_RES x TFT_VER_RES image to w x h. Feed it every source row in order
+ * with canvasScalerRow; rowFn receives each output row as one palette index per pixel.
+ * Needs about 35 bytes of heap per output column.
+ * @return Null if w or h is out of range or the memory could not be allocated.
+ */
+CanvasScaler *canvasScalerCreate(int w, int h, canvas_scaled_row_fn_t rowFn, void *ctx)
+{
+  if (w < 1 || w > TFT_HOR_RES || h < 1 || h > TFT_VER_RES)
+    return nullptr;
+  // Box counts are 16 bit.
+  if ((TFT_HOR_RES / w + 1) * (TFT_VER_RES / h + 1) > UINT16_MAX)
+    return nullptr;
+  size_t size = sizeof(CanvasScaler) + w * 16 * sizeof(uint16_t) + w * sizeof(uint16_t) + w;
+  CanvasScaler *s = (CanvasScaler *)malloc(size);
+  if (!s)
+    return nullptr;
+  s->w = w;
+  s->h = h;
+  s->rowFn = rowFn;
+  s->rowCtx = ctx;
+  s->outY = 0;
+  s->nextRowStart = boxStart(1, TFT_VER_RES, h);
+  s->counts = (uint16_t *)(s + 1);
+  s->present = s->counts + w * 16;
+  s->indices = (uint8_t *)(s->present + w);
+  memset(s->counts, 0, w * 16 * sizeof(uint16_t) + w * sizeof(uint16_t));
+
+  for (int ox = 0; ox < w; ox++)
+    for (int x = boxStart(ox, TFT_HOR_RES, w); x < boxStart(ox + 1, TFT_HOR_RES, w); x++)
+      s->destColumn[x] = ox;
+  buildDistanceTable(s->distance);
+  return s;
+}
+
+void canvasScalerFree(CanvasScaler *s)
+{
+  free(s);
+}
+
+/** Pick the palette index closest to the average color of each box, then hand the row over. */
+static void emitRow(CanvasScaler *s)
+{
+  for (int ox = 0; ox < s->w; ox++)
+  {
+    uint16_t mask = s->present[ox];
+    uint16_t *count = s->counts + ox * 16;
+    if (!(mask & (mask - 1)))
+    {
+      // One color (the usual case on line art), nothing to weigh.
+      s->indices[ox] = mask ? __builtin_ctz(mask) : 0;
+    }
+    else
+    {
+      // Sum of squared distances to every pixel in the box; its minimum is the nearest color to the mean.
+      uint32_t bestCost = UINT32_MAX;
+      uint8_t best = 0;
+      for (int j = 0; j < 16; j++)
+      {
+        uint32_t cost = 0;
+        for (uint16_t m = mask; m; m &= m - 1)
+        {
+          int i = __builtin_ctz(m);
+          cost += count[i] * s->distance[i][j];
+        }
+        if (cost < bestCost)
+        {
+          bestCost = cost;
+          best = j;
+        }
+      }
+      s->indices[ox] = best;
+    }
+    if (mask)
+      memset(count, 0, 16 * sizeof(uint16_t));
+    s->present[ox] = 0;
+  }
+  s->rowFn(s->rowCtx, s->outY, s->indices);
+  s->outY++;
+  s->nextRowStart = boxStart(s->outY + 1, TFT_VER_RES, s->h);
+}
+
+/**
+ * Add source row srcY (TFT_HOR_RES packed pixels) to the downscale. Rows must arrive in order.
+ * The signature matches fbox_row_fn_t so a scaler can sit directly behind fboxRead.
+ */
+void canvasScalerRow(void *scaler, int srcY, const uint8_t *row)
+{
+  CanvasScaler *s = (CanvasScaler *)scaler;
+  if (s->outY >= s->h)
+    return;
+  for (int b = 0; b < TFT_HOR_RES / 2; b++)
+  {
+    uint8_t left = row[b] >> 4;
+    uint8_t right = row[b] & 0x0F;
+    int c0 = s->destColumn[2 * b];
+    int c1 = s->destColumn[2 * b + 1];
+    s->counts[c0 * 16 + left]++;
+    s->counts[c1 * 16 + right]++;
+    s->present[c0] |= 1 << left;
+    s->present[c1] |= 1 << right;
+  }
+  if (srcY + 1 >= s->nextRowStart)
+    emitRow(s);
+}
+
+static void previewRowToPanel(void *ctx, int, const uint8_t *indices)
+{
+  CanvasPreview *p = (CanvasPreview *)ctx;
+  uint16_t *line = p->lines[p->lineIndex];
+  p->lineIndex ^= 1;
+  for (int ox = 0; ox < p->scaler->w; ox++)
+    line[ox] = p->paletteSwapped[indices[ox]];
+  // The address window covers the whole preview, so consecutive rows just continue it.
+  tft.writePixelsDMA(line, p->scaler->w, false);
+}
+
+/**
+ * Start drawing a w x h box-filtered preview at x,y. Feed source rows to canvasPreviewRow, then call
+ * canvasPreviewEnd. Holds the panel between the two, so nothing else may draw in the meantime.
+ * @return Null if the memory could not be allocated.
+ */
+CanvasPreview *canvasPreviewBegin(int x, int y, int w, int h)
+{
+  CanvasPreview *p = (CanvasPreview *)malloc(sizeof(CanvasPreview) + 2 * w * sizeof(uint16_t));
+  if (!p)
+    return nullptr;
+  p->scaler = canvasScalerCreate(w, h, previewRowToPanel, p);
+  if (!p->scaler)
+  {
+    free(p);
+    return nullptr;
+  }
+  for (int c = 0; c < 16; c++)
+    p->paletteSwapped[c] = (uint16_t)((draw_color_palette[c] << 8) | (draw_color_palette[c] >> 8));
+  p->lines[0] = (uint16_t *)(p + 1);
+  p->lines[1] = p->lines[0] + w;
+  p->lineIndex = 0;
+
+  tft.startWrite();
+  tft.setAddrWindow(x, y, w, h);
+  return p;
+}
+
+/** Source row callback for a preview, compatible with fbox_row_fn_t. */
+void canvasPreviewRow(void *preview, int srcY, const uint8_t *row)
+{
+  canvasScalerRow(((CanvasPreview *)preview)->scaler, srcY, row);
+}
+
+/** Finish a preview. Rows that never arrived (a damaged file) are left as they were on the panel. */
+void canvasPreviewEnd(CanvasPreview *p)
+{
+  tft.waitDMA();
+  tft.endWrite();
+  canvasScalerFree(p->scaler);
+  free(p);
+}
+
+/** Draw the current canvas shrunk to w x h at x,y. */
+bool canvasPreviewFramebuffer(int x, int y, int w, int h)
+{
+  CanvasPreview *p = canvasPreviewBegin(x, y, w, h);
+  if (!p)
+    return false;
+  for (int py = 0; py < TFT_VER_RES; py++)
+    canvasPreviewRow(p, py, canvas_framebuffer + py * (TFT_HOR_RES / 2));
+  canvasPreviewEnd(p);
+  return true;
+}
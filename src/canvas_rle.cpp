@@ -0,0 +1,78 @@
+#include "canvas.h"
+#include <string.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// PackBits run length coding, shared by the undo journal and the sketch file format.
+
+/**
+ * Encode len bytes of src as PackBits into dst, which must hold CANVAS_PACKBITS_MAX_SIZE(len) bytes.
+ * Header n < 128 is followed by n + 1 literal bytes, header n > 128 by one byte repeated 257 - n times.
+ * Runs shorter than 3 stay inside literals so the output never grows past the bound.
+ * @return Number of bytes written to dst.
+ */
+size_t canvasPackBitsEncode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+  size_t in = 0;
+  size_t out = 0;
+  while (in < len)
+  {
+    size_t run = 1;
+    while (in + run < len && run < 128 && src[in + run] == src[in])
+      run++;
+    if (run >= 3)
+    {
+      dst[out++] = (uint8_t)(257 - run);
+      dst[out++] = src[in];
+      in += run;
+      continue;
+    }
+
+    // Literal, up to the next run of 3 or more.
+    size_t lit = 0;
+    while (in + lit < len && lit < 128)
+    {
+      size_t p = in + lit;
+      if (p + 2 < len && src[p] == src[p + 1] && src[p] == src[p + 2])
+        break;
+      lit++;
+    }
+    dst[out++] = (uint8_t)(lit - 1);
+    memcpy(dst + out, src + in, lit);
+    out += lit;
+    in += lit;
+  }
+  return out;
+}
+
+/**
+ * Decode PackBits from src into dst. Stops at the end of either buffer, so corrupt input can never
+ * write past dstLen.
+ * @return Number of bytes written to dst. Anything short of the expected size means the input was bad.
+ */
+size_t canvasPackBitsDecode(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstLen)
+{
+  size_t in = 0;
+  size_t out = 0;
+  while (in < srcLen && out < dstLen)
+  {
+    uint8_t header = src[in++];
+    if (header < 128)
+    {
+      size_t lit = header + 1;
+      if (lit > srcLen - in || lit > dstLen - out)
+        break;
+      memcpy(dst + out, src + in, lit);
+      in += lit;
+      out += lit;
+    }
+    else if (header > 128)
+    {
+      size_t run = 257 - header;
+      if (in >= srcLen || run > dstLen - out)
+        break;
+      memset(dst + out, src[in++], run);
+      out += run;
+    }
+  }
+  return out;
+}
@@ -0,0 +1,450 @@
+#include "friend_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Friend list cache, see friend_cache.h for the file layout.
+
+static const uint8_t cacheMagic[4] = {'F', 'B', 'F', 'C'};
+
+/** FriendTableParser::state */
+enum
+{
+  PARSE_BEFORE_ARRAY,
+  PARSE_IN_ARRAY,
+  PARSE_IN_STRING,
+  PARSE_ESCAPE,
+  PARSE_UNICODE
+};
+
+/** Gathers small writes so storage sees a few large ones. */
+struct CacheWriter
+{
+  friend_cache_write_fn_t write;
+  void *ctx;
+  uint8_t buffer[256];
+  size_t used;
+  bool ok;
+};
+
+static void flushWriter(CacheWriter *w)
+{
+  if (w->ok && w->used && w->write(w->ctx, w->buffer, w->used) != w->used)
+    w->ok = false;
+  w->used = 0;
+}
+
+static void put(CacheWriter *w, const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  while (len > 0 && w->ok)
+  {
+    if (w->used == sizeof(w->buffer))
+      flushWriter(w);
+    size_t n = sizeof(w->buffer) - w->used;
+    if (n > len)
+      n = len;
+    memcpy(w->buffer + w->used, p, n);
+    w->used += n;
+    p += n;
+    len -= n;
+  }
+}
+
+/** Buffered source, so reading a name is not one storage call per field. */
+struct CacheReader
+{
+  friend_cache_read_fn_t read;
+  void *ctx;
+  uint8_t buffer[256];
+  size_t length;
+  size_t position;
+};
+
+static bool take(CacheReader *r, void *data, size_t len)
+{
+  uint8_t *p = (uint8_t *)data;
+  while (len > 0)
+  {
+    if (r->position == r->length)
+    {
+      r->length = r->read(r->ctx, r->buffer, sizeof(r->buffer));
+      r->position = 0;
+      if (r->length == 0)
+        return false;
+    }
+    size_t n = r->length - r->position;
+    if (n > len)
+      n = len;
+    memcpy(p, r->buffer + r->position, n);
+    r->position += n;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+void friendTableInit(FriendTable *table, uint32_t maxBytes)
+{
+  table->block = nullptr;
+  table->capacity = 0;
+  table->used = 0;
+  table->count = 0;
+  table->maxBytes = maxBytes < UINT16_MAX ? maxBytes : UINT16_MAX;
+  table->truncated = false;
+}
+
+/** Release the block and empty the table. It can be filled again afterwards. */
+void friendTableFree(FriendTable *table)
+{
+  free(table->block);
+  friendTableInit(table, table->maxBytes);
+}
+
+static inline uint8_t *offsetSlot(const FriendTable *table, uint32_t i)
+{
+  return table->block + table->capacity - 2 * (i + 1);
+}
+
+/**
+ * Append a name of len bytes. The block doubles as needed up to maxBytes.
+ * @return False if it would not fit, which also marks the table truncated.
+ */
+bool friendTableAdd(FriendTable *table, const char *name, size_t len)
+{
+  uint32_t need = table->used + len + 1 + 2 * (table->count + 1);
+  // Once one name is dropped, drop the rest too, so the table is always a prefix of the list.
+  if (table->truncated || need > table->maxBytes || table->count >= FRIEND_CACHE_MAX_FRIENDS)
+  {
+    table->truncated = true;
+    return false;
+  }
+  if (need > table->capacity)
+  {
+    uint32_t capacity = table->capacity ? table->capacity : FRIEND_TABLE_INITIAL_BYTES;
+    while (capacity < need)
+      capacity *= 2;
+    if (capacity > table->maxBytes)
+      capacity = table->maxBytes;
+    uint8_t *block = (uint8_t *)realloc(table->block, capacity);
+    if (!block)
+    {
+      table->truncated = true;
+      return false;
+    }
+    // Offsets sit at the end, move them to the new end.
+    uint32_t offsetBytes = 2 * table->count;
+    memmove(block + capacity - offsetBytes, block + table->capacity - offsetBytes, offsetBytes);
+    table->block = block;
+    table->capacity = capacity;
+  }
+  uint8_t *slot = offsetSlot(table, table->count);
+  slot[0] = table->used & 0xFF;
+  slot[1] = table->used >> 8;
+  memcpy(table->block + table->used, name, len);
+  table->block[table->used + len] = 0;
+  table->used += len + 1;
+  table->count++;
+  return true;
+}
+
+const char *friendTableName(const FriendTable *table, uint32_t i)
+{
+  if (i >= table->count)
+    return "";
+  const uint8_t *slot = offsetSlot(table, i);
+  return (const char *)table->block + (slot[0] | (slot[1] << 8));
+}
+
+/** Same names in the same order. Offsets follow from the names, so only those are compared. */
+bool friendTableEqual(const FriendTable *a, const FriendTable *b)
+{
+  return a->count == b->count && a->used == b->used && (a->used == 0 || memcmp(a->block, b->block, a->used) == 0);
+}
+
+void friendTableSwap(FriendTable *a, FriendTable *b)
+{
+  FriendTable t = *a;
+  *a = *b;
+  *b = t;
+}
+
+/** Start scanning a response into table, which should be empty. */
+void friendTableParseBegin(FriendTableParser *parser, FriendTable *table)
+{
+  parser->table = table;
+  parser->result = FRIEND_PARSE_MORE;
+  parser->state = PARSE_BEFORE_ARRAY;
+  parser->depth = 0;
+  parser->capture = false;
+  parser->hexDigits = 0;
+  parser->codepoint = 0;
+  parser->nameLength = 0;
+}
+
+static inline void nameByte(FriendTableParser *parser, uint8_t c)
+{
+  // Names past FRIEND_CACHE_NAME_MAX are cut short.
+  if (parser->capture && parser->nameLength < FRIEND_CACHE_NAME_MAX)
+    parser->name[parser->nameLength++] = c;
+}
+
+/** Append a \u escape as UTF-8. Surrogate halves are not paired up and become '?'. */
+static void nameCodepoint(FriendTableParser *parser, uint16_t cp)
+{
+  if (cp < 0x80)
+  {
+    nameByte(parser, cp);
+  }
+  else if (cp < 0x800)
+  {
+    nameByte(parser, 0xC0 | (cp >> 6));
+    nameByte(parser, 0x80 | (cp & 0x3F));
+  }
+  else if (cp >= 0xD800 && cp < 0xE000)
+  {
+    nameByte(parser, '?');
+  }
+  else
+  {
+    nameByte(parser, 0xE0 | (cp >> 12));
+    nameByte(parser, 0x80 | ((cp >> 6) & 0x3F));
+    nameByte(parser, 0x80 | (cp & 0x3F));
+  }
+}
+
+static int hexValue(uint8_t c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * Feed the next len bytes of the response. Chunks may split anywhere, including inside a name or
+ * an escape. Names are added to the table as each one closes.
+ * @return FRIEND_PARSE_DONE once the array has closed, after which further input is ignored.
+ */
+friend_parse_result_id_t friendTableParse(FriendTableParser *parser, const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len && parser->result == FRIEND_PARSE_MORE; i++)
+  {
+    uint8_t c = data[i];
+    switch (parser->state)
+    {
+    case PARSE_BEFORE_ARRAY:
+      if (c == '[')
+      {
+        parser->depth = 1;
+        parser->state = PARSE_IN_ARRAY;
+      }
+      else if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+      {
+        parser->result = FRIEND_PARSE_ERROR;
+      }
+      break;
+    case PARSE_IN_ARRAY:
+      // Commas, colons, whitespace and bare values (numbers, true, null) all fall through here.
+      if (c == '"')
+      {
+        parser->capture = parser->depth == 1;
+        parser->nameLength = 0;
+        parser->state = PARSE_IN_STRING;
+      }
+      else if (c == '[' || c == '{')
+      {
+        parser->depth++;
+      }
+      else if ((c == ']' || c == '}') && --parser->depth == 0)
+      {
+        parser->result = FRIEND_PARSE_DONE;
+      }
+      break;
+    case PARSE_IN_STRING:
+      if (c == '"')
+      {
+        if (parser->capture)
+          friendTableAdd(parser->table, parser->name, parser->nameLength);
+        parser->state = PARSE_IN_ARRAY;
+      }
+      else if (c == '\\')
+      {
+        parser->state = PARSE_ESCAPE;
+      }
+      else
+      {
+        nameByte(parser, c);
+      }
+      break;
+    case PARSE_ESCAPE:
+      parser->state = PARSE_IN_STRING;
+      switch (c)
+      {
+      case 'b':
+        nameByte(parser, '\b');
+        break;
+      case 'f':
+        nameByte(parser, '\f');
+        break;
+      case 'n':
+        nameByte(parser, '\n');
+        break;
+      case 'r':
+        nameByte(parser, '\r');
+        break;
+      case 't':
+        nameByte(parser, '\t');
+        break;
+      case 'u':
+        parser->hexDigits = 0;
+        parser->codepoint = 0;
+        parser->state = PARSE_UNICODE;
+        break;
+      default:
+        // \" \\ \/ and anything unknown stand for themselves.
+        nameByte(parser, c);
+        break;
+      }
+      break;
+    case PARSE_UNICODE:
+    {
+      int v = hexValue(c);
+      if (v < 0)
+      {
+        // Broken escape, keep the character and carry on with the string.
+        parser->state = PARSE_IN_STRING;
+        i--;
+        break;
+      }
+      parser->codepoint = (parser->codepoint << 4) | v;
+      if (++parser->hexDigits == 4)
+      {
+        nameCodepoint(parser, parser->codepoint);
+        parser->state = PARSE_IN_STRING;
+      }
+      break;
+    }
+    }
+  }
+  return parser->result;
+}
+
+void friendCacheInit(FriendCache *cache, uint32_t ttlMs)
+{
+  friendTableInit(&cache->friends);
+  cache->etag[0] = 0;
+  cache->fetchedMs = 0;
+  cache->fresh = false;
+  cache->ttlMs = ttlMs;
+  cache->version = 0;
+}
+
+/** True if the list was never confirmed this boot or has outlived its TTL. */
+bool friendCacheNeedsRefresh(const FriendCache *cache, uint32_t nowMs)
+{
+  return !cache->fresh || nowMs - cache->fetchedMs >= cache->ttlMs;
+}
+
+/** Take a list from a full (200) response. If it differs, friends is left holding the old list to free. */
+void friendCacheStore(FriendCache *cache, FriendTable *friends, const char *etag, uint32_t nowMs)
+{
+  if (!friendTableEqual(friends, &cache->friends))
+  {
+    friendTableSwap(friends, &cache->friends);
+    cache->version++;
+  }
+  size_t len = etag ? strlen(etag) : 0;
+  if (len >= FRIEND_CACHE_ETAG_MAX)
+    len = 0;
+  if (len)
+    memcpy(cache->etag, etag, len);
+  cache->etag[len] = 0;
+  friendCacheConfirm(cache, nowMs);
+}
+
+/** The server answered 304, the list we have is current. */
+void friendCacheConfirm(FriendCache *cache, uint32_t nowMs)
+{
+  cache->fetchedMs = nowMs;
+  cache->fresh = true;
+}
+
+/** Write the list and its ETag. Names longer than FRIEND_CACHE_NAME_MAX are truncated. */
+bool friendCacheSave(const FriendCache *cache, friend_cache_write_fn_t write, void *ctx)
+{
+  CacheWriter w;
+  w.write = write;
+  w.ctx = ctx;
+  w.used = 0;
+  w.ok = true;
+
+  uint32_t count = cache->friends.count;
+  size_t etagLen = strlen(cache->etag);
+  uint8_t header[FRIEND_CACHE_HEADER_SIZE];
+  memcpy(header, cacheMagic, 4);
+  header[4] = FRIEND_CACHE_VERSION;
+  header[5] = (uint8_t)etagLen;
+  header[6] = count & 0xFF;
+  header[7] = count >> 8;
+  put(&w, header, sizeof(header));
+  put(&w, cache->etag, etagLen);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const char *name = friendTableName(&cache->friends, i);
+    size_t nameLen = strlen(name);
+    uint8_t len = nameLen < FRIEND_CACHE_NAME_MAX ? nameLen : FRIEND_CACHE_NAME_MAX;
+    put(&w, &len, 1);
+    put(&w, name, len);
+  }
+  flushWriter(&w);
+  return w.ok;
+}
+
+/**
+ * Replace the cache contents with a saved list. It comes back marked stale, so the first look at
+ * it triggers a conditional refresh. On failure the cache is left empty.
+ */
+bool friendCacheLoad(FriendCache *cache, friend_cache_read_fn_t read, void *ctx)
+{
+  CacheReader r;
+  r.read = read;
+  r.ctx = ctx;
+  r.length = 0;
+  r.position = 0;
+
+  uint8_t header[FRIEND_CACHE_HEADER_SIZE];
+  friendTableFree(&cache->friends);
+  cache->etag[0] = 0;
+  cache->fresh = false;
+  cache->version++;
+  if (!take(&r, header, sizeof(header)) || memcmp(header, cacheMagic, 4) != 0 || header[4] != FRIEND_CACHE_VERSION)
+    return false;
+  size_t etagLen = header[5];
+  uint32_t count = header[6] | (header[7] << 8);
+  if (etagLen >= FRIEND_CACHE_ETAG_MAX || !take(&r, cache->etag, etagLen))
+  {
+    cache->etag[0] = 0;
+    return false;
+  }
+  cache->etag[etagLen] = 0;
+
+  char name[FRIEND_CACHE_NAME_MAX];
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint8_t len;
+    if (!take(&r, &len, 1) || !take(&r, name, len))
+    {
+      friendTableFree(&cache->friends);
+      cache->etag[0] = 0;
+      return false;
+    }
+    // Past the table's ceiling the rest is dropped, same as a fresh fetch would.
+    if (!friendTableAdd(&cache->friends, name, len))
+      break;
+  }
+  return true;
+}
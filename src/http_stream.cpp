@@ -0,0 +1,445 @@
+#include "http_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// HTTP/1.1 client over a kept-alive connection, see http_stream.h.
+
+/**
+ * Send a request line and headers. The connection is asked to stay open for the next request.
+ * @param contentType Body type, or null for a request without a body.
+ * @param contentLength Body size, or -1 to announce a chunked body written with httpChunkedWrite.
+ * @param extraHeaders More header lines, each ending in CRLF. May be null.
+ * @return Bytes written, 0 if the head did not fit or the write failed.
+ */
+size_t httpWriteRequestHead(http_write_fn_t write, void *ctx, const char *method, const char *host, uint16_t port, const char *path, const char *contentType, int32_t contentLength, const char *extraHeaders)
+{
+  char head[2 * HTTP_LINE_MAX];
+  char bodyHeaders[HTTP_LINE_MAX];
+  if (!contentType)
+    bodyHeaders[0] = 0;
+  else if (contentLength < 0)
+    snprintf(bodyHeaders, sizeof(bodyHeaders), "Content-Type: %s\r\nTransfer-Encoding: chunked\r\n", contentType);
+  else
+    snprintf(bodyHeaders, sizeof(bodyHeaders), "Content-Type: %s\r\nContent-Length: %ld\r\n", contentType, (long)contentLength);
+  int len = snprintf(head, sizeof(head),
+                     "%s %s HTTP/1.1\r\n"
+                     "Host: %s:%u\r\n"
+                     "%s"
+                     "%s"
+                     "Connection: keep-alive\r\n"
+                     "\r\n",
+                     method, path, host, (unsigned)port, bodyHeaders, extraHeaders ? extraHeaders : "");
+  if (len <= 0 || (size_t)len >= sizeof(head))
+    return 0;
+  return write(ctx, (const uint8_t *)head, len) == (size_t)len ? len : 0;
+}
+
+void httpChunkedBegin(HttpChunkedWriter *writer, http_write_fn_t write, void *ctx)
+{
+  writer->write = write;
+  writer->ctx = ctx;
+  writer->used = 0;
+  writer->bytesOnWire = 0;
+  writer->ok = true;
+}
+
+/** Send the buffered body bytes as one chunk, size line and all in a single write. */
+static void flushChunk(HttpChunkedWriter *writer)
+{
+  if (!writer->ok || writer->used == 0)
+    return;
+  char sizeLine[HTTP_CHUNK_PREFIX + 1];
+  int prefix = snprintf(sizeLine, sizeof(sizeLine), "%X\r\n", (unsigned)writer->used);
+  uint8_t *start = writer->buffer + HTTP_CHUNK_PREFIX - prefix;
+  memcpy(start, sizeLine, prefix);
+  memcpy(writer->buffer + HTTP_CHUNK_PREFIX + writer->used, "\r\n", 2);
+  size_t len = prefix + writer->used + 2;
+  if (writer->write(writer->ctx, start, len) != len)
+    writer->ok = false;
+  writer->bytesOnWire += len;
+  writer->used = 0;
+}
+
+/**
+ * Add body bytes. They are held until a full chunk has gathered, so callers can write in pieces
+ * of any size without each becoming a packet. Compatible with fbox_write_fn_t.
+ * @param writer An HttpChunkedWriter.
+ * @return len, or 0 once a write to the socket has failed.
+ */
+size_t httpChunkedWrite(void *writer, const uint8_t *data, size_t len)
+{
+  HttpChunkedWriter *w = (HttpChunkedWriter *)writer;
+  size_t remaining = len;
+  while (remaining > 0 && w->ok)
+  {
+    size_t n = HTTP_CHUNK_SIZE - w->used;
+    if (n > remaining)
+      n = remaining;
+    memcpy(w->buffer + HTTP_CHUNK_PREFIX + w->used, data, n);
+    w->used += n;
+    data += n;
+    remaining -= n;
+    if (w->used == HTTP_CHUNK_SIZE)
+      flushChunk(w);
+  }
+  return w->ok ? len : 0;
+}
+
+/** Send what is left and the terminating zero-length chunk. */
+bool httpChunkedEnd(HttpChunkedWriter *writer)
+{
+  static const uint8_t lastChunk[] = {'0', '\r', '\n', '\r', '\n'};
+  flushChunk(writer);
+  if (writer->ok && writer->write(writer->ctx, lastChunk, sizeof(lastChunk)) != sizeof(lastChunk))
+    writer->ok = false;
+  writer->bytesOnWire += sizeof(lastChunk);
+  return writer->ok;
+}
+
+/**
+ * One CRLF terminated line without the terminator.
+ * @param received Incremented by the bytes read, terminator included. May be null.
+ * @return Its length, or -1 on end of stream.
+ */
+static int readLine(http_read_fn_t read, void *ctx, char *line, size_t *received = nullptr)
+{
+  int len = 0;
+  uint8_t c;
+  while (read(ctx, &c, 1) == 1)
+  {
+    if (received)
+      (*received)++;
+    if (c == '\n')
+    {
+      if (len > 0 && line[len - 1] == '\r')
+        len--;
+      line[len] = 0;
+      return len;
+    }
+    // Overlong lines are cut short, only the status line and a few short headers matter here.
+    if (len < HTTP_LINE_MAX - 1)
+      line[len++] = c;
+  }
+  return -1;
+}
+
+/** Header value after "Name:", leading spaces skipped. Null if line is not that header. */
+static const char *headerValue(const char *line, const char *name)
+{
+  size_t n = strlen(name);
+  if (strncasecmp(line, name, n) != 0 || line[n] != ':')
+    return nullptr;
+  line += n + 1;
+  while (*line == ' ' || *line == '\t')
+    line++;
+  return line;
+}
+
+static int readResponseHead(http_read_fn_t read, void *ctx, HttpResponse *response, size_t *received)
+{
+  char line[HTTP_LINE_MAX];
+  response->status = -1;
+  response->contentLength = -1;
+  response->rangeStart = -1;
+  response->rangeTotal = -1;
+  response->chunked = false;
+  response->keepAlive = false;
+  response->etag[0] = 0;
+  if (readLine(read, ctx, line, received) < 12 || strncmp(line, "HTTP/1.", 7) != 0)
+    return -1;
+  // HTTP/1.0 servers close unless they say otherwise.
+  response->keepAlive = line[7] != '0';
+  int status = atoi(line + 9);
+  int len;
+  while ((len = readLine(read, ctx, line, received)) > 0)
+  {
+    const char *value;
+    if ((value = headerValue(line, "Content-Length")))
+      response->contentLength = atol(value);
+    else if ((value = headerValue(line, "Content-Range")))
+    {
+      // bytes <first>-<last>/<total>, the total may be *.
+      const char *slash = strchr(value, '/');
+      if (strncasecmp(value, "bytes ", 6) == 0 && value[6] != '*')
+        response->rangeStart = atol(value + 6);
+      if (slash && slash[1] != '*')
+        response->rangeTotal = atol(slash + 1);
+    }
+    else if ((value = headerValue(line, "Transfer-Encoding")))
+      response->chunked = strstr(value, "chunked") != nullptr;
+    else if ((value = headerValue(line, "Connection")))
+      response->keepAlive = strncasecmp(value, "close", 5) != 0;
+    else if ((value = headerValue(line, "ETag")) && strlen(value) < HTTP_ETAG_MAX)
+      strcpy(response->etag, value);
+  }
+  if (len != 0)
+    return -1;
+  response->status = status;
+  return status;
+}
+
+/**
+ * Read the status line and headers of a response, leaving the stream at the start of the body.
+ * @return Status code, or -1 if the response was cut off or malformed.
+ */
+int httpReadResponseHead(http_read_fn_t read, void *ctx, HttpResponse *response)
+{
+  return readResponseHead(read, ctx, response, nullptr);
+}
+
+/** True if the response to a request carries no body whatever its headers say. */
+static bool hasNoBody(const HttpResponse *response)
+{
+  return response->status == 204 || response->status == 304 || (response->status >= 100 && response->status < 200);
+}
+
+/** Start reading the body of a response whose head httpReadResponseHead has just read. */
+void httpBodyBegin(HttpBodyReader *body, http_read_fn_t read, void *ctx, HttpResponse *response)
+{
+  body->read = read;
+  body->ctx = ctx;
+  body->response = response;
+  body->left = response->contentLength > 0 ? response->contentLength : 0;
+  body->started = false;
+  body->failed = false;
+  body->done = hasNoBody(response) || (!response->chunked && response->contentLength == 0);
+}
+
+/** Move on to the next chunk. @return False at the end of the body or on bad framing. */
+static bool nextChunk(HttpBodyReader *body)
+{
+  char line[HTTP_LINE_MAX];
+  // Each chunk's data is followed by an empty line.
+  if (body->started && readLine(body->read, body->ctx, line) != 0)
+  {
+    body->failed = true;
+    return false;
+  }
+  body->started = true;
+  if (readLine(body->read, body->ctx, line) < 0)
+  {
+    body->failed = true;
+    return false;
+  }
+  body->left = strtoul(line, nullptr, 16);
+  if (body->left > 0)
+    return true;
+  // Skip any trailers up to the blank line that ends the body.
+  int len;
+  while ((len = readLine(body->read, body->ctx, line)) > 0)
+    ;
+  body->failed = len != 0;
+  body->done = !body->failed;
+  return false;
+}
+
+/**
+ * Read up to len bytes of body. Compatible with fbox_read_fn_t, so a decoder can pull straight off
+ * the socket. A body with neither length nor chunking runs to the end of the stream, after which
+ * response->keepAlive is false.
+ * @param body An HttpBodyReader.
+ * @return Bytes read, 0 at the end of the body or on error; check done and failed to tell which.
+ */
+size_t httpBodyRead(void *body, uint8_t *data, size_t len)
+{
+  HttpBodyReader *b = (HttpBodyReader *)body;
+  if (b->done || b->failed || len == 0)
+    return 0;
+  if (!b->response->chunked && b->response->contentLength < 0)
+  {
+    size_t n = b->read(b->ctx, data, len);
+    if (n == 0)
+    {
+      b->done = true;
+      b->response->keepAlive = false;
+    }
+    return n;
+  }
+  if (b->left == 0 && (!b->response->chunked || !nextChunk(b)))
+    return 0;
+  size_t n = b->read(b->ctx, data, len < b->left ? len : b->left);
+  if (n == 0)
+  {
+    b->failed = true;
+    return 0;
+  }
+  b->left -= n;
+  if (b->left == 0 && !b->response->chunked)
+    b->done = true;
+  return n;
+}
+
+/**
+ * Read the body after httpReadResponseHead, so the connection is ready for the next request.
+ * @param sink Receives the body a piece at a time. Null to discard it.
+ * @return False if the body was cut off or sink failed.
+ */
+bool httpReadBody(http_read_fn_t read, void *ctx, HttpResponse *response, http_write_fn_t sink, void *sinkCtx)
+{
+  HttpBodyReader body;
+  httpBodyBegin(&body, read, ctx, response);
+  uint8_t buffer[512];
+  size_t n;
+  while ((n = httpBodyRead(&body, buffer, sizeof(buffer))) > 0)
+  {
+    if (sink && sink(sinkCtx, buffer, n) != n)
+      return false;
+  }
+  return body.done;
+}
+
+void httpConnectionInit(HttpConnection *conn, const char *host, uint16_t port, http_write_fn_t write, http_read_fn_t read, http_connect_fn_t connect, http_close_fn_t close, void *ctx, http_closed_fn_t closed)
+{
+  conn->host = host;
+  conn->port = port;
+  conn->write = write;
+  conn->read = read;
+  conn->connect = connect;
+  conn->close = close;
+  conn->closed = closed;
+  conn->ctx = ctx;
+  conn->open = false;
+  conn->connects = 0;
+  conn->requests = 0;
+  conn->retries = 0;
+  conn->bytesOnWire = 0;
+}
+
+void httpConnectionClose(HttpConnection *conn)
+{
+  if (conn->open)
+    conn->close(conn->ctx);
+  conn->open = false;
+}
+
+/** The connection's write, counting what goes out. ctx is the HttpConnection. */
+static size_t connectionWrite(void *ctx, const uint8_t *data, size_t len)
+{
+  HttpConnection *conn = (HttpConnection *)ctx;
+  size_t n = conn->write(conn->ctx, data, len);
+  conn->bytesOnWire += n;
+  return n;
+}
+
+static bool sendRequest(HttpConnection *conn, const char *method, const char *path, const char *contentType, int32_t contentLength, const char *extraHeaders, http_body_fn_t body, void *bodyCtx)
+{
+  if (!httpWriteRequestHead(connectionWrite, conn, method, conn->host, conn->port, path, contentType, contentLength, extraHeaders))
+    return false;
+  if (!body)
+    return true;
+  if (contentLength >= 0)
+    return body(bodyCtx, connectionWrite, conn);
+  HttpChunkedWriter chunked;
+  httpChunkedBegin(&chunked, connectionWrite, conn);
+  return body(bodyCtx, httpChunkedWrite, &chunked) && httpChunkedEnd(&chunked);
+}
+
+/**
+ * Send a request on the kept-alive connection, opening it first if need be, and read the
+ * response head. Finish with httpFinishRequest before the next request.
+ * Servers drop idle connections without telling us, which only shows when a request sent on one
+ * gets nothing back. In that case, and only if not a single byte of response arrived and the
+ * server is known to have closed its end, the request is sent once more on a fresh connection. A
+ * read that merely timed out is never resent: the server may still be working on the request, and
+ * a POST it has already taken must not go twice.
+ * @param contentType Body type, or null for a request without a body.
+ * @param contentLength Body size, or -1 to send it chunked.
+ * @param body Writes the body, may be null.
+ * @return HTTP status, or -1 if no response could be had.
+ */
+int httpRequest(HttpConnection *conn, const char *method, const char *path, const char *contentType, int32_t contentLength, const char *extraHeaders, http_body_fn_t body, void *bodyCtx, HttpResponse *response)
+{
+  response->status = -1;
+  response->keepAlive = false;
+  for (int attempt = 0;; attempt++)
+  {
+    bool reused = conn->open;
+    if (!conn->open)
+    {
+      if (!conn->connect(conn->ctx, conn->host, conn->port))
+        return -1;
+      conn->open = true;
+      conn->connects++;
+    }
+    conn->bytesOnWire = 0;
+    size_t received = 0;
+    bool sent = sendRequest(conn, method, path, contentType, contentLength, extraHeaders, body, bodyCtx);
+    int status = sent ? readResponseHead(conn->read, conn->ctx, response, &received) : -1;
+    if (status >= 0)
+    {
+      conn->requests++;
+      return status;
+    }
+    // Ask before closing, which would make it true either way.
+    bool closedUnderUs = reused && received == 0 && attempt == 0 && conn->closed && conn->closed(conn->ctx);
+    httpConnectionClose(conn);
+    if (!closedUnderUs)
+      return -1;
+    conn->retries++;
+  }
+}
+
+/**
+ * Read the rest of a response from httpRequest and leave the connection ready for the next one,
+ * or close it if the server asked to or the body was cut off.
+ * @param sink Receives the body, null to discard it.
+ */
+bool httpFinishRequest(HttpConnection *conn, HttpResponse *response, http_write_fn_t sink, void *sinkCtx)
+{
+  bool ok = httpReadBody(conn->read, conn->ctx, response, sink, sinkCtx);
+  if (!ok || !response->keepAlive)
+    httpConnectionClose(conn);
+  return ok;
+}
+
+/**
+ * httpFinishRequest for a body already being pulled through httpBodyRead: discard whatever of it
+ * is left, then keep or close the connection the same way.
+ * @return False if the body was cut off.
+ */
+bool httpDrainBody(HttpConnection *conn, HttpBodyReader *body)
+{
+  uint8_t buffer[512];
+  while (httpBodyRead(body, buffer, sizeof(buffer)) > 0)
+    ;
+  if (!body->done || !body->response->keepAlive)
+    httpConnectionClose(conn);
+  return body->done;
+}
+
+/**
+ * Escape text for use in a URL path or query: everything but letters, digits and -._~ becomes %XX.
+ * @return False if it does not fit out, which is left empty.
+ */
+bool httpPercentEncode(const char *in, char *out, size_t size)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  size_t used = 0;
+  for (; *in; in++)
+  {
+    uint8_t c = (uint8_t)*in;
+    bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' || c == '~';
+    if (used + (plain ? 1 : 3) >= size)
+    {
+      if (size > 0)
+        out[0] = 0;
+      return false;
+    }
+    if (plain)
+    {
+      out[used++] = (char)c;
+    }
+    else
+    {
+      out[used++] = '%';
+      out[used++] = hex[c >> 4];
+      out[used++] = hex[c & 15];
+    }
+  }
+  if (size > 0)
+    out[used] = 0;
+  return size > 0;
+}
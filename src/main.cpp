@@ -2,10 +2,19 @@
 #include <LittleFS.h>
 #include <WiFi.h>
 #include <ArduinoJson.h>
-#include <HTTPClient.h>
 #include <LovyanGFX.h>
 // #include <AceRoutine.h>
 #include <LGFX_ESP32_ST7796S_XPT2046.hpp>
+#include "canvas.h"
+#include "fbox.h"
+#include "sketch_index.h"
+#include "friend_cache.h"
+#include "http_stream.h"
+#include "net_queue.h"
+#include "outbox.h"
+#include "boot_seq.h"
+#include "touch_stream.h"
+#include "spsc_ring.h"
 #include <SPI.h>
 #include <SD.h>
 #include "secrets.h"
@@ -26,12 +35,11 @@
 // To be implemented.
 
 // Display
-static LGFX tft;
-#define TFT_HOR_RES 480
-#define TFT_VER_RES 320
-
-/* Stores our image drawing buffer. About ~76.8kb! */
-uint8_t *canvas_framebuffer;
+LGFX tft;
+/** Strokes only update the framebuffer, dirty rectangles are sent to the panel once per frame. Comment out to draw straight to the panel. */
+#define CANVAS_BATCHED_FLUSH
+/** How far one press of the dither density buttons moves, out of CANVAS_DITHER_LEVELS. */
+#define DITHER_LEVEL_STEP 4
 
 /** Defines tools that we can use on the canvas. */
 typedef enum
@@ -114,46 +122,6 @@ static screen_id_t currentScreen = SCREEN_STARTUP;
 static screen_id_t lastScreen; // Used by drawFriendboxLoadingScreen to return to previous context after showing loading screen.
 static dropdown_id_t currentDropdown = DROPDOWN_NONE;
 
-/** Defines color palette for our 4-bit color frame buffer.
- *
- * @param 0 Black
- * @param 1 Gray
- * @param 2 White
- * @param 3 Red
- * @param 4 Meat
- * @param 5 Dark Brown
- * @param 6 Brown
- * @param 7 Orange
- * @param 8 Yellow
- * @param 9 Dark Green
- * @param 10 Green
- * @param 11 Slime Green
- * @param 12 Night Blue
- * @param 13 Sea Blue
- * @param 14 Sky Blue
- * @param 15 Cloud Blue
- *
- * Color palette is from https://androidarts.com/palette/16pal.htm
- */
-uint16_t draw_color_palette[16] = {
-    0x0000, // Black (0)
-    0x9CF3, // Gray (1)
-    0xFFFF, // White (2)
-    0xb926, // Red (3)
-    0xdb71, // Meat (4)
-    0x49e5, // Dark Brown (5)
-    0xa324, // Brown (6)
-    0xec46, // Orange (7)
-    0xf70d, // Yellow (8)
-    0x3249, // Dark Green (9)
-    0x4443, // Green (10)
-    0xa665, // Slime Green (11)
-    0x1926, // Night Blue (12)
-    0x02b0, // Sea Blue (13)
-    0x351d, // Sky Blue (14)
-    0xb6dd  // Cloud Blue (15)
-};
-
 uint16_t draw_rainbow_palette_index[7] = {
     3,
     7,
@@ -189,6 +157,10 @@ static int currentDrawColorIndex = 3;
 static int currentRainbowPaletteIndex = 0;
 static int currentBrushRadius = 5;
 static int currentSaveSlot = 0;
+/** Last point drawn in the current stroke, so the next sample can be joined to it. */
+static int strokeLastX, strokeLastY;
+/** True while the pen is down on the canvas and strokeLastX/Y are valid. */
+static bool strokeActive = false;
 
 // Touch
 uint16_t touchX, touchY, touchZ; // Z:0 = no touch, Z>0 = touching
@@ -196,14 +168,14 @@ uint16_t touchX, touchY, touchZ; // Z:0 = no touch, Z>0 = touching
 static unsigned long lastTouchTime = 0;
 // For how many milliseconds after last input should we count before registering release?
 #define UI_TOUCH_INPUT_BUFFER_MS
-/** How many "inputs" should we drop after intial touch and liftoff? */
-#define TOUCH_INPUT_BUFFER 10
-/** Stores how many times we have registered a touch input. */
-static uint16_t touch_count = 0;
-/** Touch inputs waiting to be drawn (insane asylum) */
-static uint16_t touch_queue_x[TOUCH_INPUT_BUFFER] = {0}, touch_queue_y[TOUCH_INPUT_BUFFER] = {0};
-/** Last written value(s) in the touch queue. */
-static uint8_t touch_queue_lastwrite_position = 0;
+/** Filled by touchTask at TOUCH_SAMPLE_HZ, drained by handleTouch. */
+TouchStream touchStream;
+/** Only touchTask uses it. */
+static TouchFilter touchFilterState;
+TaskHandle_t touchTaskHandle;
+#define TOUCH_TASK_STACK 3072
+/** Above loop() on the same core, so a long frame cannot hold sampling up. */
+#define TOUCH_TASK_PRIORITY 5
 
 /* SCREEN_CANVAS_MENU */
 #define SCREEN_CANVAS_UI_ACTION_BAR_DIST_FROM_TOP_PX 5
@@ -231,14 +203,18 @@ static const char *SCREEN_CANVAS_MENU_TOOL_BUTTON_LABEL[TOOL_DROPDOWN_BUTTON_COU
 #define SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON_COUNT 6
 UIButton SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON_COUNT];
 // static const char *SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON_LABEL = "Set Size";
-#define MENU_DROPDOWN_BUTTON_COUNT 5
+#define MENU_DROPDOWN_BUTTON_COUNT 7
 UIButton SCREEN_CANVAS_MENU_MENU_BUTTON[MENU_DROPDOWN_BUTTON_COUNT];
-static const char *SCREEN_CANVAS_MENU_MENU_BUTTON_LABEL[MENU_DROPDOWN_BUTTON_COUNT] = {"Home", "Send", "Restart", "Files", "Network"};
+static const char *SCREEN_CANVAS_MENU_MENU_BUTTON_LABEL[MENU_DROPDOWN_BUTTON_COUNT] = {"Home", "Send", "Restart", "Files", "Inbox", "Undo", "Redo"};
 #define SLOT_DROPDOWN_BUTTON_COUNT 7
 UIButton SCREEN_CANVAS_MENU_SAVE_BUTTON[SLOT_DROPDOWN_BUTTON_COUNT];
 static const char *SCREEN_CANVAS_MENU_SAVE_BUTTON_LABEL[SLOT_DROPDOWN_BUTTON_COUNT] = {"Slot 1", "Slot 2", "Slot 3", "Slot 4", "Slot 5", "Slot 6", "Slot 7"};
 UIButton SCREEN_CANVAS_MENU_LOAD_BUTTON[SLOT_DROPDOWN_BUTTON_COUNT];
 static const char *SCREEN_CANVAS_MENU_LOAD_BUTTON_LABEL[SLOT_DROPDOWN_BUTTON_COUNT] = {"Slot 1", "Slot 2", "Slot 3", "Slot 4", "Slot 5", "Slot 6", "Slot 7"};
+/** Where the load dropdown previews the slot being touched. */
+#define SLOT_PREVIEW_X_POS SCREEN_CANVAS_UI_ACTION_BUTTON_X_POS(1)
+#define SLOT_PREVIEW_Y_POS 160
+bool slotPreviewShown = false;
 
 /* SCREEN_SEND */
 #define SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT 5
@@ -255,20 +231,121 @@ static const char *SCREEN_FILE_BROWSER_FILE_BUTTON_LABEL[SCREEN_FILE_BROWSER_FIL
 #define SCREEN_FILE_BROWSER_NAVI_BUTTON_COUNT 4
 UIButton SCREEN_FILE_BROWSER_NAVI_BUTTON[SCREEN_FILE_BROWSER_NAVI_BUTTON_COUNT];
 static const char *SCREEN_FILE_BROWSER_NAVI_BUTTON_LABEL[SCREEN_FILE_BROWSER_NAVI_BUTTON_COUNT] = {"Back", "Sort", "/\\", "\\/"};
+/** Shown on the Sort button, indexed by sketch_sort_id_t. */
+static const char *SCREEN_FILE_BROWSER_SORT_LABEL[SKETCH_SORT_COUNT] = {"Name", "Date", "Size"};
 
 // Network
 #define LOCAL_HOSTNAME "friendbox"
-HTTPClient http;
+#define FRIENDBOX_SERVER_HOST "192.168.1.8"
+#define FRIENDBOX_SERVER_PORT 8000
+#define FRIENDS_PATH "/get/friends"
+/** GET lists the ids of sketches waiting for us, oldest first. GET /<id> fetches one, DELETE /<id> acknowledges it. */
+#define INBOX_PATH "/sketches/inbox"
+/** Takes a batch of sketches for the recipient named in ?to=, see writeOutboxBody. Idempotency-Key names the sender and sketches. */
+#define OUTBOX_SEND_PATH "/sketches/send"
+/** How long a read on the backend connection waits for the server before the request fails. */
+#define BACKEND_READ_TIMEOUT_MS 10000
+/** Time the cached access point gets to take us back and lease us an address before a full scan is started instead. */
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 5000
+
+/** Where bringing up the Wi-Fi link has got to, advanced by handleWifi. */
+typedef enum
+{
+  /** Joining the cached access point on its channel, no scan. The address still comes from DHCP. */
+  WIFI_STATE_FAST_CONNECT,
+  /** Scanning for the network and asking DHCP for an address. */
+  WIFI_STATE_SCAN_CONNECT,
+  WIFI_STATE_CONNECTED,
+  /** Lost after connecting, the driver reconnects on its own. */
+  WIFI_STATE_DISCONNECTED
+} wifi_state_id_t;
+
+wifi_state_id_t wifiState = WIFI_STATE_SCAN_CONNECT;
+static const char *wifiSsid;
+static const char *wifiPassword;
+static unsigned long wifiStartMs;
+/** Set by the Wi-Fi event task, acted on by handleWifi in loop(). */
+static volatile bool wifiGotIp = false;
+static volatile bool wifiLost = false;
+/** millis() when the canvas first came up, for the boot timing report. */
+static unsigned long bootToCanvasMs = 0;
 
 struct UIList
 {
-  std::vector<std::string> listItems;
   int page;
 };
 
 UIList friendListUI;
 UIList fileListUI;
 
+/** Address book shown on SCREEN_SEND. Paging reads only this, the server is asked in the background. */
+FriendCache friendCache;
+/** A friend list fetch queued on the network worker. Filled by the worker, read by the UI once it reports done. */
+struct FriendRefresh
+{
+  /** Id of the queued fetch, 0 if none is pending. */
+  uint32_t requestId;
+  /** Sent as If-None-Match, copied so the worker never touches friendCache. */
+  char etag[FRIEND_CACHE_ETAG_MAX];
+  FriendTable friends;
+  char responseEtag[FRIEND_CACHE_ETAG_MAX];
+};
+FriendRefresh friendRefresh;
+
+/** Downloads stay here until complete, so a dropped link resumes where it stopped instead of starting over. */
+#define INBOX_PARTIAL_DIR "/friendbox/inbox"
+/** Longest inbox id taken, terminator included; "inbox_<id>.fbox" has to fit SKETCH_INDEX_NAME_MAX. */
+#define INBOX_ID_MAX 28
+/** Goes at a download before giving up until the next check. Each one resumes where the last stopped. */
+#define INBOX_ATTEMPTS 3
+#define RECEIVE_BAND_ROWS 8
+#define RECEIVE_BAND_COUNT 4
+
+/** Decoded rows of an incoming sketch on their way from the network worker to the panel. */
+struct ReceiveBand
+{
+  int16_t y;
+  int16_t rows;
+  uint8_t pixels[RECEIVE_BAND_ROWS * TFT_HOR_RES / 2];
+};
+
+/** The inbox download in flight. The worker fills it, the UI reads name once the download reports done. */
+struct InboxReceive
+{
+  /** Id of the queued download, 0 if none is pending. */
+  uint32_t requestId;
+  /** File name in SKETCH_INDEX_DIR of the sketch received. */
+  char name[SKETCH_INDEX_NAME_MAX];
+  /** Rows as they decode, drawn on SCREEN_RECEIVED. The worker waits when the UI falls behind. */
+  SpscRing<ReceiveBand, RECEIVE_BAND_COUNT> bands;
+};
+InboxReceive inboxReceive;
+static bool receivedTouched = false;
+
+/** Network requests run here, on the core the Wi-Fi stack lives on, so the UI never waits on a socket. */
+NetWorker netWorker;
+TaskHandle_t networkTaskHandle;
+/** The one connection to the server, kept open between requests. Only the network worker uses it. */
+WiFiClient backendClient;
+HttpConnection backend;
+#define NETWORK_TASK_STACK 8192
+#define NETWORK_TASK_CORE 0
+/** Upload progress strip along the top of the canvas. */
+#define NETWORK_PROGRESS_STRIP_HEIGHT 3
+#define NETWORK_FAILED_STRIP_MS 2000
+static unsigned long networkStripClearAt = 0;
+/** Banner over the top of the canvas for news the strip cannot tell, such as a sketch the server refused. */
+#define NETWORK_NOTICE_HEIGHT 24
+#define NETWORK_NOTICE_MS 5000
+static unsigned long networkNoticeClearAt = 0;
+/**
+ * Sketches waiting to be sent, persisted on SD. The UI queues, the network worker drains; the lock
+ * covers the queue and its log, and is never held over the network.
+ */
+Outbox outbox;
+File outboxLog;
+SemaphoreHandle_t outboxLock;
+
 // Storage
 Preferences nvs; // https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/storage/nvs_flash.html
 SPIClass sdspi = SPIClass(HSPI);
@@ -276,6 +353,42 @@ SPIClass sdspi = SPIClass(HSPI);
 #define SD_SCK 14
 #define SD_MISO 32
 #define SD_MOSI 13
+/**
+ * The card and the touch controller share SCK, MOSI and MISO, driven by two SPI drivers that know
+ * nothing of each other. touchTask holds this around each reading, and every function that touches
+ * the card holds it while it does; the undo journal's spill file takes it through
+ * canvasJournalSetBusLock. Recursive, so those functions can call each other. Take it last:
+ * never wait for outboxLock while holding it. The network worker holds it one SD access at a time,
+ * never across the network, so touch never waits on Wi-Fi.
+ */
+SemaphoreHandle_t spiBusLock;
+
+/** Holds spiBusLock for as long as it is in scope. */
+struct SpiBusHold
+{
+  SpiBusHold() { xSemaphoreTakeRecursive(spiBusLock, portMAX_DELAY); }
+  ~SpiBusHold() { xSemaphoreGiveRecursive(spiBusLock); }
+};
+
+/** spiBusLock for code outside this file. */
+static void spiBusTake()
+{
+  xSemaphoreTakeRecursive(spiBusLock, portMAX_DELAY);
+}
+
+static void spiBusGive()
+{
+  xSemaphoreGiveRecursive(spiBusLock);
+}
+
+/** Index of SKETCH_INDEX_DIR, kept open once the file browser first needs it. */
+SketchIndex sketchIndex;
+File sketchIndexFile;
+bool sketchIndexReady = false;
+/** Sort orders of the index, and the file browser's view of it one page at a time. */
+SketchIndexOrder sketchIndexOrder;
+File sketchIndexOrderFile;
+SketchPager sketchPager;
 
 // Audio
 // Worry about this later.
@@ -283,124 +396,167 @@ SPIClass sdspi = SPIClass(HSPI);
 // Functions
 void handleMenuButton(bool recheckInput);
 void setDrawColor(uint8_t colorIndex);
-void drawPixelToFB(int x, int y, uint8_t colorIndex);
-void drawBrushToFB(int x, int y, int radius, uint8_t colorIndex);
-void drawDitherToFB(int x, int y, int radius, uint8_t colorIndex);
 void initUIForScreen(screen_id_t targetScreen);
 void drawScreenCanvasMenu();
 void drawScreenSend(int page = 0);
 void drawScreenFileBrowser(int page = 0);
-void drawClearScreen();
-bool drawSketchPreview(const char *filepath, int x, int y, int scaleDown, bool drawBorder = true);
+bool drawSketchPreview(const char *filepath, int x, int y, float scaleDown, bool drawBorder = true);
 void drawFriendboxLoadingScreen(const char *subtitle, int holdTimeMs = 0, const char *subsubtitle = "", const char *subsubsubtitle = "");
 void saveImageToSD(int slot);
 void loadSketchFromSD(const char *path);
 void loadImageFromSD(int slot);
-void drawFramebuffer(int x = 0, int y = 0, int w = TFT_HOR_RES, int h = TFT_VER_RES);
-void networkSendFramebuffer(int userID);
-void networkReceiveFramebuffer();
-bool networkSendCanvas();
-std::vector<std::string> sdGetFboxFiles();
-std::vector<std::string> networkGetFriends();
+int networkReceiveFramebuffer(NetProgress *progress);
+bool networkCheckInbox();
+uint32_t networkSubmit(NetRequest *request);
+bool outboxQueueCanvas(const char *recipient);
+void handleNetworkEvents();
+bool sdLoadFriendCache();
+bool sdLoadOutbox();
+bool sdCompactOutbox();
+bool sdSaveFriendCache();
+bool sdOpenSketchIndex();
+bool sdIndexSketch(const char *name);
+bool sdUnindexSketch(const char *name);
+int networkGetFriends(const char *etag, FriendTable *friends, char *responseEtag);
+bool networkRefreshFriends(bool force);
 void cleanupUIOutOfContext(bool destroyElement = false);
 bool checkIfUIIsInitialized(screen_id_t targetScreen);
 void changeScreenContext(screen_id_t targetScreen);
-void drawTest4();
 bool handleUIButtonPress(UIButton *targetButton, ui_button_mode_id_t buttonMode = ACT_ON_PRESS);
 bool initSD(bool forceFormat);
 bool initDisplay();
+bool initFramebuffer();
 bool initTouch(bool forceCalibrate);
 bool initNetwork(const char *netSSID, const char *netPassword, const char *hostname);
-bool initNVS();
+void handleWifi();
+bool initNetworkWorker();
+bool initTouchTask();
+void handleCanvasDraw();
 
-/** Read from the display, and queue touch points if valid. */
+/**
+ * Act on every touch sample since the last loop(), oldest first. The canvas gets each one, so a
+ * stroke keeps its shape however long the frame took; the UI sees the state after the last.
+ */
 void handleTouch()
 {
-  uint16_t localTouchX, localTouchY;
-  if (tft.getTouch(&localTouchX, &localTouchY) && (localTouchX >= 0 && localTouchX < TFT_HOR_RES &&
-                                                   localTouchY >= 0 && localTouchY < TFT_VER_RES))
-  { // Touching in bounds
-    // Serial.print("Touch - X: ");
-    // Serial.print(localTouchX);
-    // Serial.print(" Y: ");
-    // Serial.println(localTouchY);
-
-    // Drop inputs until we exceed TOUCH_INPUT_BUFFER, this prevents smearing from pen applying pressure.
-    if (++touch_count > TOUCH_INPUT_BUFFER)
+  static TouchSample samples[TOUCH_RING_SIZE];
+  uint32_t n = touchStreamDrain(&touchStream, samples, TOUCH_RING_SIZE);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    if (samples[i].z)
     {
-      if (touch_queue_lastwrite_position < TOUCH_INPUT_BUFFER)
-      {
-        touch_queue_x[touch_queue_lastwrite_position] = localTouchX;
-        touch_queue_y[touch_queue_lastwrite_position] = localTouchY;
-
-        touch_queue_lastwrite_position =
-            (touch_queue_lastwrite_position + 1) % TOUCH_INPUT_BUFFER;
-      }
-      // Draw points in queue if valid.
-      uint8_t touch_queue_read_position = (touch_queue_lastwrite_position + TOUCH_INPUT_BUFFER - (TOUCH_INPUT_BUFFER - 1)) % TOUCH_INPUT_BUFFER;
-
-      // Serial.print("Last Write Pos: ");
-      // Serial.println(touch_queue_lastwrite_position);
-      // Serial.print("Read Pos: ");
-      // Serial.println(touch_queue_read_position);
-      // Serial.print("X Value: ");
-      // Serial.println(touch_queue_x[touch_queue_read_position]);
-
-      if (((touch_queue_x[touch_queue_read_position] +
-            touch_queue_y[touch_queue_read_position]) > 0))
-      {
-        touchX = touch_queue_x[touch_queue_read_position];
-        touchY = touch_queue_y[touch_queue_read_position];
-        touchZ = 1;
-      }
+      touchX = samples[i].x;
+      touchY = samples[i].y;
+      touchZ = 1;
+    }
+    else
+    {
+      lastTouchTime = millis();
+      touchZ = 0;
     }
+    handleCanvasDraw();
   }
-  else
-  { // No longer touching, re-init to zero. Also drops last 10 inputs to prevent smearing from pen removing pressure.
-    touch_count = 0;
-    memset(touch_queue_x, 0, sizeof(touch_queue_x));
-    memset(touch_queue_y, 0, sizeof(touch_queue_y));
-    lastTouchTime = millis();
-    touchZ = 0;
+}
+
+/**
+ * Reads the touch controller every 1/TOUCH_SAMPLE_HZ s, filters the reading and queues what comes
+ * out on touchStream, whatever loop() is doing.
+ */
+void touchTask(void *)
+{
+  TickType_t wake = xTaskGetTickCount();
+  for (;;)
+  {
+    lgfx::touch_point_t point;
+    xSemaphoreTakeRecursive(spiBusLock, portMAX_DELAY);
+    bool touching = tft.getTouch(&point, 1) && point.x >= 0 && point.x < TFT_HOR_RES && point.y >= 0 && point.y < TFT_VER_RES;
+    xSemaphoreGiveRecursive(spiBusLock);
+    TouchSample raw = {(uint32_t)micros(), 0, 0, 0};
+    if (touching)
+    {
+      raw.x = point.x;
+      raw.y = point.y;
+      // size is the XPT2046's pressure reading.
+      raw.z = point.size ? point.size : 1;
+    }
+    TouchSample filtered;
+    if (touchFilter(&touchFilterState, &raw, &filtered))
+      touchStreamSample(&touchStream, filtered.us, filtered.z != 0, filtered.x, filtered.y, filtered.z);
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(1000 / TOUCH_SAMPLE_HZ));
   }
 }
 
-/** Draw to screen if within canvas context! */
+/** Draw to screen if within canvas context!
+ * Consecutive samples of one touch are joined into a continuous stroke instead of stamping a disc per loop.
+ */
 void handleCanvasDraw()
 {
-  if (currentScreen == SCREEN_CANVAS && touchZ)
+  if (currentScreen != SCREEN_CANVAS || !touchZ)
   {
-    switch (currentTool)
-    {
-    case TOOL_PENCIL:
-      drawBrushToFB(touchX, touchY, currentBrushRadius, currentDrawColorIndex);
-      break;
-    case TOOL_BRUSH:
+    if (strokeActive)
+      canvasJournalEndStroke();
+    strokeActive = false;
+    return;
+  }
+  if (!strokeActive)
+    canvasJournalBeginStroke();
+
+  // First sample of a stroke stamps a disc; after that, only draw when the pen has moved.
+  bool moved = !strokeActive || touchX != strokeLastX || touchY != strokeLastY;
+
+  switch (currentTool)
+  {
+  case TOOL_PENCIL:
+  case TOOL_BRUSH:
+    if (!strokeActive)
       drawBrushToFB(touchX, touchY, currentBrushRadius, currentDrawColorIndex);
-      break;
-    case TOOL_FILL:
-      drawClearScreen();
-      break;
-    case TOOL_RAINBOW: // Wouldn't be a bad idea to make this actually rainbow instead of cycling thru palette.... to follow ROYGBIV.
-      drawBrushToFB(touchX, touchY, currentBrushRadius, draw_rainbow_palette_index[currentRainbowPaletteIndex]);
+    else if (moved)
+      drawStrokeToFB(strokeLastX, strokeLastY, touchX, touchY, currentBrushRadius, currentDrawColorIndex);
+    break;
+  case TOOL_FILL:
+    // Fill once per touch, where the pen first lands.
+    if (!strokeActive && !drawFillToFB(touchX, touchY, currentDrawColorIndex))
+    {
+#ifdef FRIENDBOX_DEBUG_MODE
+      Serial.println("ERROR: Not enough memory to fill!");
+#endif
+    }
+    break;
+  case TOOL_RAINBOW: // Wouldn't be a bad idea to make this actually rainbow instead of cycling thru palette.... to follow ROYGBIV.
+    if (moved)
+    {
+      if (!strokeActive)
+        drawBrushToFB(touchX, touchY, currentBrushRadius, draw_rainbow_palette_index[currentRainbowPaletteIndex]);
+      else
+        drawStrokeToFB(strokeLastX, strokeLastY, touchX, touchY, currentBrushRadius, draw_rainbow_palette_index[currentRainbowPaletteIndex]);
       currentRainbowPaletteIndex = (currentRainbowPaletteIndex + 1) % 7;
-      break;
-    case TOOL_DITHER:
-      // Oh my god. why?
+    }
+    break;
+  case TOOL_DITHER:
+    if (!strokeActive)
       drawDitherToFB(touchX, touchY, currentBrushRadius, currentDrawColorIndex);
-      break;
-    case TOOL_STICKER:
+    else if (moved)
+      drawDitherStrokeToFB(strokeLastX, strokeLastY, touchX, touchY, currentBrushRadius, currentDrawColorIndex);
+    break;
+  case TOOL_STICKER:
+    // Stamp once per touch, where the pen first lands; every sample would repaint the whole canvas.
+    if (!strokeActive)
+    {
       drawTest4();
       drawFramebuffer();
-      break;
     }
+    break;
   }
+
+  strokeActive = true;
+  strokeLastX = touchX;
+  strokeLastY = touchY;
 }
 
 /* Change brush size while keeping brush size above 0.*/
 void changeBrushSize(int targetValue)
 {
-  if (targetValue > 0 && targetValue <= 100)
+  if (targetValue > 0 && targetValue <= CANVAS_MAX_BRUSH_RADIUS)
   {
     Serial.print("Adjusting brush size to ");
     Serial.println(targetValue);
@@ -408,6 +564,17 @@ void changeBrushSize(int targetValue)
   }
 }
 
+/** Step the ordered dither density by DITHER_LEVEL_STEP, 0 (off) to CANVAS_DITHER_LEVELS (solid). */
+void changeDitherLevel(int targetValue)
+{
+  if (targetValue >= 0 && targetValue <= CANVAS_DITHER_LEVELS)
+  {
+    Serial.print("Adjusting dither level to ");
+    Serial.println(targetValue);
+    canvasSetDitherLevel(targetValue);
+  }
+}
+
 /** Run this to check the target button for inputs, and register a logical press when the button is pressed according to mode.
  * @param targetButton The button we are checking for input on.
  * @param buttonMode The mode we are checking for input in, this determines when we register a logical press.
@@ -511,6 +678,12 @@ void handleTouchUIUpdate()
         drawScreenCanvasMenu();
       }
     }
+    // Finger lifted, put the canvas back under the slot preview. A load that follows redraws it anyway.
+    if (!touchZ && slotPreviewShown)
+    {
+      drawFramebuffer(SLOT_PREVIEW_X_POS - 1, SLOT_PREVIEW_Y_POS - 1, FBOX_THUMB_WIDTH + 2, FBOX_THUMB_HEIGHT + 2);
+      slotPreviewShown = false;
+    }
     // Handle dropdown buttons logic.
     if (!touchZ && currentDropdown != DROPDOWN_NONE)
     {
@@ -552,6 +725,19 @@ void handleTouchUIUpdate()
             changeScreenContext(SCREEN_FILE_BROWSER);
             return;
             break;
+          case 4: // Inbox
+            changeScreenContext(SCREEN_RECEIVED);
+            return;
+          case 5: // Undo
+            changeScreenContext(SCREEN_CANVAS);
+            canvasUndo();
+            changeScreenContext(SCREEN_CANVAS_MENU);
+            return;
+          case 6: // Redo
+            changeScreenContext(SCREEN_CANVAS);
+            canvasRedo();
+            changeScreenContext(SCREEN_CANVAS_MENU);
+            return;
           }
         }
       }
@@ -586,6 +772,20 @@ void handleTouchUIUpdate()
               changeBrushSize(currentBrushRadius + 1);
               drawScreenCanvasMenu();
               break;
+            case 2:
+              if (currentTool == TOOL_DITHER)
+              {
+                changeDitherLevel(canvasGetDitherLevel() - DITHER_LEVEL_STEP);
+                drawScreenCanvasMenu();
+              }
+              break;
+            case 3:
+              if (currentTool == TOOL_DITHER)
+              {
+                changeDitherLevel(canvasGetDitherLevel() + DITHER_LEVEL_STEP);
+                drawScreenCanvasMenu();
+              }
+              break;
             default:
               break;
             }
@@ -612,14 +812,17 @@ void handleTouchUIUpdate()
     case DROPDOWN_LOAD:
       for (uint8_t b = 0; b < SLOT_DROPDOWN_BUTTON_COUNT; b++)
       {
-        /*if (handleUIButtonPress(&SCREEN_CANVAS_MENU_LOAD_BUTTON[b], ACT_ON_PRESS))
+        bool released = handleUIButtonPress(&SCREEN_CANVAS_MENU_LOAD_BUTTON[b], ACT_ON_HOVER_AND_RELEASE);
+        // Preview the slot under the finger. Thumbnails make this cheap enough to do while sliding.
+        if (SCREEN_CANVAS_MENU_LOAD_BUTTON[b].button.justPressed())
         {
           char filename[50];
           snprintf(filename, sizeof(filename), "/sketches/slots/slot%d.fbox", b);
-          drawSketchPreview(filename, SCREEN_CANVAS_UI_ACTION_BUTTON_X_POS(1), 160, 4, true);
-          lastPressedButton = nullptr;
-        }*/
-        if (handleUIButtonPress(&SCREEN_CANVAS_MENU_LOAD_BUTTON[b], ACT_ON_HOVER_AND_RELEASE))
+          if (!drawSketchPreview(filename, SLOT_PREVIEW_X_POS, SLOT_PREVIEW_Y_POS, FBOX_THUMB_SCALE, true))
+            drawFramebuffer(SLOT_PREVIEW_X_POS - 1, SLOT_PREVIEW_Y_POS - 1, FBOX_THUMB_WIDTH + 2, FBOX_THUMB_HEIGHT + 2);
+          slotPreviewShown = true;
+        }
+        if (released)
         {
           changeScreenContext(SCREEN_CANVAS);
           loadImageFromSD(b);
@@ -629,6 +832,21 @@ void handleTouchUIUpdate()
       break;
     }
     break;
+  case SCREEN_RECEIVED:
+    // Any tap once the download is over goes back to the canvas. Wait for the release, so the
+    // same touch does not land on the menu.
+    if (touchZ)
+      receivedTouched = true;
+    else if (receivedTouched)
+    {
+      receivedTouched = false;
+      if (!inboxReceive.requestId)
+      {
+        drawFramebuffer();
+        changeScreenContext(SCREEN_CANVAS_MENU);
+      }
+    }
+    break;
   case SCREEN_SEND:
     // Handle logic for send screen.
     for (uint8_t b = 0; b < SCREEN_SEND_NAVI_BUTTON_COUNT; b++)
@@ -644,7 +862,8 @@ void handleTouchUIUpdate()
       case 1: // Refresh
         if (handleUIButtonPress(&SCREEN_SEND_NAVI_BUTTON[b], ACT_ON_PRESS))
         {
-          drawScreenSend(friendListUI.page);
+          // The list is redrawn by handleNetworkEvents if it changed.
+          networkRefreshFriends(true);
         }
         break;
       case 2: // Sort
@@ -659,7 +878,7 @@ void handleTouchUIUpdate()
         }
         break;
       case 4: // Down
-        if ((friendListUI.page + 1) * SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT < friendListUI.listItems.size())
+        if ((friendListUI.page + 1) * SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT < friendCache.friends.count)
         {
           if (handleUIButtonPress(&SCREEN_SEND_NAVI_BUTTON[b], ACT_ON_PRESS))
           {
@@ -679,34 +898,21 @@ void handleTouchUIUpdate()
     {
       if (handleUIButtonPress(&SCREEN_SEND_ADDRESSBOOK_BUTTON[b], ACT_ON_PRESS))
       {
-        switch (b)
+        uint32_t friendIndex = b + friendListUI.page * SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT;
+        if (friendIndex >= friendCache.friends.count)
+          continue;
+        // Back to drawing straight away: the sketch is safe on SD and goes out whenever the server
+        // can be reached, shown as a strip along the top of the canvas.
+        if (outboxQueueCanvas(friendTableName(&friendCache.friends, friendIndex)))
         {
-        case 0:
-          drawFriendboxLoadingScreen("Sending...", 0);
-          if (networkSendCanvas())
-          {
-            drawFriendboxLoadingScreen("Sent!", 500);
-            delay(500);
-          }
-          else
-          {
-            drawFriendboxLoadingScreen("Failed to send.", 1000);
-            delay(500);
-          }
+          drawFramebuffer();
+          changeScreenContext(SCREEN_CANVAS);
+        }
+        else
+        {
+          drawFriendboxLoadingScreen(outbox.count == OUTBOX_MAX_PENDING ? "Outbox full." : "Failed to send.", 1000);
           drawFramebuffer();
           changeScreenContext(SCREEN_SEND);
-          break;
-        case 1:
-          break;
-        case 2:
-          break;
-        case 3:
-          break;
-        case 4:
-          break;
-        default:
-          networkSendFramebuffer(b);
-          break;
         }
       }
     }
@@ -723,7 +929,15 @@ void handleTouchUIUpdate()
         }
         break;
       case 1: // Sort
-              // Not implemented yet.
+        if (handleUIButtonPress(&SCREEN_FILE_BROWSER_NAVI_BUTTON[b], ACT_ON_PRESS))
+        {
+          sketchPagerSetSort(&sketchPager, (sketch_sort_id_t)((sketchPager.sort + 1) % SKETCH_SORT_COUNT));
+          // Force a full redraw, even when already on the first page.
+          SCREEN_FILE_BROWSER_FILE_BUTTON[0].isDrawn = false;
+          SCREEN_FILE_BROWSER_NAVI_BUTTON[0].isDrawn = false;
+          drawScreenFileBrowser(0);
+        }
+        break;
       case 2: // Up
         if (fileListUI.page > 0)
         {
@@ -734,7 +948,7 @@ void handleTouchUIUpdate()
         }
         break;
       case 3: // Down
-        if ((fileListUI.page + 1) * SCREEN_FILE_BROWSER_FILE_BUTTON_COUNT < fileListUI.listItems.size())
+        if ((fileListUI.page + 1) * SCREEN_FILE_BROWSER_FILE_BUTTON_COUNT < sketchPagerCount(&sketchPager))
         {
           if (handleUIButtonPress(&SCREEN_FILE_BROWSER_NAVI_BUTTON[b], ACT_ON_PRESS))
           {
@@ -757,20 +971,20 @@ void handleTouchUIUpdate()
         int fileIndex = b + (fileListUI.page * SCREEN_FILE_BROWSER_FILE_BUTTON_COUNT);
 
         // Bounds check!
-        if (fileIndex < fileListUI.listItems.size())
+        SketchIndexEntry entry;
+        if (sketchPagerGet(&sketchPager, fileIndex, &entry))
         {
-          const char *filename = fileListUI.listItems[fileIndex].c_str();
-          Serial.printf("Select Filename [%d]: %s\n", fileIndex, filename);
+          Serial.printf("Select Filename [%d]: %s\n", fileIndex, entry.name);
 
           changeScreenContext(SCREEN_CANVAS);
-          loadSketchFromSD(filename);
+          loadSketchFromSD(entry.name);
           changeScreenContext(SCREEN_FILE_BROWSER);
           drawScreenFileBrowser(fileListUI.page);
         }
         else
         {
-          Serial.printf("ERROR: Index %d out of bounds (size: %d)\n",
-                        fileIndex, fileListUI.listItems.size());
+          Serial.printf("ERROR: Index %d out of bounds (size: %u)\n",
+                        fileIndex, sketchPagerCount(&sketchPager));
         }
       }
     }
@@ -891,6 +1105,8 @@ std::string getUISubcontextName(dropdown_id_t subcontext)
 
 void changeScreenContext(screen_id_t targetScreen)
 {
+  // Get pending strokes onto the panel before any UI is drawn over the canvas.
+  canvasFlushDirty(millis(), true);
   Serial.print("Switching Context: ");
   Serial.print(getUIContextName(currentScreen).c_str());
   switch (targetScreen)
@@ -934,6 +1150,8 @@ void changeScreenContext(screen_id_t targetScreen)
       initUIForScreen(SCREEN_SEND);
     }
     currentScreen = SCREEN_SEND;
+    // Show what we have straight away, and only ask the server if it is past its TTL.
+    networkRefreshFriends(false);
     drawScreenSend();
     break;
   case SCREEN_FILE_BROWSER:
@@ -946,9 +1164,20 @@ void changeScreenContext(screen_id_t targetScreen)
     }
     currentScreen = SCREEN_FILE_BROWSER;
     fileListUI.page = 0;
-    fileListUI.listItems = sdGetFboxFiles();
+    sdOpenSketchIndex();
     drawScreenFileBrowser();
     break;
+  case SCREEN_RECEIVED:
+    Serial.println(" --> SCREEN_RECEIVED");
+    if (currentScreen != SCREEN_RECEIVED)
+    {
+      currentScreen = SCREEN_RECEIVED;
+      cleanupUIOutOfContext(true);
+    }
+    currentScreen = SCREEN_RECEIVED;
+    receivedTouched = false;
+    networkCheckInbox();
+    break;
   case SCREEN_SYSTEM_MESSAGE: // Call this when showing message.
     Serial.println(" --> SCREEN_SYSTEM_MESSAGE");
     currentScreen = SCREEN_SYSTEM_MESSAGE;
@@ -1219,14 +1448,15 @@ void drawScreenFileBrowser(int page)
 
       int fileIndex = col + (page * SCREEN_FILE_BROWSER_FILE_BUTTON_COUNT);
 
-      // Check if we have a file for this button
-      if (fileIndex < fileListUI.listItems.size())
+      // Check if we have a file for this button. Only this page and the next are read from the index.
+      SketchIndexEntry entry;
+      if (sketchPagerGet(&sketchPager, fileIndex, &entry))
       {
         // Draw the button with file name
         SCREEN_FILE_BROWSER_FILE_BUTTON[col].fillColor = draw_color_palette[currentDrawColorIndex];
         SCREEN_FILE_BROWSER_FILE_BUTTON[col].button.setTextColor(draw_color_palette_text_color[currentDrawColorIndex]);
         SCREEN_FILE_BROWSER_FILE_BUTTON[col].button.setFillColor(draw_color_palette[currentDrawColorIndex]);
-        SCREEN_FILE_BROWSER_FILE_BUTTON[col].button.drawButton(false, fileListUI.listItems[fileIndex].c_str());
+        SCREEN_FILE_BROWSER_FILE_BUTTON[col].button.drawButton(false, entry.name);
         SCREEN_FILE_BROWSER_FILE_BUTTON[col].isDrawn = true;
       }
       else
@@ -1243,13 +1473,19 @@ void drawScreenFileBrowser(int page)
       switch (col)
       {
       case 0: // Back
-      case 1: // Sort
         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].fillColor = draw_color_palette[currentDrawColorIndex];
         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.setTextColor(draw_color_palette_text_color[currentDrawColorIndex]);
         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.setFillColor(draw_color_palette[currentDrawColorIndex]);
         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.drawButton();
         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].isDrawn = true;
         break;
+      case 1: // Sort, labelled with the current order
+        SCREEN_FILE_BROWSER_NAVI_BUTTON[col].fillColor = draw_color_palette[currentDrawColorIndex];
+        SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.setTextColor(draw_color_palette_text_color[currentDrawColorIndex]);
+        SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.setFillColor(draw_color_palette[currentDrawColorIndex]);
+        SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.drawButton(false, SCREEN_FILE_BROWSER_SORT_LABEL[sketchPager.sort]);
+        SCREEN_FILE_BROWSER_NAVI_BUTTON[col].isDrawn = true;
+        break;
       case 2: // Up
         Serial.println("Drawing over previous up button.");
         drawFramebuffer(SCREEN_FILE_BROWSER_NAVI_BUTTON[col].x,
@@ -1276,12 +1512,12 @@ void drawScreenFileBrowser(int page)
                         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].y,
                         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].w,
                         SCREEN_FILE_BROWSER_NAVI_BUTTON[col].h);
-        if ((page + 1) * 5 < fileListUI.listItems.size())
+        if ((page + 1) * SCREEN_FILE_BROWSER_FILE_BUTTON_COUNT < sketchPagerCount(&sketchPager))
         {
           Serial.print("Drawing down button because ");
           Serial.print((page + 1) * SCREEN_FILE_BROWSER_FILE_BUTTON_COUNT);
           Serial.print(" < ");
-          Serial.println(fileListUI.listItems.size());
+          Serial.println(sketchPagerCount(&sketchPager));
           SCREEN_FILE_BROWSER_NAVI_BUTTON[col].fillColor = draw_color_palette[currentDrawColorIndex];
           SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.setTextColor(draw_color_palette_text_color[currentDrawColorIndex]);
           SCREEN_FILE_BROWSER_NAVI_BUTTON[col].button.setFillColor(draw_color_palette[currentDrawColorIndex]);
@@ -1309,7 +1545,6 @@ void drawScreenSend(int page)
 {
   Serial.print("Drawing SCREEN_SEND on page ");
   Serial.println(page);
-  friendListUI.listItems = networkGetFriends();
   if (!SCREEN_SEND_ADDRESSBOOK_BUTTON[0].isDrawn || friendListUI.page != page)
   {
     for (int col = 0; col < SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT; col++)
@@ -1323,13 +1558,13 @@ void drawScreenSend(int page)
       int friendIndex = col + (page * SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT);
 
       // Check if we have a friend for this button
-      if (friendIndex < friendListUI.listItems.size())
+      if (friendIndex < friendCache.friends.count)
       {
         // Draw the button with friend name
         SCREEN_SEND_ADDRESSBOOK_BUTTON[col].fillColor = draw_color_palette[currentDrawColorIndex];
         SCREEN_SEND_ADDRESSBOOK_BUTTON[col].button.setTextColor(draw_color_palette_text_color[currentDrawColorIndex]);
         SCREEN_SEND_ADDRESSBOOK_BUTTON[col].button.setFillColor(draw_color_palette[currentDrawColorIndex]);
-        SCREEN_SEND_ADDRESSBOOK_BUTTON[col].button.drawButton(false, friendListUI.listItems[friendIndex].c_str());
+        SCREEN_SEND_ADDRESSBOOK_BUTTON[col].button.drawButton(false, friendTableName(&friendCache.friends, friendIndex));
         SCREEN_SEND_ADDRESSBOOK_BUTTON[col].isDrawn = true;
       }
       else
@@ -1380,7 +1615,7 @@ void drawScreenSend(int page)
                         SCREEN_SEND_NAVI_BUTTON[col].y,
                         SCREEN_SEND_NAVI_BUTTON[col].w,
                         SCREEN_SEND_NAVI_BUTTON[col].h);
-        if ((page + 1) * 5 < friendListUI.listItems.size())
+        if ((page + 1) * SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT < friendCache.friends.count)
         {
           SCREEN_SEND_NAVI_BUTTON[col].fillColor = draw_color_palette[currentDrawColorIndex];
           SCREEN_SEND_NAVI_BUTTON[col].button.setTextColor(draw_color_palette_text_color[currentDrawColorIndex]);
@@ -1477,6 +1712,7 @@ void drawScreenCanvasMenu()
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[col].button.setTextColor(draw_color_palette_text_color[currentDrawColorIndex]);
     }
     char sizeStatus[20];
+    char densityStatus[20];
     switch (currentTool)
     {
     case TOOL_PENCIL:
@@ -1511,13 +1747,14 @@ void drawScreenCanvasMenu()
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[1].button.setLabelText("+ Size");
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[1].button.drawButton(false);
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[1].isDrawn = true;
-      SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[2].button.setLabelText("Draw Odd");
+      SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[2].button.setLabelText("- Density");
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[2].button.drawButton(false);
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[2].isDrawn = true;
-      SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[3].button.setLabelText("Draw Even");
+      SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[3].button.setLabelText("+ Density");
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[3].button.drawButton(false);
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[3].isDrawn = true;
-      SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[4].button.setLabelText("Curr: E");
+      snprintf(densityStatus, sizeof(densityStatus), "Dens: %d", canvasGetDitherLevel());
+      SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[4].button.setLabelText(densityStatus);
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[4].button.drawButton(false);
       SCREEN_CANVAS_MENU_TOOL_SETTINGS_BUTTON[4].isDrawn = true;
       snprintf(sizeStatus, sizeof(sizeStatus), "Size: %d", currentBrushRadius);
@@ -1573,81 +1810,175 @@ void drawScreenCanvasMenu()
   }
 }
 
-bool drawSketchPreview(const char *filepath, int x, int y, int scaleDown, bool drawBorder)
+/** fbox byte sink and source for SD files, ctx is a File *. Each holds spiBusLock for its one access only. */
+static size_t fboxFileWrite(void *ctx, const uint8_t *data, size_t len)
 {
-  // scale = 2 means 480x320 → 240x160
-  // scale = 3 means 480x320 → 160x107
-  // scale = 4 means 480x320 → 120x80
-
-  File f = SD.open(filepath, FILE_READ);
-  if (!f)
-    return false;
+  SpiBusHold bus;
+  return ((File *)ctx)->write(data, len);
+}
 
-  const int SOURCE_WIDTH = 480;
-  const int SOURCE_HEIGHT = 320;
-  int w = SOURCE_WIDTH / scaleDown;
-  int h = SOURCE_HEIGHT / scaleDown;
+static size_t fboxFileRead(void *ctx, uint8_t *data, size_t len)
+{
+  SpiBusHold bus;
+  return ((File *)ctx)->read(data, len);
+}
 
-  tft.startWrite();
+static void fboxDiscardRow(void *, int, const uint8_t *) {}
 
-  // Read file in strips to save memory
-  const int STRIP_HEIGHT = 16; // Process 16 source rows at a time
-  uint8_t *stripBuffer = (uint8_t *)malloc((SOURCE_WIDTH * STRIP_HEIGHT) / 2);
-  if (!stripBuffer)
+/**
+ * Load the sketch in f onto the canvas, but only once a first pass has found it whole: a cut off
+ * or corrupt file leaves the canvas and its undo history as they were.
+ */
+static fbox_result_id_t fboxFileToCanvas(File &f)
+{
+  uint32_t size;
   {
-    f.close();
-    return false;
+    SpiBusHold bus;
+    size = f.size();
+  }
+  fbox_result_id_t result = fboxRead(fboxFileRead, &f, size, fboxDiscardRow, nullptr);
+  if (result != FBOX_OK)
+    return result;
+  bool rewound;
+  {
+    SpiBusHold bus;
+    rewound = f.seek(0);
   }
+  if (!rewound)
+    return FBOX_ERR_IO;
+  result = fboxReadToFramebuffer(fboxFileRead, &f, size);
+  canvasJournalReset();
+  return result;
+}
 
-  for (int stripY = 0; stripY < SOURCE_HEIGHT; stripY += STRIP_HEIGHT)
+/**
+ * Fill thumb with the FBOX_THUMB_BYTES thumbnail of a sketch. Uses the one embedded in the file if
+ * there is one, then a "<file>.thm" sidecar. Failing both, the sketch is decoded once and the
+ * sidecar written so the next preview is quick.
+ */
+static bool loadSketchThumbnail(const char *filepath, File &f, uint8_t *thumb)
+{
+  uint32_t size;
   {
-    // Read strip from file
-    size_t bytesToRead = (SOURCE_WIDTH * STRIP_HEIGHT) / 2;
-    f.read(stripBuffer, bytesToRead);
+    SpiBusHold bus;
+    size = f.size();
+  }
+  fbox_result_id_t result = fboxReadThumbnail(fboxFileRead, &f, size, thumb);
+  if (result != FBOX_ERR_NO_THUMBNAIL)
+    return result == FBOX_OK;
 
-    // Process this strip
-    for (int localY = 0; localY < STRIP_HEIGHT; localY += scaleDown)
+  char thumbPath[64];
+  snprintf(thumbPath, sizeof(thumbPath), "%s" FBOX_THUMB_FILE_SUFFIX, filepath);
+  File sidecar;
+  {
+    SpiBusHold bus;
+    sidecar = SD.open(thumbPath, FILE_READ);
+  }
+  if (sidecar)
+  {
+    result = fboxReadThumbnailFile(fboxFileRead, &sidecar, size, thumb);
     {
-      int srcY = stripY + localY;
-      int destY = srcY / scaleDown;
-
-      if (destY >= h)
-        break;
-
-      for (int srcX = 0; srcX < SOURCE_WIDTH; srcX += scaleDown)
-      {
-        int destX = srcX / scaleDown;
-
-        // Just sample top-left pixel of each block (no averaging)
-        int pixelIndex = localY * SOURCE_WIDTH + srcX;
-        int byteIndex = pixelIndex >> 1;
-        uint8_t byte = stripBuffer[byteIndex];
+      SpiBusHold bus;
+      sidecar.close();
+    }
+    if (result == FBOX_OK)
+      return true;
+  }
 
-        uint8_t colorIndex;
-        if (pixelIndex & 1)
-        {
-          colorIndex = byte & 0x0F;
-        }
-        else
-        {
-          colorIndex = (byte >> 4) & 0x0F;
-        }
+  {
+    SpiBusHold bus;
+    f.seek(0);
+  }
+  if (fboxDecodeThumbnail(fboxFileRead, &f, size, thumb) != FBOX_OK)
+    return false;
+  {
+    SpiBusHold bus;
+    sidecar = SD.open(thumbPath, FILE_WRITE);
+  }
+  if (sidecar)
+  {
+    fboxWriteThumbnailFile(thumb, size, fboxFileWrite, &sidecar);
+    SpiBusHold bus;
+    sidecar.close();
+  }
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.print("Built thumbnail for ");
+  Serial.println(filepath);
+#endif
+  return true;
+}
 
-        tft.drawPixel(x + destX, y + destY, draw_color_palette[colorIndex]);
-      }
+/** Draw a sketch's thumbnail at x,y with one pushImage. */
+static bool drawSketchThumbnail(const char *filepath, File &f, int x, int y)
+{
+  // Packed thumbnail up front, expanded to RGB565 behind it.
+  uint8_t *buffer = (uint8_t *)malloc(FBOX_THUMB_BYTES + FBOX_THUMB_WIDTH * FBOX_THUMB_HEIGHT * sizeof(uint16_t));
+  if (!buffer)
+    return false;
+  uint8_t *thumb = buffer;
+  uint16_t *pixels = (uint16_t *)(buffer + FBOX_THUMB_BYTES);
+  bool ok = loadSketchThumbnail(filepath, f, thumb);
+  if (ok)
+  {
+    for (int i = 0; i < FBOX_THUMB_BYTES; i++)
+    {
+      pixels[2 * i] = draw_color_palette[thumb[i] >> 4];
+      pixels[2 * i + 1] = draw_color_palette[thumb[i] & 0x0F];
     }
+    tft.pushImage(x, y, FBOX_THUMB_WIDTH, FBOX_THUMB_HEIGHT, pixels);
   }
+  free(buffer);
+  return ok;
+}
 
-  tft.endWrite();
-  free(stripBuffer);
-  f.close();
+/**
+ * Draw a sketch shrunk by scaleDown at x,y. Any factor of 1 or more works, fractional ones included.
+ * At FBOX_THUMB_SCALE the embedded thumbnail is used; otherwise the sketch is decoded row by row
+ * through a box filter, so the whole image is never held in RAM.
+ */
+bool drawSketchPreview(const char *filepath, int x, int y, float scaleDown, bool drawBorder)
+{
+  // scale = 2 means 480x320 → 240x160
+  // scale = 2.5 means 480x320 → 192x128
+  // scale = 4 means 480x320 → 120x80
+  if (scaleDown < 1)
+    scaleDown = 1;
+  int w = (int)(TFT_HOR_RES / scaleDown + 0.5f);
+  int h = (int)(TFT_VER_RES / scaleDown + 0.5f);
+
+  // Only the opens, closes and seeks hold the bus: touch keeps sampling while the panel is drawn.
+  File f;
+  uint32_t size;
+  {
+    SpiBusHold bus;
+    f = SD.open(filepath, FILE_READ);
+    if (!f)
+      return false;
+    size = f.size();
+  }
+
+  bool ok;
+  if (w == FBOX_THUMB_WIDTH && h == FBOX_THUMB_HEIGHT)
+  {
+    ok = drawSketchThumbnail(filepath, f, x, y);
+  }
+  else
+  {
+    CanvasPreview *preview = canvasPreviewBegin(x, y, w, h);
+    ok = preview && fboxRead(fboxFileRead, &f, size, canvasPreviewRow, preview) == FBOX_OK;
+    if (preview)
+      canvasPreviewEnd(preview);
+  }
+  {
+    SpiBusHold bus;
+    f.close();
+  }
 
   if (drawBorder)
   {
     tft.drawRect(x - 1, y - 1, w + 2, h + 2, TFT_WHITE);
   }
-
-  return true;
+  return ok;
 }
 
 /** Loop through current UI elements to see if any exist belonging to the target context.
@@ -1704,68 +2035,364 @@ void cleanupUIOutOfContext(bool removeFromContext)
   }
 }
 
-void initFriendbox()
+/** Boot stages, in the order bootStages lists them. A stage may only wait for ones above it. */
+typedef enum
+{
+  BOOT_DISPLAY,
+  BOOT_FRAMEBUFFER,
+  BOOT_SETTINGS,
+  BOOT_SD,
+  BOOT_SD_READY,
+  BOOT_WIFI,
+  BOOT_SKETCH,
+  BOOT_SHOW,
+  BOOT_FRIENDS,
+  BOOT_OUTBOX,
+  BOOT_TOUCH,
+  BOOT_NETWORK,
+  BOOT_STAGE_COUNT
+} boot_stage_id_t;
+
+/** The lane setup() runs, and with it everything that draws. The other lane is a task on the other core. */
+#define BOOT_UI_LANE 1
+#define BOOT_WORKER_LANE 0
+#define BOOT_TASK_STACK 8192
+#define BOOT_LOG_PATH "/friendbox/boot.log"
+
+static int bootSlot;
+static bool bootSdMounted;
+
+static bool bootDisplay()
+{
+  return initDisplay();
+}
+
+/** Settings the other stages need, read in one go so nothing else touches NVS meanwhile. */
+static bool bootReadSettings()
 {
-  currentDrawColorIndex = 0 + (esp_random() % (15 - 0 + 1));
-  initDisplay();
-  drawFriendboxLoadingScreen("Starting...", 0, "Initializing SD");
-  if (initSD(false))
-  {
-    drawFriendboxLoadingScreen("Starting...", 250, "Initializing SD", "Done!");
-  }
-  else
-  {
-    drawFriendboxLoadingScreen("Starting...", 0, "Initializing SD", "Error! Retrying...");
-    while (!SD.begin(SD_CS, sdspi))
-    {
-      delay(1000);
-    }
-    drawFriendboxLoadingScreen("Starting...", 250, "Initializing SD", "Done!");
-  }
-  drawFriendboxLoadingScreen("Starting...", 0, "Initializing Touch");
-  if (initTouch(false))
-  {
-    drawFriendboxLoadingScreen("Starting...", 250, "Initializing Touch", "Done!");
-  }
-  drawFriendboxLoadingScreen("Starting...", 0, "Initializing Wi-Fi", NETWORK_SSID);
-  if (initNetwork(NETWORK_SSID, NETWORK_PASS, LOCAL_HOSTNAME))
-  {
-    drawFriendboxLoadingScreen("Starting...", 250, "Initializing Wi-Fi", "Done!");
-  }
-  drawFriendboxLoadingScreen("Starting...", 0, "Initializing NVS");
-  if (initNVS())
-  {
-    drawFriendboxLoadingScreen("Starting...", 500, "Initializing NVS", "Done!");
-  }
   nvs.begin("Friendbox", true);
-  loadImageFromSD(nvs.getUInt("lastActiveSlot", 8));
+  bootSlot = nvs.getUInt("lastActiveSlot", 8);
+  friendCacheInit(&friendCache, nvs.getUInt("friendCacheTtl", FRIEND_CACHE_TTL_MS));
   nvs.end();
-  changeScreenContext(SCREEN_CANVAS);
+  friendTableInit(&friendRefresh.friends);
+  return true;
 }
 
-bool initNetwork(const char *netSSID, const char *netPassword, const char *hostname)
+static bool bootSd()
 {
-  WiFi.setHostname(hostname);
-  WiFi.begin(netSSID, netPassword);
-  while (WiFi.status() != WL_CONNECTED)
+  bootSdMounted = initSD(false);
+  return bootSdMounted;
+}
+
+/** Everything after this may use the card. If it did not mount, say so and keep trying. */
+static bool bootWaitForSd()
+{
+  if (bootSdMounted)
+    return true;
+  drawFriendboxLoadingScreen("Starting...", 0, "Initializing SD", "Error! Retrying...");
+  SpiBusHold bus;
+  while (!SD.begin(SD_CS, sdspi))
   {
-    delay(500);
+    delay(1000);
   }
-  // What if the network cannot ever connect? How do we handle?
   return true;
 }
 
-bool initSD(bool forceFormat)
+/** Connects in the background, the canvas does not wait for it. Kept off the UI lane, where it would hold up the sketch. */
+static bool bootWifi()
 {
-#ifdef FRIENDBOX_DEBUG_MODE
-  Serial.println("INFO: Initializing SD...");
-#endif
-  sdspi.begin(SD_SCK, SD_MISO, SD_MOSI, SD_CS);
-  sdspi.setFrequency(40000000); // 40 MHz, explicitly otherwise will take 80mhz speed of display bus and cause corruption (?)
-  if (!SD.begin(SD_CS, sdspi))
+  initNetwork(NETWORK_SSID, NETWORK_PASS, LOCAL_HOSTNAME);
+  return true;
+}
+
+/** Decode the last active slot into the framebuffer, without drawing it. Nothing saved is not a failure. */
+static bool bootLoadSketch()
+{
+  if (bootSlot < 0 || bootSlot >= SLOT_DROPDOWN_BUTTON_COUNT)
+    return true;
+  char filename[50];
+  snprintf(filename, sizeof(filename), "/sketches/slots/slot%d.fbox", bootSlot);
+  File f;
   {
-#ifdef FRIENDBOX_DEBUG_MODE
-    Serial.println("ERROR: SD mount failed! Is it connected properly?");
+    SpiBusHold bus;
+    f = SD.open(filename, FILE_READ);
+  }
+  if (!f)
+    return true;
+  fbox_result_id_t result = fboxFileToCanvas(f);
+  {
+    SpiBusHold bus;
+    f.close();
+  }
+  if (result != FBOX_OK)
+  {
+#ifdef FRIENDBOX_DEBUG_MODE
+    Serial.print("WARN: fbox read error ");
+    Serial.println(result);
+#endif
+    return false;
+  }
+  currentSaveSlot = bootSlot;
+  return true;
+}
+
+static bool bootShowSketch()
+{
+  drawFramebuffer();
+  bootToCanvasMs = millis();
+  return true;
+}
+
+/** Sampling starts once calibration is done with the controller. */
+static bool bootTouch()
+{
+  initTouch(false);
+  return initTouchTask();
+}
+
+static bool bootNetworkWorker()
+{
+  return initNetworkWorker();
+}
+
+/**
+ * Start-up, as a dependency graph. Drawing stays on the UI lane, the panel is not safe to share
+ * between cores. The sketch only waits on the card, the settings and the panel, so it is on screen
+ * while touch, the friend list and the outbox are still loading. The card shares its SPI pins with
+ * the touch controller: it is mounted only once the display has set them up, and touch sampling
+ * starts only once the other lane has stopped reading the card.
+ */
+BootStage bootStages[BOOT_STAGE_COUNT] = {
+    {"display", bootDisplay, 0, BOOT_UI_LANE},
+    {"framebuffer", initFramebuffer, 0, BOOT_ANY_LANE},
+    {"settings", bootReadSettings, 0, BOOT_ANY_LANE},
+    {"sd", bootSd, BOOT_AFTER(BOOT_DISPLAY), BOOT_ANY_LANE},
+    {"sd ready", bootWaitForSd, BOOT_AFTER(BOOT_DISPLAY) | BOOT_AFTER(BOOT_SD), BOOT_UI_LANE},
+    {"wifi", bootWifi, BOOT_AFTER(BOOT_SETTINGS), BOOT_WORKER_LANE},
+    {"sketch", bootLoadSketch, BOOT_AFTER(BOOT_FRAMEBUFFER) | BOOT_AFTER(BOOT_SETTINGS) | BOOT_AFTER(BOOT_SD_READY), BOOT_ANY_LANE},
+    {"show sketch", bootShowSketch, BOOT_AFTER(BOOT_DISPLAY) | BOOT_AFTER(BOOT_SKETCH), BOOT_UI_LANE},
+    {"friends", sdLoadFriendCache, BOOT_AFTER(BOOT_SETTINGS) | BOOT_AFTER(BOOT_SD_READY), BOOT_ANY_LANE},
+    {"outbox", sdLoadOutbox, BOOT_AFTER(BOOT_SD_READY), BOOT_ANY_LANE},
+    {"touch", bootTouch, BOOT_AFTER(BOOT_SD_READY) | BOOT_AFTER(BOOT_SHOW) | BOOT_AFTER(BOOT_FRIENDS) | BOOT_AFTER(BOOT_OUTBOX), BOOT_UI_LANE},
+    {"network task", bootNetworkWorker, BOOT_AFTER(BOOT_FRIENDS) | BOOT_AFTER(BOOT_OUTBOX), BOOT_ANY_LANE},
+};
+BootSequence bootSequence;
+
+static uint32_t bootClock()
+{
+  return micros();
+}
+
+static void bootIdle()
+{
+  vTaskDelay(1);
+}
+
+static void bootLaneTask(void *done)
+{
+  bootLane(&bootSequence, BOOT_WORKER_LANE);
+  xSemaphoreGive((SemaphoreHandle_t)done);
+  vTaskDelete(nullptr);
+}
+
+/** Print the boot trace and keep it on the card, replacing the last boot's. */
+static void sdSaveBootTrace()
+{
+  static char trace[1024];
+  size_t len = bootFormatTrace(&bootSequence, trace, sizeof(trace));
+  len += snprintf(trace + len, sizeof(trace) - len, "sketch on screen at %.1f ms, boot done at %.1f ms\n",
+                  bootStages[BOOT_SHOW].endUs / 1000.0, bootEndUs(&bootSequence) / 1000.0);
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.print(trace);
+#endif
+  SpiBusHold bus;
+  SD.mkdir("/friendbox");
+  File f = SD.open(BOOT_LOG_PATH, FILE_WRITE);
+  if (f)
+  {
+    f.write((const uint8_t *)trace, len < sizeof(trace) ? len : sizeof(trace) - 1);
+    f.close();
+  }
+}
+
+/** Bring everything up, running bootStages on both cores at once. */
+void initFriendbox()
+{
+  currentDrawColorIndex = 0 + (esp_random() % (15 - 0 + 1));
+  spiBusLock = xSemaphoreCreateRecursiveMutex();
+  canvasJournalSetBusLock(spiBusTake, spiBusGive);
+  if (!bootInit(&bootSequence, bootStages, BOOT_STAGE_COUNT, bootClock, bootIdle))
+  {
+    Serial.println("FATAL: Boot stage table is invalid!");
+    while (1)
+      ;
+  }
+  SemaphoreHandle_t workerDone = xSemaphoreCreateBinary();
+  xTaskCreatePinnedToCore(bootLaneTask, "boot", BOOT_TASK_STACK, workerDone, 1, nullptr, 1 - xPortGetCoreID());
+  bootLane(&bootSequence, BOOT_UI_LANE);
+  xSemaphoreTake(workerDone, portMAX_DELAY);
+  vSemaphoreDelete(workerDone);
+  changeScreenContext(SCREEN_CANVAS);
+  sdSaveBootTrace();
+#ifdef FRIENDBOX_DEBUG_MODE
+  CanvasFlushStats flushStats = canvasGetFlushStats();
+  Serial.printf("INFO: drawFramebuffer sent %llu px in %u us over %u calls, %.0f%% of the %d MHz SPI clock.\n",
+                flushStats.pixels, flushStats.micros, flushStats.calls, canvasFlushBusUtilization() * 100.0f, CANVAS_SPI_WRITE_HZ / 1000000);
+#endif
+}
+
+/** Runs on the Wi-Fi event task: only note what happened, handleWifi acts on it. */
+static void wifiEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+  switch (event)
+  {
+  case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    wifiLost = false;
+    wifiGotIp = true;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    wifiGotIp = false;
+    wifiLost = true;
+    break;
+  default:
+    break;
+  }
+}
+
+/** Join the network the slow way: scan every channel for it, then ask DHCP for an address. */
+static void wifiScanConnect()
+{
+  wifiState = WIFI_STATE_SCAN_CONNECT;
+  WiFi.disconnect();
+  wifiLost = false;
+  WiFi.begin(wifiSsid, wifiPassword);
+}
+
+/**
+ * Remember the access point and its channel, so the next boot can rejoin without a scan. The
+ * address is not kept: a lease taken over as a static one is never renewed, and would look like a
+ * working link even on a network where it is wrong.
+ */
+static void wifiSaveCache()
+{
+  nvs.begin("Friendbox", false);
+  nvs.putString("wifiSsid", wifiSsid);
+  nvs.putBytes("wifiBssid", WiFi.BSSID(), 6);
+  nvs.putUChar("wifiChannel", WiFi.channel());
+  nvs.end();
+}
+
+/**
+ * Start bringing up Wi-Fi and return at once; handleWifi follows it from loop(). If an earlier boot
+ * cached the access point and its channel, that is joined directly, which skips the scan; DHCP
+ * runs either way. Otherwise, or if that has not worked within WIFI_FAST_CONNECT_TIMEOUT_MS, the
+ * network is scanned for. The driver keeps retrying on its own while the access point is down.
+ * @return True if the cached fast path is being tried.
+ */
+bool initNetwork(const char *netSSID, const char *netPassword, const char *hostname)
+{
+  wifiSsid = netSSID;
+  wifiPassword = netPassword;
+  WiFi.onEvent(wifiEvent);
+  WiFi.setHostname(hostname);
+  // The credentials are compiled in, the driver need not write them to flash on every boot.
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+
+  uint8_t bssid[6];
+  nvs.begin("Friendbox", true);
+  bool cached = nvs.getString("wifiSsid", "") == netSSID && nvs.getBytes("wifiBssid", bssid, sizeof(bssid)) == sizeof(bssid);
+  uint8_t channel = nvs.getUChar("wifiChannel", 0);
+  nvs.end();
+
+  wifiStartMs = millis();
+  if (cached && channel)
+  {
+    wifiState = WIFI_STATE_FAST_CONNECT;
+    WiFi.begin(netSSID, netPassword, channel, bssid);
+  }
+  else
+  {
+    wifiScanConnect();
+  }
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.printf("INFO: Wi-Fi connecting to %s, %s\n", netSSID, wifiState == WIFI_STATE_FAST_CONNECT ? "cached access point" : "scanning");
+#endif
+  return wifiState == WIFI_STATE_FAST_CONNECT;
+}
+
+/** The link is up: save what it took and let waiting work go. */
+static void wifiConnected()
+{
+  bool fast = wifiState == WIFI_STATE_FAST_CONNECT;
+  bool firstTime = wifiStartMs != 0;
+  if (!fast)
+    wifiSaveCache();
+  wifiState = WIFI_STATE_CONNECTED;
+#ifdef FRIENDBOX_DEBUG_MODE
+  if (firstTime)
+    Serial.printf("INFO: Wi-Fi up %lu ms after boot (%lu ms after the canvas) via %s, %s\n", millis(), millis() - bootToCanvasMs,
+                  fast ? "cached access point" : "scan", WiFi.localIP().toString().c_str());
+  else
+    Serial.printf("INFO: Wi-Fi back, %s\n", WiFi.localIP().toString().c_str());
+#endif
+  wifiStartMs = 0;
+  // Whatever was waiting on the connection can go now rather than at the end of its backoff.
+  xSemaphoreTake(outboxLock, portMAX_DELAY);
+  outboxRetryNow(&outbox, millis());
+  xSemaphoreGive(outboxLock);
+  xTaskNotifyGive(networkTaskHandle);
+  networkRefreshFriends(false);
+}
+
+/** Follow the Wi-Fi link from loop(), falling back to a scan if the cached access point does not answer. */
+void handleWifi()
+{
+  switch (wifiState)
+  {
+  case WIFI_STATE_FAST_CONNECT:
+    if (wifiGotIp)
+    {
+      wifiConnected();
+    }
+    else if (wifiLost || millis() - wifiStartMs > WIFI_FAST_CONNECT_TIMEOUT_MS)
+    {
+#ifdef FRIENDBOX_DEBUG_MODE
+      Serial.println("INFO: Cached access point did not answer, scanning");
+#endif
+      wifiScanConnect();
+    }
+    break;
+  case WIFI_STATE_SCAN_CONNECT:
+  case WIFI_STATE_DISCONNECTED:
+    if (wifiGotIp)
+      wifiConnected();
+    break;
+  case WIFI_STATE_CONNECTED:
+    if (!wifiGotIp)
+    {
+      wifiState = WIFI_STATE_DISCONNECTED;
+#ifdef FRIENDBOX_DEBUG_MODE
+      Serial.println("INFO: Wi-Fi lost, reconnecting");
+#endif
+    }
+    break;
+  }
+}
+
+bool initSD(bool forceFormat)
+{
+  SpiBusHold bus;
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.println("INFO: Initializing SD...");
+#endif
+  sdspi.begin(SD_SCK, SD_MISO, SD_MOSI, SD_CS);
+  sdspi.setFrequency(40000000); // 40 MHz, explicitly otherwise will take 80mhz speed of display bus and cause corruption (?)
+  if (!SD.begin(SD_CS, sdspi))
+  {
+#ifdef FRIENDBOX_DEBUG_MODE
+    Serial.println("ERROR: SD mount failed! Is it connected properly?");
 #endif
     return false;
   }
@@ -1788,21 +2415,36 @@ bool initDisplay()
   tft.setRotation(3); // This option enables suffering. Don't forget to account for coordinate translation!
   tft.setBrightness(255);
   tft.setColorDepth(16);
+#ifdef CANVAS_BATCHED_FLUSH
+  canvasSetBatchedFlush(true);
+#endif
+  return true;
+}
 
-  // Allocate framebuffer in ROTATED dimensions
-  canvas_framebuffer = (uint8_t *)malloc((tft.width() * tft.height()) / 2); // 76.8 KB
+/** Canvas memory. Needs no display, so a sketch can be decoded into it while the panel starts up. */
+bool initFramebuffer()
+{
+  // In ROTATED dimensions
+  canvas_framebuffer = (uint8_t *)malloc(CANVAS_FRAMEBUFFER_SIZE); // 76.8 KB
   if (!canvas_framebuffer)
   {
     Serial.println("FATAL: Framebuffer allocation failed!");
     while (1)
       ;
   }
-  memset(canvas_framebuffer, 0, (tft.width() * tft.height()) / 2);
+  memset(canvas_framebuffer, 0, CANVAS_FRAMEBUFFER_SIZE);
+  if (!canvasJournalInit())
+  {
+#ifdef FRIENDBOX_DEBUG_MODE
+    Serial.println("WARN: Not enough memory for undo history, undo disabled.");
+#endif
+  }
   return true;
 }
 
 bool initTouch(bool forceCalibrate)
 {
+  SpiBusHold bus;
 #ifdef FRIENDBOX_DEBUG_MODE
   Serial.println("INFO: Initializing LGFX touch...");
 #endif
@@ -1864,34 +2506,14 @@ bool initTouch(bool forceCalibrate)
       Serial.println("INFO: Successfully wrote calibration data to SD.");
 #endif
     }
+    // Calibration took over the screen, put the canvas back.
+    drawFramebuffer();
   }
 
   tft.setTouchCalibrate(calibration_data);
   return true;
 }
 
-bool initNVS()
-{
-  nvs.begin("Friendbox", true);
-  // loadImageFromSD(nvs.getUInt("lastActiveSlot", 8));
-  nvs.end();
-  return true;
-}
-
-void drawPixelToFB(int x, int y, uint8_t colorIndex)
-{
-  if (x < 0 || x >= tft.width() || y < 0 || y >= tft.height())
-    return;
-
-  int index = y * tft.width() + x;
-  int byteIndex = index >> 1;
-
-  if (index & 1)
-    canvas_framebuffer[byteIndex] = (canvas_framebuffer[byteIndex] & 0xF0) | (colorIndex & 0x0F);
-  else
-    canvas_framebuffer[byteIndex] = (canvas_framebuffer[byteIndex] & 0x0F) | ((colorIndex & 0x0F) << 4);
-}
-
 // Helper functions to change tool settings
 void setDrawColor(uint8_t colorIndex)
 {
@@ -1914,88 +2536,6 @@ void setBackgroundColor(uint8_t colorIndex)
   }
 }
 
-/** Draw a circle brush at x,y with given radius and color - Updates BOTH framebuffer and screen in real-time! */
-void drawBrushToFB(int x, int y, int radius, uint8_t colorIndex)
-{
-  // Draw filled circle using midpoint circle algorithm
-  for (int dy = -radius; dy <= radius; dy++)
-  {
-    for (int dx = -radius; dx <= radius; dx++)
-    {
-      // Check if point is inside circle
-      if (dx * dx + dy * dy <= radius * radius)
-      {
-        int px = x + dx;
-        int py = y + dy;
-
-        // Draw to framebuffer
-        drawPixelToFB(px, py, colorIndex);
-
-        // Draw to screen immediately for instant feedback
-        if (px >= 0 && px < tft.width() && py >= 0 && py < tft.height())
-        {
-          tft.drawPixel(px, py, draw_color_palette[colorIndex]);
-        }
-      }
-    }
-  }
-}
-
-void drawDitherToFB(int x, int y, int radius, uint8_t colorIndex)
-{
-  // Draw filled circle using midpoint circle algorithm
-  for (int dy = -radius; dy <= radius; dy++)
-  {
-    for (int dx = -radius; dx <= radius; dx++)
-    {
-      // Check if point is inside circle
-      if (dx * dx + dy * dy <= radius * radius)
-      {
-        int px = x + dx;
-        int py = y + dy;
-
-        // Only draw even pixels.
-        if ((px % 2 == 0) && py % 2 == 0)
-        {
-          // Draw to framebuffer
-          drawPixelToFB(px, py, colorIndex);
-
-          // Draw to screen immediately for instant feedback
-          if (px >= 0 && px < tft.width() && py >= 0 && py < tft.height())
-          {
-            tft.drawPixel(px, py, draw_color_palette[colorIndex]);
-          }
-        }
-      }
-    }
-  }
-}
-
-void drawTest4()
-{
-  for (int y = 0; y < tft.height(); y++)
-  {
-    for (int x = 0; x < tft.width(); x++)
-    {
-      uint8_t color = (x >> 5) & 0x0F; // 16 vertical stripes
-      drawPixelToFB(x, y, color);
-    }
-  }
-}
-
-void drawClearScreen()
-{
-  for (int y = 0; y < tft.height(); y++)
-  {
-    for (int x = 0; x < tft.width(); x++)
-    {
-      drawPixelToFB(x, y, currentDrawColorIndex);
-    }
-  }
-  // updateDisplayWithFB();
-  drawFramebuffer();
-}
-
 void saveImageToSD(int slot)
 {
   drawFriendboxLoadingScreen("Saving...", 0);
@@ -2006,11 +2546,24 @@ void saveImageToSD(int slot)
   }
   char filename[50];
   snprintf(filename, sizeof(filename), "/sketches/slots/slot%d.fbox", slot);
-  File f = SD.open(filename, FILE_WRITE);
-  if (f)
+  bool ok;
   {
-    f.write(canvas_framebuffer, (tft.width() * tft.height()) / 2);
+    File f;
+    {
+      SpiBusHold bus;
+      f = SD.open(filename, FILE_WRITE);
+    }
+    ok = f && fboxWrite(canvas_framebuffer, fboxFileWrite, &f) == FBOX_OK;
+    SpiBusHold bus;
     f.close();
+    // The new file carries its own thumbnail, so any sidecar from an older save is stale.
+    char thumbPath[64];
+    snprintf(thumbPath, sizeof(thumbPath), "%s" FBOX_THUMB_FILE_SUFFIX, filename);
+    if (ok && SD.exists(thumbPath))
+      SD.remove(thumbPath);
+  }
+  if (ok)
+  {
     currentSaveSlot = slot;
     nvs.begin("Friendbox", false);
     nvs.putUInt("lastActiveSlot", currentSaveSlot);
@@ -2025,7 +2578,6 @@ void saveImageToSD(int slot)
   }
   else
   {
-    f.close();
     drawFriendboxLoadingScreen("ERROR: SAVE FAILED!", 1000);
     drawFramebuffer();
   }
@@ -2034,19 +2586,42 @@ void saveImageToSD(int slot)
 void loadSketchFromSD(const char *path)
 {
   drawFriendboxLoadingScreen("Loading...", 0);
-  char filename[50];
-  snprintf(filename, sizeof(filename), "/sketches/saved/%s", path);
+  char filename[sizeof(SKETCH_INDEX_DIR "/") + SKETCH_INDEX_NAME_MAX];
+  int len = snprintf(filename, sizeof(filename), SKETCH_INDEX_DIR "/%s", path);
+  if (len < 0 || (size_t)len >= sizeof(filename))
+  {
+    // Not a name the index could have written; the file may well be there, so leave it listed.
+    drawFriendboxLoadingScreen("Loading...", 500, "Name too long :(");
+    return;
+  }
   Serial.println("Loading: ");
   Serial.println(filename);
-  File f = SD.open(filename, FILE_READ);
-  if (f)
+  fbox_result_id_t result = FBOX_ERR_IO;
+  bool found;
   {
-    f.read(canvas_framebuffer, (TFT_VER_RES * TFT_HOR_RES) / 2);
-    f.close();
+    File f;
+    {
+      SpiBusHold bus;
+      f = SD.open(filename, FILE_READ);
+    }
+    found = f;
+    if (found)
+    {
+      result = fboxFileToCanvas(f);
+      SpiBusHold bus;
+      f.close();
+    }
+  }
+  if (found)
+  {
+    if (result != FBOX_OK)
+      drawFriendboxLoadingScreen("Loading...", 500, "File is damaged :(");
     drawFramebuffer();
   }
   else
   {
+    // Deleted behind the index's back, stop listing it.
+    sdUnindexSketch(path);
     drawFriendboxLoadingScreen("Loading...", 500, "File Doesn't Exist :(");
   }
 }
@@ -2063,11 +2638,34 @@ void loadImageFromSD(int slot)
   char filename[50];
   snprintf(filename, sizeof(filename), "/sketches/slots/slot%d.fbox", slot);
 
-  File f = SD.open(filename, FILE_READ);
-  if (f)
+  fbox_result_id_t result = FBOX_ERR_IO;
+  bool found;
   {
-    f.read(canvas_framebuffer, (tft.width() * tft.height()) / 2);
-    f.close();
+    File f;
+    {
+      SpiBusHold bus;
+      f = SD.open(filename, FILE_READ);
+    }
+    found = f;
+    if (found)
+    {
+      result = fboxFileToCanvas(f);
+      SpiBusHold bus;
+      f.close();
+    }
+  }
+  if (found)
+  {
+    if (result != FBOX_OK)
+    {
+      drawFriendboxLoadingScreen("Loading...", 500, "Sketch is damaged :(");
+#ifdef FRIENDBOX_DEBUG_MODE
+      Serial.print("WARN: fbox read error ");
+      Serial.println(result);
+#endif
+      drawFramebuffer();
+      return;
+    }
     drawFramebuffer();
     currentSaveSlot = slot;
     nvs.begin("Friendbox", false);
@@ -2091,198 +2689,1074 @@ void loadImageFromSD(int slot)
   }
 }
 
-// Replace specified areas with corresponding contents of the framebuffer. Passing no parameters, this will be the entire screen.
-void drawFramebuffer(int x, int y, int w, int h)
+/** http_stream socket access, ctx is a WiFiClient *. */
+static size_t wifiClientWrite(void *ctx, const uint8_t *data, size_t len)
 {
-  int x1 = max(0, x);
-  int y1 = max(0, y);
-  int x2 = min((int)tft.width(), x + w);
-  int y2 = min((int)tft.height(), y + h);
-
-  int width = x2 - x1;
-  int height = y2 - y1;
-
-  if (width <= 0 || height <= 0)
-    return;
+  return ((WiFiClient *)ctx)->write(data, len);
+}
 
-  static uint16_t lineBuffer[TFT_HOR_RES];
+static size_t wifiClientRead(void *ctx, uint8_t *data, size_t len)
+{
+  return ((WiFiClient *)ctx)->readBytes(data, len);
+}
 
-  tft.startWrite();
-  tft.setAddrWindow(x1, y1, width, height);
+static bool wifiClientConnect(void *ctx, const char *host, uint16_t port)
+{
+  WiFiClient *client = (WiFiClient *)ctx;
+  if (!client->connect(host, port))
+    return false;
+  // Heads and bodies go out in separate writes; don't let Nagle hold the body back for an ACK.
+  client->setNoDelay(true);
+  // Stream's default of a second is shorter than the server takes to store a batch.
+  client->setTimeout(BACKEND_READ_TIMEOUT_MS);
+  return true;
+}
 
-  for (int py = y1; py < y2; py++)
-  {
-    for (int px = x1; px < x2; px++)
-    {
-      int pixelIndex = py * tft.width() + px;
-      int byteIndex = pixelIndex >> 1;
-      uint8_t byte = canvas_framebuffer[byteIndex];
-      uint8_t colorIndex;
+static void wifiClientClose(void *ctx)
+{
+  ((WiFiClient *)ctx)->stop();
+}
 
-      if (pixelIndex & 1)
-      {
-        colorIndex = byte & 0x0F;
-      }
-      else
-      {
-        colorIndex = (byte >> 4) & 0x0F;
-      }
+static bool wifiClientClosed(void *ctx)
+{
+  WiFiClient *client = (WiFiClient *)ctx;
+  return !client->connected() && client->available() == 0;
+}
 
-      lineBuffer[px - x1] = draw_color_palette[colorIndex];
-    }
+/** A sketch file on SD. */
+struct FileBody
+{
+  File *file;
+  NetProgress *progress;
+};
 
-    // Try the version with swap parameter
-    tft.writePixelsDMA(lineBuffer, width, true); // false = don't swap bytes
+static bool writeFileBody(void *ctx, http_write_fn_t write, void *writeCtx)
+{
+  FileBody *body = (FileBody *)ctx;
+  uint32_t total;
+  {
+    SpiBusHold bus;
+    total = body->file->size();
+    body->file->seek(0);
   }
-
-  tft.endWrite();
+  uint32_t done = 0;
+  // One segment's worth per read, so SD and Wi-Fi take turns without a large buffer in between.
+  uint8_t buffer[HTTP_CHUNK_SIZE];
+  size_t n;
+  while ((n = fboxFileRead(body->file, buffer, sizeof(buffer))) > 0)
+  {
+    if (write(writeCtx, buffer, n) != n)
+      return false;
+    done += n;
+    netReportProgress(body->progress, done, total);
+  }
+  return done == total;
 }
 
-void networkSendFramebuffer(int userID)
+/** httpFinishRequest sink that collects a short response, ctx is a String. */
+static size_t stringWrite(void *ctx, const uint8_t *data, size_t len)
 {
-  JsonDocument jsonDoc;
-  jsonDoc["userID"] = userID;
-  jsonDoc["data"] = "FASTAPI SUCKS!";
+  return ((String *)ctx)->concat((const char *)data, len) ? len : 0;
+}
 
-  String jsonString;
-  serializeJson(jsonDoc, jsonString);
+/** Where the outbox keeps the sketch queued under sequence. */
+static void outboxSketchPath(uint32_t sequence, char *path, size_t size)
+{
+  snprintf(path, size, OUTBOX_DIR "/%lu.fbox", (unsigned long)sequence);
+}
+
+/** A batch from the outbox. Each sketch goes out as its length, 4 bytes little endian, then the file. */
+struct OutboxBody
+{
+  const OutboxEntry *batch;
+  uint32_t count;
+  NetProgress *progress;
+};
 
-  http.begin("http://192.168.1.8:8000/posttest");
-  http.addHeader("Content-Type", "application/json");
+static bool writeOutboxBody(void *ctx, http_write_fn_t write, void *writeCtx)
+{
+  OutboxBody *body = (OutboxBody *)ctx;
+  for (uint32_t i = 0; i < body->count; i++)
+  {
+    char path[32];
+    outboxSketchPath(body->batch[i].sequence, path, sizeof(path));
+    File f;
+    uint32_t size;
+    {
+      SpiBusHold bus;
+      f = SD.open(path, FILE_READ);
+      if (!f)
+        return false;
+      size = f.size();
+    }
+    uint8_t length[4] = {(uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24)};
+    FileBody file = {&f, nullptr};
+    bool ok = write(writeCtx, length, sizeof(length)) == sizeof(length) && writeFileBody(&file, write, writeCtx);
+    {
+      SpiBusHold bus;
+      f.close();
+    }
+    if (!ok)
+      return false;
+    netReportProgress(body->progress, i + 1, body->count);
+  }
+  return true;
+}
 
-  int httpCode = http.POST(jsonString);
+/** True if the server turned a batch down in a way sending it again will not change. */
+static bool outboxRefused(int httpCode)
+{
+  return httpCode >= 400 && httpCode < 500 && httpCode != 408 && httpCode != 429;
+}
 
-  if (httpCode == 200)
+/**
+ * Send the next batch from the outbox: the oldest sketches for one recipient, in one chunked POST
+ * on the kept-alive connection. Runs on the network worker. A batch the server accepts, or refuses
+ * in a way retrying will not change, comes off the queue; anything else backs the queue off.
+ * @return HTTP status, 204 if nothing was due or nothing due could be sent, or negative on failure.
+ */
+int networkSendOutbox(NetProgress *progress)
+{
+  OutboxEntry batch[OUTBOX_BATCH_MAX];
+  xSemaphoreTake(outboxLock, portMAX_DELAY);
+  uint32_t n = outboxNextBatch(&outbox, millis(), batch);
+  xSemaphoreGive(outboxLock);
+
+  // A sketch whose file has gone (the card was changed, or a crash came between the two writes
+  // of a queue) can never be sent, so it must not hold up the rest.
+  OutboxEntry lost[OUTBOX_BATCH_MAX];
+  uint32_t kept = 0, lostCount = 0;
+  for (uint32_t i = 0; i < n; i++)
   {
-    String payload = http.getString();
+    char path[32];
+    outboxSketchPath(batch[i].sequence, path, sizeof(path));
+    SpiBusHold bus;
+    if (SD.exists(path))
+      batch[kept++] = batch[i];
+    else
+      lost[lostCount++] = batch[i];
+  }
+  if (lostCount > 0)
+  {
+    xSemaphoreTake(outboxLock, portMAX_DELAY);
+    {
+      SpiBusHold bus;
+      outboxDone(&outbox, lost, lostCount);
+      outboxLog.flush();
+    }
+    xSemaphoreGive(outboxLock);
+  }
+  if (kept == 0)
+    return 204;
+
+  // Three characters per byte always fits the escaped name.
+  char to[3 * OUTBOX_RECIPIENT_MAX];
+  char path[sizeof(OUTBOX_SEND_PATH "?to=") + sizeof(to)];
+  httpPercentEncode(batch[0].recipient, to, sizeof(to));
+  snprintf(path, sizeof(path), OUTBOX_SEND_PATH "?to=%s", to);
+  // A batch whose reply never arrives is sent again later, possibly after the server stored it.
+  // The key names this device and the sketches in body order, so the server can drop any it has.
+  char idempotency[40 + 11 * OUTBOX_BATCH_MAX];
+  int keyLength = snprintf(idempotency, sizeof(idempotency), "Idempotency-Key: %012llx-", (unsigned long long)ESP.getEfuseMac());
+  for (uint32_t i = 0; i < kept; i++)
+    keyLength += snprintf(idempotency + keyLength, sizeof(idempotency) - keyLength, i ? ",%u" : "%u", batch[i].sequence);
+  snprintf(idempotency + keyLength, sizeof(idempotency) - keyLength, "\r\n");
+  unsigned long startMs = millis();
+  OutboxBody body = {batch, kept, progress};
+  HttpResponse response;
+  int httpCode = httpRequest(&backend, "POST", path, "application/x-fbox-batch", -1, idempotency, writeOutboxBody, &body, &response);
+  if (httpCode >= 0)
+    httpFinishRequest(&backend, &response);
+  bool refused = outboxRefused(httpCode);
+
+  xSemaphoreTake(outboxLock, portMAX_DELAY);
+  bool done;
+  {
+    SpiBusHold bus;
+    done = (httpCode == 200 || refused) && outboxDone(&outbox, batch, kept);
+    if (!done)
+      outboxFailed(&outbox, millis(), esp_random());
+    outboxLog.flush();
+    if (outboxNeedsCompact(&outbox))
+      sdCompactOutbox();
+  }
+  uint32_t waitMs = outboxWaitMs(&outbox, millis());
+  xSemaphoreGive(outboxLock);
 
-    Serial.println(payload);
+  if (done)
+  {
+    for (uint32_t i = 0; i < kept; i++)
+    {
+      char sketchPath[32];
+      outboxSketchPath(batch[i].sequence, sketchPath, sizeof(sketchPath));
+      SpiBusHold bus;
+      SD.remove(sketchPath);
+    }
   }
+#ifdef FRIENDBOX_DEBUG_MODE
+  if (done)
+    Serial.printf("INFO: %s %u sketches for %s in %lu ms (%d)\n", refused ? "Server refused" : "Sent", kept, batch[0].recipient, millis() - startMs, httpCode);
   else
+    Serial.printf("INFO: Outbox send failed (%d), retrying in %lu ms\n", httpCode, (unsigned long)waitMs);
+#endif
+  return httpCode;
+}
+
+/** The network worker's transport: run one queued request. */
+static int networkHandleRequest(void *, const NetRequest *request, NetProgress *progress)
+{
+  switch (request->type)
   {
-    Serial.printf("Error: %d\n", httpCode);
-    Serial.printf("Error Payload: %s\n", http.errorToString(httpCode).c_str());
+  case NET_REQUEST_GET_FRIENDS:
+    return networkGetFriends(friendRefresh.etag, &friendRefresh.friends, friendRefresh.responseEtag);
+  case NET_REQUEST_RECEIVE_INBOX:
+    return networkReceiveFramebuffer(progress);
+  case NET_REQUEST_SEND_OUTBOX:
+    return networkSendOutbox(progress);
   }
+  return -1;
+}
 
-  http.end();
+/** The network worker's transport, with the backend connection's reuse logged after each request. */
+static int networkRunRequest(void *ctx, const NetRequest *request, NetProgress *progress)
+{
+  int status = networkHandleRequest(ctx, request, progress);
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.printf("INFO: Backend has served %u requests over %u connections, %u resent\n", backend.requests, backend.connects, backend.retries);
+#endif
+  return status;
 }
 
-bool networkSendCanvas()
+/**
+ * Body of the network task: run queued requests, then the outbox whenever a batch is due. Sleeps
+ * until notified, or until the outbox's backoff runs out, when there is nothing to do.
+ */
+static void networkTask(void *)
 {
-  HTTPClient http;
+  for (;;)
+  {
+    if (netWorkerStep(&netWorker))
+      continue;
+    xSemaphoreTake(outboxLock, portMAX_DELAY);
+    uint32_t waitMs = outboxWaitMs(&outbox, millis());
+    xSemaphoreGive(outboxLock);
+    if (waitMs == 0)
+    {
+      NetRequest request = {NET_REQUEST_SEND_OUTBOX};
+      netWorkerRun(&netWorker, &request);
+      continue;
+    }
+    ulTaskNotifyTake(pdTRUE, waitMs == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(waitMs));
+  }
+}
 
-  // Calculate size
-  size_t framebufferSize = (tft.width() * tft.height()) / 2; // 76,800 bytes
+/** Lets the UI drain the mailbox while the worker waits to post a completion. */
+static void networkTaskIdle()
+{
+  vTaskDelay(1);
+}
 
-  http.begin("http://192.168.1.8:8000/sketches/upload");
-  http.addHeader("Content-Type", "application/octet-stream");
+/** Start sampling on the calling core, which must be the one loop() runs on. */
+bool initTouchTask()
+{
+  touchStreamInit(&touchStream);
+  touchFilterInit(&touchFilterState);
+  return xTaskCreatePinnedToCore(touchTask, "touch", TOUCH_TASK_STACK, nullptr, TOUCH_TASK_PRIORITY, &touchTaskHandle, xPortGetCoreID()) == pdPASS;
+}
 
-  // Send raw framebuffer data
-  int httpCode = http.POST(canvas_framebuffer, framebufferSize);
+/** Start the network worker on the Wi-Fi core. */
+bool initNetworkWorker()
+{
+  httpConnectionInit(&backend, FRIENDBOX_SERVER_HOST, FRIENDBOX_SERVER_PORT, wifiClientWrite, wifiClientRead, wifiClientConnect, wifiClientClose, &backendClient, wifiClientClosed);
+  netWorkerInit(&netWorker, networkRunRequest, nullptr, networkTaskIdle);
+  return xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, nullptr, 1, &networkTaskHandle, NETWORK_TASK_CORE) == pdPASS;
+}
 
-  if (httpCode == 200)
+/**
+ * Queue a request and wake the worker.
+ * @return The request id, or 0 if the queue is full, in which case request->body is still the caller's.
+ */
+uint32_t networkSubmit(NetRequest *request)
+{
+  uint32_t id = netSubmit(&netWorker, request);
+  if (id)
+    xTaskNotifyGive(networkTaskHandle);
+  return id;
+}
+
+/**
+ * Send the canvas as it is now to recipient, by way of the outbox: the sketch is written to SD,
+ * then queued with one record appended to the log, and the network worker woken to send it.
+ * @return False if it could not be stored or the outbox is full.
+ */
+bool outboxQueueCanvas(const char *recipient)
+{
+  char path[32];
+  xSemaphoreTake(outboxLock, portMAX_DELAY);
+  outboxSketchPath(outbox.nextSequence, path, sizeof(path));
+  bool ok = outbox.count < OUTBOX_MAX_PENDING;
+  if (ok)
+  {
+    // The encoder's writes take the bus one at a time, so touch is sampled while it compresses.
+    File f;
+    {
+      SpiBusHold bus;
+      f = SD.open(path, FILE_WRITE);
+    }
+    ok = f && fboxWrite(canvas_framebuffer, fboxFileWrite, &f) == FBOX_OK;
+    SpiBusHold bus;
+    f.close();
+  }
   {
-    String response = http.getString();
-    Serial.println("Sketch uploaded successfully!");
-    Serial.println(response);
-    http.end();
+    SpiBusHold bus;
+    ok = ok && outboxAdd(&outbox, recipient, millis());
+    outboxLog.flush();
+  }
+  xSemaphoreGive(outboxLock);
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.printf("INFO: %s %s for %s, %u in the outbox\n", ok ? "Queued" : "Could not queue", path, recipient, outbox.count);
+#endif
+  if (ok)
+    xTaskNotifyGive(networkTaskHandle);
+  return ok;
+}
+
+/** Inbox ids become file names, so only take plain ones. */
+static bool isInboxId(const char *id)
+{
+  size_t len = strlen(id);
+  if (len == 0 || len >= INBOX_ID_MAX)
+    return false;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (!isalnum((unsigned char)id[i]) && id[i] != '-' && id[i] != '_')
+      return false;
+  }
+  return true;
+}
+
+/** Ask the server for the oldest sketch waiting for us. @return HTTP status, 204 if there is none. */
+static int networkNextInboxId(char *id)
+{
+  HttpResponse response;
+  int httpCode = httpRequest(&backend, "GET", INBOX_PATH, nullptr, 0, nullptr, nullptr, nullptr, &response);
+  if (httpCode < 0)
+    return httpCode;
+  String list;
+  bool read = httpFinishRequest(&backend, &response, stringWrite, &list);
+  if (httpCode != 200)
+    return httpCode;
+  JsonDocument doc;
+  if (!read || deserializeJson(doc, list))
+    return -1;
+  JsonArray ids = doc.as<JsonArray>();
+  if (ids.size() == 0)
+    return 204;
+  const char *first = ids[0] | "";
+  if (!isInboxId(first))
+    return -1;
+  strcpy(id, first);
+  return 200;
+}
+
+/** fboxRead source for a download: what an earlier attempt left on SD, then the body, appended to the file as it arrives. */
+struct InboxReader
+{
+  File *part;
+  /** Bytes still to replay from the file before the body takes over. */
+  uint32_t fromFile;
+  /** Bytes in the file. */
+  uint32_t onFile;
+  /** Size of the whole sketch. */
+  uint32_t total;
+  HttpBodyReader body;
+  bool writeFailed;
+  NetProgress *progress;
+};
+
+static size_t inboxRead(void *ctx, uint8_t *data, size_t len)
+{
+  InboxReader *r = (InboxReader *)ctx;
+  if (r->fromFile > 0)
+  {
+    SpiBusHold bus;
+    size_t n = r->part->read(data, len < r->fromFile ? len : r->fromFile);
+    r->fromFile -= n;
+    // Reads and writes on one file need a seek in between.
+    if (n > 0 && r->fromFile == 0)
+      r->part->seek(r->onFile);
+    return n;
+  }
+  size_t n = httpBodyRead(&r->body, data, len);
+  if (n > 0 && fboxFileWrite(r->part, data, n) != n)
+  {
+    r->writeFailed = true;
+    return 0;
+  }
+  r->onFile += n;
+  netReportProgress(r->progress, r->onFile, r->total);
+  return n;
+}
+
+/** Rows gathered by the worker for the next band. */
+static ReceiveBand inboxBand;
+
+static void flushInboxBand()
+{
+  if (inboxBand.rows == 0)
+    return;
+  while (!inboxReceive.bands.push(inboxBand))
+    vTaskDelay(1);
+  inboxBand.rows = 0;
+}
+
+/** fboxRead row callback, hands rows to the UI a band at a time. */
+static void inboxRow(void *, int y, const uint8_t *row)
+{
+  if (inboxBand.rows == 0)
+    inboxBand.y = y;
+  memcpy(inboxBand.pixels + inboxBand.rows * (TFT_HOR_RES / 2), row, TFT_HOR_RES / 2);
+  if (++inboxBand.rows == RECEIVE_BAND_ROWS)
+    flushInboxBand();
+}
+
+/**
+ * Download inbox sketch id to partPath, decoding and showing it as it arrives. Nothing but the
+ * decoder's small buffers is held in RAM: every byte goes to SD as it is read. If an earlier
+ * attempt left part of the file behind, only the rest is requested with a Range header, and the
+ * part on SD is replayed through the decoder first so the sketch still fills in from the top.
+ * @return 200 once the whole sketch is on SD and its CRC checks out, otherwise the HTTP status or -1.
+ */
+static int networkDownloadSketch(const char *id, const char *partPath, NetProgress *progress)
+{
+  char path[64];
+  snprintf(path, sizeof(path), INBOX_PATH "/%s", id);
+  int httpCode = -1;
+  for (int attempt = 0; attempt < INBOX_ATTEMPTS; attempt++)
+  {
+    File part;
+    uint32_t onFile = 0;
+    {
+      SpiBusHold bus;
+      part = SD.open(partPath, SD.exists(partPath) ? "r+" : "w+");
+      if (part)
+        onFile = part.size();
+    }
+    if (!part)
+      return -1;
+    InboxReader reader = {&part, 0, onFile, 0};
+    reader.progress = progress;
+    char range[40] = "";
+    if (reader.onFile > 0)
+      snprintf(range, sizeof(range), "Range: bytes=%u-\r\n", reader.onFile);
+    HttpResponse response;
+    httpCode = httpRequest(&backend, "GET", path, nullptr, 0, range, nullptr, nullptr, &response);
+    if (httpCode == 206 && response.rangeStart == (int32_t)reader.onFile && response.rangeTotal > 0)
+    {
+      reader.fromFile = reader.onFile;
+      reader.total = response.rangeTotal;
+      SpiBusHold bus;
+      part.seek(0);
+    }
+    else if (httpCode == 200)
+    {
+      // No range, or the server would not honour it: start over.
+      SpiBusHold bus;
+      part.close();
+      part = SD.open(partPath, "w+");
+      reader.onFile = 0;
+      reader.total = response.contentLength > 0 ? response.contentLength : 0;
+    }
+    else
+    {
+      if (httpCode >= 0)
+        httpFinishRequest(&backend, &response);
+      SpiBusHold bus;
+      part.close();
+      // 416, or a 206 from somewhere else than we asked: what we hold does not match the sketch on
+      // the server. Throw it away and start over.
+      if (httpCode == 416 || httpCode == 206)
+      {
+        SD.remove(partPath);
+        continue;
+      }
+      return httpCode;
+    }
+
+    httpBodyBegin(&reader.body, wifiClientRead, &backendClient, &response);
+    if (reader.total == 0)
+    {
+      // Chunked, no Content-Length: the sketch says how big it is. Its header goes to SD like the
+      // rest of the body, then is replayed to the decoder from there.
+      uint8_t header[FBOX_HEADER_SIZE];
+      size_t got = 0;
+      size_t n;
+      while (got < sizeof(header) && (n = inboxRead(&reader, header + got, sizeof(header) - got)) > 0)
+        got += n;
+      reader.total = fboxFileSize(header, got);
+      reader.fromFile = reader.onFile;
+      SpiBusHold bus;
+      part.seek(0);
+    }
+    inboxBand.rows = 0;
+    fbox_result_id_t result = fboxRead(inboxRead, &reader, reader.total, inboxRow, nullptr);
+    flushInboxBand();
+    {
+      SpiBusHold bus;
+      part.close();
+    }
+    if (result == FBOX_OK)
+    {
+      // fboxRead stops at the last row, the chunked terminator may still be on the wire.
+      httpDrainBody(&backend, &reader.body);
+      return 200;
+    }
+    // The body did not arrive in full, so the connection is in no state for another request.
+    httpConnectionClose(&backend);
+    bool cutOff = reader.body.failed || (!reader.body.done && result == FBOX_ERR_IO);
+    if (!cutOff || reader.writeFailed)
+    {
+      // Damaged rather than cut short, resuming would only give the same result.
+      SpiBusHold bus;
+      SD.remove(partPath);
+      return -1;
+    }
+#ifdef FRIENDBOX_DEBUG_MODE
+    Serial.printf("INFO: Inbox download cut off at %u of %u bytes, resuming\n", reader.onFile, reader.total);
+#endif
+  }
+  return -1;
+}
+
+/**
+ * Receive the oldest sketch waiting in the inbox into SKETCH_INDEX_DIR. Runs on the network worker;
+ * rows go to the UI through inboxReceive.bands as they decode. The sketch is only acknowledged to
+ * the server once it is safely on SD.
+ * @return 200 with inboxReceive.name set, 204 if the inbox is empty, otherwise the HTTP status or -1.
+ */
+int networkReceiveFramebuffer(NetProgress *progress)
+{
+  char id[INBOX_ID_MAX];
+  int httpCode = networkNextInboxId(id);
+  if (httpCode != 200)
+    return httpCode;
+
+  char partPath[64];
+  char finalPath[64];
+  {
+    SpiBusHold bus;
+    SD.mkdir("/friendbox");
+    SD.mkdir(INBOX_PARTIAL_DIR);
+  }
+  snprintf(partPath, sizeof(partPath), INBOX_PARTIAL_DIR "/%s.part", id);
+  httpCode = networkDownloadSketch(id, partPath, progress);
+  if (httpCode != 200)
+    return httpCode;
+
+  snprintf(inboxReceive.name, sizeof(inboxReceive.name), "inbox_%s.fbox", id);
+  snprintf(finalPath, sizeof(finalPath), SKETCH_INDEX_DIR "/%s", inboxReceive.name);
+  {
+    SpiBusHold bus;
+    SD.remove(finalPath);
+    if (!SD.rename(partPath, finalPath))
+      return -1;
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), INBOX_PATH "/%s", id);
+  HttpResponse response;
+  if (httpRequest(&backend, "DELETE", path, nullptr, 0, nullptr, nullptr, nullptr, &response) >= 0)
+    httpFinishRequest(&backend, &response);
+  return 200;
+}
+
+/** Fill SCREEN_RECEIVED with a message, which incoming rows then draw over. */
+static void drawReceivedMessage(const char *message)
+{
+  tft.fillScreen(draw_color_palette[currentDrawColorIndex]);
+  tft.setTextColor(draw_color_palette_text_color[currentDrawColorIndex], draw_color_palette[currentDrawColorIndex]);
+  tft.setTextSize(5);
+  tft.drawCenterString("Inbox", 240, 120);
+  tft.setTextSize(3);
+  tft.drawCenterString(message, 240, 180);
+}
+
+/** Queue a download of the next sketch in the inbox, unless one is already running. */
+bool networkCheckInbox()
+{
+  if (inboxReceive.requestId)
+  {
+    drawReceivedMessage("Receiving...");
     return true;
   }
-  else
+  if (WiFi.status() != WL_CONNECTED)
   {
-    Serial.printf("Upload failed: %d\n", httpCode);
-    http.end();
+    drawReceivedMessage("No connection.");
     return false;
   }
+  NetRequest request = {NET_REQUEST_RECEIVE_INBOX};
+  inboxReceive.requestId = networkSubmit(&request);
+  drawReceivedMessage(inboxReceive.requestId ? "Checking..." : "Busy, try again.");
+  return inboxReceive.requestId != 0;
 }
 
-void networkReceiveFramebuffer()
+/** Restore the friend list saved by the last session, so the address book works before the first fetch. */
+bool sdLoadFriendCache()
 {
-  // To implement
+  SpiBusHold bus;
+  File f = SD.open(FRIEND_CACHE_PATH, FILE_READ);
+  if (!f)
+    return false;
+  bool ok = friendCacheLoad(&friendCache, fboxFileRead, &f);
+  f.close();
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.printf("INFO: %s %u cached friends\n", ok ? "Loaded" : "Could not load", friendCache.friends.count);
+#endif
+  return ok;
+}
+
+bool sdSaveFriendCache()
+{
+  SpiBusHold bus;
+  SD.mkdir("/friendbox");
+  File f = SD.open(FRIEND_CACHE_PATH, FILE_WRITE);
+  if (!f)
+    return false;
+  bool ok = friendCacheSave(&friendCache, fboxFileWrite, &f);
+  f.close();
+  return ok;
+}
+
+/**
+ * Replace the outbox log with one holding only what is still pending, and reopen it for appending.
+ * Called with outboxLock held.
+ */
+bool sdCompactOutbox()
+{
+  SpiBusHold bus;
+  File temp = SD.open(OUTBOX_LOG_TEMP_PATH, FILE_WRITE);
+  bool ok = temp && outboxCompact(&outbox, fboxFileWrite, &temp);
+  temp.close();
+  if (!ok)
+    return false;
+  outboxLog.close();
+  SD.remove(OUTBOX_LOG_PATH);
+  ok = SD.rename(OUTBOX_LOG_TEMP_PATH, OUTBOX_LOG_PATH);
+  outboxLog = SD.open(OUTBOX_LOG_PATH, FILE_APPEND);
+  return ok && outboxLog;
+}
+
+/** Rebuild the outbox from its log, so sketches queued before a reboot still go out. */
+bool sdLoadOutbox()
+{
+  outboxLock = xSemaphoreCreateMutex();
+  SpiBusHold bus;
+  outboxInit(&outbox, fboxFileWrite, &outboxLog);
+  SD.mkdir("/friendbox");
+  SD.mkdir(OUTBOX_DIR);
+  // A compaction cut off between removing the old log and putting the new one in its place.
+  if (!SD.exists(OUTBOX_LOG_PATH) && SD.exists(OUTBOX_LOG_TEMP_PATH))
+    SD.rename(OUTBOX_LOG_TEMP_PATH, OUTBOX_LOG_PATH);
+  File f = SD.open(OUTBOX_LOG_PATH, FILE_READ);
+  if (f)
+  {
+    outboxLoad(&outbox, fboxFileRead, &f);
+    f.close();
+  }
+  bool ok;
+  if (outboxNeedsCompact(&outbox))
+  {
+    ok = sdCompactOutbox();
+  }
+  else
+  {
+    outboxLog = SD.open(OUTBOX_LOG_PATH, FILE_APPEND);
+    ok = outboxLog;
+  }
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.printf("INFO: %u sketches waiting in the outbox, log of %u records%s\n", outbox.count, outbox.records, ok ? "" : " could not be opened");
+#endif
+  return ok;
+}
+
+/** Positional access to the open index file, ctx is a File *. */
+static size_t sdIndexRead(void *ctx, uint32_t offset, uint8_t *data, size_t len)
+{
+  SpiBusHold bus;
+  File *f = (File *)ctx;
+  if (!f->seek(offset))
+    return 0;
+  return f->read(data, len);
+}
+
+static size_t sdIndexWrite(void *ctx, uint32_t offset, const uint8_t *data, size_t len)
+{
+  SpiBusHold bus;
+  File *f = (File *)ctx;
+  if (!f->seek(offset))
+    return 0;
+  return f->write(data, len);
+}
+
+/** Last write time of SKETCH_INDEX_DIR, which the index is validated against. */
+static uint32_t sdSketchDirModified()
+{
+  SpiBusHold bus;
+  File dir = SD.open(SKETCH_INDEX_DIR);
+  if (!dir)
+    return 0;
+  uint32_t modified = dir.getLastWrite();
+  dir.close();
+  return modified;
 }
 
-std::vector<std::string> sdGetFboxFiles()
+static bool isFboxFileName(const char *name)
 {
-  std::vector<std::string> fileNames;
-  File root = SD.open("/sketches/saved");
+  size_t len = strlen(name);
+  return len > 5 && strcmp(name + len - 5, ".fbox") == 0;
+}
+
+/** Index entry for the file name in SKETCH_INDEX_DIR, reading just its header. */
+static bool sdMakeIndexEntry(File &file, const char *name, SketchIndexEntry *entry)
+{
+  SpiBusHold bus;
+  uint8_t header[FBOX_HEADER_SIZE];
+  size_t got = file.read(header, sizeof(header));
+  return sketchIndexMakeEntry(entry, name, file.size(), file.getLastWrite(), header, got);
+}
+
+/** Walk SKETCH_INDEX_DIR once and write a fresh index. Only needed when the card changed elsewhere. */
+static bool sdRebuildSketchIndex(uint32_t dirModified)
+{
+  SpiBusHold bus;
+#ifdef FRIENDBOX_DEBUG_MODE
+  unsigned long startMs = millis();
+#endif
+  sketchIndexFile.close();
+  sketchIndexFile = SD.open(SKETCH_INDEX_PATH, "w+");
+  if (!sketchIndexFile || !sketchIndexReset(&sketchIndex))
+    return false;
+
+  File root = SD.open(SKETCH_INDEX_DIR);
   if (root)
   {
     File entry;
     while (entry = root.openNextFile())
     {
-      if (!entry.isDirectory())
+      SketchIndexEntry indexEntry;
+      // Skip directories and the .thm thumbnail sidecars that live next to old sketches.
+      if (!entry.isDirectory() && isFboxFileName(entry.name()))
       {
-        Serial.println("Found file: " + String(entry.name()));
-        fileNames.push_back(entry.name());
+        if (sdMakeIndexEntry(entry, entry.name(), &indexEntry))
+          sketchIndexAppend(&sketchIndex, &indexEntry);
+#ifdef FRIENDBOX_DEBUG_MODE
+        else
+          Serial.printf("WARN: %s has too long a name to index\n", entry.name());
+#endif
       }
       entry.close();
     }
     root.close();
   }
-  return fileNames;
+  bool ok = sketchIndexCommit(&sketchIndex, dirModified);
+  sketchIndexFile.flush();
+#ifdef FRIENDBOX_DEBUG_MODE
+  Serial.printf("INFO: Indexed %u sketches in %lu ms\n", sketchIndex.count, millis() - startMs);
+#endif
+  return ok;
+}
+
+/**
+ * Open the sketch index, rebuilding it if it is missing or the directory's modification time no
+ * longer matches. Stays open afterwards, so later calls cost nothing. Sort orders are rebuilt by
+ * the pager the first time it finds them out of date.
+ */
+bool sdOpenSketchIndex()
+{
+  SpiBusHold bus;
+  if (sketchIndexReady)
+    return true;
+  SD.mkdir("/friendbox");
+  SD.mkdir(SKETCH_INDEX_DIR);
+  sketchIndex.read = sdIndexRead;
+  sketchIndex.write = sdIndexWrite;
+  sketchIndex.ctx = &sketchIndexFile;
+  sketchIndexOrder.read = sdIndexRead;
+  sketchIndexOrder.write = sdIndexWrite;
+  sketchIndexOrder.ctx = &sketchIndexOrderFile;
+  if (!sketchPager.index)
+    sketchPagerInit(&sketchPager, &sketchIndex, &sketchIndexOrder, SCREEN_FILE_BROWSER_FILE_BUTTON_COUNT);
+  sketchPagerInvalidate(&sketchPager);
+
+  if (!sketchIndexOrderFile)
+    sketchIndexOrderFile = SD.open(SKETCH_INDEX_ORDER_PATH, SD.exists(SKETCH_INDEX_ORDER_PATH) ? "r+" : "w+");
+  uint32_t dirModified = sdSketchDirModified();
+  sketchIndexFile = SD.open(SKETCH_INDEX_PATH, SD.exists(SKETCH_INDEX_PATH) ? "r+" : "w+");
+  if (sketchIndexFile && sketchIndexOpen(&sketchIndex, dirModified))
+    sketchIndexReady = true;
+  else
+  {
+    // Carry on past the orders' generation, in case the index was lost and they were not.
+    sketchIndexOrderOpen(&sketchIndexOrder, &sketchIndex);
+    if (sketchIndexOrder.generation > sketchIndex.generation)
+      sketchIndex.generation = sketchIndexOrder.generation;
+    sketchIndexReady = sdRebuildSketchIndex(dirModified);
+  }
+  sketchIndexOrderOpen(&sketchIndexOrder, &sketchIndex);
+  return sketchIndexReady;
 }
 
-std::vector<std::string> networkGetFriends()
+/**
+ * Record a sketch that was just written to SKETCH_INDEX_DIR, without walking the directory.
+ * Call after every save or receive into it.
+ */
+bool sdIndexSketch(const char *name)
 {
-  std::vector<std::string> friendNames;
-  http.begin("http://192.168.1.8:8000/get/friends");
-  http.addHeader("Content-Type", "application/json");
+  SpiBusHold bus;
+  if (!sdOpenSketchIndex())
+    return false;
+  char path[64];
+  snprintf(path, sizeof(path), SKETCH_INDEX_DIR "/%s", name);
+  File f = SD.open(path, FILE_READ);
+  if (!f)
+    return false;
+  SketchIndexEntry entry;
+  bool ok = sdMakeIndexEntry(f, name, &entry);
+  f.close();
+  ok = ok && sketchIndexUpsert(&sketchIndex, &entry);
+  // Writing the file may have moved the directory's timestamp; we know why, so the index stays valid.
+  ok = ok && sketchIndexCommit(&sketchIndex, sdSketchDirModified());
+  sketchIndexFile.flush();
+  sketchPagerInvalidate(&sketchPager);
+  return ok;
+}
+
+/** Forget a sketch that was deleted or turned out to be missing. */
+bool sdUnindexSketch(const char *name)
+{
+  SpiBusHold bus;
+  if (!sdOpenSketchIndex())
+    return false;
+  bool ok = sketchIndexRemove(&sketchIndex, name) && sketchIndexCommit(&sketchIndex, sdSketchDirModified());
+  sketchIndexFile.flush();
+  sketchPagerInvalidate(&sketchPager);
+  return ok;
+}
+
+/** httpFinishRequest sink that scans the body into a FriendTable as it arrives. ctx is a FriendTableParser. */
+static size_t friendTableParseWrite(void *ctx, const uint8_t *data, size_t len)
+{
+  friendTableParse((FriendTableParser *)ctx, data, len);
+  return len;
+}
 
-  int httpCode = http.GET();
+/**
+ * Fetch the friend list. The body is never buffered: it is read off the backend connection
+ * (chunked encoding undone) a piece at a time straight into the table.
+ * @param etag ETag of the list we already have, sent as If-None-Match. Empty for an unconditional fetch.
+ * @param friends Filled on 200, should be empty beforehand.
+ * @param responseEtag Set to the server's ETag for the list on 200, empty if it sent none. FRIEND_CACHE_ETAG_MAX bytes.
+ * @return HTTP status; 304 means the list behind etag is still current.
+ */
+int networkGetFriends(const char *etag, FriendTable *friends, char *responseEtag)
+{
+  char conditional[FRIEND_CACHE_ETAG_MAX + 24] = "";
+  if (etag[0])
+    snprintf(conditional, sizeof(conditional), "If-None-Match: %s\r\n", etag);
+  HttpResponse response;
+  int httpCode = httpRequest(&backend, "GET", FRIENDS_PATH, nullptr, 0, conditional, nullptr, nullptr, &response);
 
   if (httpCode == 200)
   {
-    // Store payload.
-    String payload = http.getString();
-    http.end();
+    strlcpy(responseEtag, response.etag, FRIEND_CACHE_ETAG_MAX);
+    FriendTableParser parser;
+    friendTableParseBegin(&parser, friends);
+    bool read = httpFinishRequest(&backend, &response, friendTableParseWrite, &parser);
+    if (!read || parser.result != FRIEND_PARSE_DONE)
+    {
+      Serial.println("Failed to read friends list");
+      friendTableFree(friends);
+      return -1;
+    }
 #ifdef FRIENDBOX_DEBUG_MODE
-    Serial.println("Successfully retrieved friends list!");
-    Serial.print("Payload:");
-    Serial.println(payload);
+    Serial.printf("Parsed %u friends into %u bytes%s\n", friends->count, friends->capacity,
+                  friends->truncated ? ", list truncated" : "");
 #endif
-
-    // Init json object.
-    JsonDocument jsonDoc;
-    // Deserialize JSON payload into document.
-    DeserializationError error = deserializeJson(jsonDoc, payload);
-    if (error)
+  }
+  else
+  {
+    if (httpCode >= 0)
+      httpFinishRequest(&backend, &response);
+    if (httpCode == 304)
     {
-      Serial.print("Failed to parse JSON: ");
-      // throw exception?
-      Serial.println(error.c_str());
-      return friendNames;
+#ifdef FRIENDBOX_DEBUG_MODE
+      Serial.println("Friends list unchanged.");
+#endif
     }
+    else
+      Serial.printf("Error: %d\n", httpCode);
+  }
+  return httpCode;
+}
 
-    // Check if it's an array
-    if (jsonDoc.is<JsonArray>())
-    {
-      JsonArray array = jsonDoc.as<JsonArray>();
+/**
+ * Queue a fetch of the friend list on the network worker, unless one is already pending.
+ * @param force Fetch even if the cached list is within its TTL. The fetch is still conditional,
+ * so an unchanged list costs a 304.
+ * @return True if a fetch was queued.
+ */
+bool networkRefreshFriends(bool force)
+{
+  if (friendRefresh.requestId || WiFi.status() != WL_CONNECTED)
+    return false;
+  if (!force && !friendCacheNeedsRefresh(&friendCache, millis()))
+    return false;
+  strcpy(friendRefresh.etag, friendCache.etag);
+  NetRequest request = {NET_REQUEST_GET_FRIENDS};
+  friendRefresh.requestId = networkSubmit(&request);
+  return friendRefresh.requestId != 0;
+}
 
-      // Iterate through array and add each name
-      for (JsonVariant v : array)
-      {
-        if (v.is<const char *>())
-        {
-          friendNames.push_back(v.as<const char *>());
-        }
-      }
+/** Apply a finished fetch: update the cache, persist it and redraw if it is on screen. */
+static void applyFriendRefresh(int httpCode)
+{
+  friendRefresh.requestId = 0;
+  uint32_t version = friendCache.version;
+  if (httpCode == 200)
+  {
+    friendCacheStore(&friendCache, &friendRefresh.friends, friendRefresh.responseEtag, millis());
+    sdSaveFriendCache();
+  }
+  else if (httpCode == 304)
+  {
+    friendCacheConfirm(&friendCache, millis());
+  }
+  // Either the old list after a swap, or a copy identical to the cache's.
+  friendTableFree(&friendRefresh.friends);
+
+  if (currentScreen == SCREEN_SEND && friendCache.version != version)
+  {
+    // The list may have shrunk under the current page.
+    int lastPage = friendCache.friends.count ? (friendCache.friends.count - 1) / SCREEN_SEND_ADDRESSBOOK_BUTTON_COUNT : 0;
+    SCREEN_SEND_ADDRESSBOOK_BUTTON[0].isDrawn = false;
+    SCREEN_SEND_NAVI_BUTTON[0].isDrawn = false;
+    drawScreenSend(friendListUI.page < lastPage ? friendListUI.page : lastPage);
+  }
+}
+
+/** A download from the inbox finished: list the new sketch, or say why there is none. */
+static void applyInboxReceive(int httpCode)
+{
+  inboxReceive.requestId = 0;
+  if (httpCode == 200)
+    sdIndexSketch(inboxReceive.name);
+  if (currentScreen != SCREEN_RECEIVED)
+    return;
+  if (httpCode == 204)
+    drawReceivedMessage("No new sketches.");
+  else if (httpCode != 200)
+    drawReceivedMessage("Failed, will resume.");
+}
+
+/**
+ * Draw the upload strip over the top of the canvas, or put the canvas back under it if fraction < 0.
+ * Does nothing while a notice covers it.
+ */
+static void drawNetworkStrip(float fraction, uint32_t color)
+{
+  if (currentScreen != SCREEN_CANVAS || networkNoticeClearAt)
+    return;
+  drawFramebuffer(0, 0, TFT_HOR_RES, NETWORK_PROGRESS_STRIP_HEIGHT);
+  if (fraction >= 0)
+    tft.fillRect(0, 0, (int)(TFT_HOR_RES * fraction), NETWORK_PROGRESS_STRIP_HEIGHT, color);
+}
+
+/** Show a notice over the top of the canvas, or put the canvas back under it if message is null. */
+static void drawNetworkNotice(const char *message)
+{
+  if (currentScreen != SCREEN_CANVAS)
+    return;
+  if (!message)
+  {
+    drawFramebuffer(0, 0, TFT_HOR_RES, NETWORK_NOTICE_HEIGHT);
+    return;
+  }
+  tft.fillRect(0, 0, TFT_HOR_RES, NETWORK_NOTICE_HEIGHT, TFT_RED);
+  tft.setTextColor(TFT_WHITE, TFT_RED);
+  tft.setTextSize(2);
+  tft.drawCenterString(message, TFT_HOR_RES / 2, 4);
+}
+
+/** Drain the network mailbox: show upload progress and apply finished requests. Called every loop(). */
+void handleNetworkEvents()
+{
+  // Rows of an incoming sketch. Static, a band is too big for the loop task's stack to spare.
+  static ReceiveBand band;
+  while (inboxReceive.bands.pop(&band))
+  {
+    if (currentScreen == SCREEN_RECEIVED)
+      drawPackedRows(band.pixels, band.y, band.rows);
+  }
 
-      Serial.printf("Parsed %d friends\n", friendNames.size());
+  NetEvent event;
+  while (netPollEvent(&netWorker, &event))
+  {
+    if (event.type == NET_REQUEST_GET_FRIENDS)
+    {
+      if (event.kind == NET_EVENT_DONE && event.requestId == friendRefresh.requestId)
+        applyFriendRefresh(event.status);
+      continue;
     }
-    else
+    if (event.type == NET_REQUEST_RECEIVE_INBOX)
     {
-      Serial.println("Response is not a JSON array!");
-      return friendNames; // Return empty array.
-      // throw exception?
+      if (event.kind == NET_EVENT_DONE && event.requestId == inboxReceive.requestId)
+        applyInboxReceive(event.status);
+      continue;
+    }
+    switch (event.kind)
+    {
+    case NET_EVENT_STARTED:
+    case NET_EVENT_PROGRESS:
+      // Unknown totals still get a sliver, so the user can see something is going on.
+      drawNetworkStrip(event.total ? (float)event.done / event.total : 0.05f, TFT_GREEN);
+      networkStripClearAt = 0;
+      break;
+    case NET_EVENT_DONE:
+      if (event.type == NET_REQUEST_SEND_OUTBOX && outboxRefused(event.status))
+      {
+        // The batch is off the queue for good, so say so rather than flash the strip.
+        char message[40];
+        snprintf(message, sizeof(message), "Sketch refused by server (%d)", (int)event.status);
+        drawNetworkNotice(message);
+        networkNoticeClearAt = millis() + NETWORK_NOTICE_MS;
+        networkStripClearAt = 0;
+      }
+      else if (event.status >= 200 && event.status < 300)
+      {
+        drawNetworkStrip(-1, 0);
+        networkStripClearAt = 0;
+      }
+      else
+      {
+        drawNetworkStrip(1, TFT_RED);
+        networkStripClearAt = millis() + NETWORK_FAILED_STRIP_MS;
+      }
+#ifdef FRIENDBOX_DEBUG_MODE
+      Serial.printf("INFO: Network request %u finished with %d\n", event.requestId, event.status);
+#endif
+      break;
     }
   }
-  else
+  if (networkStripClearAt && (long)(millis() - networkStripClearAt) >= 0)
+  {
+    drawNetworkStrip(-1, 0);
+    networkStripClearAt = 0;
+  }
+  if (networkNoticeClearAt && (long)(millis() - networkNoticeClearAt) >= 0)
   {
-    Serial.printf("Error: %d\n", httpCode);
-    Serial.printf("Error Payload: %s\n", http.errorToString(httpCode).c_str());
-    return friendNames; // Return empty array.
+    drawNetworkNotice(nullptr);
+    networkNoticeClearAt = 0;
   }
-  return friendNames;
 }
 
 void setup()
@@ -2301,8 +3775,10 @@ void setup()
 void loop()
 {
   handleTouch();
-  handleCanvasDraw();
+  canvasFlushDirty(millis());
   handleTouchUIUpdate();
+  handleNetworkEvents();
+  handleWifi();
   // We just gotta run this on loop until we can set up interrupts.
   handleMenuButton(false);
 }
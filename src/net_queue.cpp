@@ -0,0 +1,93 @@
+#include "net_queue.h"
+#include <stdlib.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Network work queue, see net_queue.h.
+
+void netWorkerInit(NetWorker *worker, net_handler_fn_t handler, void *ctx, void (*idle)())
+{
+  worker->handler = handler;
+  worker->ctx = ctx;
+  worker->idle = idle;
+  worker->nextId = 1;
+}
+
+/**
+ * Queue a request, UI side. Fills in request->id.
+ * @return The request id, or 0 if the queue is full, in which case body still belongs to the caller.
+ */
+uint32_t netSubmit(NetWorker *worker, NetRequest *request)
+{
+  request->id = worker->nextId;
+  if (!worker->requests.push(*request))
+    return 0;
+  if (++worker->nextId == 0)
+    worker->nextId = 1;
+  return request->id;
+}
+
+/** Post to the UI. Completion waits for room, anything else is dropped if the mailbox is full. */
+static void postEvent(NetWorker *worker, const NetEvent &event)
+{
+  while (!worker->events.push(event))
+  {
+    if (event.kind != NET_EVENT_DONE)
+    {
+      worker->droppedEvents.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (worker->idle)
+      worker->idle();
+  }
+}
+
+/**
+ * Run the next queued request, worker side.
+ * @return False if there was nothing to do.
+ */
+bool netWorkerStep(NetWorker *worker)
+{
+  NetRequest request;
+  if (!worker->requests.pop(&request))
+    return false;
+  netWorkerRun(worker, &request);
+  return true;
+}
+
+/**
+ * Run a request the worker made up itself, such as a scheduled retry, reporting it to the UI like
+ * a queued one. Worker side. Its id is 0, which the UI never waits on. Frees request->body.
+ * @return The transport's result.
+ */
+int netWorkerRun(NetWorker *worker, NetRequest *request)
+{
+  postEvent(worker, {NET_EVENT_STARTED, request->type, request->id, 0, 0, request->bodyLength});
+  NetProgress progress = {worker, request, 0};
+  int status = worker->handler(worker->ctx, request, &progress);
+  free(request->body);
+  request->body = nullptr;
+  postEvent(worker, {NET_EVENT_DONE, request->type, request->id, status, progress.lastReported, request->bodyLength});
+  return status;
+}
+
+/**
+ * Report how far the running request has got. Cheap to call per chunk: only every
+ * 1/NET_PROGRESS_STEPS of the total (or every chunk when the total is unknown) reaches the UI.
+ */
+void netReportProgress(NetProgress *progress, uint32_t done, uint32_t total)
+{
+  if (!progress)
+    return;
+  uint32_t step = total / NET_PROGRESS_STEPS;
+  if (done != total && done - progress->lastReported < step)
+    return;
+  progress->lastReported = done;
+  const NetRequest *request = progress->request;
+  postEvent(progress->worker, {NET_EVENT_PROGRESS, request->type, request->id, 0, done, total});
+}
+
+/** Take the next event, UI side. @return False if there is none. */
+bool netPollEvent(NetWorker *worker, NetEvent *event)
+{
+  return worker->events.pop(event);
+}
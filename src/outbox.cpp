@@ -0,0 +1,246 @@
+#include "outbox.h"
+#include <string.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Durable outbox, see outbox.h for the log layout.
+
+#define RECORD_QUEUED 'Q'
+#define RECORD_DONE 'D'
+
+static_assert(OUTBOX_BATCH_MAX <= OUTBOX_DONE_MAX, "A batch must fit one delivered record");
+
+static inline void putU32(uint8_t *p, uint32_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = v >> 24;
+}
+
+static inline uint32_t getU32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint8_t recordChecksum(const uint8_t *record)
+{
+  uint8_t sum = 0x5A;
+  for (int i = 2; i < OUTBOX_RECORD_SIZE; i++)
+    sum = (uint8_t)((sum << 1) | (sum >> 7)) ^ record[i];
+  return sum;
+}
+
+static void encodeQueued(const OutboxEntry *entry, uint8_t *record)
+{
+  memset(record, 0, OUTBOX_RECORD_SIZE);
+  record[0] = RECORD_QUEUED;
+  putU32(record + 4, entry->sequence);
+  strcpy((char *)record + 8, entry->recipient);
+  record[1] = recordChecksum(record);
+}
+
+static bool appendRecord(Outbox *outbox, const uint8_t *record)
+{
+  if (outbox->append(outbox->ctx, record, OUTBOX_RECORD_SIZE) != OUTBOX_RECORD_SIZE)
+    return false;
+  outbox->records++;
+  return true;
+}
+
+static void removePending(Outbox *outbox, uint32_t sequence)
+{
+  for (uint32_t i = 0; i < outbox->count; i++)
+  {
+    if (outbox->pending[i].sequence == sequence)
+    {
+      memmove(&outbox->pending[i], &outbox->pending[i + 1], (outbox->count - i - 1) * sizeof(OutboxEntry));
+      outbox->count--;
+      return;
+    }
+  }
+}
+
+static size_t readFully(outbox_read_fn_t read, void *ctx, uint8_t *data, size_t len)
+{
+  size_t got = 0;
+  size_t n;
+  while (got < len && (n = read(ctx, data + got, len - got)) > 0)
+    got += n;
+  return got;
+}
+
+void outboxInit(Outbox *outbox, outbox_write_fn_t append, void *ctx)
+{
+  memset(outbox, 0, sizeof(*outbox));
+  outbox->nextSequence = 1;
+  outbox->append = append;
+  outbox->ctx = ctx;
+}
+
+/**
+ * Rebuild the pending queue by replaying the log from the start.
+ * @return False if it ended in a damaged record. What came before it is kept, but the log must be
+ * compacted before anything more is appended.
+ */
+bool outboxLoad(Outbox *outbox, outbox_read_fn_t read, void *ctx)
+{
+  uint8_t record[OUTBOX_RECORD_SIZE];
+  size_t got;
+  while ((got = readFully(read, ctx, record, sizeof(record))) > 0)
+  {
+    bool queued = record[0] == RECORD_QUEUED && memchr(record + 8, 0, OUTBOX_RECIPIENT_MAX);
+    bool done = record[0] == RECORD_DONE && record[2] <= OUTBOX_DONE_MAX;
+    if (got < sizeof(record) || record[1] != recordChecksum(record) || !(queued || done))
+    {
+      outbox->damaged = true;
+      break;
+    }
+    outbox->records++;
+    if (queued)
+    {
+      uint32_t sequence = getU32(record + 4);
+      if (sequence >= outbox->nextSequence)
+        outbox->nextSequence = sequence + 1 ? sequence + 1 : 1;
+      // outboxAdd never lets the queue overflow, so neither can a replay of what it wrote.
+      if (outbox->count < OUTBOX_MAX_PENDING)
+      {
+        OutboxEntry *entry = &outbox->pending[outbox->count++];
+        entry->sequence = sequence;
+        strcpy(entry->recipient, (const char *)record + 8);
+      }
+    }
+    else
+    {
+      for (uint8_t i = 0; i < record[2]; i++)
+        removePending(outbox, getU32(record + 4 + 4 * i));
+    }
+  }
+  return !outbox->damaged;
+}
+
+/**
+ * Queue the sketch already written under outbox->nextSequence for recipient: one record appended
+ * to the log. A fresh send is tried straight away, even while backing off.
+ * @return False if the queue is full, the name too long or the append failed.
+ */
+bool outboxAdd(Outbox *outbox, const char *recipient, uint32_t nowMs)
+{
+  size_t len = strlen(recipient);
+  if (outbox->damaged || outbox->count == OUTBOX_MAX_PENDING || len == 0 || len >= OUTBOX_RECIPIENT_MAX)
+    return false;
+  OutboxEntry *entry = &outbox->pending[outbox->count];
+  entry->sequence = outbox->nextSequence;
+  memcpy(entry->recipient, recipient, len + 1);
+  uint8_t record[OUTBOX_RECORD_SIZE];
+  encodeQueued(entry, record);
+  if (!appendRecord(outbox, record))
+    return false;
+  outbox->count++;
+  if (++outbox->nextSequence == 0)
+    outbox->nextSequence = 1;
+  outboxRetryNow(outbox, nowMs);
+  return true;
+}
+
+/**
+ * Cut any backoff short, for when there is reason to think sending works again. Failures still
+ * count, so if it does not the next wait is longer.
+ */
+void outboxRetryNow(Outbox *outbox, uint32_t nowMs)
+{
+  outbox->retryAtMs = nowMs;
+}
+
+/**
+ * The next batch to send: the oldest pending sketch and those after it for the same recipient,
+ * oldest first, up to OUTBOX_BATCH_MAX.
+ * @param batch Room for OUTBOX_BATCH_MAX entries.
+ * @return Entries in the batch, 0 if the queue is empty or still backing off.
+ */
+uint32_t outboxNextBatch(Outbox *outbox, uint32_t nowMs, OutboxEntry *batch)
+{
+  if (outboxWaitMs(outbox, nowMs) != 0)
+    return 0;
+  uint32_t n = 0;
+  const char *recipient = outbox->pending[0].recipient;
+  for (uint32_t i = 0; i < outbox->count && n < OUTBOX_BATCH_MAX; i++)
+  {
+    if (strcmp(outbox->pending[i].recipient, recipient) == 0)
+      batch[n++] = outbox->pending[i];
+  }
+  return n;
+}
+
+/**
+ * Take a batch off the queue, delivered or refused for good: one record appended to the log. Ends
+ * any backoff. The caller deletes the sketches' files afterwards.
+ * @return False if the append failed. The batch stays queued and will be sent again.
+ */
+bool outboxDone(Outbox *outbox, const OutboxEntry *batch, uint32_t n)
+{
+  if (outbox->damaged || n > OUTBOX_DONE_MAX)
+    return false;
+  uint8_t record[OUTBOX_RECORD_SIZE];
+  memset(record, 0, sizeof(record));
+  record[0] = RECORD_DONE;
+  record[2] = (uint8_t)n;
+  for (uint32_t i = 0; i < n; i++)
+    putU32(record + 4 + 4 * i, batch[i].sequence);
+  record[1] = recordChecksum(record);
+  if (!appendRecord(outbox, record))
+    return false;
+  for (uint32_t i = 0; i < n; i++)
+    removePending(outbox, batch[i].sequence);
+  outbox->failures = 0;
+  return true;
+}
+
+/**
+ * A batch could not be sent. Hold the queue back OUTBOX_RETRY_MIN_MS, doubling with each failure in
+ * a row up to OUTBOX_RETRY_MAX_MS, plus up to a quarter again at random so a fleet of boxes that
+ * lost the server together does not come back in step.
+ */
+void outboxFailed(Outbox *outbox, uint32_t nowMs, uint32_t random)
+{
+  if (outbox->failures < 31)
+    outbox->failures++;
+  uint32_t delay = OUTBOX_RETRY_MAX_MS;
+  if (outbox->failures <= 16 && (OUTBOX_RETRY_MIN_MS << (outbox->failures - 1)) < OUTBOX_RETRY_MAX_MS)
+    delay = OUTBOX_RETRY_MIN_MS << (outbox->failures - 1);
+  outbox->retryAtMs = nowMs + delay + random % (delay / 4 + 1);
+}
+
+/** @return ms until a batch is due, 0 if one is due now, UINT32_MAX if nothing is queued. */
+uint32_t outboxWaitMs(const Outbox *outbox, uint32_t nowMs)
+{
+  if (outbox->count == 0)
+    return UINT32_MAX;
+  if (outbox->failures == 0)
+    return 0;
+  int32_t wait = (int32_t)(outbox->retryAtMs - nowMs);
+  return wait > 0 ? (uint32_t)wait : 0;
+}
+
+/** The log holds far more than the pending records, or ends in a damaged one. */
+bool outboxNeedsCompact(const Outbox *outbox)
+{
+  return outbox->damaged || outbox->records > outbox->count + OUTBOX_COMPACT_SLACK;
+}
+
+/**
+ * Write a fresh log holding just the pending records. Once it is safely stored in place of the
+ * old one, the caller points outbox->append at it.
+ */
+bool outboxCompact(Outbox *outbox, outbox_write_fn_t write, void *ctx)
+{
+  uint8_t record[OUTBOX_RECORD_SIZE];
+  for (uint32_t i = 0; i < outbox->count; i++)
+  {
+    encodeQueued(&outbox->pending[i], record);
+    if (write(ctx, record, sizeof(record)) != sizeof(record))
+      return false;
+  }
+  outbox->records = outbox->count;
+  outbox->damaged = false;
+  return true;
+}
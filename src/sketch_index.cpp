@@ -0,0 +1,452 @@
+#include "sketch_index.h"
+#include "fbox.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Fixed record sketch index, see sketch_index.h for the layout.
+
+static const uint8_t indexMagic[4] = {'F', 'B', 'I', 'X'};
+static const uint8_t orderMagic[4] = {'F', 'B', 'I', 'O'};
+
+static inline void putU32(uint8_t *p, uint32_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = v >> 24;
+}
+
+static inline uint32_t getU32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t recordOffset(uint32_t i)
+{
+  return SKETCH_INDEX_HEADER_SIZE + i * SKETCH_INDEX_RECORD_SIZE;
+}
+
+static void encodeRecord(const SketchIndexEntry *entry, uint8_t *record)
+{
+  memset(record, 0, SKETCH_INDEX_RECORD_SIZE);
+  memcpy(record, entry->name, SKETCH_INDEX_NAME_MAX);
+  record[SKETCH_INDEX_NAME_MAX - 1] = 0;
+  putU32(record + 40, entry->size);
+  putU32(record + 44, entry->modified);
+  putU32(record + 48, entry->nameKey);
+  putU32(record + 52, entry->thumbOffset);
+  record[56] = entry->flags;
+}
+
+static void decodeRecord(const uint8_t *record, SketchIndexEntry *entry)
+{
+  memcpy(entry->name, record, SKETCH_INDEX_NAME_MAX);
+  entry->name[SKETCH_INDEX_NAME_MAX - 1] = 0;
+  entry->size = getU32(record + 40);
+  entry->modified = getU32(record + 44);
+  entry->nameKey = getU32(record + 48);
+  entry->thumbOffset = getU32(record + 52);
+  entry->flags = record[56];
+}
+
+static bool writeHeader(SketchIndex *index)
+{
+  uint8_t header[SKETCH_INDEX_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, indexMagic, 4);
+  header[4] = SKETCH_INDEX_VERSION;
+  putU32(header + 8, index->count);
+  putU32(header + 12, index->dirModified);
+  putU32(header + 16, index->generation);
+  return index->write(index->ctx, 0, header, sizeof(header)) == sizeof(header);
+}
+
+/** Case-folded first four characters, big endian so integer order matches name order. */
+uint32_t sketchIndexNameKey(const char *name)
+{
+  uint32_t key = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    uint8_t c = *name ? (uint8_t)*name++ : 0;
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    key = (key << 8) | c;
+  }
+  return key;
+}
+
+/**
+ * Fill entry for a file in the sketch directory.
+ * @param fboxHeader The first bytes of the file, at least FBOX_HEADER_SIZE if it is that long.
+ * @return False if the name is too long to index.
+ */
+bool sketchIndexMakeEntry(SketchIndexEntry *entry, const char *name, uint32_t size, uint32_t modified, const uint8_t *fboxHeader, size_t headerLen)
+{
+  size_t len = strlen(name);
+  if (len >= SKETCH_INDEX_NAME_MAX)
+    return false;
+  memset(entry, 0, sizeof(*entry));
+  memcpy(entry->name, name, len);
+  entry->size = size;
+  entry->modified = modified;
+  entry->nameKey = sketchIndexNameKey(name);
+  if (headerLen >= FBOX_HEADER_SIZE && memcmp(fboxHeader, "FBOX", 4) == 0 && fboxHeader[4] == FBOX_VERSION)
+  {
+    entry->flags |= SKETCH_INDEX_FLAG_V2;
+    if (fboxHeader[5] & FBOX_FLAG_THUMBNAIL)
+      entry->thumbOffset = FBOX_HEADER_SIZE;
+  }
+  return true;
+}
+
+/**
+ * Load the header of an existing index. It is only trusted if it was committed against the same
+ * directory modification time, anything else means the directory changed behind our back.
+ * @return False if the index is missing, damaged or stale; rebuild it with sketchIndexReset.
+ */
+bool sketchIndexOpen(SketchIndex *index, uint32_t dirModified)
+{
+  uint8_t header[SKETCH_INDEX_HEADER_SIZE];
+  index->count = 0;
+  index->dirModified = 0;
+  index->generation = 0;
+  if (index->read(index->ctx, 0, header, sizeof(header)) != sizeof(header))
+    return false;
+  if (memcmp(header, indexMagic, 4) != 0 || header[4] != SKETCH_INDEX_VERSION)
+    return false;
+  index->count = getU32(header + 8);
+  index->dirModified = getU32(header + 12);
+  index->generation = getU32(header + 16);
+  return index->dirModified == dirModified && index->count <= SKETCH_INDEX_MAX_ENTRIES;
+}
+
+/**
+ * Empty the index. Storage should be truncated by the caller beforehand. The generation carries on
+ * from whatever was open, so orders built from the old contents are never mistaken for current.
+ */
+bool sketchIndexReset(SketchIndex *index)
+{
+  index->count = 0;
+  index->dirModified = 0;
+  index->generation++;
+  return writeHeader(index);
+}
+
+/**
+ * Write the header, making appended and replaced records visible. Until this runs, a crash leaves
+ * the previous header in place and any new records past its count are simply ignored.
+ */
+bool sketchIndexCommit(SketchIndex *index, uint32_t dirModified)
+{
+  index->dirModified = dirModified;
+  // Skip 0, it marks "no orders built" in SketchIndexOrder.
+  if (++index->generation == 0)
+    index->generation = 1;
+  return writeHeader(index);
+}
+
+bool sketchIndexGet(SketchIndex *index, uint32_t i, SketchIndexEntry *entry)
+{
+  if (i >= index->count)
+    return false;
+  uint8_t record[SKETCH_INDEX_RECORD_SIZE];
+  if (index->read(index->ctx, recordOffset(i), record, sizeof(record)) != sizeof(record))
+    return false;
+  decodeRecord(record, entry);
+  return true;
+}
+
+/**
+ * Position of name in the index, or -1. Reads SKETCH_INDEX_SCAN_RECORDS records per call and only
+ * compares full names when the key matches.
+ */
+int32_t sketchIndexFind(SketchIndex *index, const char *name)
+{
+  uint32_t key = sketchIndexNameKey(name);
+  uint8_t records[SKETCH_INDEX_SCAN_RECORDS * SKETCH_INDEX_RECORD_SIZE];
+  for (uint32_t i = 0; i < index->count; i += SKETCH_INDEX_SCAN_RECORDS)
+  {
+    uint32_t n = index->count - i < SKETCH_INDEX_SCAN_RECORDS ? index->count - i : SKETCH_INDEX_SCAN_RECORDS;
+    size_t len = n * SKETCH_INDEX_RECORD_SIZE;
+    if (index->read(index->ctx, recordOffset(i), records, len) != len)
+      return -1;
+    for (uint32_t r = 0; r < n; r++)
+    {
+      const uint8_t *record = records + r * SKETCH_INDEX_RECORD_SIZE;
+      if (getU32(record + 48) == key && strncmp((const char *)record, name, SKETCH_INDEX_NAME_MAX) == 0)
+        return i + r;
+    }
+  }
+  return -1;
+}
+
+/** Add an entry at the end. Not visible on storage until sketchIndexCommit. */
+bool sketchIndexAppend(SketchIndex *index, const SketchIndexEntry *entry)
+{
+  if (index->count >= SKETCH_INDEX_MAX_ENTRIES)
+    return false;
+  uint8_t record[SKETCH_INDEX_RECORD_SIZE];
+  encodeRecord(entry, record);
+  if (index->write(index->ctx, recordOffset(index->count), record, sizeof(record)) != sizeof(record))
+    return false;
+  index->count++;
+  return true;
+}
+
+/** Replace the entry with the same name, or append it if there is none. */
+bool sketchIndexUpsert(SketchIndex *index, const SketchIndexEntry *entry)
+{
+  int32_t i = sketchIndexFind(index, entry->name);
+  if (i < 0)
+    return sketchIndexAppend(index, entry);
+  uint8_t record[SKETCH_INDEX_RECORD_SIZE];
+  encodeRecord(entry, record);
+  return index->write(index->ctx, recordOffset(i), record, sizeof(record)) == sizeof(record);
+}
+
+/** Drop the entry called name by moving the last record into its place. Order is not preserved. */
+bool sketchIndexRemove(SketchIndex *index, const char *name)
+{
+  int32_t i = sketchIndexFind(index, name);
+  if (i < 0)
+    return false;
+  uint32_t last = index->count - 1;
+  if ((uint32_t)i != last)
+  {
+    uint8_t record[SKETCH_INDEX_RECORD_SIZE];
+    if (index->read(index->ctx, recordOffset(last), record, sizeof(record)) != sizeof(record))
+      return false;
+    if (index->write(index->ctx, recordOffset(i), record, sizeof(record)) != sizeof(record))
+      return false;
+  }
+  index->count--;
+  return true;
+}
+
+/** Load the order file's header. @return True if it matches the index as it stands. */
+bool sketchIndexOrderOpen(SketchIndexOrder *order, const SketchIndex *index)
+{
+  uint8_t header[SKETCH_INDEX_ORDER_HEADER_SIZE];
+  order->generation = 0;
+  order->count = 0;
+  if (order->read(order->ctx, 0, header, sizeof(header)) != sizeof(header))
+    return false;
+  if (memcmp(header, orderMagic, 4) != 0 || header[4] != SKETCH_INDEX_ORDER_VERSION)
+    return false;
+  order->generation = getU32(header + 8);
+  order->count = getU32(header + 12);
+  return order->generation == index->generation && order->count == index->count;
+}
+
+/** Sort keys for one index entry, gathered in a single pass over the records. */
+struct SketchSortKeys
+{
+  uint32_t nameKey;
+  uint32_t modified;
+  uint32_t size;
+  /** Offset of the full name in the name pool, for ties the key cannot settle. */
+  uint32_t nameOffset;
+};
+
+/**
+ * Sort the index three ways and store the orders. Reads every record once and keeps the names in
+ * a pool while sorting, so it needs roughly 20 bytes plus the name length per entry of heap.
+ * Only runs when the index has changed since the last build.
+ */
+bool sketchIndexOrderBuild(SketchIndexOrder *order, SketchIndex *index)
+{
+  uint32_t n = index->count;
+  SketchSortKeys *keys = (SketchSortKeys *)malloc(n * sizeof(SketchSortKeys) + 1);
+  uint16_t *positions = (uint16_t *)malloc(n * sizeof(uint16_t) + 1);
+  size_t poolSize = n * 16 + 1;
+  char *pool = (char *)malloc(poolSize);
+  bool ok = keys && positions && pool;
+
+  size_t poolUsed = 0;
+  uint8_t records[SKETCH_INDEX_SCAN_RECORDS * SKETCH_INDEX_RECORD_SIZE];
+  for (uint32_t i = 0; ok && i < n; i += SKETCH_INDEX_SCAN_RECORDS)
+  {
+    uint32_t batch = n - i < SKETCH_INDEX_SCAN_RECORDS ? n - i : SKETCH_INDEX_SCAN_RECORDS;
+    size_t len = batch * SKETCH_INDEX_RECORD_SIZE;
+    ok = index->read(index->ctx, recordOffset(i), records, len) == len;
+    for (uint32_t r = 0; ok && r < batch; r++)
+    {
+      SketchIndexEntry entry;
+      decodeRecord(records + r * SKETCH_INDEX_RECORD_SIZE, &entry);
+      size_t nameLen = strlen(entry.name) + 1;
+      if (poolUsed + nameLen > poolSize)
+      {
+        // Names are longer than guessed, grow the pool.
+        poolSize = poolSize * 2 + nameLen;
+        char *grown = (char *)realloc(pool, poolSize);
+        if (!grown)
+        {
+          ok = false;
+          break;
+        }
+        pool = grown;
+      }
+      memcpy(pool + poolUsed, entry.name, nameLen);
+      keys[i + r] = {entry.nameKey, entry.modified, entry.size, (uint32_t)poolUsed};
+      poolUsed += nameLen;
+    }
+  }
+
+  uint8_t header[SKETCH_INDEX_ORDER_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, orderMagic, 4);
+  header[4] = SKETCH_INDEX_ORDER_VERSION;
+  // Invalidate first, so a build that dies half way is never trusted.
+  ok = ok && order->write(order->ctx, 0, header, sizeof(header)) == sizeof(header);
+
+  for (int sort = 0; ok && sort < SKETCH_SORT_COUNT; sort++)
+  {
+    for (uint32_t i = 0; i < n; i++)
+      positions[i] = i;
+    // Ties fall back to record position so every build of the same index gives the same order.
+    std::sort(positions, positions + n, [&](uint16_t a, uint16_t b)
+              {
+                const SketchSortKeys &ka = keys[a];
+                const SketchSortKeys &kb = keys[b];
+                switch (sort)
+                {
+                case SKETCH_SORT_DATE:
+                  if (ka.modified != kb.modified)
+                    return ka.modified > kb.modified;
+                  break;
+                case SKETCH_SORT_SIZE:
+                  if (ka.size != kb.size)
+                    return ka.size > kb.size;
+                  break;
+                default:
+                {
+                  if (ka.nameKey != kb.nameKey)
+                    return ka.nameKey < kb.nameKey;
+                  int c = strcasecmp(pool + ka.nameOffset, pool + kb.nameOffset);
+                  if (c != 0)
+                    return c < 0;
+                  break;
+                }
+                }
+                return a < b; });
+
+    uint8_t bytes[2 * SKETCH_INDEX_SCAN_RECORDS * 8];
+    const uint32_t perWrite = sizeof(bytes) / 2;
+    for (uint32_t i = 0; ok && i < n; i += perWrite)
+    {
+      uint32_t batch = n - i < perWrite ? n - i : perWrite;
+      for (uint32_t k = 0; k < batch; k++)
+      {
+        bytes[2 * k] = positions[i + k] & 0xFF;
+        bytes[2 * k + 1] = positions[i + k] >> 8;
+      }
+      uint32_t offset = SKETCH_INDEX_ORDER_HEADER_SIZE + (sort * n + i) * 2;
+      ok = order->write(order->ctx, offset, bytes, batch * 2) == batch * 2;
+    }
+  }
+
+  if (ok)
+  {
+    putU32(header + 8, index->generation);
+    putU32(header + 12, n);
+    ok = order->write(order->ctx, 0, header, sizeof(header)) == sizeof(header);
+  }
+  order->generation = ok ? index->generation : 0;
+  order->count = ok ? n : 0;
+  free(keys);
+  free(positions);
+  free(pool);
+  return ok;
+}
+
+/** Record positions of entries first..first+n-1 in the given order. */
+bool sketchIndexOrderRead(SketchIndexOrder *order, sketch_sort_id_t sort, uint32_t first, uint32_t n, uint16_t *positions)
+{
+  if (first + n > order->count)
+    return false;
+  uint8_t bytes[4 * SKETCH_PAGER_MAX_PAGE];
+  while (n > 0)
+  {
+    uint32_t batch = n < sizeof(bytes) / 2 ? n : sizeof(bytes) / 2;
+    uint32_t offset = SKETCH_INDEX_ORDER_HEADER_SIZE + (sort * order->count + first) * 2;
+    if (order->read(order->ctx, offset, bytes, batch * 2) != batch * 2)
+      return false;
+    for (uint32_t k = 0; k < batch; k++)
+      positions[k] = bytes[2 * k] | (bytes[2 * k + 1] << 8);
+    positions += batch;
+    first += batch;
+    n -= batch;
+  }
+  return true;
+}
+
+void sketchPagerInit(SketchPager *pager, SketchIndex *index, SketchIndexOrder *order, uint32_t pageSize)
+{
+  pager->index = index;
+  pager->order = order;
+  pager->sort = SKETCH_SORT_NAME;
+  pager->pageSize = pageSize < SKETCH_PAGER_MAX_PAGE ? pageSize : SKETCH_PAGER_MAX_PAGE;
+  if (pager->pageSize == 0)
+    pager->pageSize = 1;
+  pager->cacheFirst = 0;
+  pager->cacheCount = 0;
+}
+
+void sketchPagerSetSort(SketchPager *pager, sketch_sort_id_t sort)
+{
+  pager->sort = sort;
+  pager->cacheCount = 0;
+}
+
+/** Drop cached entries, call after the index changes. */
+void sketchPagerInvalidate(SketchPager *pager)
+{
+  pager->cacheCount = 0;
+}
+
+uint32_t sketchPagerCount(const SketchPager *pager)
+{
+  return pager->index->count;
+}
+
+/**
+ * Entry at position in the current sort order. A miss loads the page holding it plus the next
+ * page, so stepping forward through pages reads from storage only every other page. Orders are
+ * rebuilt first if the index changed; if that is impossible, entries come in index order.
+ */
+bool sketchPagerGet(SketchPager *pager, uint32_t position, SketchIndexEntry *entry)
+{
+  SketchIndex *index = pager->index;
+  if (position >= index->count)
+    return false;
+  if (position < pager->cacheFirst || position >= pager->cacheFirst + pager->cacheCount)
+  {
+    SketchIndexOrder *order = pager->order;
+    bool ordered = order->generation == index->generation && order->count == index->count;
+    if (!ordered && order->write)
+      ordered = sketchIndexOrderBuild(order, index);
+
+    uint32_t first = position - position % pager->pageSize;
+    uint32_t n = 2 * pager->pageSize;
+    if (n > index->count - first)
+      n = index->count - first;
+    uint16_t positions[2 * SKETCH_PAGER_MAX_PAGE];
+    if (!ordered || !sketchIndexOrderRead(order, pager->sort, first, n, positions))
+      for (uint32_t k = 0; k < n; k++)
+        positions[k] = first + k;
+
+    pager->cacheCount = 0;
+    for (uint32_t k = 0; k < n; k++)
+    {
+      if (!sketchIndexGet(index, positions[k], &pager->cache[k]))
+        return false;
+      pager->cacheCount++;
+    }
+    pager->cacheFirst = first;
+  }
+  *entry = pager->cache[position - pager->cacheFirst];
+  return true;
+}
@@ -0,0 +1,167 @@
+#include "touch_stream.h"
+#include <string.h>
+#include <math.h>
+
+// (C) 2025-2026 Brandon Bunce - FriendBox System Software
+// Touch sample stream, see touch_stream.h.
+
+/** Call before the sampling task starts. */
+void touchStreamInit(TouchStream *stream)
+{
+  stream->ring.head.store(0, std::memory_order_relaxed);
+  stream->ring.tail.store(0, std::memory_order_relaxed);
+  stream->dropped.store(0, std::memory_order_relaxed);
+  stream->down = false;
+  stream->holding = false;
+}
+
+/**
+ * Producer side, once per reading of the controller. Contacts are all pushed, a lift only when
+ * it ends a touch, so an idle screen costs the ring nothing.
+ * @return False if the sample was lost to a full ring.
+ */
+bool touchStreamSample(TouchStream *stream, uint32_t us, bool touching, uint16_t x, uint16_t y, uint16_t z)
+{
+  if (!touching && !stream->down)
+    return true;
+  TouchSample sample = {us, x, y, (uint16_t)(touching ? (z ? z : 1) : 0)};
+  // down only follows a sample that made it, so a lift lost to a full ring is pushed again next time.
+  if (!stream->ring.push(sample))
+  {
+    stream->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  stream->down = touching;
+  return true;
+}
+
+/**
+ * Consumer side, once per loop(): every sample since the last drain, oldest first. A lift that
+ * follows contacts delivered in the same drain is kept back for the next one, so that the UI sees
+ * a tap that started and ended during one slow frame as a press, then a release.
+ * @return Samples written to out.
+ */
+uint32_t touchStreamDrain(TouchStream *stream, TouchSample *out, uint32_t max)
+{
+  uint32_t n = 0;
+  if (stream->holding && max > 0)
+  {
+    out[n++] = stream->held;
+    stream->holding = false;
+  }
+  TouchSample sample;
+  while (n < max && stream->ring.pop(&sample))
+  {
+    if (sample.z == 0 && n > 0 && out[n - 1].z != 0)
+    {
+      stream->held = sample;
+      stream->holding = true;
+      break;
+    }
+    out[n++] = sample;
+  }
+  return n;
+}
+
+void touchFilterInit(TouchFilter *filter)
+{
+  memset(filter, 0, sizeof(*filter));
+}
+
+static inline uint16_t median3(const uint16_t *v)
+{
+  uint16_t lo = v[0] < v[1] ? v[0] : v[1];
+  uint16_t hi = v[0] < v[1] ? v[1] : v[0];
+  return v[2] < lo ? lo : (v[2] > hi ? hi : v[2]);
+}
+
+/** Smoothing factor of a first order low-pass at cutoffHz, for a step of dt seconds. */
+static inline float lowPassAlpha(float cutoffHz, float dt)
+{
+  float tau = 1.0f / (2.0f * (float)M_PI * cutoffHz);
+  return 1.0f / (1.0f + tau / dt);
+}
+
+static float oneEuro(TouchAxis *axis, float raw, float dt)
+{
+  float speed = (raw - axis->value) / dt;
+  axis->speed += lowPassAlpha(TOUCH_FILTER_SPEED_CUTOFF_HZ, dt) * (speed - axis->speed);
+  float cutoff = TOUCH_FILTER_MIN_CUTOFF_HZ + TOUCH_FILTER_BETA * fabsf(axis->speed);
+  axis->value += lowPassAlpha(cutoff, dt) * (raw - axis->value);
+  return axis->value;
+}
+
+/** First contact passed on in a touch: everything starts from here. */
+static void beginTouch(TouchFilter *filter, const TouchSample *in)
+{
+  filter->down = true;
+  filter->peakZ = in->z;
+  for (int i = 0; i < 3; i++)
+  {
+    filter->recentX[i] = in->x;
+    filter->recentY[i] = in->y;
+  }
+  filter->recent = 0;
+  filter->x = {(float)in->x, 0};
+  filter->y = {(float)in->y, 0};
+}
+
+/**
+ * Feed one sample from the stream, in order.
+ * @return True if out holds something to act on: a filtered contact, or a lift. A lift comes early
+ * when the pressure falls away, and again with the real one.
+ */
+bool touchFilter(TouchFilter *filter, const TouchSample *in, TouchSample *out)
+{
+  if (in->z == 0)
+  {
+    touchFilterInit(filter);
+    *out = *in;
+    return true;
+  }
+  uint32_t dtUs = in->us - filter->lastUs;
+  filter->lastUs = in->us;
+
+  if (filter->lifted)
+  {
+    // Ended early by falling pressure. Only pressing firmly again starts a new stroke before the lift.
+    if ((uint32_t)in->z * 100 < (uint32_t)filter->peakZ * TOUCH_RELAND_PCT)
+      return false;
+    filter->lifted = false;
+    filter->lastZ = 0;
+    filter->settling = 0;
+  }
+
+  if (!filter->down)
+  {
+    // Pen-down: the position wanders while the pressure is still building, so wait for it to level off.
+    bool rising = filter->lastZ == 0 || (uint32_t)in->z * 100 > (uint32_t)filter->lastZ * (100 + TOUCH_SETTLE_RISE_PCT);
+    filter->lastZ = in->z;
+    if (rising && ++filter->settling <= TOUCH_SETTLE_MAX)
+      return false;
+    beginTouch(filter, in);
+    *out = *in;
+    return true;
+  }
+
+  // Pen-up: the position wanders again as the pressure goes, so end the stroke before it does.
+  if (in->z > filter->peakZ)
+    filter->peakZ = in->z;
+  if ((uint32_t)in->z * 100 < (uint32_t)filter->peakZ * TOUCH_LIFT_PCT)
+  {
+    filter->down = false;
+    filter->lifted = true;
+    *out = *in;
+    out->z = 0;
+    return true;
+  }
+
+  filter->recentX[filter->recent] = in->x;
+  filter->recentY[filter->recent] = in->y;
+  filter->recent = (filter->recent + 1) % 3;
+  float dt = (dtUs ? dtUs : 1) / 1e6f;
+  *out = *in;
+  out->x = (uint16_t)lroundf(oneEuro(&filter->x, median3(filter->recentX), dt));
+  out->y = (uint16_t)lroundf(oneEuro(&filter->y, median3(filter->recentY), dt));
+  return true;
+}